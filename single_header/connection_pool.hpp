@@ -5,11 +5,21 @@
 #ifndef CONNECTIONPOOL_CONNECTION_POOL_HPP
 #define CONNECTIONPOOL_CONNECTION_POOL_HPP
 
-#include <deque>
+#include <algorithm>
+#include <atomic>
 #include <mutex>
 #include <chrono>
 #include <thread>
+#include <vector>
 #include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <random>
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#endif
 
 /*** Start of inlined file: conn_factory_concept.hpp ***/
 //
@@ -19,6 +29,8 @@
 #ifndef CONNECTIONPOOL_CONN_FACTORY_CONCEPT_HPP
 #define CONNECTIONPOOL_CONN_FACTORY_CONCEPT_HPP
 
+#include <cstddef>
+#include <vector>
 
 /*** Start of inlined file: static_detected.hpp ***/
 //
@@ -78,6 +90,40 @@ using all = void_t<static_create_connection<Conn, ConnFactory>,
 		static_destroy<Conn, ConnFactory>>;
 };
 
+// optional hooks
+namespace traits {
+template<typename Conn, typename ConnFactory>
+using static_create_connections = enable_if_same<decltype(std::declval<ConnFactory>().createConnections(0)),
+		std::vector<Conn *>>;
+
+template<typename Conn, typename ConnFactory>
+using static_reset = enable_if_same<decltype(std::declval<ConnFactory>().reset(static_cast<Conn *>(nullptr))), bool>;
+
+template<typename Conn, typename ConnFactory>
+using static_check_valid_batch = enable_if_same<decltype(std::declval<ConnFactory>().checkValidBatch(
+		static_cast<Conn *const *>(nullptr), std::size_t(0), static_cast<bool *>(nullptr))), void>;
+
+template<typename Conn, typename ConnFactory>
+using static_is_cheap = enable_if_same<decltype(std::declval<ConnFactory>().isCheap(
+		static_cast<Conn *>(nullptr))), bool>;
+};
+
+// The optional factory hooks the pool uses when present, each a std::true_type or std::false_type
+// to dispatch on, so an absent hook costs nothing:
+//   std::vector<Conn*> createConnections(int n)  up to n connections at once, at least one or throws
+//   bool reset(Conn*)                             cleans a connection released with destroy, true
+//                                                 if it can be kept instead
+//   void checkValidBatch(Conn* const*, size_t n, bool* valid)  pings n idle connections at once
+//   bool isCheap(Conn*)                           true if checkValid on it is cheap enough to run
+//                                                 on every borrow
+template<typename Conn, typename ConnFactory>
+struct factory_hooks {
+	using has_create_connections = is_detected<traits::static_create_connections, Conn, ConnFactory>;
+	using has_reset = is_detected<traits::static_reset, Conn, ConnFactory>;
+	using has_check_valid_batch = is_detected<traits::static_check_valid_batch, Conn, ConnFactory>;
+	using has_is_cheap = is_detected<traits::static_is_cheap, Conn, ConnFactory>;
+};
+
 template<typename Conn, typename ConnFactory>
 struct is_acceptable : is_detected<traits::all, Conn, ConnFactory> {
 	constexpr static bool diagnose() {
@@ -96,415 +142,6624 @@ struct is_acceptable : is_detected<traits::all, Conn, ConnFactory> {
 
 /*** End of inlined file: conn_factory_concept.hpp ***/
 
-
-
-/*** Start of inlined file: conn_guard.hpp ***/
+/*** Start of inlined file: idle_wheel.hpp ***/
 //
-// Created by dx2880 on 2018/1/13.
+// Created by dx2880 on 2026/10/17.
 //
 
-#ifndef CONNECTIONPOOL_CONNECTION_HPP
-#define CONNECTIONPOOL_CONNECTION_HPP
+#ifndef CONNECTIONPOOL_IDLE_WHEEL_HPP
+#define CONNECTIONPOOL_IDLE_WHEEL_HPP
 
-#include <functional>
-#include <iostream>
-#include <memory>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <vector>
 
-/*** Start of inlined file: connection_pool.hpp ***/
+/*** Start of inlined file: idle_stack.hpp ***/
 //
-// Created by dx2880 on 2018/1/13.
+// Created by dx2880 on 2026/10/17.
 //
 
-#ifndef CONNECTIONPOOL_CONNECTION_POOL_HPP
-#define CONNECTIONPOOL_CONNECTION_POOL_HPP
+#ifndef CONNECTIONPOOL_IDLE_STACK_HPP
+#define CONNECTIONPOOL_IDLE_STACK_HPP
 
-#include <deque>
+#include <array>
+#include <atomic>
+#include <cstdint>
 #include <mutex>
-#include <chrono>
-#include <thread>
-#include <condition_variable>
+#include <stdexcept>
 
 namespace modern_utils {
-template<typename Conn, typename ConnFactory>
-class ConnectionPool {
-private:
-	static_assert(is_acceptable<Conn, ConnFactory>::diagnose());
-public:
-	using ConnectionType = Conn;
-	using ConnFactoryType = ConnFactory;
-public:
-	explicit ConnectionPool(const std::shared_ptr<ConnFactoryType> &conn_factory, int max_count = 20) : conn_factory_(
-			conn_factory), max_count_(max_count) {
-		initPool();
-	}
 
-	explicit ConnectionPool(std::shared_ptr<ConnFactoryType> &&conn_factory, int max_count = 20) : conn_factory_(
-			std::move(conn_factory)), max_count_(20) {
-		initPool();
-	}
+// Lock-free LIFO (Treiber) list of 32-bit indices. The links live in the caller's nodes, reached
+// through next_of(index), and the head carries a 32-bit version so a recycled index cannot cause ABA.
+class TaggedIndexList {
+public:
+	static constexpr uint32_t kNil = 0xffffffffu;
 
-	~ConnectionPool() {
-		std::lock_guard<std::mutex> guard(mutex_);
-		idle_connection_.clear();
+	template<typename NextOf>
+	void push(uint32_t index, NextOf next_of) {
+		auto old_head = head_.load();
+		do {
+			next_of(index).store(indexOf(old_head), std::memory_order_relaxed);
+		} while (!head_.compare_exchange_weak(old_head, pack(index, tagOf(old_head) + 1)));
 	}
 
-	ConnectionPool(const ConnectionPool &rhs) = delete;
-
-	ConnectionPool &operator=(const ConnectionPool &rhs) = delete;
-
-	void setConnectionCount(int count) {
-		std::lock_guard<std::mutex> guard(mutex_);
-		max_count_ = count;
-		auto old_idle_count = idle_count_;
-		auto new_idle_count = 0;
-		if (idle_count_ + busy_count_ > max_count_) {
-			new_idle_count = max_count_ - busy_count_ > 0 ? max_count_ - busy_count_ : 0;
-		}
-
-		auto differ_count = new_idle_count - old_idle_count;
-		if (differ_count > 0) {
-			for (int i = 0; i < differ_count; ++i) {
-				auto conn = std::shared_ptr<Conn>(conn_factory_->createConnection(),
-												  [conn_factory = conn_factory_](Conn *p) {
-													  conn_factory->destroy(p);
-												  });
-				idle_connection_.push_back({conn, time(nullptr)});
-				++idle_count_;
-			}
-		} else if (differ_count < 0) {
-			for (int i = 0; i < abs(differ_count) && !idle_connection_.empty(); ++i) {
-				idle_connection_.pop_back();
-				--idle_count_;
+	template<typename NextOf>
+	uint32_t pop(NextOf next_of) {
+		auto old_head = head_.load();
+		while (indexOf(old_head) != kNil) {
+			auto next = next_of(indexOf(old_head)).load(std::memory_order_relaxed);
+			if (head_.compare_exchange_weak(old_head, pack(next, tagOf(old_head) + 1))) {
+				return indexOf(old_head);
 			}
 		}
+		return kNil;
 	}
 
-	auto getConnection() {
-		std::unique_lock<std::mutex> lock(mutex_);
-		cv_.wait_for(lock, std::chrono::seconds(timeout_),
-					 [this] { return idle_count_ > 0 || idle_count_ + busy_count_ < max_count_; });
-		if (idle_count_ > 0) {
-			--idle_count_;
-			++busy_count_;
-			auto conn = idle_connection_.back().first;
-			idle_connection_.pop_back();
-			return conn;
-		} else if (idle_count_ + busy_count_ < max_count_) {
-			auto conn = std::shared_ptr<Conn>(conn_factory_->createConnection(),
-											  [conn_factory = conn_factory_](Conn *p) { conn_factory->destroy(p); });
-			++busy_count_;
-			return conn;
-		}
-
-		throw std::runtime_error("getConnection timeout");
-	}
-
-	auto recoverConnection() {
-		auto conn = std::shared_ptr<Conn>(conn_factory_->createConnection(),
-										  [conn_factory = conn_factory_](Conn *p) { conn_factory->destroy(p); });
-
-		return conn;
-	}
-
-	void releaseConnecion(const std::shared_ptr<Conn> &conn, bool destroy = false) {
-		std::lock_guard<std::mutex> guard(mutex_);
-		if (idle_count_ + busy_count_ <= max_count_ && !destroy) {
-			idle_connection_.push_back({conn, time(nullptr)});
-			++idle_count_;
-			--busy_count_;
-		} else {
-			--busy_count_;
-		}
-
-		cv_.notify_one();
+	bool empty() const {
+		return indexOf(head_.load()) == kNil;
 	}
 
 private:
-	void initPool() {
-		for (int i = 0; i < max_count_; ++i) {
-			auto conn = std::shared_ptr<Conn>(conn_factory_->createConnection(),
-											  [conn_factory = conn_factory_](Conn *p) { conn_factory->destroy(p); });
-			idle_connection_.push_back({conn, time(nullptr)});
-			++idle_count_;
-		}
-
-		connection_checker_ = std::make_shared<std::thread>([this] {
-			while (checking_) {
-				std::this_thread::sleep_for(std::chrono::seconds(5));
-				std::lock_guard<std::mutex> guard(mutex_);
-				auto now = time(nullptr);
-				if (idle_count_ > 0 && idle_count_ + busy_count_ > 1) {
-					for (auto iter = idle_connection_.begin(); iter != idle_connection_.end() - 1; ++iter) {
-						if (now - iter->second >= max_idle_time_) {
-							--idle_count_;
-							idle_connection_.pop_front();
-						}
-					}
-				}
-			}
-		});
+	static uint64_t pack(uint32_t index, uint32_t tag) {
+		return (static_cast<uint64_t>(tag) << 32) | index;
 	}
 
-private:
-	std::shared_ptr<ConnFactoryType> conn_factory_;
-public:
-	const std::shared_ptr<ConnFactory> &getConnFactory() const {
-		return conn_factory_;
+	static uint32_t indexOf(uint64_t head) {
+		return static_cast<uint32_t>(head);
 	}
 
-private:
-	std::deque<std::pair<std::shared_ptr<Conn>, time_t> > idle_connection_;
-	int max_count_{20};
-	int idle_count_{0};
-	int busy_count_{0};
-	int timeout_{3};
-	int max_idle_time_{300};
-public:
-	void setMaxIdleTime(int max_idle_time) {
-		max_idle_time_ = max_idle_time;
+	static uint32_t tagOf(uint64_t head) {
+		return static_cast<uint32_t>(head >> 32);
 	}
 
 private:
-	std::mutex mutex_;
-	std::condition_variable cv_;
-	std::shared_ptr<std::thread> connection_checker_;
-	bool checking_{true};
+	std::atomic<uint64_t> head_{pack(kNil, 0)};
 };
-};
-
-#endif //CONNECTIONPOOL_CONNECTION_POOL_HPP
-
-/*** End of inlined file: connection_pool.hpp ***/
 
+// Lock-free LIFO stack of values. Nodes live in chunks that are never freed before the stack
+// itself, so push and pop are a couple of CAS operations. Only growing the node storage takes a lock.
+// With kLists > 1 it holds that many independent stacks sharing one node storage.
+template<typename T, uint32_t kLists = 1>
+class IdleStack {
+private:
+	static constexpr uint32_t kNil = TaggedIndexList::kNil;
+	static constexpr uint32_t kChunkShift = 6;
+	static constexpr uint32_t kChunkSize = 1u << kChunkShift;
+	static constexpr uint32_t kMaxChunks = 1024;
 
-namespace modern_utils {
+	struct Node {
+		T value;
+		std::atomic<uint32_t> next{kNil};
+	};
 
-template<typename ConnectionPool>
-class ConnGuard {
-public:
-	using ConnectionType = typename ConnectionPool::ConnectionType;
-	using ConnFactoryType = typename ConnectionPool::ConnFactoryType;
 public:
-	explicit ConnGuard(const std::shared_ptr<ConnectionPool> &pool) : pool_(pool) {
-		auto _pool = pool_.lock();
-		if(_pool) {
-			conn_ = _pool->getConnection();
+	IdleStack() {
+		for (auto &chunk : chunks_) {
+			chunk.store(nullptr, std::memory_order_relaxed);
 		}
 	}
 
-	explicit ConnGuard(std::shared_ptr<ConnectionPool> &&pool) : pool_(
-			std::move(pool)) {
-		auto _pool = pool_.lock();
-		if(_pool) {
-			conn_ = _pool->getConnection();
+	~IdleStack() {
+		for (auto &chunk : chunks_) {
+			delete[] chunk.load(std::memory_order_relaxed);
 		}
 	}
 
-	ConnGuard(const ConnGuard &rhs) = delete;
+	IdleStack(const IdleStack &rhs) = delete;
 
-	ConnGuard &operator=(const ConnGuard &rhs) = delete;
+	IdleStack &operator=(const IdleStack &rhs) = delete;
 
-	virtual ~ConnGuard() {
-		auto _pool = pool_.lock();
-		if(_pool && conn_ != nullptr) {
-			_pool->releaseConnecion(conn_);
+	void push(T value, uint32_t list = 0) {
+		auto index = free_.pop(nextOf());
+		if (index == kNil) {
+			index = grow();
 		}
+		node(index).value = std::move(value);
+		heads_[list].push(index, nextOf());
 	}
 
-	auto operator->() {
-		if (isReady()) {
-			return conn_;
-		} else {
-			throw std::runtime_error("connection not initialized");
+	bool pop(T &value, uint32_t list = 0) {
+		auto index = heads_[list].pop(nextOf());
+		if (index == kNil) {
+			return false;
 		}
-
-		return decltype(conn_)();
+		value = std::move(node(index).value);
+		free_.push(index, nextOf());
+		return true;
 	}
 
-	bool isReady() {
-		return conn_ != nullptr;
+	bool empty(uint32_t list = 0) const {
+		return heads_[list].empty();
 	}
 
-	virtual bool checkValid() {
-		auto _pool = pool_.lock();
-		if(_pool && conn_ != nullptr) {
-			return _pool->getConnFactory()->checkValid(conn_.get());
-		}
-
-		return false;
+private:
+	Node &node(uint32_t index) {
+		return chunks_[index >> kChunkShift].load(std::memory_order_acquire)[index & (kChunkSize - 1)];
 	}
 
-	auto get() {
-		return conn_.get();
+	auto nextOf() {
+		return [this](uint32_t index) -> std::atomic<uint32_t> & { return node(index).next; };
 	}
 
-	void recover() {
-		auto _pool = pool_.lock();
-		if(_pool && conn_ != nullptr) {
-			conn_ = _pool->recoverConnection();
-		} else {
-			conn_ = nullptr;
+	// Allocates a new chunk, keeps its first node for the caller and frees the rest.
+	uint32_t grow() {
+		std::lock_guard<std::mutex> guard(grow_mutex_);
+		auto chunk_count = chunk_count_.load(std::memory_order_relaxed);
+		if (chunk_count == kMaxChunks) {
+			throw std::runtime_error("IdleStack capacity exceeded");
+		}
+		chunks_[chunk_count].store(new Node[kChunkSize], std::memory_order_release);
+		chunk_count_.store(chunk_count + 1, std::memory_order_relaxed);
+
+		auto first = chunk_count << kChunkShift;
+		for (uint32_t i = kChunkSize - 1; i > 0; --i) {
+			free_.push(first + i, nextOf());
 		}
+		return first;
 	}
+
 private:
-	virtual void log_error(const char *error) { std::cout << error << std::endl; };
-private:
-	std::shared_ptr<ConnectionType> conn_;
-	std::weak_ptr<ConnectionPool> pool_;
+	std::array<TaggedIndexList, kLists> heads_;
+	TaggedIndexList free_;
+	std::array<std::atomic<Node *>, kMaxChunks> chunks_;
+	std::atomic<uint32_t> chunk_count_{0};
+	std::mutex grow_mutex_;
 };
 };
 
-#endif //CONNECTIONPOOL_CONNECTION_HPP
+#endif //CONNECTIONPOOL_IDLE_STACK_HPP
 
-/*** End of inlined file: conn_guard.hpp ***/
+/*** End of inlined file: idle_stack.hpp ***/
+
+/*** Start of inlined file: pool_options.hpp ***/
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_POOL_OPTIONS_HPP
+#define CONNECTIONPOOL_POOL_OPTIONS_HPP
 
 namespace modern_utils {
-template<typename Conn, typename ConnFactory>
-class ConnectionPool {
-private:
-	static_assert(is_acceptable<Conn, ConnFactory>::diagnose());
-public:
-	using ConnectionType = Conn;
-	using ConnFactoryType = ConnFactory;
-public:
-	explicit ConnectionPool(const std::shared_ptr<ConnFactoryType> &conn_factory, int max_count = 20) : conn_factory_(
-			conn_factory), max_count_(max_count) {
-		initPool();
-	}
 
-	explicit ConnectionPool(std::shared_ptr<ConnFactoryType> &&conn_factory, int max_count = 20) : conn_factory_(
-			std::move(conn_factory)), max_count_(20) {
-		initPool();
-	}
+enum class WarmupMode {
+	// create max_count connections before the constructor returns
+	kEager,
+	// create min_idle connections before the constructor returns, the rest on demand
+	kLazy,
+	// return at once and create max_count connections in the background; borrowers only wait
+	// for the first one that is ready
+	kBackground
+};
 
-	~ConnectionPool() {
-		std::lock_guard<std::mutex> guard(mutex_);
-		idle_connection_.clear();
-	}
+enum class ReuseOrder {
+	// the most recently released idle connection first, keeping reuse on cache-hot connections
+	kLifo,
+	// the longest idle connection first, spreading load so every connection stays warm
+	kFifo
+};
 
-	ConnectionPool(const ConnectionPool &rhs) = delete;
+// Waiters are served highest priority first, in arrival order within a priority.
+enum class Priority {
+	kLow, kNormal, kHigh
+};
 
-	ConnectionPool &operator=(const ConnectionPool &rhs) = delete;
+struct PoolOptions {
+	PoolOptions() = default;
 
-	void setConnectionCount(int count) {
-		std::lock_guard<std::mutex> guard(mutex_);
-		max_count_ = count;
-		auto old_idle_count = idle_count_;
-		auto new_idle_count = 0;
-		if (idle_count_ + busy_count_ > max_count_) {
-			new_idle_count = max_count_ - busy_count_ > 0 ? max_count_ - busy_count_ : 0;
-		}
+	explicit PoolOptions(int max_count) : max_count(max_count) {}
 
-		auto differ_count = new_idle_count - old_idle_count;
-		if (differ_count > 0) {
-			for (int i = 0; i < differ_count; ++i) {
-				auto conn = std::shared_ptr<Conn>(conn_factory_->createConnection(),
-												  [conn_factory = conn_factory_](Conn *p) {
-													  conn_factory->destroy(p);
-												  });
-				idle_connection_.push_back({conn, time(nullptr)});
-				++idle_count_;
-			}
-		} else if (differ_count < 0) {
-			for (int i = 0; i < abs(differ_count) && !idle_connection_.empty(); ++i) {
-				idle_connection_.pop_back();
-				--idle_count_;
-			}
-		}
-	}
+	int max_count{20};
+	WarmupMode warmup{WarmupMode::kEager};
+	// also the number of connections the idle checker never evicts below
+	int min_idle{0};
+	// connects running at once during warm-up
+	int warmup_concurrency{1};
+};
+};
 
-	auto getConnection() {
-		std::unique_lock<std::mutex> lock(mutex_);
-		cv_.wait_for(lock, std::chrono::seconds(timeout_),
-					 [this] { return idle_count_ > 0 || idle_count_ + busy_count_ < max_count_; });
-		if (idle_count_ > 0) {
-			--idle_count_;
-			++busy_count_;
-			auto conn = idle_connection_.back().first;
-			idle_connection_.pop_back();
-			return conn;
-		} else if (idle_count_ + busy_count_ < max_count_) {
-			auto conn = std::shared_ptr<Conn>(conn_factory_->createConnection(),
-											  [conn_factory = conn_factory_](Conn *p) { conn_factory->destroy(p); });
-			++busy_count_;
-			return conn;
-		}
+#endif //CONNECTIONPOOL_POOL_OPTIONS_HPP
 
-		throw std::runtime_error("getConnection timeout");
-	}
+/*** End of inlined file: pool_options.hpp ***/
 
-	auto recoverConnection() {
-		auto conn = std::shared_ptr<Conn>(conn_factory_->createConnection(),
-										  [conn_factory = conn_factory_](Conn *p) { conn_factory->destroy(p); });
+namespace modern_utils {
 
-		return conn;
-	}
+// Idle values bucketed by release time, a hashed timing wheel whose slots are lock-free stacks.
+// Each slot covers tick units of whatever clock stamps the entries. pop() takes from the newest
+// slot first for kLifo and from the oldest for kFifo, which is FIFO to the slot. Expiry drains
+// only the slots up to the cutoff's own, so it touches expired entries, plus the live ones sharing
+// the cutoff's slot, and leaves the rest of the pool alone.
+template<typename V, ReuseOrder kOrder = ReuseOrder::kLifo>
+class IdleWheel {
+public:
+	using Entry = std::pair<V, int64_t>;
+	static constexpr uint32_t kSlots = 64;
 
-	void releaseConnecion(const std::shared_ptr<Conn> &conn, bool destroy = false) {
-		std::lock_guard<std::mutex> guard(mutex_);
-		if (idle_count_ + busy_count_ <= max_count_ && !destroy) {
-			idle_connection_.push_back({conn, time(nullptr)});
-			++idle_count_;
-			--busy_count_;
-		} else {
-			--busy_count_;
+	explicit IdleWheel(int tick = 5) : tick_(tick > 0 ? tick : 1) {}
+
+	IdleWheel(const IdleWheel &rhs) = delete;
+
+	IdleWheel &operator=(const IdleWheel &rhs) = delete;
+
+	void push(Entry entry) {
+		auto epoch = epochOf(entry.second);
+		auto newest = newest_epoch_.load(std::memory_order_relaxed);
+		while (epoch > newest && !newest_epoch_.compare_exchange_weak(newest, epoch)) {
 		}
+		stacks_.push(std::move(entry), slotOf(epoch));
+	}
 
-		cv_.notify_one();
+	bool pop(Entry &entry) {
+		// swept entries are older than most, so they go last for kLifo and first for kFifo
+		if (kOrder == ReuseOrder::kFifo && stacks_.pop(entry, kSwept)) {
+			return true;
+		}
+		auto newest = newest_epoch_.load(std::memory_order_relaxed);
+		for (uint32_t i = 0; i < kSlots; ++i) {
+			// unsigned wrap-around keeps the slot right, as 2^64 is a multiple of kSlots
+			auto epoch = kOrder == ReuseOrder::kLifo ? newest - i : newest - (kSlots - 1) + i;
+			if (stacks_.pop(entry, slotOf(epoch))) {
+				return true;
+			}
+		}
+		return kOrder == ReuseOrder::kLifo && stacks_.pop(entry, kSwept);
 	}
 
-private:
-	void initPool() {
-		for (int i = 0; i < max_count_; ++i) {
-			auto conn = std::shared_ptr<Conn>(conn_factory_->createConnection(),
-											  [conn_factory = conn_factory_](Conn *p) { conn_factory->destroy(p); });
-			idle_connection_.push_back({conn, time(nullptr)});
-			++idle_count_;
+	// Offers every entry released at or before cutoff to evict, oldest slot first. Entries it
+	// declines, and newer ones found in a drained slot after the tick changed, are put back.
+	// Only one thread may expire or sweep at a time.
+	template<typename Evict>
+	void expire(int64_t cutoff, Evict evict) {
+		if (cutoff < 0) {
+			return;
+		}
+		// the cutoff's own slot is drained too, so nothing expires a tick late; its live entries
+		// go back and the slot is looked at again on the next call
+		auto last = epochOf(cutoff);
+		auto first = std::max(epochOf(drained_until_), last >= kSlots ? last - kSlots + 1 : 0);
+		std::vector<Entry> kept;
+		for (auto epoch = first; epoch <= last; ++epoch) {
+			Entry entry;
+			while (stacks_.pop(entry, slotOf(epoch))) {
+				if (entry.second > cutoff || !evict(entry)) {
+					kept.push_back(std::move(entry));
+				}
+			}
 		}
+		drained_until_ = std::max(drained_until_, cutoff + 1);
+		for (auto iter = kept.rbegin(); iter != kept.rend(); ++iter) {
+			push(std::move(*iter));
+		}
+	}
 
-		connection_checker_ = std::make_shared<std::thread>([this] {
-			while (checking_) {
-				std::this_thread::sleep_for(std::chrono::seconds(5));
-				std::lock_guard<std::mutex> guard(mutex_);
-				auto now = time(nullptr);
-				if (idle_count_ > 0 && idle_count_ + busy_count_ > 1) {
-					for (auto iter = idle_connection_.begin(); iter != idle_connection_.end() - 1; ++iter) {
-						if (now - iter->second >= max_idle_time_) {
-							--idle_count_;
-							idle_connection_.pop_front();
-						}
-					}
+	// Hands visit the entries released at or before cutoff, batch_size at a time, oldest slot
+	// first. visit erases the entries it takes. The others, and newer ones met on the way, go on a
+	// list of their own that pop() also takes from, so each batch can be borrowed again as soon as
+	// it has been visited without being popped twice; they return to their slots at the end.
+	// Only one thread may sweep or expire at a time.
+	template<typename Visit>
+	void sweep(int64_t cutoff, int batch_size, Visit visit) {
+		if (cutoff < 0) {
+			return;
+		}
+		auto last = epochOf(cutoff);
+		auto first = last >= kSlots ? last - kSlots + 1 : 0;
+		std::vector<Entry> batch;
+		auto flush = [this, &batch, &visit] {
+			visit(batch);
+			for (auto &visited : batch) {
+				stacks_.push(std::move(visited), kSwept);
+			}
+			batch.clear();
+		};
+		for (auto epoch = first; epoch <= last; ++epoch) {
+			Entry entry;
+			while (stacks_.pop(entry, slotOf(epoch))) {
+				if (entry.second > cutoff) {
+					stacks_.push(std::move(entry), kSwept);
+					continue;
+				}
+				batch.push_back(std::move(entry));
+				if (static_cast<int>(batch.size()) >= batch_size) {
+					flush();
 				}
 			}
-		});
+			if (!batch.empty()) {
+				flush();
+			}
+		}
+		Entry entry;
+		while (stacks_.pop(entry, kSwept)) {
+			push(std::move(entry));
+		}
 	}
 
-private:
-	std::shared_ptr<ConnFactoryType> conn_factory_;
-public:
-	const std::shared_ptr<ConnFactory> &getConnFactory() const {
-		return conn_factory_;
+	int tick() const {
+		return tick_;
+	}
+
+	// Entries already stored keep their slot; expire() still checks each one's own time.
+	void setTick(int tick) {
+		tick_ = tick > 0 ? tick : 1;
 	}
 
 private:
-	std::deque<std::pair<std::shared_ptr<Conn>, time_t> > idle_connection_;
-	int max_count_{20};
-	int idle_count_{0};
-	int busy_count_{0};
-	int timeout_{3};
-	int max_idle_time_{300};
-public:
-	void setMaxIdleTime(int max_idle_time) {
-		max_idle_time_ = max_idle_time;
+	uint64_t epochOf(int64_t t) const {
+		return static_cast<uint64_t>(t) / static_cast<uint64_t>(tick_.load(std::memory_order_relaxed));
+	}
+
+	static uint32_t slotOf(uint64_t epoch) {
+		return static_cast<uint32_t>(epoch % kSlots);
 	}
 
 private:
-	std::mutex mutex_;
-	std::condition_variable cv_;
-	std::shared_ptr<std::thread> connection_checker_;
-	bool checking_{true};
+	// one list per slot, then the one sweep() parks visited entries on
+	static constexpr uint32_t kSwept = kSlots;
+	IdleStack<Entry, kSlots + 1> stacks_;
+	std::atomic<uint64_t> newest_epoch_{0};
+	std::atomic<int> tick_;
+	// everything released before this has been offered to expire()
+	int64_t drained_until_{0};
 };
 };
 
-#endif //CONNECTIONPOOL_CONNECTION_POOL_HPP
+#endif //CONNECTIONPOOL_IDLE_WHEEL_HPP
+
+/*** End of inlined file: idle_wheel.hpp ***/
+
+/*** Start of inlined file: autoscale.hpp ***/
+//
+// Created by dx2880 on 2026/10/17.
+//
 
+#ifndef CONNECTIONPOOL_AUTOSCALE_HPP
+#define CONNECTIONPOOL_AUTOSCALE_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+
+namespace modern_utils {
+
+struct AutoscaleOptions {
+	int min_count{1};
+	int max_count{100};
+	// how often the controller samples the pool
+	std::chrono::milliseconds interval{1000};
+	// grow when queued borrowers waited this long on average during the last interval
+	std::chrono::milliseconds grow_wait{5};
+	// shrink when busy / max_count stayed below this for shrink_after intervals in a row
+	double shrink_utilization{0.5};
+	int shrink_after{30};
+};
+
+enum class ScaleDirection {
+	kGrow, kShrink
+};
+
+struct ScaleEvent {
+	ScaleDirection direction{ScaleDirection::kGrow};
+	int from{0};
+	int to{0};
+	// the sample the decision was made on
+	int waiting{0};
+	std::chrono::microseconds average_wait{0};
+	double utilization{0};
+};
+
+using ScaleListener = std::function<void(const ScaleEvent &)>;
+
+// Decides the pool size from one sample per interval. Grows at once, by a quarter of the pool or
+// the number of waiters, whichever is more; shrinks by at most a quarter, only after utilization has
+// stayed low for shrink_after samples, and never below what keeps the busy connections under the
+// shrink threshold, so a shrink cannot trigger the next grow.
+class AutoscaleController {
+public:
+	explicit AutoscaleController(const AutoscaleOptions &options) : options_(options) {
+		options_.min_count = std::max(options_.min_count, 1);
+		options_.max_count = std::max(options_.max_count, options_.min_count);
+	}
+
+	const AutoscaleOptions &options() const {
+		return options_;
+	}
+
+	// Returns the new size, or current if it stays.
+	int decide(int current, int busy, int waiting, std::chrono::microseconds average_wait) {
+		auto utilization = current > 0 ? static_cast<double>(busy) / current : 1.0;
+		if (waiting > 0 || average_wait >= options_.grow_wait) {
+			low_samples_ = 0;
+			auto step = std::max({current / 4, waiting, 1});
+			return std::min(current + step, options_.max_count);
+		}
+		if (utilization >= options_.shrink_utilization) {
+			low_samples_ = 0;
+			return clamp(current);
+		}
+		if (++low_samples_ < options_.shrink_after) {
+			return clamp(current);
+		}
+		low_samples_ = 0;
+		auto needed = static_cast<int>(busy / options_.shrink_utilization) + 1;
+		return clamp(std::max(needed, current - std::max(current / 4, 1)));
+	}
+
+private:
+	int clamp(int count) const {
+		return std::min(std::max(count, options_.min_count), options_.max_count);
+	}
+
+private:
+	AutoscaleOptions options_;
+	int low_samples_{0};
+};
+};
+
+#endif //CONNECTIONPOOL_AUTOSCALE_HPP
+
+/*** End of inlined file: autoscale.hpp ***/
+
+/*** Start of inlined file: creation_governor.hpp ***/
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_CREATION_GOVERNOR_HPP
+#define CONNECTIONPOOL_CREATION_GOVERNOR_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+
+/*** Start of inlined file: pool_errors.hpp ***/
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_POOL_ERRORS_HPP
+#define CONNECTIONPOOL_POOL_ERRORS_HPP
+
+#include <stdexcept>
+
+namespace modern_utils {
+
+// Thrown when no connection could be borrowed before the deadline. A std::runtime_error like
+// every other pool error, distinct so callers can tell an exhausted pool from a failed connect.
+class AcquireTimeoutError : public std::runtime_error {
+public:
+	AcquireTimeoutError() : std::runtime_error("getConnection timeout") {}
+
+protected:
+	explicit AcquireTimeoutError(const char *what) : std::runtime_error(what) {}
+};
+
+// Thrown at once, without waiting for the deadline, to a borrower set to fail fast when the pool
+// has nothing it may take and no room to connect. An AcquireTimeoutError, as it means the same.
+class PoolExhaustedError : public AcquireTimeoutError {
+public:
+	PoolExhaustedError() : AcquireTimeoutError("connection pool exhausted") {}
+};
+
+// Thrown instead of connecting while a CreationGovernor holds the backend for down.
+class BackendDownError : public std::runtime_error {
+public:
+	BackendDownError() : std::runtime_error("backend down") {}
+};
+};
+
+#endif //CONNECTIONPOOL_POOL_ERRORS_HPP
+
+/*** End of inlined file: pool_errors.hpp ***/
+
+namespace modern_utils {
+
+struct GovernorOptions {
+	// connects per second, and how many may start at once after a quiet spell; 0 means no limit
+	double rate{0};
+	int burst{10};
+	// connects running at once; 0 means no limit
+	int max_in_flight{0};
+	// consecutive failed connects after which the backend counts as down
+	int fail_after{3};
+	// how long it then stays down, doubling on every failed probe
+	std::chrono::milliseconds initial_backoff{100};
+	std::chrono::milliseconds max_backoff{30000};
+};
+
+// Paces the connects of one backend, which several pools may share. A connect takes a token from
+// a bucket refilled at rate per second and one of max_in_flight slots, waiting for both. After
+// fail_after failures in a row the backend is down for a backoff with jitter: every connect fails
+// at once with BackendDownError instead of running into the connect timeout. Once the backoff has
+// passed, a single connect probes the backend; it either brings it back or doubles the backoff.
+class CreationGovernor {
+public:
+	using Clock = std::chrono::steady_clock;
+public:
+	explicit CreationGovernor(const GovernorOptions &options) : options_(options), tokens_(options.burst) {
+		options_.burst = std::max(options_.burst, 1);
+		options_.fail_after = std::max(options_.fail_after, 1);
+		options_.max_backoff = std::max(options_.max_backoff, options_.initial_backoff);
+	}
+
+	CreationGovernor(const CreationGovernor &rhs) = delete;
+
+	CreationGovernor &operator=(const CreationGovernor &rhs) = delete;
+
+	// Waits until count connects may start; each must be ended with finish().
+	void begin(Clock::time_point deadline, int count = 1) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (true) {
+			auto now = Clock::now();
+			if (down_) {
+				if (now < retry_at_ || probing_) {
+					throw BackendDownError();
+				}
+				// the backoff is over: this connect probes the backend for everyone
+				probing_ = true;
+				++in_flight_;
+				return;
+			}
+			refill(now);
+			auto has_slot = options_.max_in_flight <= 0 || in_flight_ < options_.max_in_flight;
+			if (has_slot && tokens_ >= 1) {
+				// a bulk connect may leave the bucket in debt, which later connects pay off
+				tokens_ -= options_.rate > 0 ? count : 0;
+				++in_flight_;
+				return;
+			}
+			auto wake = deadline;
+			if (has_slot) {
+				wake = std::min(wake, now + std::chrono::duration_cast<Clock::duration>(
+						std::chrono::duration<double>((1 - tokens_) / options_.rate)));
+			}
+			if (now >= deadline) {
+				throw AcquireTimeoutError();
+			}
+			cv_.wait_until(lock, wake);
+		}
+	}
+
+	void finish(bool succeeded) {
+		{
+			std::lock_guard<std::mutex> guard(mutex_);
+			--in_flight_;
+			if (succeeded) {
+				failures_ = 0;
+				down_ = false;
+				probing_ = false;
+				backoff_ = options_.initial_backoff;
+			} else if (probing_ || ++failures_ >= options_.fail_after) {
+				if (probing_ || !down_) {
+					backoff_ = down_ ? std::min(backoff_ * 2, options_.max_backoff) : options_.initial_backoff;
+				}
+				down_ = true;
+				probing_ = false;
+				retry_at_ = Clock::now() + jittered(backoff_);
+			}
+		}
+		cv_.notify_one();
+	}
+
+	// Whether connects currently fail at once.
+	bool down() {
+		std::lock_guard<std::mutex> guard(mutex_);
+		return down_ && (Clock::now() < retry_at_ || probing_);
+	}
+
+private:
+	void refill(Clock::time_point now) {
+		if (options_.rate <= 0) {
+			tokens_ = options_.burst;
+			return;
+		}
+		std::chrono::duration<double> elapsed = now - refilled_;
+		tokens_ = std::min(tokens_ + elapsed.count() * options_.rate, static_cast<double>(options_.burst));
+		refilled_ = now;
+	}
+
+	// Between half and all of backoff, so pools that failed together do not retry together.
+	static Clock::duration jittered(std::chrono::milliseconds backoff) {
+		thread_local std::minstd_rand random(std::random_device{}());
+		std::uniform_real_distribution<double> share(0.5, 1.0);
+		return std::chrono::duration_cast<Clock::duration>(backoff * share(random));
+	}
+
+private:
+	GovernorOptions options_;
+	double tokens_;
+	Clock::time_point refilled_{Clock::now()};
+	int in_flight_{0};
+	int failures_{0};
+	bool down_{false};
+	bool probing_{false};
+	std::chrono::milliseconds backoff_{0};
+	Clock::time_point retry_at_;
+	std::mutex mutex_;
+	std::condition_variable cv_;
+};
+};
+
+#endif //CONNECTIONPOOL_CREATION_GOVERNOR_HPP
+
+/*** End of inlined file: creation_governor.hpp ***/
+
+/*** Start of inlined file: pool_metrics.hpp ***/
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_POOL_METRICS_HPP
+#define CONNECTIONPOOL_POOL_METRICS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace modern_utils {
+
+enum class PoolCounter {
+	kAcquires, kTimeouts, kCreates, kDestroys, kEvictions, kRecoveries, kRenewals
+};
+
+enum class PoolLatency {
+	kAcquireWait, kHoldTime, kCreateTime, kCheckValidTime
+};
+
+// HDR style log-linear buckets over microseconds: 8 linear sub-buckets per power of two, so a value
+// is reported at most 12.5% above what was recorded. Values from 2^40us (about 12 days) up share
+// the last bucket.
+struct LatencyBuckets {
+	static constexpr int kSubBits = 3;
+	static constexpr int kSubCount = 1 << kSubBits;
+	static constexpr int kMaxBits = 40;
+	static constexpr int kCount = (kMaxBits - kSubBits + 1) * kSubCount;
+
+	static int indexOf(uint64_t us) {
+		if (us >> kMaxBits) {
+			return kCount - 1;
+		}
+		int shift = 0;
+		if (us >= 2 * kSubCount) {
+#if defined(__GNUC__)
+			shift = 63 - __builtin_clzll(us) - kSubBits;
+#else
+			while ((us >> shift) >= 2 * kSubCount) {
+				++shift;
+			}
+#endif
+		}
+		return shift * kSubCount + static_cast<int>(us >> shift);
+	}
+
+	// The largest value that falls into bucket index.
+	static uint64_t upperBoundOf(int index) {
+		auto shift = index < 2 * kSubCount ? 0 : index / kSubCount - 1;
+		auto mantissa = static_cast<uint64_t>(index - shift * kSubCount);
+		return ((mantissa + 1) << shift) - 1;
+	}
+};
+
+struct LatencyHistogram {
+	// counts per LatencyBuckets index, empty while nothing was recorded
+	std::vector<uint64_t> buckets;
+	uint64_t count{0};
+	uint64_t total_us{0};
+
+	// p in [0, 100]; the bucket bound the p-th percentile value lies under.
+	std::chrono::microseconds percentile(double p) const {
+		if (count == 0) {
+			return std::chrono::microseconds(0);
+		}
+		auto rank = static_cast<uint64_t>(p / 100 * static_cast<double>(count));
+		rank = rank < 1 ? 1 : (rank > count ? count : rank);
+		uint64_t seen = 0;
+		for (int i = 0; i < static_cast<int>(buckets.size()); ++i) {
+			seen += buckets[i];
+			if (seen >= rank) {
+				return std::chrono::microseconds(LatencyBuckets::upperBoundOf(i));
+			}
+		}
+		return std::chrono::microseconds(LatencyBuckets::upperBoundOf(LatencyBuckets::kCount - 1));
+	}
+
+	std::chrono::microseconds mean() const {
+		return std::chrono::microseconds(count > 0 ? total_us / count : 0);
+	}
+
+	std::chrono::microseconds max() const {
+		return percentile(100);
+	}
+};
+
+struct MetricsSnapshot {
+	// false when the pool was built without metrics; everything else is then zero
+	bool enabled{false};
+	uint64_t acquires{0};
+	uint64_t timeouts{0};
+	uint64_t creates{0};
+	uint64_t destroys{0};
+	uint64_t evictions{0};
+	uint64_t recoveries{0};
+	// connections past their max lifetime closed once a successor was open
+	uint64_t renewals{0};
+	LatencyHistogram acquire_wait;
+	LatencyHistogram hold_time;
+	LatencyHistogram create_time;
+	LatencyHistogram check_valid_time;
+};
+
+// Per-pool counters and latency histograms. Each thread updates one of kShards shards with relaxed
+// atomic adds, so recording never takes a lock or fights over a cache line with most other
+// threads; snapshot() sums the shards.
+template<bool kEnabled>
+class PoolMetrics {
+private:
+	static constexpr int kShards = 8;
+	static constexpr int kCounters = 7;
+	static constexpr int kLatencies = 4;
+
+	struct Histogram {
+		std::array<std::atomic<uint64_t>, LatencyBuckets::kCount> buckets;
+		std::atomic<uint64_t> total_us;
+	};
+
+	struct Shard {
+		std::array<std::atomic<uint64_t>, kCounters> counters;
+		std::array<Histogram, kLatencies> histograms;
+	};
+
+public:
+	using Clock = std::chrono::steady_clock;
+
+	// value-initialized, so every atomic starts at zero
+	PoolMetrics() : shards_(new Shard[kShards]()) {}
+
+	static Clock::time_point now() {
+		return Clock::now();
+	}
+
+	void add(PoolCounter counter, uint64_t n = 1) {
+		shard().counters[static_cast<int>(counter)].fetch_add(n, std::memory_order_relaxed);
+	}
+
+	void record(PoolLatency latency, Clock::duration elapsed) {
+		auto us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+		auto value = static_cast<uint64_t>(us > 0 ? us : 0);
+		auto &histogram = shard().histograms[static_cast<int>(latency)];
+		histogram.buckets[LatencyBuckets::indexOf(value)].fetch_add(1, std::memory_order_relaxed);
+		histogram.total_us.fetch_add(value, std::memory_order_relaxed);
+	}
+
+	void record(PoolLatency latency, Clock::time_point since) {
+		record(latency, now() - since);
+	}
+
+	// A copy summed over the shards while the pool keeps running: every count in it was recorded,
+	// and each histogram's count is the sum of its own buckets.
+	MetricsSnapshot snapshot() const {
+		MetricsSnapshot snapshot;
+		snapshot.enabled = true;
+		uint64_t *counters[kCounters] = {&snapshot.acquires, &snapshot.timeouts, &snapshot.creates,
+										 &snapshot.destroys, &snapshot.evictions, &snapshot.recoveries,
+										 &snapshot.renewals};
+		LatencyHistogram *histograms[kLatencies] = {&snapshot.acquire_wait, &snapshot.hold_time,
+													&snapshot.create_time, &snapshot.check_valid_time};
+		for (auto histogram : histograms) {
+			histogram->buckets.assign(LatencyBuckets::kCount, 0);
+		}
+		for (int s = 0; s < kShards; ++s) {
+			auto &shard = shards_[s];
+			for (int c = 0; c < kCounters; ++c) {
+				*counters[c] += shard.counters[c].load(std::memory_order_relaxed);
+			}
+			for (int h = 0; h < kLatencies; ++h) {
+				for (int b = 0; b < LatencyBuckets::kCount; ++b) {
+					auto count = shard.histograms[h].buckets[b].load(std::memory_order_relaxed);
+					histograms[h]->buckets[b] += count;
+					histograms[h]->count += count;
+				}
+				histograms[h]->total_us += shard.histograms[h].total_us.load(std::memory_order_relaxed);
+			}
+		}
+		for (auto histogram : histograms) {
+			if (histogram->count == 0) {
+				histogram->buckets.clear();
+			}
+		}
+		return snapshot;
+	}
+
+private:
+	Shard &shard() {
+		static std::atomic<int> next_shard{0};
+		thread_local int index = next_shard++ % kShards;
+		return shards_[index];
+	}
+
+private:
+	std::unique_ptr<Shard[]> shards_;
+};
+
+// Compiled out: no storage, no clock reads, every call is empty.
+template<>
+class PoolMetrics<false> {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	static Clock::time_point now() {
+		return Clock::time_point();
+	}
+
+	void add(PoolCounter, uint64_t = 1) {}
+
+	void record(PoolLatency, Clock::duration) {}
+
+	void record(PoolLatency, Clock::time_point) {}
+
+	MetricsSnapshot snapshot() const {
+		return MetricsSnapshot();
+	}
+};
+};
+
+#endif //CONNECTIONPOOL_POOL_METRICS_HPP
+
+/*** End of inlined file: pool_metrics.hpp ***/
+
+/*** Start of inlined file: pool_policy.hpp ***/
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_POOL_POLICY_HPP
+#define CONNECTIONPOOL_POOL_POLICY_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+/*** Start of inlined file: idle_queue.hpp ***/
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_IDLE_QUEUE_HPP
+#define CONNECTIONPOOL_IDLE_QUEUE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace modern_utils {
+
+// Idle values in one deque in release order, guarded by a Lock. The plain alternative to
+// IdleWheel with the same interface: exact FIFO or LIFO reuse, but expire() and sweep() walk the
+// whole queue, which suits small pools.
+template<typename V, ReuseOrder kOrder = ReuseOrder::kLifo, typename Lock = std::mutex>
+class IdleQueue {
+public:
+	using Entry = std::pair<V, int64_t>;
+
+	explicit IdleQueue(int tick = 5) : tick_(tick > 0 ? tick : 1) {}
+
+	IdleQueue(const IdleQueue &rhs) = delete;
+
+	IdleQueue &operator=(const IdleQueue &rhs) = delete;
+
+	void push(Entry entry) {
+		std::lock_guard<Lock> guard(lock_);
+		entries_.push_back(std::move(entry));
+	}
+
+	bool pop(Entry &entry) {
+		std::lock_guard<Lock> guard(lock_);
+		if (entries_.empty()) {
+			return false;
+		}
+		if (kOrder == ReuseOrder::kLifo) {
+			entry = std::move(entries_.back());
+			entries_.pop_back();
+		} else {
+			entry = std::move(entries_.front());
+			entries_.pop_front();
+		}
+		return true;
+	}
+
+	// Offers every entry released at or before cutoff to evict, oldest first; evict runs under
+	// the queue lock, so it must not touch the queue.
+	template<typename Evict>
+	void expire(int64_t cutoff, Evict evict) {
+		std::lock_guard<Lock> guard(lock_);
+		for (auto iter = entries_.begin(); iter != entries_.end();) {
+			if (iter->second <= cutoff && evict(*iter)) {
+				iter = entries_.erase(iter);
+			} else {
+				++iter;
+			}
+		}
+	}
+
+	// Hands visit the entries released at or before cutoff, batch_size at a time and outside the
+	// lock. visit erases the entries it takes; the others go back at the old end of the queue.
+	template<typename Visit>
+	void sweep(int64_t cutoff, int batch_size, Visit visit) {
+		std::vector<Entry> batch;
+		std::size_t skipped = 0;
+		while (true) {
+			{
+				std::lock_guard<Lock> guard(lock_);
+				auto iter = entries_.begin() + std::min(skipped, entries_.size());
+				while (iter != entries_.end() && static_cast<int>(batch.size()) < batch_size) {
+					if (iter->second <= cutoff) {
+						batch.push_back(std::move(*iter));
+						iter = entries_.erase(iter);
+					} else {
+						++iter;
+						++skipped;
+					}
+				}
+			}
+			if (batch.empty()) {
+				return;
+			}
+			visit(batch);
+			std::lock_guard<Lock> guard(lock_);
+			for (auto iter = batch.rbegin(); iter != batch.rend(); ++iter) {
+				entries_.push_front(std::move(*iter));
+			}
+			skipped += batch.size();
+			batch.clear();
+		}
+	}
+
+	int tick() const {
+		return tick_;
+	}
+
+	// Only how often the pool calls expire(); entries are not bucketed.
+	void setTick(int tick) {
+		tick_ = tick > 0 ? tick : 1;
+	}
+
+private:
+	Lock lock_;
+	std::deque<Entry> entries_;
+	std::atomic<int> tick_;
+};
+};
+
+#endif //CONNECTIONPOOL_IDLE_QUEUE_HPP
+
+/*** End of inlined file: idle_queue.hpp ***/
+
+/*** Start of inlined file: timer_service.hpp ***/
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_TIMER_SERVICE_HPP
+#define CONNECTIONPOOL_TIMER_SERVICE_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace modern_utils {
+
+// One thread running the periodic jobs of every pool in the process, earliest deadline first.
+// It sleeps until the next job is due instead of polling, and is started on first use.
+class TimerService {
+public:
+	using Clock = std::chrono::steady_clock;
+	// Returns when the job wants to run next.
+	using Job = std::function<Clock::time_point()>;
+
+	static TimerService &instance() {
+		static TimerService service;
+		return service;
+	}
+
+	~TimerService() {
+		{
+			std::lock_guard<std::mutex> guard(mutex_);
+			stopping_ = true;
+		}
+		cv_.notify_all();
+		if (thread_.joinable()) {
+			thread_.join();
+		}
+	}
+
+	TimerService(const TimerService &rhs) = delete;
+
+	TimerService &operator=(const TimerService &rhs) = delete;
+
+	uint64_t add(Clock::time_point first, Job job) {
+		std::lock_guard<std::mutex> guard(mutex_);
+		auto id = next_id_++;
+		jobs_.emplace(id, std::move(job));
+		queue_.push({first, id});
+		if (!thread_.joinable()) {
+			thread_ = std::thread([this] { run(); });
+		}
+		cv_.notify_one();
+		return id;
+	}
+
+	// Returns once the job is gone and no longer running. Must not be called from a job.
+	void remove(uint64_t id) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		jobs_.erase(id);
+		done_cv_.wait(lock, [this, id] { return running_ != id; });
+	}
+
+private:
+	TimerService() = default;
+
+	void run() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (!stopping_) {
+			if (queue_.empty()) {
+				cv_.wait(lock);
+				continue;
+			}
+			auto next = queue_.top();
+			auto job = jobs_.find(next.second);
+			if (job == jobs_.end()) {
+				// removed, drop its queue entry
+				queue_.pop();
+				continue;
+			}
+			if (Clock::now() < next.first) {
+				cv_.wait_until(lock, next.first);
+				continue;
+			}
+			queue_.pop();
+			// run a copy, remove() may erase the job meanwhile
+			auto function = job->second;
+			running_ = next.second;
+			lock.unlock();
+			auto when = function();
+			lock.lock();
+			running_ = 0;
+			done_cv_.notify_all();
+			if (jobs_.count(next.second) != 0) {
+				queue_.push({when, next.second});
+			}
+		}
+	}
+
+private:
+	using Entry = std::pair<Clock::time_point, uint64_t>;
+
+	std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue_;
+	std::unordered_map<uint64_t, Job> jobs_;
+	uint64_t next_id_{1};
+	uint64_t running_{0};
+	bool stopping_{false};
+	std::thread thread_;
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::condition_variable done_cv_;
+};
+};
+
+#endif //CONNECTIONPOOL_TIMER_SERVICE_HPP
+
+/*** End of inlined file: timer_service.hpp ***/
+
+namespace modern_utils {
+
+// Test-and-test-and-set lock for critical sections of a few dozen instructions; yields after a
+// short spin so it still makes progress when threads outnumber cores.
+class SpinLock {
+public:
+	void lock() {
+		for (int spins = 0; locked_.exchange(true, std::memory_order_acquire); ++spins) {
+			while (locked_.load(std::memory_order_relaxed)) {
+				if (++spins > 64) {
+					std::this_thread::yield();
+				}
+			}
+		}
+	}
+
+	bool try_lock() {
+		return !locked_.load(std::memory_order_relaxed) && !locked_.exchange(true, std::memory_order_acquire);
+	}
+
+	void unlock() {
+		locked_.store(false, std::memory_order_release);
+	}
+
+private:
+	std::atomic<bool> locked_{false};
+};
+
+// Milliseconds of std::chrono::steady_clock, read on every call.
+struct SteadyClock {
+	static int64_t now() {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+};
+
+// SteadyClock cached in one atomic that the shared timer thread refreshes every kResolutionMs,
+// so a read is a single relaxed load.
+struct CoarseClock {
+	static constexpr int kResolutionMs = 100;
+
+	static int64_t now() {
+		return cached().load(std::memory_order_relaxed);
+	}
+
+private:
+	static std::atomic<int64_t> &cached() {
+		// constructed before the timer service, so it outlives the refresh job
+		static std::atomic<int64_t> cached{SteadyClock::now()};
+		static const bool refreshing = [] {
+			TimerService::instance().add(nextRefresh(), [] {
+				cached.store(SteadyClock::now(), std::memory_order_relaxed);
+				return nextRefresh();
+			});
+			return true;
+		}();
+		(void) refreshing;
+		return cached;
+	}
+
+	static TimerService::Clock::time_point nextRefresh() {
+		return TimerService::Clock::now() + std::chrono::milliseconds(static_cast<int64_t>(kResolutionMs));
+	}
+};
+
+// Idle store selectors for PoolPolicy.
+struct WheelStore {
+	template<typename V, ReuseOrder kOrder, typename Lock>
+	using type = IdleWheel<V, kOrder>;
+};
+
+struct QueueStore {
+	template<typename V, ReuseOrder kOrder, typename Lock>
+	using type = IdleQueue<V, kOrder, Lock>;
+};
+
+// Compile-time choices of a ConnectionPool, so each combination gets its own inlined hot path:
+// the lock guarding the pool (std::mutex or SpinLock), the reuse order, the clock stamping idle
+// connections (CoarseClock or SteadyClock, both in milliseconds) and the idle store. kFifo
+// defaults to QueueStore, as the wheel is FIFO only from one slot to the next.
+template<typename Lock = std::mutex, ReuseOrder kOrder = ReuseOrder::kLifo, typename Clock = CoarseClock,
+		typename IdleStore = typename std::conditional<kOrder == ReuseOrder::kLifo, WheelStore, QueueStore>::type>
+struct PoolPolicy {
+	using LockType = Lock;
+	using ClockType = Clock;
+	static constexpr ReuseOrder kReuseOrder = kOrder;
+	// std::condition_variable only works with std::mutex
+	using ConditionType = typename std::conditional<std::is_same<Lock, std::mutex>::value,
+			std::condition_variable, std::condition_variable_any>::type;
+
+	template<typename V>
+	using IdleContainer = typename IdleStore::template type<V, kOrder, Lock>;
+};
+
+using DefaultPoolPolicy = PoolPolicy<>;
+};
+
+#endif //CONNECTIONPOOL_POOL_POLICY_HPP
+
+/*** End of inlined file: pool_policy.hpp ***/
+
+/*** Start of inlined file: pool_stats.hpp ***/
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_POOL_STATS_HPP
+#define CONNECTIONPOOL_POOL_STATS_HPP
+
+#include <chrono>
+
+namespace modern_utils {
+
+struct PoolStats {
+	int max_count{0};
+	int idle_count{0};
+	int busy_count{0};
+	// connects reserved or running, not yet idle
+	int pending_count{0};
+	int waiting_count{0};
+	bool warmed_up{false};
+	// a background warm-up stopped at a failed connect, so warmed_up stays false
+	bool warmup_failed{false};
+	// from the start of construction until the warm-up target was reached
+	std::chrono::milliseconds startup_time{0};
+};
+};
+
+#endif //CONNECTIONPOOL_POOL_STATS_HPP
+
+/*** End of inlined file: pool_stats.hpp ***/
+
+/*** Start of inlined file: thread_cache.hpp ***/
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_THREAD_CACHE_HPP
+#define CONNECTIONPOOL_THREAD_CACHE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace modern_utils {
+
+// Identifies a pool to the thread caches; unlike its address it is never reused.
+inline uint64_t nextThreadCacheOwnerId() {
+	static std::atomic<uint64_t> next_id{1};
+	return next_id++;
+}
+
+// A small per-thread stack of idle connections owned by one pool. Only the owning thread uses it
+// on the fast path; the pool locks it from other threads just to reclaim or detach it.
+template<typename T>
+class ConnectionMagazine {
+public:
+	using SpillFunction = std::function<void(std::vector<T> &)>;
+
+	ConnectionMagazine(uint64_t pool_id, SpillFunction spill) : pool_id_(pool_id), spill_(std::move(spill)) {}
+
+	ConnectionMagazine(const ConnectionMagazine &rhs) = delete;
+
+	ConnectionMagazine &operator=(const ConnectionMagazine &rhs) = delete;
+
+	uint64_t poolId() const {
+		return pool_id_;
+	}
+
+	bool attached() const {
+		return attached_.load(std::memory_order_acquire);
+	}
+
+	int size() const {
+		return count_.load(std::memory_order_relaxed);
+	}
+
+	bool pop(T &value) {
+		Locker locker(lock_);
+		if (entries_.empty()) {
+			return false;
+		}
+		value = std::move(entries_.back());
+		entries_.pop_back();
+		count_.store(static_cast<int>(entries_.size()), std::memory_order_relaxed);
+		return true;
+	}
+
+	// Moves the older half of a full magazine into spill before caching value.
+	void push(T &&value, std::size_t capacity, std::vector<T> &spill) {
+		Locker locker(lock_);
+		if (entries_.size() >= capacity) {
+			auto spill_count = (entries_.size() + 1) / 2;
+			std::move(entries_.begin(), entries_.begin() + spill_count, std::back_inserter(spill));
+			entries_.erase(entries_.begin(), entries_.begin() + spill_count);
+		}
+		entries_.push_back(std::move(value));
+		count_.store(static_cast<int>(entries_.size()), std::memory_order_relaxed);
+	}
+
+	// Moves every cached entry matching predicate into out, oldest first.
+	template<typename Predicate>
+	void drain(std::vector<T> &out, Predicate predicate) {
+		Locker locker(lock_);
+		auto keep = entries_.begin();
+		for (auto iter = entries_.begin(); iter != entries_.end(); ++iter) {
+			if (predicate(*iter)) {
+				out.push_back(std::move(*iter));
+			} else {
+				*keep++ = std::move(*iter);
+			}
+		}
+		entries_.erase(keep, entries_.end());
+		count_.store(static_cast<int>(entries_.size()), std::memory_order_relaxed);
+	}
+
+	// Called by the pool before it goes away; waits for a concurrent retire() to finish.
+	void detach(std::vector<T> &out) {
+		Locker locker(lock_);
+		std::move(entries_.begin(), entries_.end(), std::back_inserter(out));
+		entries_.clear();
+		count_.store(0, std::memory_order_relaxed);
+		attached_.store(false, std::memory_order_release);
+	}
+
+	// Called when the owning thread exits: hands everything back to the pool if it still exists.
+	void retire() {
+		Locker locker(lock_);
+		if (attached_.load(std::memory_order_relaxed)) {
+			std::vector<T> entries;
+			entries.swap(entries_);
+			count_.store(0, std::memory_order_relaxed);
+			spill_(entries);
+			attached_.store(false, std::memory_order_release);
+		}
+	}
+
+private:
+	class Locker {
+	public:
+		explicit Locker(std::atomic_flag &lock) : lock_(lock) {
+			while (lock_.test_and_set(std::memory_order_acquire)) {
+				std::this_thread::yield();
+			}
+		}
+
+		~Locker() {
+			lock_.clear(std::memory_order_release);
+		}
+
+	private:
+		std::atomic_flag &lock_;
+	};
+
+private:
+	const uint64_t pool_id_;
+	SpillFunction spill_;
+	std::vector<T> entries_;
+	std::atomic<int> count_{0};
+	std::atomic<bool> attached_{true};
+	std::atomic_flag lock_ = ATOMIC_FLAG_INIT;
+};
+
+// The magazines of the calling thread, one per pool it has used. Retired when the thread exits.
+template<typename T>
+class ThreadMagazines {
+public:
+	using MagazinePtr = std::shared_ptr<ConnectionMagazine<T>>;
+
+	~ThreadMagazines() {
+		for (auto &magazine : magazines_) {
+			magazine->retire();
+		}
+	}
+
+	static ThreadMagazines &local() {
+		thread_local ThreadMagazines magazines;
+		return magazines;
+	}
+
+	ConnectionMagazine<T> *find(uint64_t pool_id) {
+		if (last_ != nullptr && last_->poolId() == pool_id) {
+			return last_;
+		}
+		for (auto iter = magazines_.begin(); iter != magazines_.end();) {
+			if (!(*iter)->attached()) {
+				iter = magazines_.erase(iter);
+			} else if ((*iter)->poolId() == pool_id) {
+				last_ = iter->get();
+				return last_;
+			} else {
+				++iter;
+			}
+		}
+		last_ = nullptr;
+		return nullptr;
+	}
+
+	void add(const MagazinePtr &magazine) {
+		magazines_.push_back(magazine);
+		last_ = magazine.get();
+	}
+
+private:
+	std::vector<MagazinePtr> magazines_;
+	ConnectionMagazine<T> *last_{nullptr};
+};
+};
+
+#endif //CONNECTIONPOOL_THREAD_CACHE_HPP
+
+/*** End of inlined file: thread_cache.hpp ***/
+
+/*** Start of inlined file: slot_pool.hpp ***/
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_SLOT_POOL_HPP
+#define CONNECTIONPOOL_SLOT_POOL_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+
+namespace modern_utils {
+
+constexpr std::size_t kCacheLineSize = 64;
+
+// One pooled connection. Slots never move, so a Slot* is the borrow handle.
+template<typename Conn>
+struct alignas(kCacheLineSize) ConnectionSlot {
+	enum State : uint32_t {
+		kEmpty, kIdle, kBusy
+	};
+
+	Conn *get() const {
+		return conn;
+	}
+
+	Conn *conn{nullptr};
+	time_t last_used{0};
+	std::atomic<uint32_t> state{kEmpty};
+	std::atomic<uint32_t> next{TaggedIndexList::kNil};
+	uint32_t index{0};
+};
+
+// A fixed-capacity pool that keeps raw connections in a preallocated, cache-line-aligned slot array.
+// Borrowing hands out a ConnectionSlot* instead of a shared_ptr: no control block per connection and
+// no reference counting, an idle borrow or a release is a single CAS on a tagged index list.
+template<typename Conn, typename ConnFactory>
+class SlotConnectionPool {
+private:
+	static_assert(is_acceptable<Conn, ConnFactory>::diagnose());
+public:
+	using ConnectionType = Conn;
+	using ConnFactoryType = ConnFactory;
+	using Slot = ConnectionSlot<Conn>;
+	using HandleType = Slot *;
+public:
+	explicit SlotConnectionPool(std::shared_ptr<ConnFactoryType> conn_factory, int max_count = 20)
+			: conn_factory_(std::move(conn_factory)), max_count_(max_count) {
+		// operator new only honours the slot alignment from C++17 on, so align the array by hand
+		storage_.reset(new char[sizeof(Slot) * max_count_ + kCacheLineSize]);
+		auto address = reinterpret_cast<std::uintptr_t>(storage_.get());
+		slots_ = reinterpret_cast<Slot *>((address + kCacheLineSize - 1) & ~(kCacheLineSize - 1));
+		for (int i = 0; i < max_count_; ++i) {
+			new(&slots_[i]) Slot();
+			slots_[i].index = static_cast<uint32_t>(i);
+		}
+
+		try {
+			for (int i = max_count_ - 1; i >= 0; --i) {
+				slots_[i].conn = conn_factory_->createConnection();
+				slots_[i].last_used = time(nullptr);
+				slots_[i].state = Slot::kIdle;
+				idle_.push(slots_[i].index, nextOf());
+			}
+		} catch (...) {
+			// the destructor does not run for a constructor that throws
+			clear();
+			throw;
+		}
+	}
+
+	~SlotConnectionPool() {
+		clear();
+	}
+
+	SlotConnectionPool(const SlotConnectionPool &rhs) = delete;
+
+	SlotConnectionPool &operator=(const SlotConnectionPool &rhs) = delete;
+
+	Slot *getConnection() {
+		Slot *slot = nullptr;
+		bool empty = false;
+		if (!claimSlot(slot, empty)) {
+			Waiting waiting(waiting_);
+			std::unique_lock<std::mutex> lock(mutex_);
+			if (!cv_.wait_for(lock, std::chrono::seconds(timeout_),
+							  [this, &slot, &empty] { return claimSlot(slot, empty); })) {
+				throw AcquireTimeoutError();
+			}
+		}
+		// an empty slot is connected outside mutex_, so a slow connect holds up no other borrower
+		if (empty) {
+			connect(slot);
+		}
+		return slot;
+	}
+
+	void releaseConnecion(Slot *slot, bool destroy = false) {
+		if (destroy) {
+			conn_factory_->destroy(slot->conn);
+			slot->conn = nullptr;
+			slot->state.store(Slot::kEmpty, std::memory_order_relaxed);
+			empty_.push(slot->index, nextOf());
+		} else {
+			slot->last_used = time(nullptr);
+			slot->state.store(Slot::kIdle, std::memory_order_relaxed);
+			idle_.push(slot->index, nextOf());
+		}
+
+		if (waiting_ > 0) {
+			std::lock_guard<std::mutex> guard(mutex_);
+			cv_.notify_one();
+		}
+	}
+
+	// Replaces the borrowed connection in place; the slot stays borrowed.
+	void recoverConnection(Slot *slot) {
+		auto conn = conn_factory_->createConnection();
+		if (slot->conn != nullptr) {
+			conn_factory_->destroy(slot->conn);
+		}
+		slot->conn = conn;
+	}
+
+	const std::shared_ptr<ConnFactory> &getConnFactory() const {
+		return conn_factory_;
+	}
+
+	static Conn *connectionOf(Slot *slot) {
+		return slot->conn;
+	}
+
+	bool checkValid(Slot *slot) {
+		return conn_factory_->checkValid(slot->conn);
+	}
+
+	int getCapacity() const {
+		return max_count_;
+	}
+
+private:
+	auto nextOf() {
+		return [this](uint32_t index) -> std::atomic<uint32_t> & { return slots_[index].next; };
+	}
+
+	// Counts a borrower in waiting_ for as long as it waits, however it stops waiting.
+	struct Waiting {
+		explicit Waiting(std::atomic<int> &waiting) : waiting(waiting) {
+			++waiting;
+		}
+
+		~Waiting() {
+			--waiting;
+		}
+
+		std::atomic<int> &waiting;
+	};
+
+	// Takes an idle slot, or else an empty one that the caller must connect; false if neither is
+	// left. Never connects, so it is safe under mutex_.
+	bool claimSlot(Slot *&slot, bool &empty) {
+		auto index = idle_.pop(nextOf());
+		empty = index == TaggedIndexList::kNil;
+		if (empty) {
+			index = empty_.pop(nextOf());
+			if (index == TaggedIndexList::kNil) {
+				return false;
+			}
+		} else {
+			slots_[index].state.store(Slot::kBusy, std::memory_order_relaxed);
+		}
+		slot = &slots_[index];
+		return true;
+	}
+
+	// Fills a claimed empty slot; if the connect fails the slot goes back empty for a waiter.
+	void connect(Slot *slot) {
+		try {
+			slot->conn = conn_factory_->createConnection();
+		} catch (...) {
+			empty_.push(slot->index, nextOf());
+			if (waiting_ > 0) {
+				std::lock_guard<std::mutex> guard(mutex_);
+				cv_.notify_one();
+			}
+			throw;
+		}
+		slot->state.store(Slot::kBusy, std::memory_order_relaxed);
+	}
+
+	void clear() {
+		for (int i = 0; i < max_count_; ++i) {
+			if (slots_[i].conn != nullptr) {
+				conn_factory_->destroy(slots_[i].conn);
+			}
+			slots_[i].~Slot();
+		}
+	}
+
+private:
+	std::shared_ptr<ConnFactoryType> conn_factory_;
+	const int max_count_;
+	std::unique_ptr<char[]> storage_;
+	Slot *slots_{nullptr};
+	TaggedIndexList idle_;
+	TaggedIndexList empty_;
+	std::atomic<int> waiting_{0};
+	int timeout_{3};
+	std::mutex mutex_;
+	std::condition_variable cv_;
+};
+};
+
+#endif //CONNECTIONPOOL_SLOT_POOL_HPP
+
+/*** End of inlined file: slot_pool.hpp ***/
+
+/*** Start of inlined file: multiplexed_pool.hpp ***/
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_MULTIPLEXED_POOL_HPP
+#define CONNECTIONPOOL_MULTIPLEXED_POOL_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace modern_utils {
+
+// One connection shared by up to max_streams borrowers at a time.
+template<typename Conn>
+struct SharedConnection {
+	Conn *get() const {
+		return conn.get();
+	}
+
+	std::shared_ptr<Conn> conn;
+	// the two below are guarded by the pool mutex
+	int streams{0};
+	// takes no new streams, and closes when its last one is released
+	bool retired{false};
+};
+
+// A pool for protocols that pipeline or multiplex many requests over one connection (HTTP/2,
+// Redis pipelining, ...). A borrow opens a stream on the least loaded connection with a spare
+// one, and a new connection is made only when every connection is at max_streams. The handle
+// stays valid until the stream is released; UniqueConnGuard releases the stream, not the
+// connection. Conn must be safe to use from several threads at once.
+template<typename Conn, typename ConnFactory>
+class MultiplexedConnectionPool {
+private:
+	static_assert(is_acceptable<Conn, ConnFactory>::diagnose());
+public:
+	using ConnectionType = Conn;
+	using ConnFactoryType = ConnFactory;
+	using Shared = SharedConnection<Conn>;
+	using HandleType = Shared *;
+public:
+	explicit MultiplexedConnectionPool(std::shared_ptr<ConnFactoryType> conn_factory, int max_count = 4,
+									   int max_streams = 100)
+			: conn_factory_(std::move(conn_factory)), max_count_(max_count),
+			  max_streams_(max_streams > 0 ? max_streams : 1) {
+	}
+
+	MultiplexedConnectionPool(const MultiplexedConnectionPool &rhs) = delete;
+
+	MultiplexedConnectionPool &operator=(const MultiplexedConnectionPool &rhs) = delete;
+
+	Shared *getConnection() {
+		return getConnection(std::chrono::seconds(timeout_));
+	}
+
+	Shared *getConnection(std::chrono::milliseconds timeout) {
+		return getConnection(std::chrono::steady_clock::now() + timeout);
+	}
+
+	Shared *getConnection(std::chrono::steady_clock::time_point deadline) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (true) {
+			auto shared = leastLoaded();
+			if (shared != nullptr) {
+				++shared->streams;
+				return shared;
+			}
+			if (live_count_ + creating_ < max_count_) {
+				return openConnection(lock);
+			}
+			++waiting_;
+			auto status = cv_.wait_until(lock, deadline);
+			--waiting_;
+			if (status == std::cv_status::timeout && (shared = leastLoaded()) == nullptr &&
+				live_count_ + creating_ >= max_count_) {
+				throw AcquireTimeoutError();
+			}
+		}
+	}
+
+	// Closes the stream; destroy also retires its connection, which closes once every stream
+	// on it is released.
+	void releaseConnecion(Shared *shared, bool destroy = false) {
+		std::shared_ptr<Conn> closed;
+		{
+			std::lock_guard<std::mutex> guard(mutex_);
+			if (destroy) {
+				retire(shared);
+			}
+			--shared->streams;
+			if (shared->retired && shared->streams == 0) {
+				closed = std::move(shared->conn);
+				connections_.erase(std::find_if(connections_.begin(), connections_.end(),
+												[shared](const std::unique_ptr<Shared> &c) {
+													return c.get() == shared;
+												}));
+			}
+			if (waiting_ > 0) {
+				cv_.notify_one();
+			}
+		}
+		// a retired connection closes here, outside the lock
+	}
+
+	// Retires the stream's connection and moves the stream to another, new if need be.
+	void recoverConnection(Shared *&shared) {
+		auto next = getConnectionOnOther(shared);
+		releaseConnecion(shared, true);
+		shared = next;
+	}
+
+	const std::shared_ptr<ConnFactory> &getConnFactory() const {
+		return conn_factory_;
+	}
+
+	static Conn *connectionOf(Shared *shared) {
+		return shared->get();
+	}
+
+	bool checkValid(Shared *shared) {
+		return conn_factory_->checkValid(shared->get());
+	}
+
+	// Live connections, retired ones excluded.
+	int getConnectionCount() {
+		std::lock_guard<std::mutex> guard(mutex_);
+		return live_count_;
+	}
+
+	int getStreamCount() {
+		std::lock_guard<std::mutex> guard(mutex_);
+		int streams = 0;
+		for (auto &shared : connections_) {
+			streams += shared->streams;
+		}
+		return streams;
+	}
+
+private:
+	// Called with mutex_ held: the live connection with the fewest streams, if it has a spare one.
+	Shared *leastLoaded() {
+		Shared *best = nullptr;
+		for (auto &shared : connections_) {
+			if (!shared->retired && shared->streams < max_streams_ &&
+				(best == nullptr || shared->streams < best->streams)) {
+				best = shared.get();
+			}
+		}
+		return best;
+	}
+
+	// Called with mutex_ held and room for one more connection; connects with it released and
+	// returns the new connection with one stream open.
+	Shared *openConnection(std::unique_lock<std::mutex> &lock) {
+		++creating_;
+		lock.unlock();
+		std::unique_ptr<Shared> shared(new Shared);
+		try {
+			auto factory = conn_factory_;
+			shared->conn.reset(conn_factory_->createConnection(), [factory](Conn *p) { factory->destroy(p); });
+		} catch (...) {
+			lock.lock();
+			--creating_;
+			// the room is free again for a waiter to connect into
+			if (waiting_ > 0) {
+				cv_.notify_one();
+			}
+			throw;
+		}
+		lock.lock();
+		--creating_;
+		++live_count_;
+		shared->streams = 1;
+		connections_.push_back(std::move(shared));
+		// the new connection's other streams are free for waiters
+		if (waiting_ > 0) {
+			cv_.notify_all();
+		}
+		return connections_.back().get();
+	}
+
+	Shared *getConnectionOnOther(Shared *current) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		retire(current);
+		auto shared = leastLoaded();
+		if (shared != nullptr) {
+			++shared->streams;
+			return shared;
+		}
+		lock.unlock();
+		return getConnection();
+	}
+
+	// Called with mutex_ held.
+	void retire(Shared *shared) {
+		if (!shared->retired) {
+			shared->retired = true;
+			--live_count_;
+		}
+	}
+
+private:
+	std::shared_ptr<ConnFactoryType> conn_factory_;
+	const int max_count_;
+	const int max_streams_;
+	std::vector<std::unique_ptr<Shared>> connections_;
+	int live_count_{0};
+	int creating_{0};
+	int waiting_{0};
+	int timeout_{3};
+	std::mutex mutex_;
+	std::condition_variable cv_;
+};
+};
+
+#endif //CONNECTIONPOOL_MULTIPLEXED_POOL_HPP
+
+/*** End of inlined file: multiplexed_pool.hpp ***/
+
+/*** Start of inlined file: keyed_pool.hpp ***/
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_KEYED_POOL_HPP
+#define CONNECTIONPOOL_KEYED_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace modern_utils {
+
+// defined in connection_pool.hpp, which includes this header
+template<typename Conn, typename ConnFactory, bool kMetrics, typename Policy>
+class ConnectionPool;
+
+// One pool per key (host, shard, ...) under a single budget of global_max connections. A key gets
+// its sub-pool and factory on first use and grows its quota one connection at a time: from the
+// unallocated budget while there is some, then from the key with the most slack, i.e. quota not
+// backed by a busy or connecting connection. Taking quota from a key closes one of its idle
+// connections, so a cold key cannot sit on connections a hot key is queueing for. Keys with queued
+// borrowers are topped up as well, as other keys' connections go idle. That and every sub-pool's
+// eviction and validation run on one maintenance thread of the keyed pool, and each sub-pool
+// connects on a single creator thread, so n keys cost n + 1 threads rather than six per key.
+template<typename Key, typename Conn, typename ConnFactory, typename Hash = std::hash<Key>>
+class KeyedConnectionPool {
+public:
+	using PoolType = ConnectionPool<Conn, ConnFactory, false, DefaultPoolPolicy>;
+	using FactoryMaker = std::function<std::shared_ptr<ConnFactory>(const Key &)>;
+public:
+	KeyedConnectionPool(FactoryMaker make_factory, int global_max, int key_max = 0)
+			: make_factory_(std::move(make_factory)), global_max_(global_max),
+			  key_max_(key_max > 0 ? key_max : global_max) {
+		rebalance_timer_ = TimerService::instance().add(nextRebalance(), [this] {
+			wakeMaintainer(true);
+			return nextRebalance();
+		});
+	}
+
+	~KeyedConnectionPool() {
+		TimerService::instance().remove(rebalance_timer_);
+		{
+			std::lock_guard<std::mutex> guard(maintain_mutex_);
+			stopping_ = true;
+		}
+		maintain_cv_.notify_one();
+		if (maintainer_.joinable()) {
+			maintainer_.join();
+		}
+		// a sub-pool still held elsewhere goes back to maintaining itself
+		for (auto &entry : entries_) {
+			entry.second->pool->setMaintenanceDriver(nullptr);
+		}
+	}
+
+	KeyedConnectionPool(const KeyedConnectionPool &rhs) = delete;
+
+	KeyedConnectionPool &operator=(const KeyedConnectionPool &rhs) = delete;
+
+	std::shared_ptr<Conn> acquire(const Key &key) {
+		return acquire(key, std::chrono::seconds(timeout_));
+	}
+
+	std::shared_ptr<Conn> acquire(const Key &key, std::chrono::milliseconds timeout) {
+		auto deadline = std::chrono::steady_clock::now() + timeout;
+		auto pool = poolOf(key);
+		std::shared_ptr<Conn> conn;
+		if (pool->tryGetConnection(conn)) {
+			return conn;
+		}
+		{
+			std::lock_guard<std::mutex> guard(mutex_);
+			grow(*entries_.find(key)->second);
+		}
+		return pool->getConnection(deadline);
+	}
+
+	void releaseConnecion(const Key &key, std::shared_ptr<Conn> conn, bool destroy = false) {
+		poolOf(key)->releaseConnecion(std::move(conn), destroy);
+	}
+
+	// The sub-pool of key, created with its factory on first use.
+	std::shared_ptr<PoolType> poolOf(const Key &key) {
+		std::lock_guard<std::mutex> guard(mutex_);
+		auto iter = entries_.find(key);
+		if (iter != entries_.end()) {
+			return iter->second->pool;
+		}
+		auto factory = make_factory_(key);
+		if (factory == nullptr) {
+			throw std::runtime_error("no connection factory for key");
+		}
+		PoolOptions options(0);
+		options.warmup = WarmupMode::kLazy;
+		std::shared_ptr<Entry> entry(new Entry);
+		entry->pool = std::make_shared<PoolType>(std::move(factory), options);
+		entry->pool->setCreateConcurrency(1);
+		entry->pool->setMaintenanceDriver([this] { wakeMaintainer(false); });
+		entries_.emplace(key, entry);
+		return entry->pool;
+	}
+
+	PoolStats getStats(const Key &key) {
+		return poolOf(key)->getStats();
+	}
+
+	// Connections the keys may hold between them, at most global_max.
+	int getAllocated() {
+		std::lock_guard<std::mutex> guard(mutex_);
+		return allocated_;
+	}
+
+	void setRebalanceInterval(std::chrono::milliseconds interval) {
+		rebalance_interval_ms_ = static_cast<int>(interval.count());
+	}
+
+private:
+	struct Entry {
+		std::shared_ptr<PoolType> pool;
+		int quota{0};
+	};
+
+	static int slackOf(const PoolStats &stats) {
+		return stats.max_count - stats.busy_count - stats.pending_count;
+	}
+
+	// Called with mutex_ held. Gives entry one more connection of quota unless it already has room.
+	bool grow(Entry &entry) {
+		auto stats = entry.pool->getStats();
+		if (stats.idle_count > 0 || slackOf(stats) > 0 || entry.quota >= key_max_) {
+			return false;
+		}
+		if (allocated_ < global_max_) {
+			++allocated_;
+		} else {
+			Entry *victim = nullptr;
+			int most_slack = 0;
+			for (auto &other : entries_) {
+				if (other.second.get() == &entry) {
+					continue;
+				}
+				auto slack = slackOf(other.second->pool->getStats());
+				if (slack > most_slack) {
+					most_slack = slack;
+					victim = other.second.get();
+				}
+			}
+			if (victim == nullptr) {
+				return false;
+			}
+			// closes one of its idle connections if it has no unused quota
+			victim->pool->setMaxCount(--victim->quota);
+		}
+		entry.pool->setMaxCount(++entry.quota);
+		return true;
+	}
+
+	// Runs on the maintenance thread: moves quota to keys with queued borrowers.
+	void rebalance() {
+		std::lock_guard<std::mutex> guard(mutex_);
+		for (auto &entry : entries_) {
+			auto waiting = entry.second->pool->getStats().waiting_count;
+			for (int i = 0; i < waiting; ++i) {
+				if (!grow(*entry.second)) {
+					break;
+				}
+			}
+		}
+	}
+
+	// Called by the rebalance timer, and by sub-pools with their lock held, so it takes no lock
+	// a sub-pool call can be made under.
+	void wakeMaintainer(bool rebalance) {
+		std::lock_guard<std::mutex> guard(maintain_mutex_);
+		if (stopping_) {
+			return;
+		}
+		(rebalance ? rebalance_due_ : maintenance_due_) = true;
+		if (!maintainer_.joinable()) {
+			maintainer_ = std::thread([this] { runMaintainer(); });
+		}
+		maintain_cv_.notify_one();
+	}
+
+	void runMaintainer() {
+		std::unique_lock<std::mutex> lock(maintain_mutex_);
+		while (true) {
+			maintain_cv_.wait(lock, [this] { return stopping_ || rebalance_due_ || maintenance_due_; });
+			if (stopping_) {
+				return;
+			}
+			auto rebalance_due = rebalance_due_;
+			auto maintenance_due = maintenance_due_;
+			rebalance_due_ = maintenance_due_ = false;
+			lock.unlock();
+			if (rebalance_due) {
+				rebalance();
+			}
+			if (maintenance_due) {
+				std::vector<std::shared_ptr<PoolType>> pools;
+				{
+					std::lock_guard<std::mutex> guard(mutex_);
+					for (auto &entry : entries_) {
+						pools.push_back(entry.second->pool);
+					}
+				}
+				for (auto &pool : pools) {
+					pool->runMaintenance();
+				}
+			}
+			lock.lock();
+		}
+	}
+
+	std::chrono::steady_clock::time_point nextRebalance() const {
+		return std::chrono::steady_clock::now() + std::chrono::milliseconds(rebalance_interval_ms_);
+	}
+
+private:
+	FactoryMaker make_factory_;
+	const int global_max_;
+	const int key_max_;
+	int allocated_{0};
+	std::unordered_map<Key, std::shared_ptr<Entry>, Hash> entries_;
+	std::atomic<int> rebalance_interval_ms_{100};
+	uint64_t rebalance_timer_{0};
+	int timeout_{3};
+	std::mutex mutex_;
+	// guards the fields below; never held while calling into a sub-pool
+	std::mutex maintain_mutex_;
+	std::condition_variable maintain_cv_;
+	std::thread maintainer_;
+	bool rebalance_due_{false};
+	bool maintenance_due_{false};
+	bool stopping_{false};
+};
+};
+
+#endif //CONNECTIONPOOL_KEYED_POOL_HPP
+
+/*** End of inlined file: keyed_pool.hpp ***/
+
+/*** Start of inlined file: balanced_pool.hpp ***/
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_BALANCED_POOL_HPP
+#define CONNECTIONPOOL_BALANCED_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace modern_utils {
+
+// defined in connection_pool.hpp, which includes this header
+template<typename Conn, typename ConnFactory, bool kMetrics, typename Policy>
+class ConnectionPool;
+
+enum class BalanceMode {
+	// the replica with the lowest (in-flight + 1) * latency score
+	kLeastOutstanding,
+	// the better of two replicas picked at random by the same score
+	kPowerOfTwo
+};
+
+struct ReplicaStats {
+	bool ejected{false};
+	int in_flight{0};
+	int failures{0};
+	// moving average of acquire and checkValid latency
+	std::chrono::microseconds latency{0};
+};
+
+// Spreads borrows over several replicas of one service, one ConnectionPool per factory. Each borrow
+// goes to the replica with the least in-flight work weighted by its observed latency, and fails
+// over to the next one if that replica cannot hand out a connection. A replica whose connects or
+// checkValid calls fail eject_after times in a row is ejected: its idle connections are closed and
+// no borrow is routed to it. After a backoff, doubling up to max_backoff, a probe connect runs on
+// its creator thread; a connection that connects and passes checkValid puts the replica back.
+// Timeouts do not count as failures, an exhausted replica is not a broken one.
+template<typename Conn, typename ConnFactory>
+class BalancedConnectionPool {
+public:
+	using ConnectionType = Conn;
+	using ConnFactoryType = ConnFactory;
+	using PoolType = ConnectionPool<Conn, ConnFactory, false, DefaultPoolPolicy>;
+
+	// The borrow handle: the connection and the replica to give it back to.
+	struct HandleType {
+		std::shared_ptr<Conn> conn;
+		int replica{-1};
+	};
+public:
+	explicit BalancedConnectionPool(const std::vector<std::shared_ptr<ConnFactory>> &factories,
+									int max_per_replica = 20, BalanceMode mode = BalanceMode::kPowerOfTwo)
+			: max_per_replica_(max_per_replica), mode_(mode) {
+		if (factories.empty()) {
+			throw std::runtime_error("no replica");
+		}
+		// lazy, so a replica that is down cannot fail the constructor
+		PoolOptions options(max_per_replica);
+		options.warmup = WarmupMode::kLazy;
+		for (auto &factory : factories) {
+			std::unique_ptr<Replica> replica(new Replica);
+			replica->pool.reset(new PoolType(factory, options));
+			replicas_.push_back(std::move(replica));
+		}
+		probe_timer_ = TimerService::instance().add(nextProbe(), [this] { return probe(); });
+	}
+
+	~BalancedConnectionPool() {
+		TimerService::instance().remove(probe_timer_);
+		// pending probes are failed by the replica pools, after which they must not touch this
+		stopping_ = true;
+	}
+
+	BalancedConnectionPool(const BalancedConnectionPool &rhs) = delete;
+
+	BalancedConnectionPool &operator=(const BalancedConnectionPool &rhs) = delete;
+
+	HandleType getConnection() {
+		return getConnection(std::chrono::seconds(timeout_));
+	}
+
+	HandleType getConnection(std::chrono::milliseconds timeout) {
+		auto deadline = std::chrono::steady_clock::now() + timeout;
+		std::vector<bool> tried(replicas_.size(), false);
+		std::exception_ptr error;
+		for (std::size_t attempt = 0; attempt < replicas_.size(); ++attempt) {
+			auto index = pick(tried);
+			if (index < 0) {
+				break;
+			}
+			tried[index] = true;
+			auto &replica = *replicas_[index];
+			++replica.in_flight;
+			auto start = std::chrono::steady_clock::now();
+			try {
+				auto conn = replica.pool->getConnection(deadline);
+				recordSuccess(replica, std::chrono::steady_clock::now() - start);
+				return {std::move(conn), index};
+			} catch (const AcquireTimeoutError &) {
+				--replica.in_flight;
+				error = std::current_exception();
+			} catch (...) {
+				--replica.in_flight;
+				error = std::current_exception();
+				recordFailure(index);
+			}
+		}
+		if (error) {
+			std::rethrow_exception(error);
+		}
+		throw std::runtime_error("no healthy replica");
+	}
+
+	void releaseConnecion(HandleType handle, bool destroy = false) {
+		auto &replica = *replicas_[handle.replica];
+		--replica.in_flight;
+		replica.pool->releaseConnecion(std::move(handle.conn), destroy);
+	}
+
+	// Replaces the connection on its own replica; a failed connect counts against the replica.
+	void recoverConnection(HandleType &handle) {
+		try {
+			replicas_[handle.replica]->pool->recoverConnection(handle.conn);
+		} catch (...) {
+			recordFailure(handle.replica);
+			throw;
+		}
+	}
+
+	// checkValid through the replica pool, feeding the replica's latency and failure count.
+	bool checkValid(const HandleType &handle) {
+		auto &replica = *replicas_[handle.replica];
+		auto start = std::chrono::steady_clock::now();
+		auto valid = replica.pool->checkValid(handle.conn);
+		if (valid) {
+			recordSuccess(replica, std::chrono::steady_clock::now() - start);
+		} else {
+			recordFailure(handle.replica);
+		}
+		return valid;
+	}
+
+	static Conn *connectionOf(const HandleType &handle) {
+		return handle.conn.get();
+	}
+
+	int getReplicaCount() const {
+		return static_cast<int>(replicas_.size());
+	}
+
+	ReplicaStats getReplicaStats(int index) const {
+		auto &replica = *replicas_[index];
+		ReplicaStats stats;
+		stats.ejected = replica.ejected;
+		stats.in_flight = replica.in_flight;
+		stats.failures = replica.failures;
+		stats.latency = std::chrono::microseconds(replica.latency_us.load());
+		return stats;
+	}
+
+	PoolType &getReplicaPool(int index) {
+		return *replicas_[index]->pool;
+	}
+
+	void setEjectPolicy(int eject_after, std::chrono::milliseconds initial_backoff,
+						std::chrono::milliseconds max_backoff) {
+		eject_after_ = std::max(eject_after, 1);
+		initial_backoff_ms_ = static_cast<int>(initial_backoff.count());
+		max_backoff_ms_ = static_cast<int>(std::max(max_backoff, initial_backoff).count());
+	}
+
+private:
+	struct Replica {
+		std::unique_ptr<PoolType> pool;
+		std::atomic<int> in_flight{0};
+		std::atomic<long long> latency_us{0};
+		std::atomic<int> failures{0};
+		std::atomic<bool> ejected{false};
+		std::atomic<bool> probing{false};
+		// guarded by mutex_
+		int backoff_ms{0};
+		std::chrono::steady_clock::time_point retry_at;
+	};
+
+	long long scoreOf(const Replica &replica) const {
+		return (replica.in_flight + 1LL) * (replica.latency_us.load(std::memory_order_relaxed) + 1);
+	}
+
+	// A healthy replica not tried yet, or -1.
+	int pick(const std::vector<bool> &tried) {
+		thread_local std::minstd_rand random(std::random_device{}());
+		int candidates[2] = {-1, -1};
+		int seen = 0;
+		for (int i = 0; i < static_cast<int>(replicas_.size()); ++i) {
+			if (tried[i] || replicas_[i]->ejected) {
+				continue;
+			}
+			++seen;
+			if (mode_ == BalanceMode::kLeastOutstanding) {
+				if (candidates[0] < 0 || scoreOf(*replicas_[i]) < scoreOf(*replicas_[candidates[0]])) {
+					candidates[0] = i;
+				}
+			} else if (seen <= 2) {
+				candidates[seen - 1] = i;
+			} else {
+				// reservoir sampling keeps two uniformly random candidates in one pass
+				auto slot = static_cast<int>(random() % seen);
+				if (slot < 2) {
+					candidates[slot] = i;
+				}
+			}
+		}
+		if (candidates[1] >= 0 && scoreOf(*replicas_[candidates[1]]) < scoreOf(*replicas_[candidates[0]])) {
+			return candidates[1];
+		}
+		return candidates[0];
+	}
+
+	void recordSuccess(Replica &replica, std::chrono::steady_clock::duration elapsed) {
+		auto sample = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+		auto latency = replica.latency_us.load(std::memory_order_relaxed);
+		// moving average with weight 1/8 for the new sample
+		replica.latency_us.store(latency == 0 ? sample + 1 : latency + (sample - latency) / 8,
+								 std::memory_order_relaxed);
+		replica.failures = 0;
+	}
+
+	void recordFailure(int index) {
+		auto &replica = *replicas_[index];
+		if (++replica.failures >= eject_after_ && !replica.ejected.exchange(true)) {
+			std::lock_guard<std::mutex> guard(mutex_);
+			replica.backoff_ms = initial_backoff_ms_;
+			replica.retry_at = std::chrono::steady_clock::now() + std::chrono::milliseconds(replica.backoff_ms);
+			replica.pool->setMaxCount(0);
+		}
+	}
+
+	// Runs on the shared timer thread: starts a probe connect on each ejected replica whose backoff
+	// has run out. The connect and checkValid run on the replica pool's creator thread.
+	std::chrono::steady_clock::time_point probe() {
+		auto now = std::chrono::steady_clock::now();
+		for (int i = 0; i < static_cast<int>(replicas_.size()); ++i) {
+			auto &replica = *replicas_[i];
+			if (!replica.ejected || replica.probing) {
+				continue;
+			}
+			{
+				std::lock_guard<std::mutex> guard(mutex_);
+				if (now < replica.retry_at) {
+					continue;
+				}
+			}
+			replica.probing = true;
+			replica.pool->setMaxCount(max_per_replica_);
+			replica.pool->acquireAsync([this, i](std::shared_ptr<Conn> conn, std::exception_ptr error) {
+				if (!stopping_) {
+					probed(i, std::move(conn), error);
+				}
+			});
+		}
+		return nextProbe();
+	}
+
+	void probed(int index, std::shared_ptr<Conn> conn, std::exception_ptr error) {
+		auto &replica = *replicas_[index];
+		auto valid = !error && conn != nullptr && replica.pool->checkValid(conn);
+		if (conn != nullptr) {
+			replica.pool->releaseConnecion(std::move(conn), !valid);
+		}
+		if (valid) {
+			replica.failures = 0;
+			replica.ejected = false;
+		} else {
+			std::lock_guard<std::mutex> guard(mutex_);
+			replica.backoff_ms = std::min(replica.backoff_ms * 2, max_backoff_ms_.load());
+			replica.retry_at = std::chrono::steady_clock::now() + std::chrono::milliseconds(replica.backoff_ms);
+			replica.pool->setMaxCount(0);
+		}
+		replica.probing = false;
+	}
+
+	std::chrono::steady_clock::time_point nextProbe() const {
+		return std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+	}
+
+private:
+	// declared first, so both outlive the replica pools and the probe callbacks they fail
+	std::atomic<bool> stopping_{false};
+	std::mutex mutex_;
+	std::vector<std::unique_ptr<Replica>> replicas_;
+	const int max_per_replica_;
+	const BalanceMode mode_;
+	std::atomic<int> eject_after_{3};
+	std::atomic<int> initial_backoff_ms_{1000};
+	std::atomic<int> max_backoff_ms_{30000};
+	uint64_t probe_timer_{0};
+	int timeout_{3};
+};
+};
+
+#endif //CONNECTIONPOOL_BALANCED_POOL_HPP
+
+/*** End of inlined file: balanced_pool.hpp ***/
+
+/*** Start of inlined file: conn_batch_guard.hpp ***/
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_CONN_BATCH_GUARD_HPP
+#define CONNECTIONPOOL_CONN_BATCH_GUARD_HPP
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace modern_utils {
+
+enum class BatchGrant {
+	// all n connections or none: the caller waits, holding nothing, until the pool can grant them
+	kAll,
+	// at least one connection, plus as many of the n as are idle at that point
+	kPartial
+};
+
+// Move-only set of connections borrowed with acquireMany. They go back to the pool together, in
+// one releaseMany, when the guard is reset or destroyed. The pool must outlive the guard.
+template<typename ConnectionPool>
+class ConnBatchGuard {
+public:
+	using ConnectionType = typename ConnectionPool::ConnectionType;
+	using HandleType = typename ConnectionPool::HandleType;
+public:
+	ConnBatchGuard() = default;
+
+	ConnBatchGuard(ConnectionPool &pool, std::vector<HandleType> conns) : pool_(&pool), conns_(std::move(conns)) {}
+
+	ConnBatchGuard(ConnBatchGuard &&rhs) noexcept : pool_(rhs.pool_), conns_(std::move(rhs.conns_)) {
+		rhs.pool_ = nullptr;
+		rhs.conns_.clear();
+	}
+
+	ConnBatchGuard &operator=(ConnBatchGuard &&rhs) noexcept {
+		if (this != &rhs) {
+			reset();
+			pool_ = rhs.pool_;
+			conns_ = std::move(rhs.conns_);
+			rhs.pool_ = nullptr;
+			rhs.conns_.clear();
+		}
+		return *this;
+	}
+
+	ConnBatchGuard(const ConnBatchGuard &rhs) = delete;
+
+	ConnBatchGuard &operator=(const ConnBatchGuard &rhs) = delete;
+
+	~ConnBatchGuard() {
+		reset();
+	}
+
+	std::size_t size() const {
+		return conns_.size();
+	}
+
+	bool empty() const {
+		return conns_.empty();
+	}
+
+	ConnectionType *operator[](std::size_t index) const {
+		return ConnectionPool::connectionOf(conns_[index]);
+	}
+
+	// The pool's handle of connection index, e.g. for recoverConnection.
+	HandleType &handle(std::size_t index) {
+		return conns_[index];
+	}
+
+	// Returns every connection to the pool now; destroy drops them instead of keeping them idle.
+	void reset(bool destroy = false) {
+		if (pool_ != nullptr && !conns_.empty()) {
+			pool_->releaseMany(std::move(conns_), destroy);
+		}
+		pool_ = nullptr;
+		conns_.clear();
+	}
+
+private:
+	ConnectionPool *pool_{nullptr};
+	std::vector<HandleType> conns_;
+};
+};
+
+#endif //CONNECTIONPOOL_CONN_BATCH_GUARD_HPP
+
+/*** End of inlined file: conn_batch_guard.hpp ***/
+
+/*** Start of inlined file: unique_conn_guard.hpp ***/
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_UNIQUE_CONN_GUARD_HPP
+#define CONNECTIONPOOL_UNIQUE_CONN_GUARD_HPP
+
+#include <utility>
+
+namespace modern_utils {
+
+// Move-only counterpart of ConnGuard for hot paths. It keeps a plain pointer to the pool, which
+// must outlive the guard, and the pool's borrow handle, so borrowing does no weak_ptr locking and
+// operator-> hands out Conn* without touching a reference count. Works with any pool exposing
+// HandleType, getConnection, releaseConnecion, recoverConnection(HandleType &), checkValid and
+// connectionOf, i.e. ConnectionPool (one shared_ptr), SlotConnectionPool (one slot pointer),
+// BalancedConnectionPool (a shared_ptr and its replica) and MultiplexedConnectionPool (one stream).
+template<typename ConnectionPool>
+class UniqueConnGuard {
+public:
+	using ConnectionType = typename ConnectionPool::ConnectionType;
+	using HandleType = typename ConnectionPool::HandleType;
+public:
+	UniqueConnGuard() = default;
+
+	explicit UniqueConnGuard(ConnectionPool &pool) : pool_(&pool), conn_(pool.getConnection()) {}
+
+	UniqueConnGuard(UniqueConnGuard &&rhs) noexcept : pool_(rhs.pool_), conn_(std::move(rhs.conn_)) {
+		rhs.pool_ = nullptr;
+		rhs.conn_ = HandleType();
+	}
+
+	UniqueConnGuard &operator=(UniqueConnGuard &&rhs) noexcept {
+		if (this != &rhs) {
+			reset();
+			pool_ = rhs.pool_;
+			conn_ = std::move(rhs.conn_);
+			rhs.pool_ = nullptr;
+			rhs.conn_ = HandleType();
+		}
+		return *this;
+	}
+
+	UniqueConnGuard(const UniqueConnGuard &rhs) = delete;
+
+	UniqueConnGuard &operator=(const UniqueConnGuard &rhs) = delete;
+
+	~UniqueConnGuard() {
+		reset();
+	}
+
+	ConnectionType *operator->() const {
+		return get();
+	}
+
+	ConnectionType &operator*() const {
+		return *get();
+	}
+
+	ConnectionType *get() const {
+		return ConnectionPool::connectionOf(conn_);
+	}
+
+	bool isReady() const {
+		return pool_ != nullptr;
+	}
+
+	explicit operator bool() const {
+		return isReady();
+	}
+
+	bool checkValid() {
+		return isReady() && pool_->checkValid(conn_);
+	}
+
+	void recover() {
+		if (isReady()) {
+			pool_->recoverConnection(conn_);
+		}
+	}
+
+	// Returns the connection to the pool now; destroy drops it instead of keeping it idle.
+	void reset(bool destroy = false) {
+		if (isReady()) {
+			pool_->releaseConnecion(std::move(conn_), destroy);
+			pool_ = nullptr;
+			conn_ = HandleType();
+		}
+	}
+
+private:
+	ConnectionPool *pool_{nullptr};
+	HandleType conn_{};
+};
+};
+
+#endif //CONNECTIONPOOL_UNIQUE_CONN_GUARD_HPP
+
+/*** End of inlined file: unique_conn_guard.hpp ***/
+
+/*** Start of inlined file: conn_executor.hpp ***/
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_CONN_EXECUTOR_HPP
+#define CONNECTIONPOOL_CONN_EXECUTOR_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace modern_utils {
+
+// Runs tasks on worker threads that each keep one connection borrowed from the pool for as long
+// as the executor lives, so a task costs a queue push and pop instead of a borrow and a release.
+// submit() spreads tasks over per-worker queues and an idle worker steals from the others. When a
+// task throws, its worker checks its connection and recovers it if dead; a worker that cannot
+// borrow fails its tasks with the pool's error until it can. Works with any pool UniqueConnGuard
+// works with, which must outlive the executor and have a connection for every worker.
+template<typename ConnectionPool>
+class ConnectionExecutor {
+public:
+	using ConnectionType = typename ConnectionPool::ConnectionType;
+private:
+	// Runs with the worker's connection and returns false if it threw, or fails with error when
+	// there is no connection.
+	using Task = std::function<bool(ConnectionType *, std::exception_ptr)>;
+
+	struct TaskQueue {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+public:
+	ConnectionExecutor(ConnectionPool &pool, int workers) : pool_(pool) {
+		workers = workers > 0 ? workers : 1;
+		for (int i = 0; i < workers; ++i) {
+			queues_.emplace_back(new TaskQueue);
+		}
+		for (int i = 0; i < workers; ++i) {
+			workers_.emplace_back([this, i] { runWorker(i); });
+		}
+	}
+
+	ConnectionExecutor(const ConnectionExecutor &rhs) = delete;
+
+	ConnectionExecutor &operator=(const ConnectionExecutor &rhs) = delete;
+
+	// Runs the tasks already submitted, then gives the connections back.
+	~ConnectionExecutor() {
+		{
+			std::lock_guard<std::mutex> guard(sleep_mutex_);
+			stopping_ = true;
+		}
+		sleep_cv_.notify_all();
+		for (auto &worker : workers_) {
+			worker.join();
+		}
+	}
+
+	// Queues task(ConnectionType &) and returns a future of its result, or of what it threw.
+	template<typename Function>
+	auto submit(Function task) -> std::future<decltype(task(std::declval<ConnectionType &>()))> {
+		using Result = decltype(task(std::declval<ConnectionType &>()));
+		auto promise = std::make_shared<std::promise<Result>>();
+		auto future = promise->get_future();
+		push([promise, task](ConnectionType *conn, std::exception_ptr error) mutable {
+			if (conn == nullptr) {
+				promise->set_exception(error);
+				return true;
+			}
+			try {
+				fulfil(*promise, task, *conn, std::is_void<Result>());
+				return true;
+			} catch (...) {
+				promise->set_exception(std::current_exception());
+				return false;
+			}
+		});
+		return future;
+	}
+
+	int getWorkerCount() const {
+		return static_cast<int>(workers_.size());
+	}
+
+	// Also pings a worker's connection before a task when the worker has been idle for idle_ms or
+	// more; -1 turns it off.
+	void setValidateAfterIdle(int idle_ms) {
+		validate_after_idle_ = idle_ms;
+	}
+
+private:
+	template<typename Result, typename Function>
+	static void fulfil(std::promise<Result> &promise, Function &task, ConnectionType &conn, std::false_type) {
+		promise.set_value(task(conn));
+	}
+
+	template<typename Result, typename Function>
+	static void fulfil(std::promise<Result> &promise, Function &task, ConnectionType &conn, std::true_type) {
+		task(conn);
+		promise.set_value();
+	}
+
+	void push(Task task) {
+		auto &queue = *queues_[next_++ % queues_.size()];
+		{
+			std::lock_guard<std::mutex> guard(queue.mutex);
+			queue.tasks.push_back(std::move(task));
+		}
+		// pairs with a worker announcing itself in sleeping_ before it checks queued_, so either
+		// the worker sees the task or we see the worker
+		++queued_;
+		if (sleeping_ > 0) {
+			std::lock_guard<std::mutex> guard(sleep_mutex_);
+			sleep_cv_.notify_one();
+		}
+	}
+
+	// The oldest task of the worker's own queue, or else the newest of another's.
+	bool pop(int index, Task &task) {
+		auto count = static_cast<int>(queues_.size());
+		for (int i = 0; i < count; ++i) {
+			auto &queue = *queues_[(index + i) % count];
+			std::lock_guard<std::mutex> guard(queue.mutex);
+			if (!queue.tasks.empty()) {
+				if (i == 0) {
+					task = std::move(queue.tasks.front());
+					queue.tasks.pop_front();
+				} else {
+					task = std::move(queue.tasks.back());
+					queue.tasks.pop_back();
+				}
+				--queued_;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Blocks until there is a task, or returns false once stopping with none left.
+	bool take(int index, Task &task) {
+		while (!pop(index, task)) {
+			std::unique_lock<std::mutex> lock(sleep_mutex_);
+			++sleeping_;
+			sleep_cv_.wait(lock, [this] { return stopping_ || queued_ > 0; });
+			--sleeping_;
+			if (stopping_ && queued_ <= 0) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void runWorker(int index) {
+		UniqueConnGuard<ConnectionPool> conn;
+		auto idle_since = std::chrono::steady_clock::now();
+		Task task;
+		while (take(index, task)) {
+			auto validate_after_idle = validate_after_idle_.load(std::memory_order_relaxed);
+			if (conn && validate_after_idle >= 0 && std::chrono::steady_clock::now() - idle_since >=
+													std::chrono::milliseconds(validate_after_idle) &&
+				!conn.checkValid()) {
+				recover(conn);
+			}
+			if (!conn) {
+				try {
+					conn = UniqueConnGuard<ConnectionPool>(pool_);
+				} catch (...) {
+					task(nullptr, std::current_exception());
+					continue;
+				}
+			}
+			if (!task(conn.get(), nullptr) && !conn.checkValid()) {
+				recover(conn);
+			}
+			task = nullptr;
+			idle_since = std::chrono::steady_clock::now();
+		}
+	}
+
+	// Swaps a dead connection for a new one; if that fails too, drops it and borrows again on the
+	// next task.
+	static void recover(UniqueConnGuard<ConnectionPool> &conn) {
+		try {
+			conn.recover();
+		} catch (...) {
+			conn.reset(true);
+		}
+	}
+
+private:
+	ConnectionPool &pool_;
+	std::vector<std::unique_ptr<TaskQueue>> queues_;
+	std::vector<std::thread> workers_;
+	std::atomic<unsigned> next_{0};
+	std::atomic<int> queued_{0};
+	std::atomic<int> sleeping_{0};
+	std::atomic<int> validate_after_idle_{-1};
+	bool stopping_{false};
+	std::mutex sleep_mutex_;
+	std::condition_variable sleep_cv_;
+};
+};
+
+#endif //CONNECTIONPOOL_CONN_EXECUTOR_HPP
+
+/*** End of inlined file: conn_executor.hpp ***/
+
+/*** Start of inlined file: conn_guard.hpp ***/
+//
+// Created by dx2880 on 2018/1/13.
+//
+
+#ifndef CONNECTIONPOOL_CONNECTION_HPP
+#define CONNECTIONPOOL_CONNECTION_HPP
+
+#include <functional>
+#include <iostream>
+#include <memory>
+
+/*** Start of inlined file: connection_pool.hpp ***/
+//
+// Created by dx2880 on 2018/1/13.
+//
+
+#ifndef CONNECTIONPOOL_CONNECTION_POOL_HPP
+#define CONNECTIONPOOL_CONNECTION_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <random>
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#endif
+
+namespace modern_utils {
+// kMetrics = true compiles in the counters and latency histograms, whose clock reads cost about as
+// much as a borrow and release themselves; Policy picks the lock, idle store, reuse order and
+// clock, see PoolPolicy.
+template<typename Conn, typename ConnFactory, bool kMetrics = false, typename Policy = DefaultPoolPolicy>
+class ConnectionPool {
+private:
+	static_assert(is_acceptable<Conn, ConnFactory>::diagnose());
+	using Mutex = typename Policy::LockType;
+	using ConditionVariable = typename Policy::ConditionType;
+	using Clock = typename Policy::ClockType;
+	using Hooks = factory_hooks<Conn, ConnFactory>;
+public:
+	using ConnectionType = Conn;
+	using ConnFactoryType = ConnFactory;
+	using HandleType = std::shared_ptr<Conn>;
+	// Receives either a connection or the reason none could be obtained; must not throw.
+	using AcquireCallback = std::function<void(std::shared_ptr<Conn>, std::exception_ptr)>;
+public:
+	explicit ConnectionPool(const std::shared_ptr<ConnFactoryType> &conn_factory, int max_count = 20)
+			: ConnectionPool(conn_factory, PoolOptions(max_count)) {
+	}
+
+
+	explicit ConnectionPool(std::shared_ptr<ConnFactoryType> &&conn_factory, int max_count = 20)
+			: ConnectionPool(std::move(conn_factory), PoolOptions(max_count)) {
+	}
+
+	ConnectionPool(std::shared_ptr<ConnFactoryType> conn_factory, const PoolOptions &options) : conn_factory_(
+			std::move(conn_factory)), max_count_(options.max_count) {
+		initPool(options);
+	}
+
+	~ConnectionPool() {
+		TimerService::instance().remove(evict_timer_);
+		if (health_timer_ != 0) {
+			TimerService::instance().remove(health_timer_);
+		}
+		if (autoscale_timer_ != 0) {
+			TimerService::instance().remove(autoscale_timer_);
+		}
+		if (renew_timer_ != 0) {
+			TimerService::instance().remove(renew_timer_);
+		}
+		std::vector<std::thread> creators;
+		{
+			std::lock_guard<Mutex> guard(mutex_);
+			stopping_ = true;
+			creators.swap(creators_);
+		}
+		create_cv_.notify_all();
+		maintain_cv_.notify_all();
+		if (maintainer_.joinable()) {
+			maintainer_.join();
+		}
+		if (warmup_thread_.joinable()) {
+			warmup_thread_.join();
+		}
+		for (auto &creator : creators) {
+			creator.join();
+		}
+
+		std::vector<IdleConnection> cached;
+		for (auto &magazine : threadMagazines()) {
+			magazine->detach(cached);
+		}
+
+		std::unique_lock<Mutex> lock(mutex_);
+		IdleConnection idle;
+		while (idle_connection_.pop(idle)) {
+		}
+		auto error = std::make_exception_ptr(std::runtime_error("connection pool destroyed"));
+		while (!waiters_.empty()) {
+			serve(lock, popWaiter(), nullptr, error);
+		}
+	}
+
+	ConnectionPool(const ConnectionPool &rhs) = delete;
+
+	ConnectionPool &operator=(const ConnectionPool &rhs) = delete;
+
+	// Connects up to count at once; above it, idle connections close now and busy ones on release.
+	void setConnectionCount(int count) {
+		resize(count, true);
+	}
+
+	// Like setConnectionCount but never connects; queued borrowers connect into new room.
+	void setMaxCount(int count) {
+		resize(count, false);
+	}
+
+	auto getConnection() {
+		return getConnection(std::chrono::seconds(timeout_));
+	}
+
+	// Never waits or connects: an idle connection, or false.
+	bool tryGetConnection(std::shared_ptr<Conn> &conn) {
+		return tryBorrow(conn);
+	}
+
+	std::shared_ptr<Conn> getConnection(std::chrono::milliseconds timeout, Priority priority = Priority::kNormal) {
+		return getConnection(std::chrono::steady_clock::now() + timeout, priority);
+	}
+
+	// Blocked callers are served by priority and then strictly in arrival order: each waits on its
+	// own condition variable and a released connection is handed to the first one directly.
+	// Borrowers below the priority set with setFailFast throw PoolExhaustedError instead of
+	// queueing when the pool is full.
+	std::shared_ptr<Conn> getConnection(std::chrono::steady_clock::time_point deadline,
+										Priority priority = Priority::kNormal) {
+		std::shared_ptr<Conn> conn;
+		if (tryBorrow(conn, priority)) {
+			return conn;
+		}
+
+		// slow path: the idle stack is empty, so create a connection or block until one is released.
+		// Announce the waiter before reclaiming the thread caches so no releaser parks a connection
+		// in its cache unseen.
+		++waiting_;
+		if (thread_cache_size_ > 0) {
+			reclaimThreadCaches([](const IdleConnection &) { return true; });
+		}
+		// A new connection is made by a creator thread and handed out like a released one, so a
+		// release during the connect serves this caller and the new connection goes to the next.
+		auto start = metrics_.now();
+		std::unique_lock<Mutex> lock(mutex_);
+		auto admitted = admits(priority, 0);
+		if (admitted && popIdle(conn)) {
+			--waiting_;
+			recordBorrow(conn, start);
+			return conn;
+		}
+		if (static_cast<int>(priority) < fail_fast_below_ && (!admitted || counted() >= max_count_)) {
+			--waiting_;
+			throw PoolExhaustedError();
+		}
+		if (refusedByBackend(admitted)) {
+			--waiting_;
+			throw BackendDownError();
+		}
+		auto waiter = std::make_shared<Waiter>();
+		waiter->priority = priority;
+		waiter->request = admitted ? requestCreate() : nullptr;
+		enqueue(waiter);
+		while (!waiter->ready) {
+			if (waiter->cv.wait_until(lock, deadline) == std::cv_status::timeout && !waiter->ready) {
+				waiters_.erase(std::find(waiters_.begin(), waiters_.end(), waiter));
+				--waiting_;
+				recordWait(waiter->since);
+				metrics_.add(PoolCounter::kTimeouts);
+				throw AcquireTimeoutError();
+			}
+		}
+		if (waiter->error) {
+			std::rethrow_exception(waiter->error);
+		}
+		return std::move(waiter->conn);
+	}
+
+	// Never blocks and never connects on this thread. The callback runs right away here only if a
+	// connection is idle or the borrow fails at once. Otherwise it is queued and runs on whichever
+	// thread serves it: a creator thread with the connection it made or the connect error, a
+	// thread releasing a connection, the pool's maintenance thread after it frees room, a thread
+	// resizing the pool or warming it up, or the destructor with an error. Keep it short.
+	void acquireAsync(AcquireCallback callback) {
+		std::shared_ptr<Conn> conn;
+		try {
+			if (!acquireOrEnqueue(conn, callback)) {
+				return;
+			}
+		} catch (...) {
+			callback(nullptr, std::current_exception());
+			return;
+		}
+		callback(std::move(conn), nullptr);
+	}
+
+	ConnBatchGuard<ConnectionPool> acquireMany(int n, BatchGrant grant = BatchGrant::kAll) {
+		return acquireMany(n, std::chrono::steady_clock::now() + std::chrono::seconds(timeout_), grant);
+	}
+
+	ConnBatchGuard<ConnectionPool> acquireMany(int n, std::chrono::milliseconds timeout,
+											   BatchGrant grant = BatchGrant::kAll) {
+		return acquireMany(n, std::chrono::steady_clock::now() + timeout, grant);
+	}
+
+	// Borrows n connections for a fan-out under one lock. With kAll a caller that cannot have all
+	// of them queues as one waiter, and connections released meanwhile are collected for it inside
+	// the pool until it has n; it never holds part of a set, so callers cannot deadlock each other
+	// on partial sets. With kPartial it gets what is idle, waiting only while that is nothing.
+	ConnBatchGuard<ConnectionPool> acquireMany(int n, std::chrono::steady_clock::time_point deadline,
+											   BatchGrant grant = BatchGrant::kAll) {
+		std::vector<std::shared_ptr<Conn>> conns;
+		if (n <= 0) {
+			return ConnBatchGuard<ConnectionPool>(*this, std::move(conns));
+		}
+		++waiting_;
+		if (thread_cache_size_ > 0) {
+			reclaimThreadCaches([](const IdleConnection &) { return true; });
+		}
+		auto start = metrics_.now();
+		std::unique_lock<Mutex> lock(mutex_);
+		std::shared_ptr<Conn> conn;
+		while (static_cast<int>(conns.size()) < n && admits(Priority::kNormal, 0) && popIdle(conn)) {
+			conns.push_back(std::move(conn));
+		}
+		if (static_cast<int>(conns.size()) == n || (grant == BatchGrant::kPartial && !conns.empty())) {
+			--waiting_;
+			for (auto &borrowed : conns) {
+				recordBorrow(borrowed, start);
+			}
+			return ConnBatchGuard<ConnectionPool>(*this, std::move(conns));
+		}
+		auto waiter = std::make_shared<Waiter>();
+		if (grant == BatchGrant::kAll) {
+			if (n > max_count_) {
+				--waiting_;
+				returnIdle(lock, conns);
+				throw std::runtime_error("acquireMany more than max count");
+			}
+			waiter->wanted = n;
+			waiter->batch = std::move(conns);
+		}
+		waiter->request = requestCreate();
+		enqueue(waiter);
+		for (int i = static_cast<int>(waiter->batch.size()) + 1; i < waiter->wanted; ++i) {
+			auto request = requestCreate();
+			if (request == nullptr) {
+				break;
+			}
+			waiter->batch_requests.push_back(std::move(request));
+		}
+		while (!waiter->ready) {
+			if (waiter->cv.wait_until(lock, deadline) == std::cv_status::timeout && !waiter->ready) {
+				waiters_.erase(std::find(waiters_.begin(), waiters_.end(), waiter));
+				--waiting_;
+				recordWait(waiter->since);
+				metrics_.add(PoolCounter::kTimeouts);
+				returnIdle(lock, waiter->batch);
+				throw AcquireTimeoutError();
+			}
+		}
+		if (waiter->error) {
+			std::rethrow_exception(waiter->error);
+		}
+		if (waiter->conn != nullptr) {
+			conns.push_back(std::move(waiter->conn));
+			// kPartial: top up from what is idle, unless that belongs to later waiters
+			while (waiters_.empty() && static_cast<int>(conns.size()) < n && admits(Priority::kNormal, 0) &&
+				   popIdle(conn)) {
+				recordBorrow(conn, waiter->since);
+				conns.push_back(std::move(conn));
+			}
+		} else {
+			conns = std::move(waiter->batch);
+		}
+		return ConnBatchGuard<ConnectionPool>(*this, std::move(conns));
+	}
+
+	std::future<std::shared_ptr<Conn>> acquireFuture() {
+		auto promise = std::make_shared<std::promise<std::shared_ptr<Conn>>>();
+		auto future = promise->get_future();
+		acquireAsync([promise](std::shared_ptr<Conn> conn, std::exception_ptr error) {
+			if (error) {
+				promise->set_exception(error);
+			} else {
+				promise->set_value(std::move(conn));
+			}
+		});
+		return future;
+	}
+
+	// Runs every op(Conn &) of ops back to back on one borrowed connection. When an op throws on a
+	// connection that then fails checkValid, the connection is recovered and the batch resumes from
+	// that op; any other exception stops the batch and is rethrown.
+	template<typename Range>
+	void withConnection(Range &&ops) {
+		auto conn = getConnection();
+		try {
+			for (auto &op : ops) {
+				runResuming(conn, op);
+			}
+		} catch (...) {
+			if (conn != nullptr) {
+				releaseConnecion(std::move(conn));
+			}
+			throw;
+		}
+		releaseConnecion(std::move(conn));
+	}
+
+	// Runs op(Conn &) and returns once it has run, or rethrows what it threw. Ops that threads submit
+	// at the same time share one borrow: the first thread runs them all, its own included, like
+	// withConnection, while the others wait.
+	void coalesce(std::function<void(Conn &)> op) {
+		CoalescedOperation operation(std::move(op));
+		std::unique_lock<Mutex> lock(coalesce_mutex_);
+		coalesced_.push_back(&operation);
+		coalesce_cv_.wait(lock, [this, &operation] { return operation.done || !coalescing_; });
+		if (!operation.done) {
+			coalescing_ = true;
+			runCoalesced(lock);
+		}
+		if (operation.error) {
+			std::rethrow_exception(operation.error);
+		}
+	}
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+	class AcquireAwaitable {
+	public:
+		explicit AcquireAwaitable(ConnectionPool &pool) : pool_(pool) {}
+
+		bool await_ready() {
+			return pool_.tryBorrow(conn_);
+		}
+
+		// The coroutine may be resumed on the releasing thread before this returns, so members
+		// must not be touched once the waiter is queued.
+		bool await_suspend(std::coroutine_handle<> handle) {
+			AcquireCallback resume = [this, handle](std::shared_ptr<Conn> conn, std::exception_ptr error) {
+				conn_ = std::move(conn);
+				error_ = error;
+				handle.resume();
+			};
+			try {
+				return !pool_.acquireOrEnqueue(conn_, resume);
+			} catch (...) {
+				error_ = std::current_exception();
+				return false;
+			}
+		}
+
+		std::shared_ptr<Conn> await_resume() {
+			if (error_) {
+				std::rethrow_exception(error_);
+			}
+			return std::move(conn_);
+		}
+
+	private:
+		ConnectionPool &pool_;
+		std::shared_ptr<Conn> conn_;
+		std::exception_ptr error_;
+	};
+
+	// co_await pool.acquire() suspends the coroutine, not the thread, while the pool is exhausted.
+	AcquireAwaitable acquire() {
+		return AcquireAwaitable(*this);
+	}
+#endif
+
+	// A new connection for a borrower to use in place of the dead one it holds and drops, which
+	// is counted closed. The in-place overload below also keeps the borrow's hold time.
+	auto recoverConnection() {
+		auto recovered = createConnection();
+		if (kMetrics) {
+			deleterOf(recovered)->borrowed = metrics_.now();
+		}
+		metrics_.add(PoolCounter::kRecoveries);
+		metrics_.add(PoolCounter::kDestroys);
+		return recovered;
+	}
+
+	void recoverConnection(std::shared_ptr<Conn> &conn) {
+		auto recovered = createConnection();
+		if (kMetrics && conn != nullptr) {
+			// the borrow goes on, so does its hold time
+			deleterOf(recovered)->borrowed = deleterOf(conn)->borrowed;
+		}
+		conn = std::move(recovered);
+		metrics_.add(PoolCounter::kRecoveries);
+		metrics_.add(PoolCounter::kDestroys);
+	}
+
+	void releaseConnecion(std::shared_ptr<Conn> conn, bool destroy = false) {
+		auto deleter = kMetrics ? deleterOf(conn) : nullptr;
+		if (deleter != nullptr) {
+			metrics_.record(PoolLatency::kHoldTime, deleter->borrowed);
+		}
+		if (destroy && reset(conn, typename Hooks::has_reset())) {
+			destroy = false;
+		}
+		if (!destroy && retireStale(conn)) {
+			destroy = true;
+			metrics_.add(PoolCounter::kRenewals);
+		}
+		if (counted() <= max_count_ && !destroy) {
+			if ((waiting_ > 0 && handOff(conn)) || pushThreadCache(conn)) {
+				return;
+			}
+			++idle_count_;
+			idle_connection_.push({std::move(conn), Clock::now()});
+			--busy_count_;
+		} else {
+			--busy_count_;
+			--total_count_;
+			metrics_.add(PoolCounter::kDestroys);
+		}
+
+		// waiting_ is checked after the push, and a waiter re-checks the stack after announcing
+		// itself, so either the waiter sees the connection or we see the waiter
+		if (waiting_ > 0) {
+			notifyWaiters();
+		}
+	}
+
+	// Gives back a set of connections under one lock; ConnBatchGuard calls it.
+	void releaseMany(std::vector<std::shared_ptr<Conn>> conns, bool destroy = false) {
+		std::vector<bool> retired;
+		for (auto &conn : conns) {
+			auto deleter = kMetrics ? deleterOf(conn) : nullptr;
+			if (deleter != nullptr) {
+				metrics_.record(PoolLatency::kHoldTime, deleter->borrowed);
+			}
+			retired.push_back(!destroy && retireStale(conn));
+		}
+		{
+			std::unique_lock<Mutex> lock(mutex_);
+			for (std::size_t i = 0; i < conns.size(); ++i) {
+				auto &conn = conns[i];
+				if (!retired[i] && counted() <= max_count_ &&
+					(!destroy || reset(conn, typename Hooks::has_reset()))) {
+					if (!waiters_.empty() && admits(waiters_.front()->priority, 1)) {
+						serveFront(lock, std::move(conn));
+						continue;
+					}
+					++idle_count_;
+					idle_connection_.push({std::move(conn), Clock::now()});
+					--busy_count_;
+				} else {
+					--busy_count_;
+					--total_count_;
+					metrics_.add(PoolCounter::kDestroys);
+					if (retired[i]) {
+						metrics_.add(PoolCounter::kRenewals);
+					}
+				}
+			}
+			// room freed by destroyed connections
+			serveWaiters(lock);
+		}
+		// the destroyed connections close here, outside the lock
+	}
+
+private:
+	// stamped with Clock, in milliseconds
+	using IdleConnection = std::pair<std::shared_ptr<Conn>, int64_t>;
+	// batches one coalescing thread runs before it hands the rest to a waiting one
+	static constexpr int kCoalesceRounds = 4;
+
+	struct CoalescedOperation {
+		explicit CoalescedOperation(std::function<void(Conn &)> op) : op(std::move(op)) {
+		}
+
+		std::function<void(Conn &)> op;
+		std::exception_ptr error;
+		bool done{false};
+	};
+
+	// Runs op on conn. If it throws and conn fails checkValid, recovers conn and runs op again on
+	// the new one; if even that fails, conn goes back destroyed and is left empty.
+	template<typename Operation>
+	void runResuming(std::shared_ptr<Conn> &conn, Operation &op) {
+		try {
+			op(*conn);
+			return;
+		} catch (...) {
+			if (checkValid(conn)) {
+				throw;
+			}
+		}
+		try {
+			recoverConnection(conn);
+		} catch (...) {
+			releaseConnecion(std::move(conn), true);
+			throw;
+		}
+		op(*conn);
+	}
+
+	// Runs the queued operations on one connection until none are left, or for kCoalesceRounds
+	// batches, then wakes a waiter to take over. Called with coalesce_mutex_ held through lock, and
+	// returns with it released.
+	void runCoalesced(std::unique_lock<Mutex> &lock) {
+		std::shared_ptr<Conn> conn;
+		for (int round = 0; round < kCoalesceRounds && !coalesced_.empty(); ++round) {
+			std::vector<CoalescedOperation *> batch(coalesced_.begin(), coalesced_.end());
+			coalesced_.clear();
+			lock.unlock();
+			std::exception_ptr borrow_error;
+			for (auto operation : batch) {
+				if (conn == nullptr && !borrow_error) {
+					try {
+						conn = getConnection();
+					} catch (...) {
+						borrow_error = std::current_exception();
+					}
+				}
+				if (conn == nullptr) {
+					operation->error = borrow_error;
+					continue;
+				}
+				try {
+					runResuming(conn, operation->op);
+				} catch (...) {
+					operation->error = std::current_exception();
+				}
+			}
+			lock.lock();
+			for (auto operation : batch) {
+				operation->done = true;
+			}
+			coalesce_cv_.notify_all();
+		}
+		coalescing_ = false;
+		// operations queued after the last batch wait for a new coalescing thread
+		coalesce_cv_.notify_all();
+		lock.unlock();
+		if (conn != nullptr) {
+			releaseConnecion(std::move(conn));
+		}
+	}
+	// max_idle_time_ is split into this many wheel ticks; the default 300s gives 5s ticks
+	static constexpr int kWheelSpan = 60;
+	static constexpr int kWheelTick = 300 * 1000 / kWheelSpan;
+
+	// Sets max_count_ and closes the idle connections above it on the maintenance thread, since
+	// shrinking may be driven by a timer job; with fill, also connects up to it.
+	void resize(int count, bool fill) {
+		reclaimThreadCaches([](const IdleConnection &) { return true; });
+		int create_count = 0;
+		int closed = 0;
+		{
+			std::lock_guard<Mutex> guard(mutex_);
+			max_count_ = count;
+			auto differ_count = max_count_ - counted();
+			if (differ_count > 0 && fill) {
+				// reserve the slots now, connect after unlocking
+				create_count = differ_count;
+				total_count_ += create_count;
+			} else if (differ_count < 0) {
+				IdleConnection idle;
+				for (; closed < -differ_count && idle_connection_.pop(idle); ++closed) {
+					--idle_count_;
+					--total_count_;
+					closing_.push_back(std::move(idle));
+				}
+			}
+		}
+		if (closed > 0) {
+			metrics_.add(PoolCounter::kDestroys, closed);
+			maintain(kClose);
+		}
+
+		std::vector<std::shared_ptr<Conn>> created;
+		std::exception_ptr error;
+		try {
+			createConnections(created, create_count);
+		} catch (...) {
+			error = std::current_exception();
+			total_count_ -= create_count - static_cast<int>(created.size());
+		}
+		for (auto &conn : created) {
+			++idle_count_;
+			idle_connection_.push({std::move(conn), Clock::now()});
+		}
+		// new connections, or room for queued borrowers to connect
+		if (waiting_ > 0) {
+			notifyWaiters();
+		}
+		if (error) {
+			std::rethrow_exception(error);
+		}
+	}
+
+	void recordWait(std::chrono::steady_clock::time_point since) {
+		wait_total_us_ += std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now() - since).count();
+		++wait_count_;
+	}
+
+	// Runs on the maintenance thread: one autoscale sample, applied through resize() without
+	// connecting, since queued borrowers start the connects they need.
+	void autoscale() {
+		auto wait_total = wait_total_us_.exchange(0);
+		auto wait_count = wait_count_.exchange(0);
+		ScaleEvent event;
+		event.average_wait = std::chrono::microseconds(wait_count > 0 ? wait_total / wait_count : 0);
+		event.waiting = waiting_;
+		auto busy = busy_count_ - cachedCount();
+		ScaleListener listener;
+		{
+			std::lock_guard<Mutex> guard(mutex_);
+			event.from = max_count_;
+			event.to = autoscale_->decide(event.from, busy, event.waiting, event.average_wait);
+			listener = scale_listener_;
+		}
+		if (event.to != event.from) {
+			event.direction = event.to > event.from ? ScaleDirection::kGrow : ScaleDirection::kShrink;
+			event.utilization = event.from > 0 ? static_cast<double>(busy) / event.from : 1.0;
+			resize(event.to, false);
+			if (listener) {
+				listener(event);
+			}
+		}
+	}
+
+	// Where replacing a stale connection is at: its successor was requested, then is open.
+	enum Renewal {
+		kNotRenewed, kRenewing, kRenewed
+	};
+
+	// Deleter of every pooled connection. It also keeps per-connection bookkeeping, reached from
+	// the handle through std::get_deleter, so no side table is needed.
+	struct ConnectionDeleter {
+		ConnectionDeleter(std::shared_ptr<ConnFactory> conn_factory, int64_t created, double jitter,
+						  uint64_t generation, std::shared_ptr<std::atomic<int>> renewed)
+				: conn_factory(std::move(conn_factory)), created(created), jitter(jitter),
+				  generation(generation), renewed(std::move(renewed)) {
+		}
+
+		ConnectionDeleter(const ConnectionDeleter &rhs)
+				: conn_factory(rhs.conn_factory), borrowed(rhs.borrowed), created(rhs.created),
+				  jitter(rhs.jitter), generation(rhs.generation), renewed(rhs.renewed),
+				  renewal(rhs.renewal.load()) {
+		}
+
+		void operator()(Conn *p) const {
+			// however it closes, its successor now counts in its place
+			if (renewal == kRenewed) {
+				--*renewed;
+			}
+			conn_factory->destroy(p);
+		}
+
+		std::shared_ptr<ConnFactory> conn_factory;
+		std::chrono::steady_clock::time_point borrowed;
+		// Clock time of the connect, and the share of lifetime_jitter_ its max lifetime is cut by
+		int64_t created;
+		double jitter;
+		// the generation_ of conn_factory, which is replaced along with the factory
+		uint64_t generation;
+		// the pool's count of kRenewed connections, which may outlive the pool
+		std::shared_ptr<std::atomic<int>> renewed;
+		// set by a creator thread while another thread may hold the connection
+		std::atomic<int> renewal{kNotRenewed};
+	};
+
+	static ConnectionDeleter *deleterOf(const std::shared_ptr<Conn> &conn) {
+		return std::get_deleter<ConnectionDeleter>(conn);
+	}
+
+	ConnectionDeleter newDeleter(std::shared_ptr<ConnFactory> conn_factory, uint64_t generation) {
+		thread_local std::minstd_rand random(std::random_device{}());
+		std::uniform_real_distribution<double> share(0, 1);
+		return ConnectionDeleter(std::move(conn_factory), Clock::now(), share(random), generation, renewed_);
+	}
+
+	static const std::shared_ptr<ConnFactory> &factoryOf(const std::shared_ptr<Conn> &conn) {
+		return deleterOf(conn)->conn_factory;
+	}
+
+	// Runs the connect create does under the creation governor, if there is one.
+	template<typename Create>
+	auto governed(int count, Create create) -> decltype(create()) {
+		auto governor = std::atomic_load(&governor_);
+		if (governor == nullptr) {
+			return create();
+		}
+		governor->begin(std::chrono::steady_clock::now() + std::chrono::seconds(timeout_), count);
+		try {
+			auto result = create();
+			governor->finish(true);
+			return result;
+		} catch (...) {
+			governor->finish(false);
+			throw;
+		}
+	}
+
+	bool backendDown() {
+		auto governor = std::atomic_load(&governor_);
+		return governor != nullptr && governor->down();
+	}
+
+	// Whether a borrower that found nothing idle needs a connect the down backend would refuse at
+	// once. One the pool cannot connect for anyway only waits for a release, and queues as usual.
+	// Called with mutex_ held.
+	bool refusedByBackend(bool admitted) {
+		return admitted && counted() < max_count_ && backendDown();
+	}
+
+	std::shared_ptr<Conn> createConnection() {
+		auto start = metrics_.now();
+		// a connection tagged with an older generation than its factory's is only replaced once more
+		auto generation = generation_.load();
+		auto factory = std::atomic_load(&conn_factory_);
+		std::shared_ptr<Conn> conn(governed(1, [&factory] { return factory->createConnection(); }),
+								   newDeleter(factory, generation));
+		metrics_.record(PoolLatency::kCreateTime, start);
+		metrics_.add(PoolCounter::kCreates);
+		return conn;
+	}
+
+	// Fills conns up to n new connections, one createConnection call at a time, or in as few
+	// createConnections calls as it takes when the factory has that hook. Throws on the first
+	// failure, leaving the connections made so far in conns.
+	void createConnections(std::vector<std::shared_ptr<Conn>> &conns, std::size_t n) {
+		while (conns.size() < n) {
+			createMore(conns, n - conns.size(), typename Hooks::has_create_connections());
+		}
+	}
+
+	void createMore(std::vector<std::shared_ptr<Conn>> &conns, std::size_t, std::false_type) {
+		conns.push_back(createConnection());
+	}
+
+	void createMore(std::vector<std::shared_ptr<Conn>> &conns, std::size_t n, std::true_type) {
+		auto start = metrics_.now();
+		auto count = static_cast<int>(n);
+		auto generation = generation_.load();
+		auto factory = std::atomic_load(&conn_factory_);
+		auto created = governed(count, [&factory, count] { return factory->createConnections(count); });
+		if (created.empty()) {
+			throw std::runtime_error("createConnections returned no connection");
+		}
+		auto elapsed = (metrics_.now() - start) / created.size();
+		for (std::size_t i = 0; i < created.size(); ++i) {
+			if (i >= n) {
+				factory->destroy(created[i]);
+				continue;
+			}
+			conns.emplace_back(created[i], newDeleter(factory, generation));
+			metrics_.record(PoolLatency::kCreateTime, elapsed);
+			metrics_.add(PoolCounter::kCreates);
+		}
+	}
+
+	bool reset(const std::shared_ptr<Conn> &, std::false_type) {
+		return false;
+	}
+
+	bool reset(const std::shared_ptr<Conn> &conn, std::true_type) {
+		return factoryOf(conn)->reset(conn.get());
+	}
+
+	bool isCheap(const std::shared_ptr<Conn> &, std::false_type) {
+		return false;
+	}
+
+	bool isCheap(const std::shared_ptr<Conn> &conn, std::true_type) {
+		return factoryOf(conn)->isCheap(conn.get());
+	}
+
+	// Moves the live connections of batch to its front and returns where they end.
+	typename std::vector<IdleConnection>::iterator partitionValid(std::vector<IdleConnection> &batch,
+																  std::false_type) {
+		return std::partition(batch.begin(), batch.end(), [this](const IdleConnection &idle) {
+			return checkValid(idle.first);
+		});
+	}
+
+	typename std::vector<IdleConnection>::iterator partitionValid(std::vector<IdleConnection> &batch,
+																  std::true_type) {
+		std::vector<Conn *> conns;
+		for (auto &idle : batch) {
+			conns.push_back(idle.first.get());
+		}
+		std::unique_ptr<bool[]> valid(new bool[conns.size()]());
+		auto start = metrics_.now();
+		// one call per run of connections made by the same factory
+		for (std::size_t begin = 0, end; begin < conns.size(); begin = end) {
+			auto &factory = factoryOf(batch[begin].first);
+			for (end = begin + 1; end < conns.size() && factoryOf(batch[end].first) == factory; ++end) {
+			}
+			factory->checkValidBatch(conns.data() + begin, end - begin, valid.get() + begin);
+		}
+		auto elapsed = (metrics_.now() - start) / std::max<std::size_t>(conns.size(), 1);
+		std::size_t live = 0;
+		for (std::size_t i = 0; i < batch.size(); ++i) {
+			metrics_.record(PoolLatency::kCheckValidTime, elapsed);
+			if (valid[i]) {
+				std::swap(batch[i], batch[live++]);
+			}
+		}
+		return batch.begin() + live;
+	}
+
+	// Counts a borrow handed to a caller who started asking at since; none means it did not wait.
+	void recordBorrow(const std::shared_ptr<Conn> &conn, std::chrono::steady_clock::time_point since = {}) {
+		if (kMetrics) {
+			auto now = metrics_.now();
+			deleterOf(conn)->borrowed = now;
+			metrics_.record(PoolLatency::kAcquireWait, since == decltype(since)() ? now - now : now - since);
+			metrics_.add(PoolCounter::kAcquires);
+		}
+	}
+
+	// A connect running on a creator thread on behalf of a waiter.
+	struct PendingCreate {
+		bool done{false};
+		std::exception_ptr error;
+		// a successor for a stale connection, made on top of max count instead of in a reserved slot
+		bool renewal{false};
+		std::weak_ptr<Conn> predecessor;
+	};
+
+	// A blocked caller (woken through cv) or a queued callback.
+	struct Waiter {
+		AcquireCallback callback;
+		ConditionVariable cv;
+		bool ready{false};
+		std::shared_ptr<Conn> conn;
+		std::exception_ptr error;
+		std::shared_ptr<PendingCreate> request;
+		std::chrono::steady_clock::time_point since{std::chrono::steady_clock::now()};
+		Priority priority{Priority::kNormal};
+		// acquireMany with kAll: the connections collected so far, until there are wanted of them
+		int wanted{1};
+		std::vector<std::shared_ptr<Conn>> batch;
+		// the connects started for the rest of the batch besides request; one failing fails the waiter
+		std::vector<std::shared_ptr<PendingCreate>> batch_requests;
+	};
+
+	// Takes an idle connection if there is one; otherwise queues callback and, if the pool may
+	// grow, starts a connect for it.
+	bool acquireOrEnqueue(std::shared_ptr<Conn> &conn, AcquireCallback &callback) {
+		if (tryBorrow(conn)) {
+			return true;
+		}
+
+		++waiting_;
+		if (thread_cache_size_ > 0) {
+			reclaimThreadCaches([](const IdleConnection &) { return true; });
+		}
+		auto start = metrics_.now();
+		std::lock_guard<Mutex> guard(mutex_);
+		auto admitted = admits(Priority::kNormal, 0);
+		if (admitted && popIdle(conn)) {
+			--waiting_;
+			recordBorrow(conn, start);
+			return true;
+		}
+		if (refusedByBackend(admitted)) {
+			--waiting_;
+			throw BackendDownError();
+		}
+		auto waiter = std::make_shared<Waiter>();
+		waiter->callback = std::move(callback);
+		waiter->request = admitted ? requestCreate() : nullptr;
+		enqueue(waiter);
+		return false;
+	}
+
+	// Called with mutex_ held: queues waiter behind every waiter of its priority or higher.
+	void enqueue(std::shared_ptr<Waiter> waiter) {
+		auto iter = waiters_.end();
+		while (iter != waiters_.begin() && (*(iter - 1))->priority < waiter->priority) {
+			--iter;
+		}
+		waiters_.insert(iter, std::move(waiter));
+	}
+
+	// total_count_ less the stale connections whose successors are open.
+	int counted() const {
+		return total_count_ - *renewed_;
+	}
+
+	// Whether a borrower of priority may take one more connection, holding held of the busy ones
+	// already: the last reserved_count_ connections are kept for reserved_priority_ and up.
+	bool admits(Priority priority, int held) const {
+		return static_cast<int>(priority) >= reserved_priority_.load(std::memory_order_relaxed) ||
+			   busy_count_ - held < max_count_ - reserved_count_;
+	}
+
+	// Called with mutex_ held; the waiter must already be off the queue.
+	std::shared_ptr<Waiter> popWaiter() {
+		auto waiter = std::move(waiters_.front());
+		waiters_.pop_front();
+		--waiting_;
+		return waiter;
+	}
+
+	// Completes a waiter. A callback runs with mutex_ released.
+	void serve(std::unique_lock<Mutex> &lock, std::shared_ptr<Waiter> waiter, std::shared_ptr<Conn> conn,
+			   std::exception_ptr error) {
+		recordWait(waiter->since);
+		if (conn != nullptr) {
+			recordBorrow(conn, waiter->since);
+		}
+		for (auto &collected : waiter->batch) {
+			if (!error) {
+				recordBorrow(collected, waiter->since);
+			}
+		}
+		if (waiter->callback) {
+			auto callback = std::move(waiter->callback);
+			lock.unlock();
+			callback(std::move(conn), error);
+			lock.lock();
+		} else {
+			waiter->conn = std::move(conn);
+			waiter->error = error;
+			waiter->ready = true;
+			waiter->cv.notify_one();
+		}
+	}
+
+	// Gives a released connection straight to the oldest waiter, so a thread arriving later
+	// cannot take it first. The connection stays busy. The waiters left behind it may still need
+	// connects started.
+	bool handOff(std::shared_ptr<Conn> &conn) {
+		std::unique_lock<Mutex> lock(mutex_);
+		if (waiters_.empty() || !admits(waiters_.front()->priority, 1)) {
+			return false;
+		}
+		serveFront(lock, std::move(conn));
+		if (!waiters_.empty()) {
+			serveWaiters(lock);
+		}
+		return true;
+	}
+
+	// Gives a busy connection to the oldest waiter. A batch waiter keeps it and stays first in
+	// line until it has collected all it wants. Called with mutex_ held and waiters_ not empty.
+	void serveFront(std::unique_lock<Mutex> &lock, std::shared_ptr<Conn> conn) {
+		auto &front = waiters_.front();
+		if (front->wanted > 1) {
+			front->batch.push_back(std::move(conn));
+			if (static_cast<int>(front->batch.size()) < front->wanted) {
+				if (front->request == nullptr || front->request->done) {
+					front->request = requestCreate();
+				}
+				return;
+			}
+		}
+		serve(lock, popWaiter(), std::move(conn), nullptr);
+	}
+
+	// Puts busy connections back on the idle wheel, serving queued waiters first.
+	void returnIdle(std::unique_lock<Mutex> &lock, std::vector<std::shared_ptr<Conn>> &conns) {
+		for (auto &conn : conns) {
+			++idle_count_;
+			idle_connection_.push({std::move(conn), Clock::now()});
+			--busy_count_;
+		}
+		conns.clear();
+		serveWaiters(lock);
+	}
+
+	void notifyWaiters() {
+		std::unique_lock<Mutex> lock(mutex_);
+		serveWaiters(lock);
+	}
+
+	// Hands idle connections to the oldest waiters and, if the pool may grow, starts connects
+	// for the waiters that have none in flight. Called with mutex_ held.
+	void serveWaiters(std::unique_lock<Mutex> &lock) {
+		std::shared_ptr<Conn> conn;
+		while (!waiters_.empty() && admits(waiters_.front()->priority, 0) && popIdle(conn)) {
+			serveFront(lock, std::move(conn));
+			conn = nullptr;
+		}
+		if (counted() < max_count_ && pending_creates_ < create_concurrency_) {
+			for (auto &waiter : waiters_) {
+				// waiters are in priority order, so none after this one may take a connection either
+				if (!admits(waiter->priority, 0)) {
+					break;
+				}
+				if (waiter->request == nullptr || waiter->request->done) {
+					waiter->request = requestCreate();
+					if (waiter->request == nullptr) {
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	// Reserves a slot and queues a connect for a creator thread; nullptr if the pool is full or
+	// create_concurrency_ connects are already running. A successor for predecessor needs no slot.
+	// Called with mutex_ held.
+	std::shared_ptr<PendingCreate> requestCreate(const std::shared_ptr<Conn> &predecessor = nullptr) {
+		auto renewal = predecessor != nullptr;
+		if (stopping_ || (!renewal && counted() >= max_count_) || pending_creates_ >= create_concurrency_) {
+			return nullptr;
+		}
+		if (!renewal) {
+			++total_count_;
+		}
+		++pending_creates_;
+		auto request = std::make_shared<PendingCreate>();
+		request->renewal = renewal;
+		request->predecessor = predecessor;
+		create_queue_.push_back(request);
+		if (idle_creators_ == 0 && static_cast<int>(creators_.size()) < create_concurrency_) {
+			creators_.emplace_back([this] { runCreator(); });
+		}
+		create_cv_.notify_one();
+		return request;
+	}
+
+	void runCreator() {
+		std::unique_lock<Mutex> lock(mutex_);
+		while (true) {
+			++idle_creators_;
+			create_cv_.wait(lock, [this] { return stopping_ || !create_queue_.empty(); });
+			--idle_creators_;
+			if (stopping_) {
+				return;
+			}
+			// one request, or every queued one in a single createConnections call
+			std::vector<std::shared_ptr<PendingCreate>> requests;
+			do {
+				requests.push_back(std::move(create_queue_.front()));
+				create_queue_.pop_front();
+			} while (Hooks::has_create_connections::value && !create_queue_.empty());
+			lock.unlock();
+
+			std::vector<std::shared_ptr<Conn>> conns;
+			std::exception_ptr error;
+			try {
+				createConnections(conns, requests.size());
+			} catch (...) {
+				error = std::current_exception();
+			}
+
+			lock.lock();
+			std::vector<std::shared_ptr<Conn>> unneeded;
+			for (std::size_t i = 0; i < requests.size(); ++i) {
+				auto &request = requests[i];
+				--pending_creates_;
+				request->done = true;
+				if (request->renewal && !renewed(request, i < conns.size())) {
+					if (i < conns.size()) {
+						unneeded.push_back(std::move(conns[i]));
+						metrics_.add(PoolCounter::kDestroys);
+					}
+					continue;
+				}
+				if (i < conns.size()) {
+					if (!waiters_.empty() && admits(waiters_.front()->priority, 0)) {
+						++busy_count_;
+						serveFront(lock, std::move(conns[i]));
+					} else {
+						++idle_count_;
+						idle_connection_.push({std::move(conns[i]), Clock::now()});
+					}
+					continue;
+				}
+				--total_count_;
+				request->error = error;
+				// fail the waiter this connect was started for
+				auto waiter = std::find_if(waiters_.begin(), waiters_.end(),
+										   [&request](const std::shared_ptr<Waiter> &w) {
+											   return w->request == request ||
+													  std::find(w->batch_requests.begin(), w->batch_requests.end(),
+																request) != w->batch_requests.end();
+										   });
+				if (waiter != waiters_.end()) {
+					auto failed = std::move(*waiter);
+					waiters_.erase(waiter);
+					--waiting_;
+					auto collected = std::move(failed->batch);
+					failed->batch.clear();
+					serve(lock, std::move(failed), nullptr, error);
+					returnIdle(lock, collected);
+				}
+			}
+			if (!unneeded.empty()) {
+				lock.unlock();
+				unneeded.clear();
+				lock.lock();
+			}
+			// create_concurrency_ caps the connects running at once, not how far the pool grows:
+			// waiters queued beyond it get theirs now that these are done
+			serveWaiters(lock);
+		}
+	}
+
+	// Settles a finished successor connect and tells whether its connection joins the pool. Once
+	// open, it counts in place of its predecessor until that closes, or, if the predecessor has
+	// closed already, fills the slot it left when there still is one. Called with mutex_ held.
+	bool renewed(const std::shared_ptr<PendingCreate> &request, bool open) {
+		auto predecessor = request->predecessor.lock();
+		if (predecessor != nullptr) {
+			deleterOf(predecessor)->renewal = open ? kRenewed : kNotRenewed;
+		}
+		if (!open || (predecessor == nullptr && counted() >= max_count_)) {
+			return false;
+		}
+		if (predecessor != nullptr) {
+			++*renewed_;
+			// it may sit idle, where only renewStale finds it
+			draining_ = true;
+		}
+		++total_count_;
+		return true;
+	}
+
+	using Magazine = ConnectionMagazine<IdleConnection>;
+
+	// Connections in a thread cache stay counted in busy_count_; getIdleCount/getBusyCount move them
+	// over to idle, so caching and reusing them on the owning thread never touches shared counters.
+	// The lock-free borrow attempt of every acquire path: the thread cache, then the idle wheel
+	// unless someone is already queued.
+	bool tryBorrow(std::shared_ptr<Conn> &conn, Priority priority = Priority::kNormal) {
+		if (!admits(priority, 0)) {
+			return false;
+		}
+		IdleConnection idle;
+		while (popThreadCache(idle) || (waiting_ == 0 && popIdle(idle))) {
+			if (validOnBorrow(idle)) {
+				conn = std::move(idle.first);
+				recordBorrow(conn);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Pings a connection idle for at least validate_on_borrow_ ms, as far as the resolution of
+	// Clock tells, or one the factory's isCheap hook calls cheap, and drops it if dead.
+	bool validOnBorrow(IdleConnection &idle) {
+		auto validate_on_borrow = validate_on_borrow_.load(std::memory_order_relaxed);
+		if (((validate_on_borrow < 0 || Clock::now() - idle.second < validate_on_borrow) &&
+			 !isCheap(idle.first, typename Hooks::has_is_cheap())) || checkValid(idle.first)) {
+			return true;
+		}
+		--busy_count_;
+		--total_count_;
+		metrics_.add(PoolCounter::kDestroys);
+		idle.first = nullptr;
+		if (waiting_ > 0) {
+			notifyWaiters();
+		}
+		return false;
+	}
+
+	bool popThreadCache(IdleConnection &idle) {
+		if (thread_cache_size_ <= 0) {
+			return false;
+		}
+		auto magazine = ThreadMagazines<IdleConnection>::local().find(pool_id_);
+		return magazine != nullptr && magazine->pop(idle);
+	}
+
+	bool pushThreadCache(std::shared_ptr<Conn> &conn) {
+		auto thread_cache_size = thread_cache_size_.load();
+		if (thread_cache_size <= 0 || waiting_ > 0) {
+			return false;
+		}
+		auto &local = ThreadMagazines<IdleConnection>::local();
+		auto magazine = local.find(pool_id_);
+		if (magazine == nullptr) {
+			auto created = std::make_shared<Magazine>(pool_id_, [this](std::vector<IdleConnection> &spilled) {
+				spillThreadCache(spilled);
+			});
+			{
+				std::lock_guard<Mutex> guard(mutex_);
+				magazines_.erase(std::remove_if(magazines_.begin(), magazines_.end(),
+												[](const std::shared_ptr<Magazine> &m) { return !m->attached(); }),
+								 magazines_.end());
+				magazines_.push_back(created);
+			}
+			local.add(created);
+			magazine = created.get();
+		}
+
+		std::vector<IdleConnection> spilled;
+		magazine->push({std::move(conn), Clock::now()}, static_cast<std::size_t>(thread_cache_size), spilled);
+		// pairs with the increment of waiting_ before a waiter reclaims the caches
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (waiting_ > 0) {
+			magazine->drain(spilled, [](const IdleConnection &) { return true; });
+		}
+		if (!spilled.empty()) {
+			spillThreadCache(spilled);
+		}
+		return true;
+	}
+
+	void spillThreadCache(std::vector<IdleConnection> &spilled) {
+		for (auto &idle : spilled) {
+			++idle_count_;
+			idle_connection_.push(std::move(idle));
+			--busy_count_;
+		}
+		if (!spilled.empty() && waiting_ > 0) {
+			notifyWaiters();
+		}
+	}
+
+	std::vector<std::shared_ptr<Magazine>> threadMagazines() {
+		std::lock_guard<Mutex> guard(mutex_);
+		return magazines_;
+	}
+
+	// Never called with mutex_ held: a thread exiting spills its magazine under the magazine lock
+	// and then takes mutex_, so the lock order is magazine before mutex_.
+	template<typename Predicate>
+	void reclaimThreadCaches(Predicate predicate) {
+		std::vector<IdleConnection> reclaimed;
+		for (auto &magazine : threadMagazines()) {
+			magazine->drain(reclaimed, predicate);
+		}
+		spillThreadCache(reclaimed);
+	}
+
+	bool popIdle(std::shared_ptr<Conn> &conn) {
+		IdleConnection idle;
+		if (!popIdle(idle)) {
+			return false;
+		}
+		conn = std::move(idle.first);
+		return true;
+	}
+
+	bool popIdle(IdleConnection &idle) {
+		if (!idle_connection_.pop(idle)) {
+			return false;
+		}
+		++busy_count_;
+		--idle_count_;
+		return true;
+	}
+
+	void initPool(const PoolOptions &options) {
+		auto start = std::chrono::steady_clock::now();
+		min_idle_ = std::min(options.min_idle, max_count_.load());
+		auto warmup_count = options.warmup == WarmupMode::kLazy ? min_idle_ : max_count_.load();
+		// warm-up connections count against max_count_ from the start, so early borrowers wait for
+		// them instead of starting connects of their own
+		total_count_ += warmup_count;
+		if (options.warmup == WarmupMode::kBackground) {
+			warmup_thread_ = std::thread([this, start, warmup_count, options] {
+				// nobody is left to rethrow to; borrowers connect what the warm-up did not
+				if (warmUp(warmup_count, options.warmup_concurrency)) {
+					warmup_failed_ = true;
+				} else {
+					recordStartup(start);
+				}
+			});
+		} else {
+			auto error = warmUp(warmup_count, options.warmup_concurrency);
+			if (error) {
+				std::rethrow_exception(error);
+			}
+			recordStartup(start);
+		}
+
+		evict_timer_ = scheduleEviction();
+	}
+
+	uint64_t scheduleEviction() {
+		return TimerService::instance().add(nextEviction(), [this] {
+			maintain(kEvict);
+			return nextEviction();
+		});
+	}
+
+	std::chrono::steady_clock::time_point nextEviction() const {
+		return std::chrono::steady_clock::now() + std::chrono::milliseconds(idle_connection_.tick());
+	}
+
+	// Runs on the maintenance thread once per wheel tick. Takes back thread cache entries unused
+	// for 5s, then closes idle connections past max_idle_time_, oldest first, while more than
+	// min_idle_ (at least one) remain. Neither step takes mutex_, and connections are closed last.
+	void evictIdle() {
+		auto now = Clock::now();
+		reclaimThreadCaches([now](const IdleConnection &idle) { return now - idle.second >= 5000; });
+		std::vector<IdleConnection> expired;
+		idle_connection_.expire(now - max_idle_time_ * 1000LL, [this, &expired](IdleConnection &idle) {
+			if (total_count_ <= std::max(min_idle_, 1)) {
+				return false;
+			}
+			--idle_count_;
+			--total_count_;
+			expired.push_back(std::move(idle));
+			return true;
+		});
+		metrics_.add(PoolCounter::kEvictions, expired.size());
+		metrics_.add(PoolCounter::kDestroys, expired.size());
+		// kept entries went back on the wheel and evictions freed capacity
+		if (waiting_ > 0) {
+			notifyWaiters();
+		}
+		expired.clear();
+	}
+
+	// Made by a replaced factory, or past its max lifetime, cut by its own share of lifetime_jitter_
+	// so that connections made together do not all age at once.
+	bool stale(const std::shared_ptr<Conn> &conn, int64_t now) {
+		auto lifetime = max_lifetime_.load(std::memory_order_relaxed);
+		auto generation = generation_.load(std::memory_order_relaxed);
+		if (lifetime <= 0 && generation == 0) {
+			return false;
+		}
+		auto deleter = deleterOf(conn);
+		return deleter->generation != generation || (lifetime > 0 && now - deleter->created >=
+				lifetime - static_cast<int64_t>(lifetime_jitter_ * deleter->jitter));
+	}
+
+	// On release: true if conn's successor is open, so it must close. A stale one without one
+	// stays in use until its own is open.
+	bool retireStale(const std::shared_ptr<Conn> &conn) {
+		if (renewed_->load(std::memory_order_relaxed) > 0 && deleterOf(conn)->renewal == kRenewed) {
+			return true;
+		}
+		if (stale(conn, Clock::now())) {
+			renew(conn);
+		}
+		return false;
+	}
+
+	// Starts a connect for the successor of stale conn, held by the caller, unless one was started.
+	void renew(const std::shared_ptr<Conn> &conn) {
+		auto deleter = deleterOf(conn);
+		if (deleter->renewal == kNotRenewed) {
+			std::lock_guard<Mutex> guard(mutex_);
+			if (requestCreate(conn) != nullptr) {
+				deleter->renewal = kRenewing;
+			}
+		}
+		// conn goes back idle stale, so the next renewStale pass must look for it
+		if (!draining_.load(std::memory_order_relaxed)) {
+			draining_ = true;
+		}
+	}
+
+	// Runs on the maintenance thread while connections may be aged or were made by a replaced
+	// factory: closes the idle connections whose successors are open and starts successors for the
+	// other stale ones.
+	void renewStale() {
+		if (max_lifetime_ > 0 || draining_.exchange(false)) {
+			auto now = Clock::now();
+			reclaimThreadCaches([this, now](const IdleConnection &idle) { return stale(idle.first, now); });
+			std::vector<IdleConnection> retired;
+			bool found = false;
+			idle_connection_.sweep(now, validation_batch_,
+								   [this, now, &retired, &found](std::vector<IdleConnection> &batch) {
+				for (auto iter = batch.begin(); iter != batch.end();) {
+					if (deleterOf(iter->first)->renewal == kRenewed) {
+						retired.push_back(std::move(*iter));
+						iter = batch.erase(iter);
+						continue;
+					}
+					if (stale(iter->first, now)) {
+						found = true;
+						renew(iter->first);
+					}
+					++iter;
+				}
+			});
+			if (found) {
+				draining_ = true;
+			}
+			auto count = static_cast<int>(retired.size());
+			idle_count_ -= count;
+			total_count_ -= count;
+			metrics_.add(PoolCounter::kRenewals, count);
+			metrics_.add(PoolCounter::kDestroys, count);
+			if (waiting_ > 0) {
+				notifyWaiters();
+			}
+		}
+	}
+
+	// Called with mutex_ held.
+	void startRenewing() {
+		if (renew_timer_ == 0) {
+			renew_timer_ = TimerService::instance().add(std::chrono::steady_clock::now() + renewInterval(), [this] {
+				maintain(kRenew);
+				return std::chrono::steady_clock::now() + renewInterval();
+			});
+		}
+	}
+
+	std::chrono::milliseconds renewInterval() const {
+		return std::chrono::milliseconds(std::max<int64_t>(max_lifetime_ / kWheelSpan, 1000));
+	}
+
+	// Runs on the maintenance thread: pings the connections idle for validation_interval_ seconds
+	// or more, validation_batch_ at a time and off the borrow path, and starts replacements for the
+	// dead ones so borrowers find live connections waiting.
+	void validateIdle() {
+		auto interval = validation_interval_.load();
+		if (interval > 0) {
+			int dead = 0;
+			idle_connection_.sweep(Clock::now() - interval * 1000LL, validation_batch_,
+								   [this, &dead](std::vector<IdleConnection> &batch) {
+				auto alive = partitionValid(batch, typename Hooks::has_check_valid_batch());
+				auto count = static_cast<int>(batch.end() - alive);
+				idle_count_ -= count;
+				total_count_ -= count;
+				metrics_.add(PoolCounter::kDestroys, count);
+				dead += count;
+				batch.erase(alive, batch.end());
+			});
+			if (dead > 0) {
+				std::lock_guard<Mutex> guard(mutex_);
+				for (int i = 0; i < dead; ++i) {
+					if (requestCreate() == nullptr) {
+						break;
+					}
+				}
+			}
+			if (waiting_ > 0) {
+				notifyWaiters();
+			}
+		}
+	}
+
+	// Periodic work, run on the pool's maintenance thread. The timer jobs only raise these bits, so
+	// a slow ping or close never holds up the process-wide timer thread and the clock it drives.
+	enum Maintenance {
+		kEvict = 1, kValidate = 2, kRenew = 4, kAutoscale = 8, kClose = 16
+	};
+
+	// Queues task, which runs once however often it is queued meanwhile.
+	void maintain(Maintenance task) {
+		std::lock_guard<Mutex> guard(mutex_);
+		if (stopping_) {
+			return;
+		}
+		maintenance_ |= task;
+		wakeMaintainer();
+	}
+
+	// Called with mutex_ held.
+	void wakeMaintainer() {
+		if (maintenance_driver_) {
+			maintenance_driver_();
+			return;
+		}
+		if (!maintainer_.joinable()) {
+			maintainer_ = std::thread([this] { runMaintainer(); });
+		}
+		maintain_cv_.notify_one();
+	}
+
+	void runMaintainer() {
+		std::unique_lock<Mutex> lock(mutex_);
+		while (true) {
+			maintain_cv_.wait(lock, [this] { return stopping_ || maintenance_ != 0; });
+			if (stopping_) {
+				return;
+			}
+			lock.unlock();
+			runMaintenance();
+			lock.lock();
+		}
+	}
+
+	// Creates count already reserved connections on up to concurrency threads, including this
+	// one, each taking one at a time or, with createConnections, an equal share at once. Stops at
+	// the first failure and gives back the reservations it did not use.
+	std::exception_ptr warmUp(int count, int concurrency) {
+		std::atomic<int> remaining{count};
+		std::exception_ptr error;
+		std::mutex error_mutex;
+		auto chunk = Hooks::has_create_connections::value ? std::max(count / std::max(concurrency, 1), 1) : 1;
+		auto worker = [this, chunk, &remaining, &error, &error_mutex] {
+			int claimed;
+			while (!stopping_ && (claimed = std::min(chunk, remaining.fetch_sub(chunk))) > 0) {
+				std::vector<std::shared_ptr<Conn>> conns;
+				std::exception_ptr failure;
+				try {
+					createConnections(conns, claimed);
+				} catch (...) {
+					failure = std::current_exception();
+				}
+				for (auto &conn : conns) {
+					++idle_count_;
+					idle_connection_.push({std::move(conn), Clock::now()});
+				}
+				if (failure) {
+					{
+						std::lock_guard<std::mutex> guard(error_mutex);
+						if (!error) {
+							error = failure;
+						}
+					}
+					total_count_ -= claimed - static_cast<int>(conns.size()) + std::max(remaining.exchange(0), 0);
+					notifyWaiters();
+					return;
+				}
+				if (waiting_ > 0) {
+					notifyWaiters();
+				}
+			}
+		};
+
+		std::vector<std::thread> workers;
+		for (int i = 1; i < std::min(concurrency, count); ++i) {
+			workers.emplace_back(worker);
+		}
+		worker();
+		for (auto &thread : workers) {
+			thread.join();
+		}
+		// stopped by the destructor before every reservation was used
+		auto unused = remaining.exchange(0);
+		if (unused > 0) {
+			total_count_ -= unused;
+		}
+		return error;
+	}
+
+	void recordStartup(std::chrono::steady_clock::time_point start) {
+		startup_time_ = std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::steady_clock::now() - start).count();
+	}
+
+private:
+	// read and replaced with std::atomic_load and std::atomic_store
+	std::shared_ptr<ConnFactoryType> conn_factory_;
+public:
+	// The factory new connections come from; see replaceFactory.
+	std::shared_ptr<ConnFactory> getConnFactory() const {
+		return std::atomic_load(&conn_factory_);
+	}
+
+	static Conn *connectionOf(const HandleType &conn) {
+		return conn.get();
+	}
+
+	// checkValid through the factory that made conn, which replaceFactory may have replaced since.
+	bool checkValid(const HandleType &conn) {
+		auto start = metrics_.now();
+		auto valid = factoryOf(conn)->checkValid(conn.get());
+		metrics_.record(PoolLatency::kCheckValidTime, start);
+		return valid;
+	}
+
+	int getIdleCount() {
+		return idle_count_ + cachedCount();
+	}
+
+	PoolStats getStats() {
+		PoolStats stats;
+		auto cached = cachedCount();
+		{
+			std::lock_guard<Mutex> guard(mutex_);
+			stats.max_count = max_count_;
+			stats.idle_count = idle_count_ + cached;
+			stats.busy_count = busy_count_ - cached;
+			stats.pending_count = total_count_ - idle_count_ - busy_count_;
+			stats.waiting_count = waiting_;
+		}
+		auto startup_time = startup_time_.load();
+		stats.warmed_up = startup_time >= 0;
+		stats.startup_time = std::chrono::milliseconds(stats.warmed_up ? startup_time : 0);
+		stats.warmup_failed = warmup_failed_;
+		return stats;
+	}
+
+	// Counters and latency histograms since construction; all zero without kMetrics.
+	MetricsSnapshot snapshot() const {
+		return metrics_.snapshot();
+	}
+
+	int getBusyCount() {
+		return busy_count_ - cachedCount();
+	}
+
+	// Each thread keeps up to size released connections for itself; 0 disables the thread caches.
+	void setThreadCacheSize(int size) {
+		thread_cache_size_ = size;
+		if (size <= 0) {
+			reclaimThreadCaches([](const IdleConnection &) { return true; });
+		}
+	}
+
+private:
+	int cachedCount() {
+		int cached = 0;
+		for (auto &magazine : threadMagazines()) {
+			cached += magazine->size();
+		}
+		return cached;
+	}
+
+private:
+	typename Policy::template IdleContainer<std::shared_ptr<Conn>> idle_connection_{kWheelTick};
+	std::atomic<int> max_count_{20};
+	std::atomic<int> idle_count_{0};
+	std::atomic<int> busy_count_{0};
+	std::atomic<int> total_count_{0};
+	std::atomic<int> waiting_{0};
+	std::deque<std::shared_ptr<Waiter>> waiters_;
+	std::deque<std::shared_ptr<PendingCreate>> create_queue_;
+	std::vector<std::thread> creators_;
+	int create_concurrency_{4};
+	int pending_creates_{0};
+	int idle_creators_{0};
+	std::atomic<bool> stopping_{false};
+	std::thread warmup_thread_;
+	int min_idle_{0};
+	// -1 until the warm-up target has been reached
+	std::atomic<long long> startup_time_{-1};
+	// a background warm-up stopped at a failed connect
+	std::atomic<bool> warmup_failed_{false};
+	ConditionVariable create_cv_;
+	// started by the first timer job that fires, unless a maintenance driver runs the work
+	std::thread maintainer_;
+	std::function<void()> maintenance_driver_;
+	int maintenance_{0};
+	// closed by the maintenance thread, or by the destructor if it stops first
+	std::vector<IdleConnection> closing_;
+	ConditionVariable maintain_cv_;
+	std::atomic<int> thread_cache_size_{0};
+	const uint64_t pool_id_{nextThreadCacheOwnerId()};
+	std::vector<std::shared_ptr<Magazine>> magazines_;
+	int timeout_{3};
+	std::atomic<int> max_idle_time_{300};
+	uint64_t evict_timer_{0};
+	std::atomic<int> validation_interval_{0};
+	std::atomic<int> validation_batch_{8};
+	std::atomic<int> validate_on_borrow_{-1};
+	uint64_t health_timer_{0};
+	PoolMetrics<kMetrics> metrics_;
+	std::unique_ptr<AutoscaleController> autoscale_;
+	ScaleListener scale_listener_;
+	uint64_t autoscale_timer_{0};
+	std::atomic<long long> wait_total_us_{0};
+	std::atomic<long long> wait_count_{0};
+	std::atomic<int> reserved_count_{0};
+	// Priority as int; kLow means nothing is reserved
+	std::atomic<int> reserved_priority_{0};
+	std::atomic<int> fail_fast_below_{0};
+	// read and replaced with std::atomic_load and std::atomic_store
+	std::shared_ptr<CreationGovernor> governor_;
+	// in milliseconds; 0 turns max lifetime off
+	std::atomic<int64_t> max_lifetime_{0};
+	std::atomic<int64_t> lifetime_jitter_{0};
+	// stale connections whose successors are open, counted down by their deleters
+	std::shared_ptr<std::atomic<int>> renewed_{std::make_shared<std::atomic<int>>(0)};
+	uint64_t renew_timer_{0};
+	// bumped by replaceFactory; connections of older generations are stale
+	std::atomic<uint64_t> generation_{0};
+	// stale connections may sit idle, where only renewStale finds them
+	std::atomic<bool> draining_{false};
+	Mutex coalesce_mutex_;
+	ConditionVariable coalesce_cv_;
+	std::deque<CoalescedOperation *> coalesced_;
+	// a thread is running the coalesced operations
+	bool coalescing_{false};
+public:
+	// Also sets the eviction tick, so connections close within about 1/60 of the limit after expiring.
+	void setMaxIdleTime(int max_idle_time) {
+		max_idle_time_ = max_idle_time;
+		idle_connection_.setTick(max_idle_time * 1000 / kWheelSpan);
+		// the running timer would wait out the old tick before the first eviction at the new one
+		auto timer = scheduleEviction();
+		{
+			std::lock_guard<Mutex> guard(mutex_);
+			std::swap(timer, evict_timer_);
+		}
+		TimerService::instance().remove(timer);
+	}
+
+	// Pings connections idle for interval seconds or more in the background, batch_size at a time,
+	// once per interval, and replaces the dead ones. 0 turns it off.
+	void setValidationInterval(int interval, int batch_size = 8) {
+		validation_batch_ = batch_size > 0 ? batch_size : 1;
+		validation_interval_ = interval > 0 ? interval : 0;
+		std::lock_guard<Mutex> guard(mutex_);
+		if (health_timer_ == 0 && validation_interval_ > 0) {
+			health_timer_ = TimerService::instance().add(
+					std::chrono::steady_clock::now() + std::chrono::seconds(validation_interval_), [this] {
+						maintain(kValidate);
+						auto interval = validation_interval_.load();
+						return std::chrono::steady_clock::now() + std::chrono::seconds(interval > 0 ? interval : 1);
+					});
+		}
+	}
+
+	// Also pings a connection on borrow when it has been idle for idle_ms or more; -1 turns it off.
+	void setValidateOnBorrow(int idle_ms) {
+		validate_on_borrow_ = idle_ms;
+	}
+
+	// Resizes the pool between options.min_count and options.max_count from then on: grows when
+	// borrowers queue or wait, shrinks when utilization stays low. listener sees every change,
+	// on the pool's maintenance thread. Calling it again replaces the options and the listener.
+	void enableAutoscale(const AutoscaleOptions &options, ScaleListener listener = nullptr) {
+		std::lock_guard<Mutex> guard(mutex_);
+		autoscale_.reset(new AutoscaleController(options));
+		scale_listener_ = std::move(listener);
+		if (autoscale_timer_ == 0) {
+			autoscale_timer_ = TimerService::instance().add(std::chrono::steady_clock::now() + options.interval, [this] {
+				maintain(kAutoscale);
+				std::lock_guard<Mutex> guard(mutex_);
+				return std::chrono::steady_clock::now() + autoscale_->options().interval;
+			});
+		}
+	}
+
+	// Keeps the last count connections of max count for borrowers of priority or higher, so lower
+	// ones cannot take the whole pool. 0 turns it off.
+	void setReservedCount(int count, Priority priority = Priority::kHigh) {
+		{
+			std::lock_guard<Mutex> guard(mutex_);
+			reserved_count_ = count > 0 ? count : 0;
+			reserved_priority_ = count > 0 ? static_cast<int>(priority) : 0;
+		}
+		// a smaller reservation may admit queued borrowers
+		if (waiting_ > 0) {
+			notifyWaiters();
+		}
+	}
+
+	// Borrowers below priority throw PoolExhaustedError rather than queue when the pool is full,
+	// or its free connections are reserved for others. Priority::kLow turns it off.
+	void setFailFast(Priority below) {
+		fail_fast_below_ = static_cast<int>(below);
+	}
+
+	// Every connect, recoverConnection included, then waits for governor's rate and in-flight
+	// limits, and borrowers fail fast with BackendDownError while it holds the backend for down.
+	// Pools connecting to the same backend may share one governor; nullptr removes it.
+	void setCreationGovernor(std::shared_ptr<CreationGovernor> governor) {
+		std::atomic_store(&governor_, std::move(governor));
+	}
+
+	// Replaces connections after max_lifetime seconds, each cut short by a random share of up to
+	// jitter of it. The successor connects first and the old connection closes once it is open:
+	// right away if idle, or on release if busy. 0 turns it off.
+	void setMaxLifetime(int max_lifetime, double jitter = 0.1) {
+		lifetime_jitter_ = static_cast<int64_t>(max_lifetime * 1000.0 * std::min(std::max(jitter, 0.0), 1.0));
+		max_lifetime_ = max_lifetime > 0 ? max_lifetime * 1000LL : 0;
+		if (max_lifetime_ > 0) {
+			std::lock_guard<Mutex> guard(mutex_);
+			startRenewing();
+		}
+	}
+
+	// Connects with conn_factory from now on, to rotate credentials or move to a new primary
+	// without rebuilding the pool. The old factory's connections are replaced like aged ones, up to
+	// create concurrency at a time: idle ones close as soon as their successors are open, busy ones
+	// on release, and borrowers keep getting them until then, so they never wait for a refill.
+	void replaceFactory(std::shared_ptr<ConnFactoryType> conn_factory) {
+		{
+			std::lock_guard<Mutex> guard(mutex_);
+			// a connect reads the generation before the factory, so it never tags an old
+			// factory's connection as new
+			std::atomic_store(&conn_factory_, std::move(conn_factory));
+			++generation_;
+			draining_ = true;
+			startRenewing();
+		}
+		// start the first successors now rather than on the next timer pass, on the maintenance
+		// thread, as only one thread may sweep the idle connections at a time
+		maintain(kRenew);
+	}
+
+	// How many connects may run at once on the pool's creator threads.
+	void setCreateConcurrency(int create_concurrency) {
+		std::lock_guard<Mutex> guard(mutex_);
+		create_concurrency_ = create_concurrency > 0 ? create_concurrency : 1;
+	}
+
+	// Lets one thread maintain many pools: from now on wake is called, under the pool lock, when
+	// there is periodic work, and its owner calls runMaintenance() on its own thread instead of the
+	// pool starting one. wake must not call into the pool. Has no effect once the pool's own
+	// maintenance thread is running; nullptr hands the work back to the pool.
+	void setMaintenanceDriver(std::function<void()> wake) {
+		std::lock_guard<Mutex> guard(mutex_);
+		if (maintainer_.joinable() && wake) {
+			return;
+		}
+		maintenance_driver_ = std::move(wake);
+		if (!stopping_ && maintenance_ != 0) {
+			wakeMaintainer();
+		}
+	}
+
+	// Runs the periodic work queued since the last run. The pool's maintenance thread calls it, or
+	// the maintenance driver's owner, never two threads at once.
+	void runMaintenance() {
+		int tasks;
+		std::vector<IdleConnection> closing;
+		{
+			std::lock_guard<Mutex> guard(mutex_);
+			if (stopping_) {
+				return;
+			}
+			tasks = maintenance_;
+			maintenance_ = 0;
+			closing.swap(closing_);
+		}
+		closing.clear();
+		if (tasks & kEvict) {
+			evictIdle();
+		}
+		if (tasks & kValidate) {
+			validateIdle();
+		}
+		if (tasks & kRenew) {
+			renewStale();
+		}
+		if (tasks & kAutoscale) {
+			autoscale();
+		}
+	}
+
+private:
+	Mutex mutex_;
+};
+};
+
+#endif //CONNECTIONPOOL_CONNECTION_POOL_HPP
+
+/*** End of inlined file: connection_pool.hpp ***/
+
+namespace modern_utils {
+
+template<typename ConnectionPool>
+class ConnGuard {
+public:
+	using ConnectionType = typename ConnectionPool::ConnectionType;
+	using ConnFactoryType = typename ConnectionPool::ConnFactoryType;
+public:
+	explicit ConnGuard(const std::shared_ptr<ConnectionPool> &pool) : pool_(pool) {
+		auto _pool = pool_.lock();
+		if(_pool) {
+			conn_ = _pool->getConnection();
+		}
+	}
+
+	explicit ConnGuard(std::shared_ptr<ConnectionPool> &&pool) : pool_(
+			std::move(pool)) {
+		auto _pool = pool_.lock();
+		if(_pool) {
+			conn_ = _pool->getConnection();
+		}
+	}
+
+	ConnGuard(const ConnGuard &rhs) = delete;
+
+	ConnGuard &operator=(const ConnGuard &rhs) = delete;
+
+	virtual ~ConnGuard() {
+		auto _pool = pool_.lock();
+		if(_pool && conn_ != nullptr) {
+			_pool->releaseConnecion(conn_);
+		}
+	}
+
+	auto operator->() {
+		if (isReady()) {
+			return conn_;
+		} else {
+			throw std::runtime_error("connection not initialized");
+		}
+
+		return decltype(conn_)();
+	}
+
+	bool isReady() {
+		return conn_ != nullptr;
+	}
+
+	virtual bool checkValid() {
+		auto _pool = pool_.lock();
+		if(_pool && conn_ != nullptr) {
+			return _pool->checkValid(conn_);
+		}
+
+		return false;
+	}
+
+	auto get() {
+		return conn_.get();
+	}
+
+	void recover() {
+		auto _pool = pool_.lock();
+		if(_pool && conn_ != nullptr) {
+			_pool->recoverConnection(conn_);
+		} else {
+			conn_ = nullptr;
+		}
+	}
+private:
+	virtual void log_error(const char *error) { std::cout << error << std::endl; };
+private:
+	std::shared_ptr<ConnectionType> conn_;
+	std::weak_ptr<ConnectionPool> pool_;
+};
+};
+
+#endif //CONNECTIONPOOL_CONNECTION_HPP
+
+/*** End of inlined file: conn_guard.hpp ***/
+
+namespace modern_utils {
+// kMetrics = true compiles in the counters and latency histograms, whose clock reads cost about as
+// much as a borrow and release themselves; Policy picks the lock, idle store, reuse order and
+// clock, see PoolPolicy.
+template<typename Conn, typename ConnFactory, bool kMetrics = false, typename Policy = DefaultPoolPolicy>
+class ConnectionPool {
+private:
+	static_assert(is_acceptable<Conn, ConnFactory>::diagnose());
+	using Mutex = typename Policy::LockType;
+	using ConditionVariable = typename Policy::ConditionType;
+	using Clock = typename Policy::ClockType;
+	using Hooks = factory_hooks<Conn, ConnFactory>;
+public:
+	using ConnectionType = Conn;
+	using ConnFactoryType = ConnFactory;
+	using HandleType = std::shared_ptr<Conn>;
+	// Receives either a connection or the reason none could be obtained; must not throw.
+	using AcquireCallback = std::function<void(std::shared_ptr<Conn>, std::exception_ptr)>;
+public:
+	explicit ConnectionPool(const std::shared_ptr<ConnFactoryType> &conn_factory, int max_count = 20)
+			: ConnectionPool(conn_factory, PoolOptions(max_count)) {
+	}
+
+
+	explicit ConnectionPool(std::shared_ptr<ConnFactoryType> &&conn_factory, int max_count = 20)
+			: ConnectionPool(std::move(conn_factory), PoolOptions(max_count)) {
+	}
+
+	ConnectionPool(std::shared_ptr<ConnFactoryType> conn_factory, const PoolOptions &options) : conn_factory_(
+			std::move(conn_factory)), max_count_(options.max_count) {
+		initPool(options);
+	}
+
+	~ConnectionPool() {
+		TimerService::instance().remove(evict_timer_);
+		if (health_timer_ != 0) {
+			TimerService::instance().remove(health_timer_);
+		}
+		if (autoscale_timer_ != 0) {
+			TimerService::instance().remove(autoscale_timer_);
+		}
+		if (renew_timer_ != 0) {
+			TimerService::instance().remove(renew_timer_);
+		}
+		std::vector<std::thread> creators;
+		{
+			std::lock_guard<Mutex> guard(mutex_);
+			stopping_ = true;
+			creators.swap(creators_);
+		}
+		create_cv_.notify_all();
+		maintain_cv_.notify_all();
+		if (maintainer_.joinable()) {
+			maintainer_.join();
+		}
+		if (warmup_thread_.joinable()) {
+			warmup_thread_.join();
+		}
+		for (auto &creator : creators) {
+			creator.join();
+		}
+
+		std::vector<IdleConnection> cached;
+		for (auto &magazine : threadMagazines()) {
+			magazine->detach(cached);
+		}
+
+		std::unique_lock<Mutex> lock(mutex_);
+		IdleConnection idle;
+		while (idle_connection_.pop(idle)) {
+		}
+		auto error = std::make_exception_ptr(std::runtime_error("connection pool destroyed"));
+		while (!waiters_.empty()) {
+			serve(lock, popWaiter(), nullptr, error);
+		}
+	}
+
+	ConnectionPool(const ConnectionPool &rhs) = delete;
+
+	ConnectionPool &operator=(const ConnectionPool &rhs) = delete;
+
+	// Connects up to count at once; above it, idle connections close now and busy ones on release.
+	void setConnectionCount(int count) {
+		resize(count, true);
+	}
+
+	// Like setConnectionCount but never connects; queued borrowers connect into new room.
+	void setMaxCount(int count) {
+		resize(count, false);
+	}
+
+	auto getConnection() {
+		return getConnection(std::chrono::seconds(timeout_));
+	}
+
+	// Never waits or connects: an idle connection, or false.
+	bool tryGetConnection(std::shared_ptr<Conn> &conn) {
+		return tryBorrow(conn);
+	}
+
+	std::shared_ptr<Conn> getConnection(std::chrono::milliseconds timeout, Priority priority = Priority::kNormal) {
+		return getConnection(std::chrono::steady_clock::now() + timeout, priority);
+	}
+
+	// Blocked callers are served by priority and then strictly in arrival order: each waits on its
+	// own condition variable and a released connection is handed to the first one directly.
+	// Borrowers below the priority set with setFailFast throw PoolExhaustedError instead of
+	// queueing when the pool is full.
+	std::shared_ptr<Conn> getConnection(std::chrono::steady_clock::time_point deadline,
+										Priority priority = Priority::kNormal) {
+		std::shared_ptr<Conn> conn;
+		if (tryBorrow(conn, priority)) {
+			return conn;
+		}
+
+		// slow path: the idle stack is empty, so create a connection or block until one is released.
+		// Announce the waiter before reclaiming the thread caches so no releaser parks a connection
+		// in its cache unseen.
+		++waiting_;
+		if (thread_cache_size_ > 0) {
+			reclaimThreadCaches([](const IdleConnection &) { return true; });
+		}
+		// A new connection is made by a creator thread and handed out like a released one, so a
+		// release during the connect serves this caller and the new connection goes to the next.
+		auto start = metrics_.now();
+		std::unique_lock<Mutex> lock(mutex_);
+		auto admitted = admits(priority, 0);
+		if (admitted && popIdle(conn)) {
+			--waiting_;
+			recordBorrow(conn, start);
+			return conn;
+		}
+		if (static_cast<int>(priority) < fail_fast_below_ && (!admitted || counted() >= max_count_)) {
+			--waiting_;
+			throw PoolExhaustedError();
+		}
+		if (refusedByBackend(admitted)) {
+			--waiting_;
+			throw BackendDownError();
+		}
+		auto waiter = std::make_shared<Waiter>();
+		waiter->priority = priority;
+		waiter->request = admitted ? requestCreate() : nullptr;
+		enqueue(waiter);
+		while (!waiter->ready) {
+			if (waiter->cv.wait_until(lock, deadline) == std::cv_status::timeout && !waiter->ready) {
+				waiters_.erase(std::find(waiters_.begin(), waiters_.end(), waiter));
+				--waiting_;
+				recordWait(waiter->since);
+				metrics_.add(PoolCounter::kTimeouts);
+				throw AcquireTimeoutError();
+			}
+		}
+		if (waiter->error) {
+			std::rethrow_exception(waiter->error);
+		}
+		return std::move(waiter->conn);
+	}
+
+	// Never blocks and never connects on this thread. The callback runs right away here only if a
+	// connection is idle or the borrow fails at once. Otherwise it is queued and runs on whichever
+	// thread serves it: a creator thread with the connection it made or the connect error, a
+	// thread releasing a connection, the pool's maintenance thread after it frees room, a thread
+	// resizing the pool or warming it up, or the destructor with an error. Keep it short.
+	void acquireAsync(AcquireCallback callback) {
+		std::shared_ptr<Conn> conn;
+		try {
+			if (!acquireOrEnqueue(conn, callback)) {
+				return;
+			}
+		} catch (...) {
+			callback(nullptr, std::current_exception());
+			return;
+		}
+		callback(std::move(conn), nullptr);
+	}
+
+	ConnBatchGuard<ConnectionPool> acquireMany(int n, BatchGrant grant = BatchGrant::kAll) {
+		return acquireMany(n, std::chrono::steady_clock::now() + std::chrono::seconds(timeout_), grant);
+	}
+
+	ConnBatchGuard<ConnectionPool> acquireMany(int n, std::chrono::milliseconds timeout,
+											   BatchGrant grant = BatchGrant::kAll) {
+		return acquireMany(n, std::chrono::steady_clock::now() + timeout, grant);
+	}
+
+	// Borrows n connections for a fan-out under one lock. With kAll a caller that cannot have all
+	// of them queues as one waiter, and connections released meanwhile are collected for it inside
+	// the pool until it has n; it never holds part of a set, so callers cannot deadlock each other
+	// on partial sets. With kPartial it gets what is idle, waiting only while that is nothing.
+	ConnBatchGuard<ConnectionPool> acquireMany(int n, std::chrono::steady_clock::time_point deadline,
+											   BatchGrant grant = BatchGrant::kAll) {
+		std::vector<std::shared_ptr<Conn>> conns;
+		if (n <= 0) {
+			return ConnBatchGuard<ConnectionPool>(*this, std::move(conns));
+		}
+		++waiting_;
+		if (thread_cache_size_ > 0) {
+			reclaimThreadCaches([](const IdleConnection &) { return true; });
+		}
+		auto start = metrics_.now();
+		std::unique_lock<Mutex> lock(mutex_);
+		std::shared_ptr<Conn> conn;
+		while (static_cast<int>(conns.size()) < n && admits(Priority::kNormal, 0) && popIdle(conn)) {
+			conns.push_back(std::move(conn));
+		}
+		if (static_cast<int>(conns.size()) == n || (grant == BatchGrant::kPartial && !conns.empty())) {
+			--waiting_;
+			for (auto &borrowed : conns) {
+				recordBorrow(borrowed, start);
+			}
+			return ConnBatchGuard<ConnectionPool>(*this, std::move(conns));
+		}
+		auto waiter = std::make_shared<Waiter>();
+		if (grant == BatchGrant::kAll) {
+			if (n > max_count_) {
+				--waiting_;
+				returnIdle(lock, conns);
+				throw std::runtime_error("acquireMany more than max count");
+			}
+			waiter->wanted = n;
+			waiter->batch = std::move(conns);
+		}
+		waiter->request = requestCreate();
+		enqueue(waiter);
+		for (int i = static_cast<int>(waiter->batch.size()) + 1; i < waiter->wanted; ++i) {
+			auto request = requestCreate();
+			if (request == nullptr) {
+				break;
+			}
+			waiter->batch_requests.push_back(std::move(request));
+		}
+		while (!waiter->ready) {
+			if (waiter->cv.wait_until(lock, deadline) == std::cv_status::timeout && !waiter->ready) {
+				waiters_.erase(std::find(waiters_.begin(), waiters_.end(), waiter));
+				--waiting_;
+				recordWait(waiter->since);
+				metrics_.add(PoolCounter::kTimeouts);
+				returnIdle(lock, waiter->batch);
+				throw AcquireTimeoutError();
+			}
+		}
+		if (waiter->error) {
+			std::rethrow_exception(waiter->error);
+		}
+		if (waiter->conn != nullptr) {
+			conns.push_back(std::move(waiter->conn));
+			// kPartial: top up from what is idle, unless that belongs to later waiters
+			while (waiters_.empty() && static_cast<int>(conns.size()) < n && admits(Priority::kNormal, 0) &&
+				   popIdle(conn)) {
+				recordBorrow(conn, waiter->since);
+				conns.push_back(std::move(conn));
+			}
+		} else {
+			conns = std::move(waiter->batch);
+		}
+		return ConnBatchGuard<ConnectionPool>(*this, std::move(conns));
+	}
+
+	std::future<std::shared_ptr<Conn>> acquireFuture() {
+		auto promise = std::make_shared<std::promise<std::shared_ptr<Conn>>>();
+		auto future = promise->get_future();
+		acquireAsync([promise](std::shared_ptr<Conn> conn, std::exception_ptr error) {
+			if (error) {
+				promise->set_exception(error);
+			} else {
+				promise->set_value(std::move(conn));
+			}
+		});
+		return future;
+	}
+
+	// Runs every op(Conn &) of ops back to back on one borrowed connection. When an op throws on a
+	// connection that then fails checkValid, the connection is recovered and the batch resumes from
+	// that op; any other exception stops the batch and is rethrown.
+	template<typename Range>
+	void withConnection(Range &&ops) {
+		auto conn = getConnection();
+		try {
+			for (auto &op : ops) {
+				runResuming(conn, op);
+			}
+		} catch (...) {
+			if (conn != nullptr) {
+				releaseConnecion(std::move(conn));
+			}
+			throw;
+		}
+		releaseConnecion(std::move(conn));
+	}
+
+	// Runs op(Conn &) and returns once it has run, or rethrows what it threw. Ops that threads submit
+	// at the same time share one borrow: the first thread runs them all, its own included, like
+	// withConnection, while the others wait.
+	void coalesce(std::function<void(Conn &)> op) {
+		CoalescedOperation operation(std::move(op));
+		std::unique_lock<Mutex> lock(coalesce_mutex_);
+		coalesced_.push_back(&operation);
+		coalesce_cv_.wait(lock, [this, &operation] { return operation.done || !coalescing_; });
+		if (!operation.done) {
+			coalescing_ = true;
+			runCoalesced(lock);
+		}
+		if (operation.error) {
+			std::rethrow_exception(operation.error);
+		}
+	}
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+	class AcquireAwaitable {
+	public:
+		explicit AcquireAwaitable(ConnectionPool &pool) : pool_(pool) {}
+
+		bool await_ready() {
+			return pool_.tryBorrow(conn_);
+		}
+
+		// The coroutine may be resumed on the releasing thread before this returns, so members
+		// must not be touched once the waiter is queued.
+		bool await_suspend(std::coroutine_handle<> handle) {
+			AcquireCallback resume = [this, handle](std::shared_ptr<Conn> conn, std::exception_ptr error) {
+				conn_ = std::move(conn);
+				error_ = error;
+				handle.resume();
+			};
+			try {
+				return !pool_.acquireOrEnqueue(conn_, resume);
+			} catch (...) {
+				error_ = std::current_exception();
+				return false;
+			}
+		}
+
+		std::shared_ptr<Conn> await_resume() {
+			if (error_) {
+				std::rethrow_exception(error_);
+			}
+			return std::move(conn_);
+		}
+
+	private:
+		ConnectionPool &pool_;
+		std::shared_ptr<Conn> conn_;
+		std::exception_ptr error_;
+	};
+
+	// co_await pool.acquire() suspends the coroutine, not the thread, while the pool is exhausted.
+	AcquireAwaitable acquire() {
+		return AcquireAwaitable(*this);
+	}
+#endif
+
+	// A new connection for a borrower to use in place of the dead one it holds and drops, which
+	// is counted closed. The in-place overload below also keeps the borrow's hold time.
+	auto recoverConnection() {
+		auto recovered = createConnection();
+		if (kMetrics) {
+			deleterOf(recovered)->borrowed = metrics_.now();
+		}
+		metrics_.add(PoolCounter::kRecoveries);
+		metrics_.add(PoolCounter::kDestroys);
+		return recovered;
+	}
+
+	void recoverConnection(std::shared_ptr<Conn> &conn) {
+		auto recovered = createConnection();
+		if (kMetrics && conn != nullptr) {
+			// the borrow goes on, so does its hold time
+			deleterOf(recovered)->borrowed = deleterOf(conn)->borrowed;
+		}
+		conn = std::move(recovered);
+		metrics_.add(PoolCounter::kRecoveries);
+		metrics_.add(PoolCounter::kDestroys);
+	}
+
+	void releaseConnecion(std::shared_ptr<Conn> conn, bool destroy = false) {
+		auto deleter = kMetrics ? deleterOf(conn) : nullptr;
+		if (deleter != nullptr) {
+			metrics_.record(PoolLatency::kHoldTime, deleter->borrowed);
+		}
+		if (destroy && reset(conn, typename Hooks::has_reset())) {
+			destroy = false;
+		}
+		if (!destroy && retireStale(conn)) {
+			destroy = true;
+			metrics_.add(PoolCounter::kRenewals);
+		}
+		if (counted() <= max_count_ && !destroy) {
+			if ((waiting_ > 0 && handOff(conn)) || pushThreadCache(conn)) {
+				return;
+			}
+			++idle_count_;
+			idle_connection_.push({std::move(conn), Clock::now()});
+			--busy_count_;
+		} else {
+			--busy_count_;
+			--total_count_;
+			metrics_.add(PoolCounter::kDestroys);
+		}
+
+		// waiting_ is checked after the push, and a waiter re-checks the stack after announcing
+		// itself, so either the waiter sees the connection or we see the waiter
+		if (waiting_ > 0) {
+			notifyWaiters();
+		}
+	}
+
+	// Gives back a set of connections under one lock; ConnBatchGuard calls it.
+	void releaseMany(std::vector<std::shared_ptr<Conn>> conns, bool destroy = false) {
+		std::vector<bool> retired;
+		for (auto &conn : conns) {
+			auto deleter = kMetrics ? deleterOf(conn) : nullptr;
+			if (deleter != nullptr) {
+				metrics_.record(PoolLatency::kHoldTime, deleter->borrowed);
+			}
+			retired.push_back(!destroy && retireStale(conn));
+		}
+		{
+			std::unique_lock<Mutex> lock(mutex_);
+			for (std::size_t i = 0; i < conns.size(); ++i) {
+				auto &conn = conns[i];
+				if (!retired[i] && counted() <= max_count_ &&
+					(!destroy || reset(conn, typename Hooks::has_reset()))) {
+					if (!waiters_.empty() && admits(waiters_.front()->priority, 1)) {
+						serveFront(lock, std::move(conn));
+						continue;
+					}
+					++idle_count_;
+					idle_connection_.push({std::move(conn), Clock::now()});
+					--busy_count_;
+				} else {
+					--busy_count_;
+					--total_count_;
+					metrics_.add(PoolCounter::kDestroys);
+					if (retired[i]) {
+						metrics_.add(PoolCounter::kRenewals);
+					}
+				}
+			}
+			// room freed by destroyed connections
+			serveWaiters(lock);
+		}
+		// the destroyed connections close here, outside the lock
+	}
+
+private:
+	// stamped with Clock, in milliseconds
+	using IdleConnection = std::pair<std::shared_ptr<Conn>, int64_t>;
+	// batches one coalescing thread runs before it hands the rest to a waiting one
+	static constexpr int kCoalesceRounds = 4;
+
+	struct CoalescedOperation {
+		explicit CoalescedOperation(std::function<void(Conn &)> op) : op(std::move(op)) {
+		}
+
+		std::function<void(Conn &)> op;
+		std::exception_ptr error;
+		bool done{false};
+	};
+
+	// Runs op on conn. If it throws and conn fails checkValid, recovers conn and runs op again on
+	// the new one; if even that fails, conn goes back destroyed and is left empty.
+	template<typename Operation>
+	void runResuming(std::shared_ptr<Conn> &conn, Operation &op) {
+		try {
+			op(*conn);
+			return;
+		} catch (...) {
+			if (checkValid(conn)) {
+				throw;
+			}
+		}
+		try {
+			recoverConnection(conn);
+		} catch (...) {
+			releaseConnecion(std::move(conn), true);
+			throw;
+		}
+		op(*conn);
+	}
+
+	// Runs the queued operations on one connection until none are left, or for kCoalesceRounds
+	// batches, then wakes a waiter to take over. Called with coalesce_mutex_ held through lock, and
+	// returns with it released.
+	void runCoalesced(std::unique_lock<Mutex> &lock) {
+		std::shared_ptr<Conn> conn;
+		for (int round = 0; round < kCoalesceRounds && !coalesced_.empty(); ++round) {
+			std::vector<CoalescedOperation *> batch(coalesced_.begin(), coalesced_.end());
+			coalesced_.clear();
+			lock.unlock();
+			std::exception_ptr borrow_error;
+			for (auto operation : batch) {
+				if (conn == nullptr && !borrow_error) {
+					try {
+						conn = getConnection();
+					} catch (...) {
+						borrow_error = std::current_exception();
+					}
+				}
+				if (conn == nullptr) {
+					operation->error = borrow_error;
+					continue;
+				}
+				try {
+					runResuming(conn, operation->op);
+				} catch (...) {
+					operation->error = std::current_exception();
+				}
+			}
+			lock.lock();
+			for (auto operation : batch) {
+				operation->done = true;
+			}
+			coalesce_cv_.notify_all();
+		}
+		coalescing_ = false;
+		// operations queued after the last batch wait for a new coalescing thread
+		coalesce_cv_.notify_all();
+		lock.unlock();
+		if (conn != nullptr) {
+			releaseConnecion(std::move(conn));
+		}
+	}
+	// max_idle_time_ is split into this many wheel ticks; the default 300s gives 5s ticks
+	static constexpr int kWheelSpan = 60;
+	static constexpr int kWheelTick = 300 * 1000 / kWheelSpan;
+
+	// Sets max_count_ and closes the idle connections above it on the maintenance thread, since
+	// shrinking may be driven by a timer job; with fill, also connects up to it.
+	void resize(int count, bool fill) {
+		reclaimThreadCaches([](const IdleConnection &) { return true; });
+		int create_count = 0;
+		int closed = 0;
+		{
+			std::lock_guard<Mutex> guard(mutex_);
+			max_count_ = count;
+			auto differ_count = max_count_ - counted();
+			if (differ_count > 0 && fill) {
+				// reserve the slots now, connect after unlocking
+				create_count = differ_count;
+				total_count_ += create_count;
+			} else if (differ_count < 0) {
+				IdleConnection idle;
+				for (; closed < -differ_count && idle_connection_.pop(idle); ++closed) {
+					--idle_count_;
+					--total_count_;
+					closing_.push_back(std::move(idle));
+				}
+			}
+		}
+		if (closed > 0) {
+			metrics_.add(PoolCounter::kDestroys, closed);
+			maintain(kClose);
+		}
+
+		std::vector<std::shared_ptr<Conn>> created;
+		std::exception_ptr error;
+		try {
+			createConnections(created, create_count);
+		} catch (...) {
+			error = std::current_exception();
+			total_count_ -= create_count - static_cast<int>(created.size());
+		}
+		for (auto &conn : created) {
+			++idle_count_;
+			idle_connection_.push({std::move(conn), Clock::now()});
+		}
+		// new connections, or room for queued borrowers to connect
+		if (waiting_ > 0) {
+			notifyWaiters();
+		}
+		if (error) {
+			std::rethrow_exception(error);
+		}
+	}
+
+	void recordWait(std::chrono::steady_clock::time_point since) {
+		wait_total_us_ += std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now() - since).count();
+		++wait_count_;
+	}
+
+	// Runs on the maintenance thread: one autoscale sample, applied through resize() without
+	// connecting, since queued borrowers start the connects they need.
+	void autoscale() {
+		auto wait_total = wait_total_us_.exchange(0);
+		auto wait_count = wait_count_.exchange(0);
+		ScaleEvent event;
+		event.average_wait = std::chrono::microseconds(wait_count > 0 ? wait_total / wait_count : 0);
+		event.waiting = waiting_;
+		auto busy = busy_count_ - cachedCount();
+		ScaleListener listener;
+		{
+			std::lock_guard<Mutex> guard(mutex_);
+			event.from = max_count_;
+			event.to = autoscale_->decide(event.from, busy, event.waiting, event.average_wait);
+			listener = scale_listener_;
+		}
+		if (event.to != event.from) {
+			event.direction = event.to > event.from ? ScaleDirection::kGrow : ScaleDirection::kShrink;
+			event.utilization = event.from > 0 ? static_cast<double>(busy) / event.from : 1.0;
+			resize(event.to, false);
+			if (listener) {
+				listener(event);
+			}
+		}
+	}
+
+	// Where replacing a stale connection is at: its successor was requested, then is open.
+	enum Renewal {
+		kNotRenewed, kRenewing, kRenewed
+	};
+
+	// Deleter of every pooled connection. It also keeps per-connection bookkeeping, reached from
+	// the handle through std::get_deleter, so no side table is needed.
+	struct ConnectionDeleter {
+		ConnectionDeleter(std::shared_ptr<ConnFactory> conn_factory, int64_t created, double jitter,
+						  uint64_t generation, std::shared_ptr<std::atomic<int>> renewed)
+				: conn_factory(std::move(conn_factory)), created(created), jitter(jitter),
+				  generation(generation), renewed(std::move(renewed)) {
+		}
+
+		ConnectionDeleter(const ConnectionDeleter &rhs)
+				: conn_factory(rhs.conn_factory), borrowed(rhs.borrowed), created(rhs.created),
+				  jitter(rhs.jitter), generation(rhs.generation), renewed(rhs.renewed),
+				  renewal(rhs.renewal.load()) {
+		}
+
+		void operator()(Conn *p) const {
+			// however it closes, its successor now counts in its place
+			if (renewal == kRenewed) {
+				--*renewed;
+			}
+			conn_factory->destroy(p);
+		}
+
+		std::shared_ptr<ConnFactory> conn_factory;
+		std::chrono::steady_clock::time_point borrowed;
+		// Clock time of the connect, and the share of lifetime_jitter_ its max lifetime is cut by
+		int64_t created;
+		double jitter;
+		// the generation_ of conn_factory, which is replaced along with the factory
+		uint64_t generation;
+		// the pool's count of kRenewed connections, which may outlive the pool
+		std::shared_ptr<std::atomic<int>> renewed;
+		// set by a creator thread while another thread may hold the connection
+		std::atomic<int> renewal{kNotRenewed};
+	};
+
+	static ConnectionDeleter *deleterOf(const std::shared_ptr<Conn> &conn) {
+		return std::get_deleter<ConnectionDeleter>(conn);
+	}
+
+	ConnectionDeleter newDeleter(std::shared_ptr<ConnFactory> conn_factory, uint64_t generation) {
+		thread_local std::minstd_rand random(std::random_device{}());
+		std::uniform_real_distribution<double> share(0, 1);
+		return ConnectionDeleter(std::move(conn_factory), Clock::now(), share(random), generation, renewed_);
+	}
+
+	static const std::shared_ptr<ConnFactory> &factoryOf(const std::shared_ptr<Conn> &conn) {
+		return deleterOf(conn)->conn_factory;
+	}
+
+	// Runs the connect create does under the creation governor, if there is one.
+	template<typename Create>
+	auto governed(int count, Create create) -> decltype(create()) {
+		auto governor = std::atomic_load(&governor_);
+		if (governor == nullptr) {
+			return create();
+		}
+		governor->begin(std::chrono::steady_clock::now() + std::chrono::seconds(timeout_), count);
+		try {
+			auto result = create();
+			governor->finish(true);
+			return result;
+		} catch (...) {
+			governor->finish(false);
+			throw;
+		}
+	}
+
+	bool backendDown() {
+		auto governor = std::atomic_load(&governor_);
+		return governor != nullptr && governor->down();
+	}
+
+	// Whether a borrower that found nothing idle needs a connect the down backend would refuse at
+	// once. One the pool cannot connect for anyway only waits for a release, and queues as usual.
+	// Called with mutex_ held.
+	bool refusedByBackend(bool admitted) {
+		return admitted && counted() < max_count_ && backendDown();
+	}
+
+	std::shared_ptr<Conn> createConnection() {
+		auto start = metrics_.now();
+		// a connection tagged with an older generation than its factory's is only replaced once more
+		auto generation = generation_.load();
+		auto factory = std::atomic_load(&conn_factory_);
+		std::shared_ptr<Conn> conn(governed(1, [&factory] { return factory->createConnection(); }),
+								   newDeleter(factory, generation));
+		metrics_.record(PoolLatency::kCreateTime, start);
+		metrics_.add(PoolCounter::kCreates);
+		return conn;
+	}
+
+	// Fills conns up to n new connections, one createConnection call at a time, or in as few
+	// createConnections calls as it takes when the factory has that hook. Throws on the first
+	// failure, leaving the connections made so far in conns.
+	void createConnections(std::vector<std::shared_ptr<Conn>> &conns, std::size_t n) {
+		while (conns.size() < n) {
+			createMore(conns, n - conns.size(), typename Hooks::has_create_connections());
+		}
+	}
+
+	void createMore(std::vector<std::shared_ptr<Conn>> &conns, std::size_t, std::false_type) {
+		conns.push_back(createConnection());
+	}
+
+	void createMore(std::vector<std::shared_ptr<Conn>> &conns, std::size_t n, std::true_type) {
+		auto start = metrics_.now();
+		auto count = static_cast<int>(n);
+		auto generation = generation_.load();
+		auto factory = std::atomic_load(&conn_factory_);
+		auto created = governed(count, [&factory, count] { return factory->createConnections(count); });
+		if (created.empty()) {
+			throw std::runtime_error("createConnections returned no connection");
+		}
+		auto elapsed = (metrics_.now() - start) / created.size();
+		for (std::size_t i = 0; i < created.size(); ++i) {
+			if (i >= n) {
+				factory->destroy(created[i]);
+				continue;
+			}
+			conns.emplace_back(created[i], newDeleter(factory, generation));
+			metrics_.record(PoolLatency::kCreateTime, elapsed);
+			metrics_.add(PoolCounter::kCreates);
+		}
+	}
+
+	bool reset(const std::shared_ptr<Conn> &, std::false_type) {
+		return false;
+	}
+
+	bool reset(const std::shared_ptr<Conn> &conn, std::true_type) {
+		return factoryOf(conn)->reset(conn.get());
+	}
+
+	bool isCheap(const std::shared_ptr<Conn> &, std::false_type) {
+		return false;
+	}
+
+	bool isCheap(const std::shared_ptr<Conn> &conn, std::true_type) {
+		return factoryOf(conn)->isCheap(conn.get());
+	}
+
+	// Moves the live connections of batch to its front and returns where they end.
+	typename std::vector<IdleConnection>::iterator partitionValid(std::vector<IdleConnection> &batch,
+																  std::false_type) {
+		return std::partition(batch.begin(), batch.end(), [this](const IdleConnection &idle) {
+			return checkValid(idle.first);
+		});
+	}
+
+	typename std::vector<IdleConnection>::iterator partitionValid(std::vector<IdleConnection> &batch,
+																  std::true_type) {
+		std::vector<Conn *> conns;
+		for (auto &idle : batch) {
+			conns.push_back(idle.first.get());
+		}
+		std::unique_ptr<bool[]> valid(new bool[conns.size()]());
+		auto start = metrics_.now();
+		// one call per run of connections made by the same factory
+		for (std::size_t begin = 0, end; begin < conns.size(); begin = end) {
+			auto &factory = factoryOf(batch[begin].first);
+			for (end = begin + 1; end < conns.size() && factoryOf(batch[end].first) == factory; ++end) {
+			}
+			factory->checkValidBatch(conns.data() + begin, end - begin, valid.get() + begin);
+		}
+		auto elapsed = (metrics_.now() - start) / std::max<std::size_t>(conns.size(), 1);
+		std::size_t live = 0;
+		for (std::size_t i = 0; i < batch.size(); ++i) {
+			metrics_.record(PoolLatency::kCheckValidTime, elapsed);
+			if (valid[i]) {
+				std::swap(batch[i], batch[live++]);
+			}
+		}
+		return batch.begin() + live;
+	}
+
+	// Counts a borrow handed to a caller who started asking at since; none means it did not wait.
+	void recordBorrow(const std::shared_ptr<Conn> &conn, std::chrono::steady_clock::time_point since = {}) {
+		if (kMetrics) {
+			auto now = metrics_.now();
+			deleterOf(conn)->borrowed = now;
+			metrics_.record(PoolLatency::kAcquireWait, since == decltype(since)() ? now - now : now - since);
+			metrics_.add(PoolCounter::kAcquires);
+		}
+	}
+
+	// A connect running on a creator thread on behalf of a waiter.
+	struct PendingCreate {
+		bool done{false};
+		std::exception_ptr error;
+		// a successor for a stale connection, made on top of max count instead of in a reserved slot
+		bool renewal{false};
+		std::weak_ptr<Conn> predecessor;
+	};
+
+	// A blocked caller (woken through cv) or a queued callback.
+	struct Waiter {
+		AcquireCallback callback;
+		ConditionVariable cv;
+		bool ready{false};
+		std::shared_ptr<Conn> conn;
+		std::exception_ptr error;
+		std::shared_ptr<PendingCreate> request;
+		std::chrono::steady_clock::time_point since{std::chrono::steady_clock::now()};
+		Priority priority{Priority::kNormal};
+		// acquireMany with kAll: the connections collected so far, until there are wanted of them
+		int wanted{1};
+		std::vector<std::shared_ptr<Conn>> batch;
+		// the connects started for the rest of the batch besides request; one failing fails the waiter
+		std::vector<std::shared_ptr<PendingCreate>> batch_requests;
+	};
+
+	// Takes an idle connection if there is one; otherwise queues callback and, if the pool may
+	// grow, starts a connect for it.
+	bool acquireOrEnqueue(std::shared_ptr<Conn> &conn, AcquireCallback &callback) {
+		if (tryBorrow(conn)) {
+			return true;
+		}
+
+		++waiting_;
+		if (thread_cache_size_ > 0) {
+			reclaimThreadCaches([](const IdleConnection &) { return true; });
+		}
+		auto start = metrics_.now();
+		std::lock_guard<Mutex> guard(mutex_);
+		auto admitted = admits(Priority::kNormal, 0);
+		if (admitted && popIdle(conn)) {
+			--waiting_;
+			recordBorrow(conn, start);
+			return true;
+		}
+		if (refusedByBackend(admitted)) {
+			--waiting_;
+			throw BackendDownError();
+		}
+		auto waiter = std::make_shared<Waiter>();
+		waiter->callback = std::move(callback);
+		waiter->request = admitted ? requestCreate() : nullptr;
+		enqueue(waiter);
+		return false;
+	}
+
+	// Called with mutex_ held: queues waiter behind every waiter of its priority or higher.
+	void enqueue(std::shared_ptr<Waiter> waiter) {
+		auto iter = waiters_.end();
+		while (iter != waiters_.begin() && (*(iter - 1))->priority < waiter->priority) {
+			--iter;
+		}
+		waiters_.insert(iter, std::move(waiter));
+	}
+
+	// total_count_ less the stale connections whose successors are open.
+	int counted() const {
+		return total_count_ - *renewed_;
+	}
+
+	// Whether a borrower of priority may take one more connection, holding held of the busy ones
+	// already: the last reserved_count_ connections are kept for reserved_priority_ and up.
+	bool admits(Priority priority, int held) const {
+		return static_cast<int>(priority) >= reserved_priority_.load(std::memory_order_relaxed) ||
+			   busy_count_ - held < max_count_ - reserved_count_;
+	}
+
+	// Called with mutex_ held; the waiter must already be off the queue.
+	std::shared_ptr<Waiter> popWaiter() {
+		auto waiter = std::move(waiters_.front());
+		waiters_.pop_front();
+		--waiting_;
+		return waiter;
+	}
+
+	// Completes a waiter. A callback runs with mutex_ released.
+	void serve(std::unique_lock<Mutex> &lock, std::shared_ptr<Waiter> waiter, std::shared_ptr<Conn> conn,
+			   std::exception_ptr error) {
+		recordWait(waiter->since);
+		if (conn != nullptr) {
+			recordBorrow(conn, waiter->since);
+		}
+		for (auto &collected : waiter->batch) {
+			if (!error) {
+				recordBorrow(collected, waiter->since);
+			}
+		}
+		if (waiter->callback) {
+			auto callback = std::move(waiter->callback);
+			lock.unlock();
+			callback(std::move(conn), error);
+			lock.lock();
+		} else {
+			waiter->conn = std::move(conn);
+			waiter->error = error;
+			waiter->ready = true;
+			waiter->cv.notify_one();
+		}
+	}
+
+	// Gives a released connection straight to the oldest waiter, so a thread arriving later
+	// cannot take it first. The connection stays busy. The waiters left behind it may still need
+	// connects started.
+	bool handOff(std::shared_ptr<Conn> &conn) {
+		std::unique_lock<Mutex> lock(mutex_);
+		if (waiters_.empty() || !admits(waiters_.front()->priority, 1)) {
+			return false;
+		}
+		serveFront(lock, std::move(conn));
+		if (!waiters_.empty()) {
+			serveWaiters(lock);
+		}
+		return true;
+	}
+
+	// Gives a busy connection to the oldest waiter. A batch waiter keeps it and stays first in
+	// line until it has collected all it wants. Called with mutex_ held and waiters_ not empty.
+	void serveFront(std::unique_lock<Mutex> &lock, std::shared_ptr<Conn> conn) {
+		auto &front = waiters_.front();
+		if (front->wanted > 1) {
+			front->batch.push_back(std::move(conn));
+			if (static_cast<int>(front->batch.size()) < front->wanted) {
+				if (front->request == nullptr || front->request->done) {
+					front->request = requestCreate();
+				}
+				return;
+			}
+		}
+		serve(lock, popWaiter(), std::move(conn), nullptr);
+	}
+
+	// Puts busy connections back on the idle wheel, serving queued waiters first.
+	void returnIdle(std::unique_lock<Mutex> &lock, std::vector<std::shared_ptr<Conn>> &conns) {
+		for (auto &conn : conns) {
+			++idle_count_;
+			idle_connection_.push({std::move(conn), Clock::now()});
+			--busy_count_;
+		}
+		conns.clear();
+		serveWaiters(lock);
+	}
+
+	void notifyWaiters() {
+		std::unique_lock<Mutex> lock(mutex_);
+		serveWaiters(lock);
+	}
+
+	// Hands idle connections to the oldest waiters and, if the pool may grow, starts connects
+	// for the waiters that have none in flight. Called with mutex_ held.
+	void serveWaiters(std::unique_lock<Mutex> &lock) {
+		std::shared_ptr<Conn> conn;
+		while (!waiters_.empty() && admits(waiters_.front()->priority, 0) && popIdle(conn)) {
+			serveFront(lock, std::move(conn));
+			conn = nullptr;
+		}
+		if (counted() < max_count_ && pending_creates_ < create_concurrency_) {
+			for (auto &waiter : waiters_) {
+				// waiters are in priority order, so none after this one may take a connection either
+				if (!admits(waiter->priority, 0)) {
+					break;
+				}
+				if (waiter->request == nullptr || waiter->request->done) {
+					waiter->request = requestCreate();
+					if (waiter->request == nullptr) {
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	// Reserves a slot and queues a connect for a creator thread; nullptr if the pool is full or
+	// create_concurrency_ connects are already running. A successor for predecessor needs no slot.
+	// Called with mutex_ held.
+	std::shared_ptr<PendingCreate> requestCreate(const std::shared_ptr<Conn> &predecessor = nullptr) {
+		auto renewal = predecessor != nullptr;
+		if (stopping_ || (!renewal && counted() >= max_count_) || pending_creates_ >= create_concurrency_) {
+			return nullptr;
+		}
+		if (!renewal) {
+			++total_count_;
+		}
+		++pending_creates_;
+		auto request = std::make_shared<PendingCreate>();
+		request->renewal = renewal;
+		request->predecessor = predecessor;
+		create_queue_.push_back(request);
+		if (idle_creators_ == 0 && static_cast<int>(creators_.size()) < create_concurrency_) {
+			creators_.emplace_back([this] { runCreator(); });
+		}
+		create_cv_.notify_one();
+		return request;
+	}
+
+	void runCreator() {
+		std::unique_lock<Mutex> lock(mutex_);
+		while (true) {
+			++idle_creators_;
+			create_cv_.wait(lock, [this] { return stopping_ || !create_queue_.empty(); });
+			--idle_creators_;
+			if (stopping_) {
+				return;
+			}
+			// one request, or every queued one in a single createConnections call
+			std::vector<std::shared_ptr<PendingCreate>> requests;
+			do {
+				requests.push_back(std::move(create_queue_.front()));
+				create_queue_.pop_front();
+			} while (Hooks::has_create_connections::value && !create_queue_.empty());
+			lock.unlock();
+
+			std::vector<std::shared_ptr<Conn>> conns;
+			std::exception_ptr error;
+			try {
+				createConnections(conns, requests.size());
+			} catch (...) {
+				error = std::current_exception();
+			}
+
+			lock.lock();
+			std::vector<std::shared_ptr<Conn>> unneeded;
+			for (std::size_t i = 0; i < requests.size(); ++i) {
+				auto &request = requests[i];
+				--pending_creates_;
+				request->done = true;
+				if (request->renewal && !renewed(request, i < conns.size())) {
+					if (i < conns.size()) {
+						unneeded.push_back(std::move(conns[i]));
+						metrics_.add(PoolCounter::kDestroys);
+					}
+					continue;
+				}
+				if (i < conns.size()) {
+					if (!waiters_.empty() && admits(waiters_.front()->priority, 0)) {
+						++busy_count_;
+						serveFront(lock, std::move(conns[i]));
+					} else {
+						++idle_count_;
+						idle_connection_.push({std::move(conns[i]), Clock::now()});
+					}
+					continue;
+				}
+				--total_count_;
+				request->error = error;
+				// fail the waiter this connect was started for
+				auto waiter = std::find_if(waiters_.begin(), waiters_.end(),
+										   [&request](const std::shared_ptr<Waiter> &w) {
+											   return w->request == request ||
+													  std::find(w->batch_requests.begin(), w->batch_requests.end(),
+																request) != w->batch_requests.end();
+										   });
+				if (waiter != waiters_.end()) {
+					auto failed = std::move(*waiter);
+					waiters_.erase(waiter);
+					--waiting_;
+					auto collected = std::move(failed->batch);
+					failed->batch.clear();
+					serve(lock, std::move(failed), nullptr, error);
+					returnIdle(lock, collected);
+				}
+			}
+			if (!unneeded.empty()) {
+				lock.unlock();
+				unneeded.clear();
+				lock.lock();
+			}
+			// create_concurrency_ caps the connects running at once, not how far the pool grows:
+			// waiters queued beyond it get theirs now that these are done
+			serveWaiters(lock);
+		}
+	}
+
+	// Settles a finished successor connect and tells whether its connection joins the pool. Once
+	// open, it counts in place of its predecessor until that closes, or, if the predecessor has
+	// closed already, fills the slot it left when there still is one. Called with mutex_ held.
+	bool renewed(const std::shared_ptr<PendingCreate> &request, bool open) {
+		auto predecessor = request->predecessor.lock();
+		if (predecessor != nullptr) {
+			deleterOf(predecessor)->renewal = open ? kRenewed : kNotRenewed;
+		}
+		if (!open || (predecessor == nullptr && counted() >= max_count_)) {
+			return false;
+		}
+		if (predecessor != nullptr) {
+			++*renewed_;
+			// it may sit idle, where only renewStale finds it
+			draining_ = true;
+		}
+		++total_count_;
+		return true;
+	}
+
+	using Magazine = ConnectionMagazine<IdleConnection>;
+
+	// Connections in a thread cache stay counted in busy_count_; getIdleCount/getBusyCount move them
+	// over to idle, so caching and reusing them on the owning thread never touches shared counters.
+	// The lock-free borrow attempt of every acquire path: the thread cache, then the idle wheel
+	// unless someone is already queued.
+	bool tryBorrow(std::shared_ptr<Conn> &conn, Priority priority = Priority::kNormal) {
+		if (!admits(priority, 0)) {
+			return false;
+		}
+		IdleConnection idle;
+		while (popThreadCache(idle) || (waiting_ == 0 && popIdle(idle))) {
+			if (validOnBorrow(idle)) {
+				conn = std::move(idle.first);
+				recordBorrow(conn);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Pings a connection idle for at least validate_on_borrow_ ms, as far as the resolution of
+	// Clock tells, or one the factory's isCheap hook calls cheap, and drops it if dead.
+	bool validOnBorrow(IdleConnection &idle) {
+		auto validate_on_borrow = validate_on_borrow_.load(std::memory_order_relaxed);
+		if (((validate_on_borrow < 0 || Clock::now() - idle.second < validate_on_borrow) &&
+			 !isCheap(idle.first, typename Hooks::has_is_cheap())) || checkValid(idle.first)) {
+			return true;
+		}
+		--busy_count_;
+		--total_count_;
+		metrics_.add(PoolCounter::kDestroys);
+		idle.first = nullptr;
+		if (waiting_ > 0) {
+			notifyWaiters();
+		}
+		return false;
+	}
+
+	bool popThreadCache(IdleConnection &idle) {
+		if (thread_cache_size_ <= 0) {
+			return false;
+		}
+		auto magazine = ThreadMagazines<IdleConnection>::local().find(pool_id_);
+		return magazine != nullptr && magazine->pop(idle);
+	}
+
+	bool pushThreadCache(std::shared_ptr<Conn> &conn) {
+		auto thread_cache_size = thread_cache_size_.load();
+		if (thread_cache_size <= 0 || waiting_ > 0) {
+			return false;
+		}
+		auto &local = ThreadMagazines<IdleConnection>::local();
+		auto magazine = local.find(pool_id_);
+		if (magazine == nullptr) {
+			auto created = std::make_shared<Magazine>(pool_id_, [this](std::vector<IdleConnection> &spilled) {
+				spillThreadCache(spilled);
+			});
+			{
+				std::lock_guard<Mutex> guard(mutex_);
+				magazines_.erase(std::remove_if(magazines_.begin(), magazines_.end(),
+												[](const std::shared_ptr<Magazine> &m) { return !m->attached(); }),
+								 magazines_.end());
+				magazines_.push_back(created);
+			}
+			local.add(created);
+			magazine = created.get();
+		}
+
+		std::vector<IdleConnection> spilled;
+		magazine->push({std::move(conn), Clock::now()}, static_cast<std::size_t>(thread_cache_size), spilled);
+		// pairs with the increment of waiting_ before a waiter reclaims the caches
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (waiting_ > 0) {
+			magazine->drain(spilled, [](const IdleConnection &) { return true; });
+		}
+		if (!spilled.empty()) {
+			spillThreadCache(spilled);
+		}
+		return true;
+	}
+
+	void spillThreadCache(std::vector<IdleConnection> &spilled) {
+		for (auto &idle : spilled) {
+			++idle_count_;
+			idle_connection_.push(std::move(idle));
+			--busy_count_;
+		}
+		if (!spilled.empty() && waiting_ > 0) {
+			notifyWaiters();
+		}
+	}
+
+	std::vector<std::shared_ptr<Magazine>> threadMagazines() {
+		std::lock_guard<Mutex> guard(mutex_);
+		return magazines_;
+	}
+
+	// Never called with mutex_ held: a thread exiting spills its magazine under the magazine lock
+	// and then takes mutex_, so the lock order is magazine before mutex_.
+	template<typename Predicate>
+	void reclaimThreadCaches(Predicate predicate) {
+		std::vector<IdleConnection> reclaimed;
+		for (auto &magazine : threadMagazines()) {
+			magazine->drain(reclaimed, predicate);
+		}
+		spillThreadCache(reclaimed);
+	}
+
+	bool popIdle(std::shared_ptr<Conn> &conn) {
+		IdleConnection idle;
+		if (!popIdle(idle)) {
+			return false;
+		}
+		conn = std::move(idle.first);
+		return true;
+	}
+
+	bool popIdle(IdleConnection &idle) {
+		if (!idle_connection_.pop(idle)) {
+			return false;
+		}
+		++busy_count_;
+		--idle_count_;
+		return true;
+	}
+
+	void initPool(const PoolOptions &options) {
+		auto start = std::chrono::steady_clock::now();
+		min_idle_ = std::min(options.min_idle, max_count_.load());
+		auto warmup_count = options.warmup == WarmupMode::kLazy ? min_idle_ : max_count_.load();
+		// warm-up connections count against max_count_ from the start, so early borrowers wait for
+		// them instead of starting connects of their own
+		total_count_ += warmup_count;
+		if (options.warmup == WarmupMode::kBackground) {
+			warmup_thread_ = std::thread([this, start, warmup_count, options] {
+				// nobody is left to rethrow to; borrowers connect what the warm-up did not
+				if (warmUp(warmup_count, options.warmup_concurrency)) {
+					warmup_failed_ = true;
+				} else {
+					recordStartup(start);
+				}
+			});
+		} else {
+			auto error = warmUp(warmup_count, options.warmup_concurrency);
+			if (error) {
+				std::rethrow_exception(error);
+			}
+			recordStartup(start);
+		}
+
+		evict_timer_ = scheduleEviction();
+	}
+
+	uint64_t scheduleEviction() {
+		return TimerService::instance().add(nextEviction(), [this] {
+			maintain(kEvict);
+			return nextEviction();
+		});
+	}
+
+	std::chrono::steady_clock::time_point nextEviction() const {
+		return std::chrono::steady_clock::now() + std::chrono::milliseconds(idle_connection_.tick());
+	}
+
+	// Runs on the maintenance thread once per wheel tick. Takes back thread cache entries unused
+	// for 5s, then closes idle connections past max_idle_time_, oldest first, while more than
+	// min_idle_ (at least one) remain. Neither step takes mutex_, and connections are closed last.
+	void evictIdle() {
+		auto now = Clock::now();
+		reclaimThreadCaches([now](const IdleConnection &idle) { return now - idle.second >= 5000; });
+		std::vector<IdleConnection> expired;
+		idle_connection_.expire(now - max_idle_time_ * 1000LL, [this, &expired](IdleConnection &idle) {
+			if (total_count_ <= std::max(min_idle_, 1)) {
+				return false;
+			}
+			--idle_count_;
+			--total_count_;
+			expired.push_back(std::move(idle));
+			return true;
+		});
+		metrics_.add(PoolCounter::kEvictions, expired.size());
+		metrics_.add(PoolCounter::kDestroys, expired.size());
+		// kept entries went back on the wheel and evictions freed capacity
+		if (waiting_ > 0) {
+			notifyWaiters();
+		}
+		expired.clear();
+	}
+
+	// Made by a replaced factory, or past its max lifetime, cut by its own share of lifetime_jitter_
+	// so that connections made together do not all age at once.
+	bool stale(const std::shared_ptr<Conn> &conn, int64_t now) {
+		auto lifetime = max_lifetime_.load(std::memory_order_relaxed);
+		auto generation = generation_.load(std::memory_order_relaxed);
+		if (lifetime <= 0 && generation == 0) {
+			return false;
+		}
+		auto deleter = deleterOf(conn);
+		return deleter->generation != generation || (lifetime > 0 && now - deleter->created >=
+				lifetime - static_cast<int64_t>(lifetime_jitter_ * deleter->jitter));
+	}
+
+	// On release: true if conn's successor is open, so it must close. A stale one without one
+	// stays in use until its own is open.
+	bool retireStale(const std::shared_ptr<Conn> &conn) {
+		if (renewed_->load(std::memory_order_relaxed) > 0 && deleterOf(conn)->renewal == kRenewed) {
+			return true;
+		}
+		if (stale(conn, Clock::now())) {
+			renew(conn);
+		}
+		return false;
+	}
+
+	// Starts a connect for the successor of stale conn, held by the caller, unless one was started.
+	void renew(const std::shared_ptr<Conn> &conn) {
+		auto deleter = deleterOf(conn);
+		if (deleter->renewal == kNotRenewed) {
+			std::lock_guard<Mutex> guard(mutex_);
+			if (requestCreate(conn) != nullptr) {
+				deleter->renewal = kRenewing;
+			}
+		}
+		// conn goes back idle stale, so the next renewStale pass must look for it
+		if (!draining_.load(std::memory_order_relaxed)) {
+			draining_ = true;
+		}
+	}
+
+	// Runs on the maintenance thread while connections may be aged or were made by a replaced
+	// factory: closes the idle connections whose successors are open and starts successors for the
+	// other stale ones.
+	void renewStale() {
+		if (max_lifetime_ > 0 || draining_.exchange(false)) {
+			auto now = Clock::now();
+			reclaimThreadCaches([this, now](const IdleConnection &idle) { return stale(idle.first, now); });
+			std::vector<IdleConnection> retired;
+			bool found = false;
+			idle_connection_.sweep(now, validation_batch_,
+								   [this, now, &retired, &found](std::vector<IdleConnection> &batch) {
+				for (auto iter = batch.begin(); iter != batch.end();) {
+					if (deleterOf(iter->first)->renewal == kRenewed) {
+						retired.push_back(std::move(*iter));
+						iter = batch.erase(iter);
+						continue;
+					}
+					if (stale(iter->first, now)) {
+						found = true;
+						renew(iter->first);
+					}
+					++iter;
+				}
+			});
+			if (found) {
+				draining_ = true;
+			}
+			auto count = static_cast<int>(retired.size());
+			idle_count_ -= count;
+			total_count_ -= count;
+			metrics_.add(PoolCounter::kRenewals, count);
+			metrics_.add(PoolCounter::kDestroys, count);
+			if (waiting_ > 0) {
+				notifyWaiters();
+			}
+		}
+	}
+
+	// Called with mutex_ held.
+	void startRenewing() {
+		if (renew_timer_ == 0) {
+			renew_timer_ = TimerService::instance().add(std::chrono::steady_clock::now() + renewInterval(), [this] {
+				maintain(kRenew);
+				return std::chrono::steady_clock::now() + renewInterval();
+			});
+		}
+	}
+
+	std::chrono::milliseconds renewInterval() const {
+		return std::chrono::milliseconds(std::max<int64_t>(max_lifetime_ / kWheelSpan, 1000));
+	}
+
+	// Runs on the maintenance thread: pings the connections idle for validation_interval_ seconds
+	// or more, validation_batch_ at a time and off the borrow path, and starts replacements for the
+	// dead ones so borrowers find live connections waiting.
+	void validateIdle() {
+		auto interval = validation_interval_.load();
+		if (interval > 0) {
+			int dead = 0;
+			idle_connection_.sweep(Clock::now() - interval * 1000LL, validation_batch_,
+								   [this, &dead](std::vector<IdleConnection> &batch) {
+				auto alive = partitionValid(batch, typename Hooks::has_check_valid_batch());
+				auto count = static_cast<int>(batch.end() - alive);
+				idle_count_ -= count;
+				total_count_ -= count;
+				metrics_.add(PoolCounter::kDestroys, count);
+				dead += count;
+				batch.erase(alive, batch.end());
+			});
+			if (dead > 0) {
+				std::lock_guard<Mutex> guard(mutex_);
+				for (int i = 0; i < dead; ++i) {
+					if (requestCreate() == nullptr) {
+						break;
+					}
+				}
+			}
+			if (waiting_ > 0) {
+				notifyWaiters();
+			}
+		}
+	}
+
+	// Periodic work, run on the pool's maintenance thread. The timer jobs only raise these bits, so
+	// a slow ping or close never holds up the process-wide timer thread and the clock it drives.
+	enum Maintenance {
+		kEvict = 1, kValidate = 2, kRenew = 4, kAutoscale = 8, kClose = 16
+	};
+
+	// Queues task, which runs once however often it is queued meanwhile.
+	void maintain(Maintenance task) {
+		std::lock_guard<Mutex> guard(mutex_);
+		if (stopping_) {
+			return;
+		}
+		maintenance_ |= task;
+		wakeMaintainer();
+	}
+
+	// Called with mutex_ held.
+	void wakeMaintainer() {
+		if (maintenance_driver_) {
+			maintenance_driver_();
+			return;
+		}
+		if (!maintainer_.joinable()) {
+			maintainer_ = std::thread([this] { runMaintainer(); });
+		}
+		maintain_cv_.notify_one();
+	}
+
+	void runMaintainer() {
+		std::unique_lock<Mutex> lock(mutex_);
+		while (true) {
+			maintain_cv_.wait(lock, [this] { return stopping_ || maintenance_ != 0; });
+			if (stopping_) {
+				return;
+			}
+			lock.unlock();
+			runMaintenance();
+			lock.lock();
+		}
+	}
+
+	// Creates count already reserved connections on up to concurrency threads, including this
+	// one, each taking one at a time or, with createConnections, an equal share at once. Stops at
+	// the first failure and gives back the reservations it did not use.
+	std::exception_ptr warmUp(int count, int concurrency) {
+		std::atomic<int> remaining{count};
+		std::exception_ptr error;
+		std::mutex error_mutex;
+		auto chunk = Hooks::has_create_connections::value ? std::max(count / std::max(concurrency, 1), 1) : 1;
+		auto worker = [this, chunk, &remaining, &error, &error_mutex] {
+			int claimed;
+			while (!stopping_ && (claimed = std::min(chunk, remaining.fetch_sub(chunk))) > 0) {
+				std::vector<std::shared_ptr<Conn>> conns;
+				std::exception_ptr failure;
+				try {
+					createConnections(conns, claimed);
+				} catch (...) {
+					failure = std::current_exception();
+				}
+				for (auto &conn : conns) {
+					++idle_count_;
+					idle_connection_.push({std::move(conn), Clock::now()});
+				}
+				if (failure) {
+					{
+						std::lock_guard<std::mutex> guard(error_mutex);
+						if (!error) {
+							error = failure;
+						}
+					}
+					total_count_ -= claimed - static_cast<int>(conns.size()) + std::max(remaining.exchange(0), 0);
+					notifyWaiters();
+					return;
+				}
+				if (waiting_ > 0) {
+					notifyWaiters();
+				}
+			}
+		};
+
+		std::vector<std::thread> workers;
+		for (int i = 1; i < std::min(concurrency, count); ++i) {
+			workers.emplace_back(worker);
+		}
+		worker();
+		for (auto &thread : workers) {
+			thread.join();
+		}
+		// stopped by the destructor before every reservation was used
+		auto unused = remaining.exchange(0);
+		if (unused > 0) {
+			total_count_ -= unused;
+		}
+		return error;
+	}
+
+	void recordStartup(std::chrono::steady_clock::time_point start) {
+		startup_time_ = std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::steady_clock::now() - start).count();
+	}
+
+private:
+	// read and replaced with std::atomic_load and std::atomic_store
+	std::shared_ptr<ConnFactoryType> conn_factory_;
+public:
+	// The factory new connections come from; see replaceFactory.
+	std::shared_ptr<ConnFactory> getConnFactory() const {
+		return std::atomic_load(&conn_factory_);
+	}
+
+	static Conn *connectionOf(const HandleType &conn) {
+		return conn.get();
+	}
+
+	// checkValid through the factory that made conn, which replaceFactory may have replaced since.
+	bool checkValid(const HandleType &conn) {
+		auto start = metrics_.now();
+		auto valid = factoryOf(conn)->checkValid(conn.get());
+		metrics_.record(PoolLatency::kCheckValidTime, start);
+		return valid;
+	}
+
+	int getIdleCount() {
+		return idle_count_ + cachedCount();
+	}
+
+	PoolStats getStats() {
+		PoolStats stats;
+		auto cached = cachedCount();
+		{
+			std::lock_guard<Mutex> guard(mutex_);
+			stats.max_count = max_count_;
+			stats.idle_count = idle_count_ + cached;
+			stats.busy_count = busy_count_ - cached;
+			stats.pending_count = total_count_ - idle_count_ - busy_count_;
+			stats.waiting_count = waiting_;
+		}
+		auto startup_time = startup_time_.load();
+		stats.warmed_up = startup_time >= 0;
+		stats.startup_time = std::chrono::milliseconds(stats.warmed_up ? startup_time : 0);
+		stats.warmup_failed = warmup_failed_;
+		return stats;
+	}
+
+	// Counters and latency histograms since construction; all zero without kMetrics.
+	MetricsSnapshot snapshot() const {
+		return metrics_.snapshot();
+	}
+
+	int getBusyCount() {
+		return busy_count_ - cachedCount();
+	}
+
+	// Each thread keeps up to size released connections for itself; 0 disables the thread caches.
+	void setThreadCacheSize(int size) {
+		thread_cache_size_ = size;
+		if (size <= 0) {
+			reclaimThreadCaches([](const IdleConnection &) { return true; });
+		}
+	}
+
+private:
+	int cachedCount() {
+		int cached = 0;
+		for (auto &magazine : threadMagazines()) {
+			cached += magazine->size();
+		}
+		return cached;
+	}
+
+private:
+	typename Policy::template IdleContainer<std::shared_ptr<Conn>> idle_connection_{kWheelTick};
+	std::atomic<int> max_count_{20};
+	std::atomic<int> idle_count_{0};
+	std::atomic<int> busy_count_{0};
+	std::atomic<int> total_count_{0};
+	std::atomic<int> waiting_{0};
+	std::deque<std::shared_ptr<Waiter>> waiters_;
+	std::deque<std::shared_ptr<PendingCreate>> create_queue_;
+	std::vector<std::thread> creators_;
+	int create_concurrency_{4};
+	int pending_creates_{0};
+	int idle_creators_{0};
+	std::atomic<bool> stopping_{false};
+	std::thread warmup_thread_;
+	int min_idle_{0};
+	// -1 until the warm-up target has been reached
+	std::atomic<long long> startup_time_{-1};
+	// a background warm-up stopped at a failed connect
+	std::atomic<bool> warmup_failed_{false};
+	ConditionVariable create_cv_;
+	// started by the first timer job that fires, unless a maintenance driver runs the work
+	std::thread maintainer_;
+	std::function<void()> maintenance_driver_;
+	int maintenance_{0};
+	// closed by the maintenance thread, or by the destructor if it stops first
+	std::vector<IdleConnection> closing_;
+	ConditionVariable maintain_cv_;
+	std::atomic<int> thread_cache_size_{0};
+	const uint64_t pool_id_{nextThreadCacheOwnerId()};
+	std::vector<std::shared_ptr<Magazine>> magazines_;
+	int timeout_{3};
+	std::atomic<int> max_idle_time_{300};
+	uint64_t evict_timer_{0};
+	std::atomic<int> validation_interval_{0};
+	std::atomic<int> validation_batch_{8};
+	std::atomic<int> validate_on_borrow_{-1};
+	uint64_t health_timer_{0};
+	PoolMetrics<kMetrics> metrics_;
+	std::unique_ptr<AutoscaleController> autoscale_;
+	ScaleListener scale_listener_;
+	uint64_t autoscale_timer_{0};
+	std::atomic<long long> wait_total_us_{0};
+	std::atomic<long long> wait_count_{0};
+	std::atomic<int> reserved_count_{0};
+	// Priority as int; kLow means nothing is reserved
+	std::atomic<int> reserved_priority_{0};
+	std::atomic<int> fail_fast_below_{0};
+	// read and replaced with std::atomic_load and std::atomic_store
+	std::shared_ptr<CreationGovernor> governor_;
+	// in milliseconds; 0 turns max lifetime off
+	std::atomic<int64_t> max_lifetime_{0};
+	std::atomic<int64_t> lifetime_jitter_{0};
+	// stale connections whose successors are open, counted down by their deleters
+	std::shared_ptr<std::atomic<int>> renewed_{std::make_shared<std::atomic<int>>(0)};
+	uint64_t renew_timer_{0};
+	// bumped by replaceFactory; connections of older generations are stale
+	std::atomic<uint64_t> generation_{0};
+	// stale connections may sit idle, where only renewStale finds them
+	std::atomic<bool> draining_{false};
+	Mutex coalesce_mutex_;
+	ConditionVariable coalesce_cv_;
+	std::deque<CoalescedOperation *> coalesced_;
+	// a thread is running the coalesced operations
+	bool coalescing_{false};
+public:
+	// Also sets the eviction tick, so connections close within about 1/60 of the limit after expiring.
+	void setMaxIdleTime(int max_idle_time) {
+		max_idle_time_ = max_idle_time;
+		idle_connection_.setTick(max_idle_time * 1000 / kWheelSpan);
+		// the running timer would wait out the old tick before the first eviction at the new one
+		auto timer = scheduleEviction();
+		{
+			std::lock_guard<Mutex> guard(mutex_);
+			std::swap(timer, evict_timer_);
+		}
+		TimerService::instance().remove(timer);
+	}
+
+	// Pings connections idle for interval seconds or more in the background, batch_size at a time,
+	// once per interval, and replaces the dead ones. 0 turns it off.
+	void setValidationInterval(int interval, int batch_size = 8) {
+		validation_batch_ = batch_size > 0 ? batch_size : 1;
+		validation_interval_ = interval > 0 ? interval : 0;
+		std::lock_guard<Mutex> guard(mutex_);
+		if (health_timer_ == 0 && validation_interval_ > 0) {
+			health_timer_ = TimerService::instance().add(
+					std::chrono::steady_clock::now() + std::chrono::seconds(validation_interval_), [this] {
+						maintain(kValidate);
+						auto interval = validation_interval_.load();
+						return std::chrono::steady_clock::now() + std::chrono::seconds(interval > 0 ? interval : 1);
+					});
+		}
+	}
+
+	// Also pings a connection on borrow when it has been idle for idle_ms or more; -1 turns it off.
+	void setValidateOnBorrow(int idle_ms) {
+		validate_on_borrow_ = idle_ms;
+	}
+
+	// Resizes the pool between options.min_count and options.max_count from then on: grows when
+	// borrowers queue or wait, shrinks when utilization stays low. listener sees every change,
+	// on the pool's maintenance thread. Calling it again replaces the options and the listener.
+	void enableAutoscale(const AutoscaleOptions &options, ScaleListener listener = nullptr) {
+		std::lock_guard<Mutex> guard(mutex_);
+		autoscale_.reset(new AutoscaleController(options));
+		scale_listener_ = std::move(listener);
+		if (autoscale_timer_ == 0) {
+			autoscale_timer_ = TimerService::instance().add(std::chrono::steady_clock::now() + options.interval, [this] {
+				maintain(kAutoscale);
+				std::lock_guard<Mutex> guard(mutex_);
+				return std::chrono::steady_clock::now() + autoscale_->options().interval;
+			});
+		}
+	}
+
+	// Keeps the last count connections of max count for borrowers of priority or higher, so lower
+	// ones cannot take the whole pool. 0 turns it off.
+	void setReservedCount(int count, Priority priority = Priority::kHigh) {
+		{
+			std::lock_guard<Mutex> guard(mutex_);
+			reserved_count_ = count > 0 ? count : 0;
+			reserved_priority_ = count > 0 ? static_cast<int>(priority) : 0;
+		}
+		// a smaller reservation may admit queued borrowers
+		if (waiting_ > 0) {
+			notifyWaiters();
+		}
+	}
+
+	// Borrowers below priority throw PoolExhaustedError rather than queue when the pool is full,
+	// or its free connections are reserved for others. Priority::kLow turns it off.
+	void setFailFast(Priority below) {
+		fail_fast_below_ = static_cast<int>(below);
+	}
+
+	// Every connect, recoverConnection included, then waits for governor's rate and in-flight
+	// limits, and borrowers fail fast with BackendDownError while it holds the backend for down.
+	// Pools connecting to the same backend may share one governor; nullptr removes it.
+	void setCreationGovernor(std::shared_ptr<CreationGovernor> governor) {
+		std::atomic_store(&governor_, std::move(governor));
+	}
+
+	// Replaces connections after max_lifetime seconds, each cut short by a random share of up to
+	// jitter of it. The successor connects first and the old connection closes once it is open:
+	// right away if idle, or on release if busy. 0 turns it off.
+	void setMaxLifetime(int max_lifetime, double jitter = 0.1) {
+		lifetime_jitter_ = static_cast<int64_t>(max_lifetime * 1000.0 * std::min(std::max(jitter, 0.0), 1.0));
+		max_lifetime_ = max_lifetime > 0 ? max_lifetime * 1000LL : 0;
+		if (max_lifetime_ > 0) {
+			std::lock_guard<Mutex> guard(mutex_);
+			startRenewing();
+		}
+	}
+
+	// Connects with conn_factory from now on, to rotate credentials or move to a new primary
+	// without rebuilding the pool. The old factory's connections are replaced like aged ones, up to
+	// create concurrency at a time: idle ones close as soon as their successors are open, busy ones
+	// on release, and borrowers keep getting them until then, so they never wait for a refill.
+	void replaceFactory(std::shared_ptr<ConnFactoryType> conn_factory) {
+		{
+			std::lock_guard<Mutex> guard(mutex_);
+			// a connect reads the generation before the factory, so it never tags an old
+			// factory's connection as new
+			std::atomic_store(&conn_factory_, std::move(conn_factory));
+			++generation_;
+			draining_ = true;
+			startRenewing();
+		}
+		// start the first successors now rather than on the next timer pass, on the maintenance
+		// thread, as only one thread may sweep the idle connections at a time
+		maintain(kRenew);
+	}
+
+	// How many connects may run at once on the pool's creator threads.
+	void setCreateConcurrency(int create_concurrency) {
+		std::lock_guard<Mutex> guard(mutex_);
+		create_concurrency_ = create_concurrency > 0 ? create_concurrency : 1;
+	}
+
+	// Lets one thread maintain many pools: from now on wake is called, under the pool lock, when
+	// there is periodic work, and its owner calls runMaintenance() on its own thread instead of the
+	// pool starting one. wake must not call into the pool. Has no effect once the pool's own
+	// maintenance thread is running; nullptr hands the work back to the pool.
+	void setMaintenanceDriver(std::function<void()> wake) {
+		std::lock_guard<Mutex> guard(mutex_);
+		if (maintainer_.joinable() && wake) {
+			return;
+		}
+		maintenance_driver_ = std::move(wake);
+		if (!stopping_ && maintenance_ != 0) {
+			wakeMaintainer();
+		}
+	}
+
+	// Runs the periodic work queued since the last run. The pool's maintenance thread calls it, or
+	// the maintenance driver's owner, never two threads at once.
+	void runMaintenance() {
+		int tasks;
+		std::vector<IdleConnection> closing;
+		{
+			std::lock_guard<Mutex> guard(mutex_);
+			if (stopping_) {
+				return;
+			}
+			tasks = maintenance_;
+			maintenance_ = 0;
+			closing.swap(closing_);
+		}
+		closing.clear();
+		if (tasks & kEvict) {
+			evictIdle();
+		}
+		if (tasks & kValidate) {
+			validateIdle();
+		}
+		if (tasks & kRenew) {
+			renewStale();
+		}
+		if (tasks & kAutoscale) {
+			autoscale();
+		}
+	}
+
+private:
+	Mutex mutex_;
+};
+};
+
+#endif //CONNECTIONPOOL_CONNECTION_POOL_HPP
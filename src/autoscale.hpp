@@ -0,0 +1,88 @@
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_AUTOSCALE_HPP
+#define CONNECTIONPOOL_AUTOSCALE_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+
+namespace modern_utils {
+
+struct AutoscaleOptions {
+    int min_count{1};
+    int max_count{100};
+    // how often the controller samples the pool
+    std::chrono::milliseconds interval{1000};
+    // grow when queued borrowers waited this long on average during the last interval
+    std::chrono::milliseconds grow_wait{5};
+    // shrink when busy / max_count stayed below this for shrink_after intervals in a row
+    double shrink_utilization{0.5};
+    int shrink_after{30};
+};
+
+enum class ScaleDirection {
+    kGrow, kShrink
+};
+
+struct ScaleEvent {
+    ScaleDirection direction{ScaleDirection::kGrow};
+    int from{0};
+    int to{0};
+    // the sample the decision was made on
+    int waiting{0};
+    std::chrono::microseconds average_wait{0};
+    double utilization{0};
+};
+
+using ScaleListener = std::function<void(const ScaleEvent &)>;
+
+// Decides the pool size from one sample per interval. Grows at once, by a quarter of the pool or
+// the number of waiters, whichever is more; shrinks by at most a quarter, only after utilization has
+// stayed low for shrink_after samples, and never below what keeps the busy connections under the
+// shrink threshold, so a shrink cannot trigger the next grow.
+class AutoscaleController {
+public:
+    explicit AutoscaleController(const AutoscaleOptions &options) : options_(options) {
+        options_.min_count = std::max(options_.min_count, 1);
+        options_.max_count = std::max(options_.max_count, options_.min_count);
+    }
+
+    const AutoscaleOptions &options() const {
+        return options_;
+    }
+
+    // Returns the new size, or current if it stays.
+    int decide(int current, int busy, int waiting, std::chrono::microseconds average_wait) {
+        auto utilization = current > 0 ? static_cast<double>(busy) / current : 1.0;
+        if (waiting > 0 || average_wait >= options_.grow_wait) {
+            low_samples_ = 0;
+            auto step = std::max({current / 4, waiting, 1});
+            return std::min(current + step, options_.max_count);
+        }
+        if (utilization >= options_.shrink_utilization) {
+            low_samples_ = 0;
+            return clamp(current);
+        }
+        if (++low_samples_ < options_.shrink_after) {
+            return clamp(current);
+        }
+        low_samples_ = 0;
+        auto needed = static_cast<int>(busy / options_.shrink_utilization) + 1;
+        return clamp(std::max(needed, current - std::max(current / 4, 1)));
+    }
+
+private:
+    int clamp(int count) const {
+        return std::min(std::max(count, options_.min_count), options_.max_count);
+    }
+
+private:
+    AutoscaleOptions options_;
+    int low_samples_{0};
+};
+};
+
+#endif //CONNECTIONPOOL_AUTOSCALE_HPP
@@ -0,0 +1,313 @@
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_BALANCED_POOL_HPP
+#define CONNECTIONPOOL_BALANCED_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include "pool_errors.hpp"
+#include "pool_options.hpp"
+#include "pool_policy.hpp"
+#include "timer_service.hpp"
+
+namespace modern_utils {
+
+// defined in connection_pool.hpp, which includes this header
+template<typename Conn, typename ConnFactory, bool kMetrics, typename Policy>
+class ConnectionPool;
+
+enum class BalanceMode {
+    // the replica with the lowest (in-flight + 1) * latency score
+    kLeastOutstanding,
+    // the better of two replicas picked at random by the same score
+    kPowerOfTwo
+};
+
+struct ReplicaStats {
+    bool ejected{false};
+    int in_flight{0};
+    int failures{0};
+    // moving average of acquire and checkValid latency
+    std::chrono::microseconds latency{0};
+};
+
+// Spreads borrows over several replicas of one service, one ConnectionPool per factory. Each borrow
+// goes to the replica with the least in-flight work weighted by its observed latency, and fails
+// over to the next one if that replica cannot hand out a connection. A replica whose connects or
+// checkValid calls fail eject_after times in a row is ejected: its idle connections are closed and
+// no borrow is routed to it. After a backoff, doubling up to max_backoff, a probe connect runs on
+// its creator thread; a connection that connects and passes checkValid puts the replica back.
+// Timeouts do not count as failures, an exhausted replica is not a broken one.
+template<typename Conn, typename ConnFactory>
+class BalancedConnectionPool {
+public:
+    using ConnectionType = Conn;
+    using ConnFactoryType = ConnFactory;
+    using PoolType = ConnectionPool<Conn, ConnFactory, false, DefaultPoolPolicy>;
+
+    // The borrow handle: the connection and the replica to give it back to.
+    struct HandleType {
+        std::shared_ptr<Conn> conn;
+        int replica{-1};
+    };
+public:
+    explicit BalancedConnectionPool(const std::vector<std::shared_ptr<ConnFactory>> &factories,
+                                    int max_per_replica = 20, BalanceMode mode = BalanceMode::kPowerOfTwo)
+            : max_per_replica_(max_per_replica), mode_(mode) {
+        if (factories.empty()) {
+            throw std::runtime_error("no replica");
+        }
+        // lazy, so a replica that is down cannot fail the constructor
+        PoolOptions options(max_per_replica);
+        options.warmup = WarmupMode::kLazy;
+        for (auto &factory : factories) {
+            std::unique_ptr<Replica> replica(new Replica);
+            replica->pool.reset(new PoolType(factory, options));
+            replicas_.push_back(std::move(replica));
+        }
+        probe_timer_ = TimerService::instance().add(nextProbe(), [this] { return probe(); });
+    }
+
+    ~BalancedConnectionPool() {
+        TimerService::instance().remove(probe_timer_);
+        // pending probes are failed by the replica pools, after which they must not touch this
+        stopping_ = true;
+    }
+
+    BalancedConnectionPool(const BalancedConnectionPool &rhs) = delete;
+
+    BalancedConnectionPool &operator=(const BalancedConnectionPool &rhs) = delete;
+
+    HandleType getConnection() {
+        return getConnection(std::chrono::seconds(timeout_));
+    }
+
+    HandleType getConnection(std::chrono::milliseconds timeout) {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        std::vector<bool> tried(replicas_.size(), false);
+        std::exception_ptr error;
+        for (std::size_t attempt = 0; attempt < replicas_.size(); ++attempt) {
+            auto index = pick(tried);
+            if (index < 0) {
+                break;
+            }
+            tried[index] = true;
+            auto &replica = *replicas_[index];
+            ++replica.in_flight;
+            auto start = std::chrono::steady_clock::now();
+            try {
+                auto conn = replica.pool->getConnection(deadline);
+                recordSuccess(replica, std::chrono::steady_clock::now() - start);
+                return {std::move(conn), index};
+            } catch (const AcquireTimeoutError &) {
+                --replica.in_flight;
+                error = std::current_exception();
+            } catch (...) {
+                --replica.in_flight;
+                error = std::current_exception();
+                recordFailure(index);
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        throw std::runtime_error("no healthy replica");
+    }
+
+    void releaseConnecion(HandleType handle, bool destroy = false) {
+        auto &replica = *replicas_[handle.replica];
+        --replica.in_flight;
+        replica.pool->releaseConnecion(std::move(handle.conn), destroy);
+    }
+
+    // Replaces the connection on its own replica; a failed connect counts against the replica.
+    void recoverConnection(HandleType &handle) {
+        try {
+            replicas_[handle.replica]->pool->recoverConnection(handle.conn);
+        } catch (...) {
+            recordFailure(handle.replica);
+            throw;
+        }
+    }
+
+    // checkValid through the replica pool, feeding the replica's latency and failure count.
+    bool checkValid(const HandleType &handle) {
+        auto &replica = *replicas_[handle.replica];
+        auto start = std::chrono::steady_clock::now();
+        auto valid = replica.pool->checkValid(handle.conn);
+        if (valid) {
+            recordSuccess(replica, std::chrono::steady_clock::now() - start);
+        } else {
+            recordFailure(handle.replica);
+        }
+        return valid;
+    }
+
+    static Conn *connectionOf(const HandleType &handle) {
+        return handle.conn.get();
+    }
+
+    int getReplicaCount() const {
+        return static_cast<int>(replicas_.size());
+    }
+
+    ReplicaStats getReplicaStats(int index) const {
+        auto &replica = *replicas_[index];
+        ReplicaStats stats;
+        stats.ejected = replica.ejected;
+        stats.in_flight = replica.in_flight;
+        stats.failures = replica.failures;
+        stats.latency = std::chrono::microseconds(replica.latency_us.load());
+        return stats;
+    }
+
+    PoolType &getReplicaPool(int index) {
+        return *replicas_[index]->pool;
+    }
+
+    void setEjectPolicy(int eject_after, std::chrono::milliseconds initial_backoff,
+                        std::chrono::milliseconds max_backoff) {
+        eject_after_ = std::max(eject_after, 1);
+        initial_backoff_ms_ = static_cast<int>(initial_backoff.count());
+        max_backoff_ms_ = static_cast<int>(std::max(max_backoff, initial_backoff).count());
+    }
+
+private:
+    struct Replica {
+        std::unique_ptr<PoolType> pool;
+        std::atomic<int> in_flight{0};
+        std::atomic<long long> latency_us{0};
+        std::atomic<int> failures{0};
+        std::atomic<bool> ejected{false};
+        std::atomic<bool> probing{false};
+        // guarded by mutex_
+        int backoff_ms{0};
+        std::chrono::steady_clock::time_point retry_at;
+    };
+
+    long long scoreOf(const Replica &replica) const {
+        return (replica.in_flight + 1LL) * (replica.latency_us.load(std::memory_order_relaxed) + 1);
+    }
+
+    // A healthy replica not tried yet, or -1.
+    int pick(const std::vector<bool> &tried) {
+        thread_local std::minstd_rand random(std::random_device{}());
+        int candidates[2] = {-1, -1};
+        int seen = 0;
+        for (int i = 0; i < static_cast<int>(replicas_.size()); ++i) {
+            if (tried[i] || replicas_[i]->ejected) {
+                continue;
+            }
+            ++seen;
+            if (mode_ == BalanceMode::kLeastOutstanding) {
+                if (candidates[0] < 0 || scoreOf(*replicas_[i]) < scoreOf(*replicas_[candidates[0]])) {
+                    candidates[0] = i;
+                }
+            } else if (seen <= 2) {
+                candidates[seen - 1] = i;
+            } else {
+                // reservoir sampling keeps two uniformly random candidates in one pass
+                auto slot = static_cast<int>(random() % seen);
+                if (slot < 2) {
+                    candidates[slot] = i;
+                }
+            }
+        }
+        if (candidates[1] >= 0 && scoreOf(*replicas_[candidates[1]]) < scoreOf(*replicas_[candidates[0]])) {
+            return candidates[1];
+        }
+        return candidates[0];
+    }
+
+    void recordSuccess(Replica &replica, std::chrono::steady_clock::duration elapsed) {
+        auto sample = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+        auto latency = replica.latency_us.load(std::memory_order_relaxed);
+        // moving average with weight 1/8 for the new sample
+        replica.latency_us.store(latency == 0 ? sample + 1 : latency + (sample - latency) / 8,
+                                 std::memory_order_relaxed);
+        replica.failures = 0;
+    }
+
+    void recordFailure(int index) {
+        auto &replica = *replicas_[index];
+        if (++replica.failures >= eject_after_ && !replica.ejected.exchange(true)) {
+            std::lock_guard<std::mutex> guard(mutex_);
+            replica.backoff_ms = initial_backoff_ms_;
+            replica.retry_at = std::chrono::steady_clock::now() + std::chrono::milliseconds(replica.backoff_ms);
+            replica.pool->setMaxCount(0);
+        }
+    }
+
+    // Runs on the shared timer thread: starts a probe connect on each ejected replica whose backoff
+    // has run out. The connect and checkValid run on the replica pool's creator thread.
+    std::chrono::steady_clock::time_point probe() {
+        auto now = std::chrono::steady_clock::now();
+        for (int i = 0; i < static_cast<int>(replicas_.size()); ++i) {
+            auto &replica = *replicas_[i];
+            if (!replica.ejected || replica.probing) {
+                continue;
+            }
+            {
+                std::lock_guard<std::mutex> guard(mutex_);
+                if (now < replica.retry_at) {
+                    continue;
+                }
+            }
+            replica.probing = true;
+            replica.pool->setMaxCount(max_per_replica_);
+            replica.pool->acquireAsync([this, i](std::shared_ptr<Conn> conn, std::exception_ptr error) {
+                if (!stopping_) {
+                    probed(i, std::move(conn), error);
+                }
+            });
+        }
+        return nextProbe();
+    }
+
+    void probed(int index, std::shared_ptr<Conn> conn, std::exception_ptr error) {
+        auto &replica = *replicas_[index];
+        auto valid = !error && conn != nullptr && replica.pool->checkValid(conn);
+        if (conn != nullptr) {
+            replica.pool->releaseConnecion(std::move(conn), !valid);
+        }
+        if (valid) {
+            replica.failures = 0;
+            replica.ejected = false;
+        } else {
+            std::lock_guard<std::mutex> guard(mutex_);
+            replica.backoff_ms = std::min(replica.backoff_ms * 2, max_backoff_ms_.load());
+            replica.retry_at = std::chrono::steady_clock::now() + std::chrono::milliseconds(replica.backoff_ms);
+            replica.pool->setMaxCount(0);
+        }
+        replica.probing = false;
+    }
+
+    std::chrono::steady_clock::time_point nextProbe() const {
+        return std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+    }
+
+private:
+    // declared first, so both outlive the replica pools and the probe callbacks they fail
+    std::atomic<bool> stopping_{false};
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<Replica>> replicas_;
+    const int max_per_replica_;
+    const BalanceMode mode_;
+    std::atomic<int> eject_after_{3};
+    std::atomic<int> initial_backoff_ms_{1000};
+    std::atomic<int> max_backoff_ms_{30000};
+    uint64_t probe_timer_{0};
+    int timeout_{3};
+};
+};
+
+#endif //CONNECTIONPOOL_BALANCED_POOL_HPP
@@ -0,0 +1,89 @@
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_CONN_BATCH_GUARD_HPP
+#define CONNECTIONPOOL_CONN_BATCH_GUARD_HPP
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace modern_utils {
+
+enum class BatchGrant {
+    // all n connections or none: the caller waits, holding nothing, until the pool can grant them
+    kAll,
+    // at least one connection, plus as many of the n as are idle at that point
+    kPartial
+};
+
+// Move-only set of connections borrowed with acquireMany. They go back to the pool together, in
+// one releaseMany, when the guard is reset or destroyed. The pool must outlive the guard.
+template<typename ConnectionPool>
+class ConnBatchGuard {
+public:
+    using ConnectionType = typename ConnectionPool::ConnectionType;
+    using HandleType = typename ConnectionPool::HandleType;
+public:
+    ConnBatchGuard() = default;
+
+    ConnBatchGuard(ConnectionPool &pool, std::vector<HandleType> conns) : pool_(&pool), conns_(std::move(conns)) {}
+
+    ConnBatchGuard(ConnBatchGuard &&rhs) noexcept : pool_(rhs.pool_), conns_(std::move(rhs.conns_)) {
+        rhs.pool_ = nullptr;
+        rhs.conns_.clear();
+    }
+
+    ConnBatchGuard &operator=(ConnBatchGuard &&rhs) noexcept {
+        if (this != &rhs) {
+            reset();
+            pool_ = rhs.pool_;
+            conns_ = std::move(rhs.conns_);
+            rhs.pool_ = nullptr;
+            rhs.conns_.clear();
+        }
+        return *this;
+    }
+
+    ConnBatchGuard(const ConnBatchGuard &rhs) = delete;
+
+    ConnBatchGuard &operator=(const ConnBatchGuard &rhs) = delete;
+
+    ~ConnBatchGuard() {
+        reset();
+    }
+
+    std::size_t size() const {
+        return conns_.size();
+    }
+
+    bool empty() const {
+        return conns_.empty();
+    }
+
+    ConnectionType *operator[](std::size_t index) const {
+        return ConnectionPool::connectionOf(conns_[index]);
+    }
+
+    // The pool's handle of connection index, e.g. for recoverConnection.
+    HandleType &handle(std::size_t index) {
+        return conns_[index];
+    }
+
+    // Returns every connection to the pool now; destroy drops them instead of keeping them idle.
+    void reset(bool destroy = false) {
+        if (pool_ != nullptr && !conns_.empty()) {
+            pool_->releaseMany(std::move(conns_), destroy);
+        }
+        pool_ = nullptr;
+        conns_.clear();
+    }
+
+private:
+    ConnectionPool *pool_{nullptr};
+    std::vector<HandleType> conns_;
+};
+};
+
+#endif //CONNECTIONPOOL_CONN_BATCH_GUARD_HPP
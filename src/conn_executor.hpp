@@ -0,0 +1,216 @@
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_CONN_EXECUTOR_HPP
+#define CONNECTIONPOOL_CONN_EXECUTOR_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "unique_conn_guard.hpp"
+
+namespace modern_utils {
+
+// Runs tasks on worker threads that each keep one connection borrowed from the pool for as long
+// as the executor lives, so a task costs a queue push and pop instead of a borrow and a release.
+// submit() spreads tasks over per-worker queues and an idle worker steals from the others. When a
+// task throws, its worker checks its connection and recovers it if dead; a worker that cannot
+// borrow fails its tasks with the pool's error until it can. Works with any pool UniqueConnGuard
+// works with, which must outlive the executor and have a connection for every worker.
+template<typename ConnectionPool>
+class ConnectionExecutor {
+public:
+    using ConnectionType = typename ConnectionPool::ConnectionType;
+private:
+    // Runs with the worker's connection and returns false if it threw, or fails with error when
+    // there is no connection.
+    using Task = std::function<bool(ConnectionType *, std::exception_ptr)>;
+
+    struct TaskQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+public:
+    ConnectionExecutor(ConnectionPool &pool, int workers) : pool_(pool) {
+        workers = workers > 0 ? workers : 1;
+        for (int i = 0; i < workers; ++i) {
+            queues_.emplace_back(new TaskQueue);
+        }
+        for (int i = 0; i < workers; ++i) {
+            workers_.emplace_back([this, i] { runWorker(i); });
+        }
+    }
+
+    ConnectionExecutor(const ConnectionExecutor &rhs) = delete;
+
+    ConnectionExecutor &operator=(const ConnectionExecutor &rhs) = delete;
+
+    // Runs the tasks already submitted, then gives the connections back.
+    ~ConnectionExecutor() {
+        {
+            std::lock_guard<std::mutex> guard(sleep_mutex_);
+            stopping_ = true;
+        }
+        sleep_cv_.notify_all();
+        for (auto &worker : workers_) {
+            worker.join();
+        }
+    }
+
+    // Queues task(ConnectionType &) and returns a future of its result, or of what it threw.
+    template<typename Function>
+    auto submit(Function task) -> std::future<decltype(task(std::declval<ConnectionType &>()))> {
+        using Result = decltype(task(std::declval<ConnectionType &>()));
+        auto promise = std::make_shared<std::promise<Result>>();
+        auto future = promise->get_future();
+        push([promise, task](ConnectionType *conn, std::exception_ptr error) mutable {
+            if (conn == nullptr) {
+                promise->set_exception(error);
+                return true;
+            }
+            try {
+                fulfil(*promise, task, *conn, std::is_void<Result>());
+                return true;
+            } catch (...) {
+                promise->set_exception(std::current_exception());
+                return false;
+            }
+        });
+        return future;
+    }
+
+    int getWorkerCount() const {
+        return static_cast<int>(workers_.size());
+    }
+
+    // Also pings a worker's connection before a task when the worker has been idle for idle_ms or
+    // more; -1 turns it off.
+    void setValidateAfterIdle(int idle_ms) {
+        validate_after_idle_ = idle_ms;
+    }
+
+private:
+    template<typename Result, typename Function>
+    static void fulfil(std::promise<Result> &promise, Function &task, ConnectionType &conn, std::false_type) {
+        promise.set_value(task(conn));
+    }
+
+    template<typename Result, typename Function>
+    static void fulfil(std::promise<Result> &promise, Function &task, ConnectionType &conn, std::true_type) {
+        task(conn);
+        promise.set_value();
+    }
+
+    void push(Task task) {
+        auto &queue = *queues_[next_++ % queues_.size()];
+        {
+            std::lock_guard<std::mutex> guard(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+        // pairs with a worker announcing itself in sleeping_ before it checks queued_, so either
+        // the worker sees the task or we see the worker
+        ++queued_;
+        if (sleeping_ > 0) {
+            std::lock_guard<std::mutex> guard(sleep_mutex_);
+            sleep_cv_.notify_one();
+        }
+    }
+
+    // The oldest task of the worker's own queue, or else the newest of another's.
+    bool pop(int index, Task &task) {
+        auto count = static_cast<int>(queues_.size());
+        for (int i = 0; i < count; ++i) {
+            auto &queue = *queues_[(index + i) % count];
+            std::lock_guard<std::mutex> guard(queue.mutex);
+            if (!queue.tasks.empty()) {
+                if (i == 0) {
+                    task = std::move(queue.tasks.front());
+                    queue.tasks.pop_front();
+                } else {
+                    task = std::move(queue.tasks.back());
+                    queue.tasks.pop_back();
+                }
+                --queued_;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Blocks until there is a task, or returns false once stopping with none left.
+    bool take(int index, Task &task) {
+        while (!pop(index, task)) {
+            std::unique_lock<std::mutex> lock(sleep_mutex_);
+            ++sleeping_;
+            sleep_cv_.wait(lock, [this] { return stopping_ || queued_ > 0; });
+            --sleeping_;
+            if (stopping_ && queued_ <= 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void runWorker(int index) {
+        UniqueConnGuard<ConnectionPool> conn;
+        auto idle_since = std::chrono::steady_clock::now();
+        Task task;
+        while (take(index, task)) {
+            auto validate_after_idle = validate_after_idle_.load(std::memory_order_relaxed);
+            if (conn && validate_after_idle >= 0 && std::chrono::steady_clock::now() - idle_since >=
+                                                    std::chrono::milliseconds(validate_after_idle) &&
+                !conn.checkValid()) {
+                recover(conn);
+            }
+            if (!conn) {
+                try {
+                    conn = UniqueConnGuard<ConnectionPool>(pool_);
+                } catch (...) {
+                    task(nullptr, std::current_exception());
+                    continue;
+                }
+            }
+            if (!task(conn.get(), nullptr) && !conn.checkValid()) {
+                recover(conn);
+            }
+            task = nullptr;
+            idle_since = std::chrono::steady_clock::now();
+        }
+    }
+
+    // Swaps a dead connection for a new one; if that fails too, drops it and borrows again on the
+    // next task.
+    static void recover(UniqueConnGuard<ConnectionPool> &conn) {
+        try {
+            conn.recover();
+        } catch (...) {
+            conn.reset(true);
+        }
+    }
+
+private:
+    ConnectionPool &pool_;
+    std::vector<std::unique_ptr<TaskQueue>> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<unsigned> next_{0};
+    std::atomic<int> queued_{0};
+    std::atomic<int> sleeping_{0};
+    std::atomic<int> validate_after_idle_{-1};
+    bool stopping_{false};
+    std::mutex sleep_mutex_;
+    std::condition_variable sleep_cv_;
+};
+};
+
+#endif //CONNECTIONPOOL_CONN_EXECUTOR_HPP
@@ -5,6 +5,8 @@
 #ifndef CONNECTIONPOOL_CONN_FACTORY_CONCEPT_HPP
 #define CONNECTIONPOOL_CONN_FACTORY_CONCEPT_HPP
 
+#include <cstddef>
+#include <vector>
 #include "static_detected.hpp"
 
 namespace modern_utils{
@@ -26,6 +28,40 @@ using all = void_t<static_create_connection<Conn, ConnFactory>,
         static_destroy<Conn, ConnFactory>>;
 };
 
+// optional hooks
+namespace traits {
+template<typename Conn, typename ConnFactory>
+using static_create_connections = enable_if_same<decltype(std::declval<ConnFactory>().createConnections(0)),
+        std::vector<Conn *>>;
+
+template<typename Conn, typename ConnFactory>
+using static_reset = enable_if_same<decltype(std::declval<ConnFactory>().reset(static_cast<Conn *>(nullptr))), bool>;
+
+template<typename Conn, typename ConnFactory>
+using static_check_valid_batch = enable_if_same<decltype(std::declval<ConnFactory>().checkValidBatch(
+        static_cast<Conn *const *>(nullptr), std::size_t(0), static_cast<bool *>(nullptr))), void>;
+
+template<typename Conn, typename ConnFactory>
+using static_is_cheap = enable_if_same<decltype(std::declval<ConnFactory>().isCheap(
+        static_cast<Conn *>(nullptr))), bool>;
+};
+
+// The optional factory hooks the pool uses when present, each a std::true_type or std::false_type
+// to dispatch on, so an absent hook costs nothing:
+//   std::vector<Conn*> createConnections(int n)  up to n connections at once, at least one or throws
+//   bool reset(Conn*)                             cleans a connection released with destroy, true
+//                                                 if it can be kept instead
+//   void checkValidBatch(Conn* const*, size_t n, bool* valid)  pings n idle connections at once
+//   bool isCheap(Conn*)                           true if checkValid on it is cheap enough to run
+//                                                 on every borrow
+template<typename Conn, typename ConnFactory>
+struct factory_hooks {
+    using has_create_connections = is_detected<traits::static_create_connections, Conn, ConnFactory>;
+    using has_reset = is_detected<traits::static_reset, Conn, ConnFactory>;
+    using has_check_valid_batch = is_detected<traits::static_check_valid_batch, Conn, ConnFactory>;
+    using has_is_cheap = is_detected<traits::static_is_cheap, Conn, ConnFactory>;
+};
+
 template<typename Conn, typename ConnFactory>
 struct is_acceptable : is_detected<traits::all, Conn, ConnFactory> {
     constexpr static bool diagnose() {
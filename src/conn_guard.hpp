@@ -61,7 +61,7 @@ public:
     virtual bool checkValid() {
         auto _pool = pool_.lock();
         if(_pool && conn_ != nullptr) {
-            return _pool->getConnFactory()->checkValid(conn_.get());
+            return _pool->checkValid(conn_);
         }
 
         return false;
@@ -74,7 +74,7 @@ public:
     void recover() {
         auto _pool = pool_.lock();
         if(_pool && conn_ != nullptr) {
-            conn_ = _pool->recoverConnection();
+            _pool->recoverConnection(conn_);
         } else {
             conn_ = nullptr;
         }
@@ -5,160 +5,1851 @@
 #ifndef CONNECTIONPOOL_CONNECTION_POOL_HPP
 #define CONNECTIONPOOL_CONNECTION_POOL_HPP
 
-#include <deque>
+#include <algorithm>
+#include <atomic>
 #include <mutex>
 #include <chrono>
 #include <thread>
+#include <vector>
 #include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <random>
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#endif
 #include "conn_factory_concept.hpp"
+#include "idle_wheel.hpp"
+#include "autoscale.hpp"
+#include "creation_governor.hpp"
+#include "pool_errors.hpp"
+#include "pool_metrics.hpp"
+#include "pool_options.hpp"
+#include "pool_policy.hpp"
+#include "pool_stats.hpp"
+#include "thread_cache.hpp"
+#include "timer_service.hpp"
+#include "slot_pool.hpp"
+#include "multiplexed_pool.hpp"
+#include "keyed_pool.hpp"
+#include "balanced_pool.hpp"
+#include "conn_batch_guard.hpp"
+#include "unique_conn_guard.hpp"
+#include "conn_executor.hpp"
 #include "conn_guard.hpp"
 
 namespace modern_utils {
-template<typename Conn, typename ConnFactory>
+// kMetrics = true compiles in the counters and latency histograms, whose clock reads cost about as
+// much as a borrow and release themselves; Policy picks the lock, idle store, reuse order and
+// clock, see PoolPolicy.
+template<typename Conn, typename ConnFactory, bool kMetrics = false, typename Policy = DefaultPoolPolicy>
 class ConnectionPool {
 private:
     static_assert(is_acceptable<Conn, ConnFactory>::diagnose());
+    using Mutex = typename Policy::LockType;
+    using ConditionVariable = typename Policy::ConditionType;
+    using Clock = typename Policy::ClockType;
+    using Hooks = factory_hooks<Conn, ConnFactory>;
 public:
     using ConnectionType = Conn;
     using ConnFactoryType = ConnFactory;
+    using HandleType = std::shared_ptr<Conn>;
+    // Receives either a connection or the reason none could be obtained; must not throw.
+    using AcquireCallback = std::function<void(std::shared_ptr<Conn>, std::exception_ptr)>;
 public:
-    explicit ConnectionPool(const std::shared_ptr<ConnFactoryType> &conn_factory, int max_count = 20) : conn_factory_(
-            conn_factory), max_count_(max_count) {
-        initPool();
+    explicit ConnectionPool(const std::shared_ptr<ConnFactoryType> &conn_factory, int max_count = 20)
+            : ConnectionPool(conn_factory, PoolOptions(max_count)) {
     }
 
 
-    explicit ConnectionPool(std::shared_ptr<ConnFactoryType> &&conn_factory, int max_count = 20) : conn_factory_(
-            std::move(conn_factory)), max_count_(20) {
-        initPool();
+    explicit ConnectionPool(std::shared_ptr<ConnFactoryType> &&conn_factory, int max_count = 20)
+            : ConnectionPool(std::move(conn_factory), PoolOptions(max_count)) {
+    }
+
+    ConnectionPool(std::shared_ptr<ConnFactoryType> conn_factory, const PoolOptions &options) : conn_factory_(
+            std::move(conn_factory)), max_count_(options.max_count) {
+        initPool(options);
     }
 
     ~ConnectionPool() {
-        std::lock_guard<std::mutex> guard(mutex_);
-        idle_connection_.clear();
+        TimerService::instance().remove(evict_timer_);
+        if (health_timer_ != 0) {
+            TimerService::instance().remove(health_timer_);
+        }
+        if (autoscale_timer_ != 0) {
+            TimerService::instance().remove(autoscale_timer_);
+        }
+        if (renew_timer_ != 0) {
+            TimerService::instance().remove(renew_timer_);
+        }
+        std::vector<std::thread> creators;
+        {
+            std::lock_guard<Mutex> guard(mutex_);
+            stopping_ = true;
+            creators.swap(creators_);
+        }
+        create_cv_.notify_all();
+        maintain_cv_.notify_all();
+        if (maintainer_.joinable()) {
+            maintainer_.join();
+        }
+        if (warmup_thread_.joinable()) {
+            warmup_thread_.join();
+        }
+        for (auto &creator : creators) {
+            creator.join();
+        }
+
+        std::vector<IdleConnection> cached;
+        for (auto &magazine : threadMagazines()) {
+            magazine->detach(cached);
+        }
+
+        std::unique_lock<Mutex> lock(mutex_);
+        IdleConnection idle;
+        while (idle_connection_.pop(idle)) {
+        }
+        auto error = std::make_exception_ptr(std::runtime_error("connection pool destroyed"));
+        while (!waiters_.empty()) {
+            serve(lock, popWaiter(), nullptr, error);
+        }
     }
 
     ConnectionPool(const ConnectionPool &rhs) = delete;
 
     ConnectionPool &operator=(const ConnectionPool &rhs) = delete;
 
+    // Connects up to count at once; above it, idle connections close now and busy ones on release.
     void setConnectionCount(int count) {
-        std::lock_guard<std::mutex> guard(mutex_);
-        max_count_ = count;
-        auto old_idle_count = idle_count_;
-        auto new_idle_count = 0;
-        if (idle_count_ + busy_count_ > max_count_) {
-            new_idle_count = max_count_ - busy_count_ > 0 ? max_count_ - busy_count_ : 0;
+        resize(count, true);
+    }
+
+    // Like setConnectionCount but never connects; queued borrowers connect into new room.
+    void setMaxCount(int count) {
+        resize(count, false);
+    }
+
+    auto getConnection() {
+        return getConnection(std::chrono::seconds(timeout_));
+    }
+
+    // Never waits or connects: an idle connection, or false.
+    bool tryGetConnection(std::shared_ptr<Conn> &conn) {
+        return tryBorrow(conn);
+    }
+
+    std::shared_ptr<Conn> getConnection(std::chrono::milliseconds timeout, Priority priority = Priority::kNormal) {
+        return getConnection(std::chrono::steady_clock::now() + timeout, priority);
+    }
+
+    // Blocked callers are served by priority and then strictly in arrival order: each waits on its
+    // own condition variable and a released connection is handed to the first one directly.
+    // Borrowers below the priority set with setFailFast throw PoolExhaustedError instead of
+    // queueing when the pool is full.
+    std::shared_ptr<Conn> getConnection(std::chrono::steady_clock::time_point deadline,
+                                        Priority priority = Priority::kNormal) {
+        std::shared_ptr<Conn> conn;
+        if (tryBorrow(conn, priority)) {
+            return conn;
         }
 
-        auto differ_count = new_idle_count - old_idle_count;
-        if (differ_count > 0) {
-            for (int i = 0; i < differ_count; ++i) {
-                auto conn = std::shared_ptr<Conn>(conn_factory_->createConnection(),
-                                                  [conn_factory = conn_factory_](Conn *p) {
-                                                      conn_factory->destroy(p);
-                                                  });
-                idle_connection_.push_back({conn, time(nullptr)});
-                ++idle_count_;
+        // slow path: the idle stack is empty, so create a connection or block until one is released.
+        // Announce the waiter before reclaiming the thread caches so no releaser parks a connection
+        // in its cache unseen.
+        ++waiting_;
+        if (thread_cache_size_ > 0) {
+            reclaimThreadCaches([](const IdleConnection &) { return true; });
+        }
+        // A new connection is made by a creator thread and handed out like a released one, so a
+        // release during the connect serves this caller and the new connection goes to the next.
+        auto start = metrics_.now();
+        std::unique_lock<Mutex> lock(mutex_);
+        auto admitted = admits(priority, 0);
+        if (admitted && popIdle(conn)) {
+            --waiting_;
+            recordBorrow(conn, start);
+            return conn;
+        }
+        if (static_cast<int>(priority) < fail_fast_below_ && (!admitted || counted() >= max_count_)) {
+            --waiting_;
+            throw PoolExhaustedError();
+        }
+        if (refusedByBackend(admitted)) {
+            --waiting_;
+            throw BackendDownError();
+        }
+        auto waiter = std::make_shared<Waiter>();
+        waiter->priority = priority;
+        waiter->request = admitted ? requestCreate() : nullptr;
+        enqueue(waiter);
+        while (!waiter->ready) {
+            if (waiter->cv.wait_until(lock, deadline) == std::cv_status::timeout && !waiter->ready) {
+                waiters_.erase(std::find(waiters_.begin(), waiters_.end(), waiter));
+                --waiting_;
+                recordWait(waiter->since);
+                metrics_.add(PoolCounter::kTimeouts);
+                throw AcquireTimeoutError();
             }
-        } else if (differ_count < 0) {
-            for (int i = 0; i < abs(differ_count) && !idle_connection_.empty(); ++i) {
-                idle_connection_.pop_back();
-                --idle_count_;
+        }
+        if (waiter->error) {
+            std::rethrow_exception(waiter->error);
+        }
+        return std::move(waiter->conn);
+    }
+
+    // Never blocks and never connects on this thread. The callback runs right away here only if a
+    // connection is idle or the borrow fails at once. Otherwise it is queued and runs on whichever
+    // thread serves it: a creator thread with the connection it made or the connect error, a
+    // thread releasing a connection, the pool's maintenance thread after it frees room, a thread
+    // resizing the pool or warming it up, or the destructor with an error. Keep it short.
+    void acquireAsync(AcquireCallback callback) {
+        std::shared_ptr<Conn> conn;
+        try {
+            if (!acquireOrEnqueue(conn, callback)) {
+                return;
             }
+        } catch (...) {
+            callback(nullptr, std::current_exception());
+            return;
         }
+        callback(std::move(conn), nullptr);
     }
 
-    auto getConnection() {
-        std::unique_lock<std::mutex> lock(mutex_);
-        cv_.wait_for(lock, std::chrono::seconds(timeout_),
-                     [this] { return idle_count_ > 0 || idle_count_ + busy_count_ < max_count_; });
-        if (idle_count_ > 0) {
-            --idle_count_;
-            ++busy_count_;
-            auto conn = idle_connection_.back().first;
-            idle_connection_.pop_back();
-            return conn;
-        } else if (idle_count_ + busy_count_ < max_count_) {
-            auto conn = std::shared_ptr<Conn>(conn_factory_->createConnection(),
-                                              [conn_factory = conn_factory_](Conn *p) { conn_factory->destroy(p); });
-            ++busy_count_;
-            return conn;
+    ConnBatchGuard<ConnectionPool> acquireMany(int n, BatchGrant grant = BatchGrant::kAll) {
+        return acquireMany(n, std::chrono::steady_clock::now() + std::chrono::seconds(timeout_), grant);
+    }
+
+    ConnBatchGuard<ConnectionPool> acquireMany(int n, std::chrono::milliseconds timeout,
+                                               BatchGrant grant = BatchGrant::kAll) {
+        return acquireMany(n, std::chrono::steady_clock::now() + timeout, grant);
+    }
+
+    // Borrows n connections for a fan-out under one lock. With kAll a caller that cannot have all
+    // of them queues as one waiter, and connections released meanwhile are collected for it inside
+    // the pool until it has n; it never holds part of a set, so callers cannot deadlock each other
+    // on partial sets. With kPartial it gets what is idle, waiting only while that is nothing.
+    ConnBatchGuard<ConnectionPool> acquireMany(int n, std::chrono::steady_clock::time_point deadline,
+                                               BatchGrant grant = BatchGrant::kAll) {
+        std::vector<std::shared_ptr<Conn>> conns;
+        if (n <= 0) {
+            return ConnBatchGuard<ConnectionPool>(*this, std::move(conns));
+        }
+        ++waiting_;
+        if (thread_cache_size_ > 0) {
+            reclaimThreadCaches([](const IdleConnection &) { return true; });
+        }
+        auto start = metrics_.now();
+        std::unique_lock<Mutex> lock(mutex_);
+        std::shared_ptr<Conn> conn;
+        while (static_cast<int>(conns.size()) < n && admits(Priority::kNormal, 0) && popIdle(conn)) {
+            conns.push_back(std::move(conn));
+        }
+        if (static_cast<int>(conns.size()) == n || (grant == BatchGrant::kPartial && !conns.empty())) {
+            --waiting_;
+            for (auto &borrowed : conns) {
+                recordBorrow(borrowed, start);
+            }
+            return ConnBatchGuard<ConnectionPool>(*this, std::move(conns));
+        }
+        auto waiter = std::make_shared<Waiter>();
+        if (grant == BatchGrant::kAll) {
+            if (n > max_count_) {
+                --waiting_;
+                returnIdle(lock, conns);
+                throw std::runtime_error("acquireMany more than max count");
+            }
+            waiter->wanted = n;
+            waiter->batch = std::move(conns);
+        }
+        waiter->request = requestCreate();
+        enqueue(waiter);
+        for (int i = static_cast<int>(waiter->batch.size()) + 1; i < waiter->wanted; ++i) {
+            auto request = requestCreate();
+            if (request == nullptr) {
+                break;
+            }
+            waiter->batch_requests.push_back(std::move(request));
+        }
+        while (!waiter->ready) {
+            if (waiter->cv.wait_until(lock, deadline) == std::cv_status::timeout && !waiter->ready) {
+                waiters_.erase(std::find(waiters_.begin(), waiters_.end(), waiter));
+                --waiting_;
+                recordWait(waiter->since);
+                metrics_.add(PoolCounter::kTimeouts);
+                returnIdle(lock, waiter->batch);
+                throw AcquireTimeoutError();
+            }
+        }
+        if (waiter->error) {
+            std::rethrow_exception(waiter->error);
+        }
+        if (waiter->conn != nullptr) {
+            conns.push_back(std::move(waiter->conn));
+            // kPartial: top up from what is idle, unless that belongs to later waiters
+            while (waiters_.empty() && static_cast<int>(conns.size()) < n && admits(Priority::kNormal, 0) &&
+                   popIdle(conn)) {
+                recordBorrow(conn, waiter->since);
+                conns.push_back(std::move(conn));
+            }
+        } else {
+            conns = std::move(waiter->batch);
+        }
+        return ConnBatchGuard<ConnectionPool>(*this, std::move(conns));
+    }
+
+    std::future<std::shared_ptr<Conn>> acquireFuture() {
+        auto promise = std::make_shared<std::promise<std::shared_ptr<Conn>>>();
+        auto future = promise->get_future();
+        acquireAsync([promise](std::shared_ptr<Conn> conn, std::exception_ptr error) {
+            if (error) {
+                promise->set_exception(error);
+            } else {
+                promise->set_value(std::move(conn));
+            }
+        });
+        return future;
+    }
+
+    // Runs every op(Conn &) of ops back to back on one borrowed connection. When an op throws on a
+    // connection that then fails checkValid, the connection is recovered and the batch resumes from
+    // that op; any other exception stops the batch and is rethrown.
+    template<typename Range>
+    void withConnection(Range &&ops) {
+        auto conn = getConnection();
+        try {
+            for (auto &op : ops) {
+                runResuming(conn, op);
+            }
+        } catch (...) {
+            if (conn != nullptr) {
+                releaseConnecion(std::move(conn));
+            }
+            throw;
+        }
+        releaseConnecion(std::move(conn));
+    }
+
+    // Runs op(Conn &) and returns once it has run, or rethrows what it threw. Ops that threads submit
+    // at the same time share one borrow: the first thread runs them all, its own included, like
+    // withConnection, while the others wait.
+    void coalesce(std::function<void(Conn &)> op) {
+        CoalescedOperation operation(std::move(op));
+        std::unique_lock<Mutex> lock(coalesce_mutex_);
+        coalesced_.push_back(&operation);
+        coalesce_cv_.wait(lock, [this, &operation] { return operation.done || !coalescing_; });
+        if (!operation.done) {
+            coalescing_ = true;
+            runCoalesced(lock);
+        }
+        if (operation.error) {
+            std::rethrow_exception(operation.error);
+        }
+    }
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+    class AcquireAwaitable {
+    public:
+        explicit AcquireAwaitable(ConnectionPool &pool) : pool_(pool) {}
+
+        bool await_ready() {
+            return pool_.tryBorrow(conn_);
+        }
+
+        // The coroutine may be resumed on the releasing thread before this returns, so members
+        // must not be touched once the waiter is queued.
+        bool await_suspend(std::coroutine_handle<> handle) {
+            AcquireCallback resume = [this, handle](std::shared_ptr<Conn> conn, std::exception_ptr error) {
+                conn_ = std::move(conn);
+                error_ = error;
+                handle.resume();
+            };
+            try {
+                return !pool_.acquireOrEnqueue(conn_, resume);
+            } catch (...) {
+                error_ = std::current_exception();
+                return false;
+            }
+        }
+
+        std::shared_ptr<Conn> await_resume() {
+            if (error_) {
+                std::rethrow_exception(error_);
+            }
+            return std::move(conn_);
         }
 
-        throw std::runtime_error("getConnection timeout");
+    private:
+        ConnectionPool &pool_;
+        std::shared_ptr<Conn> conn_;
+        std::exception_ptr error_;
+    };
+
+    // co_await pool.acquire() suspends the coroutine, not the thread, while the pool is exhausted.
+    AcquireAwaitable acquire() {
+        return AcquireAwaitable(*this);
     }
+#endif
 
+    // A new connection for a borrower to use in place of the dead one it holds and drops, which
+    // is counted closed. The in-place overload below also keeps the borrow's hold time.
     auto recoverConnection() {
-        auto conn = std::shared_ptr<Conn>(conn_factory_->createConnection(),
-                                          [conn_factory = conn_factory_](Conn *p) { conn_factory->destroy(p); });
+        auto recovered = createConnection();
+        if (kMetrics) {
+            deleterOf(recovered)->borrowed = metrics_.now();
+        }
+        metrics_.add(PoolCounter::kRecoveries);
+        metrics_.add(PoolCounter::kDestroys);
+        return recovered;
+    }
 
-        return conn;
+    void recoverConnection(std::shared_ptr<Conn> &conn) {
+        auto recovered = createConnection();
+        if (kMetrics && conn != nullptr) {
+            // the borrow goes on, so does its hold time
+            deleterOf(recovered)->borrowed = deleterOf(conn)->borrowed;
+        }
+        conn = std::move(recovered);
+        metrics_.add(PoolCounter::kRecoveries);
+        metrics_.add(PoolCounter::kDestroys);
     }
 
-    void releaseConnecion(const std::shared_ptr<Conn> &conn, bool destroy = false) {
-        std::lock_guard<std::mutex> guard(mutex_);
-        if (idle_count_ + busy_count_ <= max_count_ && !destroy) {
-            idle_connection_.push_back({conn, time(nullptr)});
+    void releaseConnecion(std::shared_ptr<Conn> conn, bool destroy = false) {
+        auto deleter = kMetrics ? deleterOf(conn) : nullptr;
+        if (deleter != nullptr) {
+            metrics_.record(PoolLatency::kHoldTime, deleter->borrowed);
+        }
+        if (destroy && reset(conn, typename Hooks::has_reset())) {
+            destroy = false;
+        }
+        if (!destroy && retireStale(conn)) {
+            destroy = true;
+            metrics_.add(PoolCounter::kRenewals);
+        }
+        if (counted() <= max_count_ && !destroy) {
+            if ((waiting_ > 0 && handOff(conn)) || pushThreadCache(conn)) {
+                return;
+            }
             ++idle_count_;
+            idle_connection_.push({std::move(conn), Clock::now()});
             --busy_count_;
         } else {
             --busy_count_;
+            --total_count_;
+            metrics_.add(PoolCounter::kDestroys);
         }
 
-        cv_.notify_one();
+        // waiting_ is checked after the push, and a waiter re-checks the stack after announcing
+        // itself, so either the waiter sees the connection or we see the waiter
+        if (waiting_ > 0) {
+            notifyWaiters();
+        }
+    }
+
+    // Gives back a set of connections under one lock; ConnBatchGuard calls it.
+    void releaseMany(std::vector<std::shared_ptr<Conn>> conns, bool destroy = false) {
+        std::vector<bool> retired;
+        for (auto &conn : conns) {
+            auto deleter = kMetrics ? deleterOf(conn) : nullptr;
+            if (deleter != nullptr) {
+                metrics_.record(PoolLatency::kHoldTime, deleter->borrowed);
+            }
+            retired.push_back(!destroy && retireStale(conn));
+        }
+        {
+            std::unique_lock<Mutex> lock(mutex_);
+            for (std::size_t i = 0; i < conns.size(); ++i) {
+                auto &conn = conns[i];
+                if (!retired[i] && counted() <= max_count_ &&
+                    (!destroy || reset(conn, typename Hooks::has_reset()))) {
+                    if (!waiters_.empty() && admits(waiters_.front()->priority, 1)) {
+                        serveFront(lock, std::move(conn));
+                        continue;
+                    }
+                    ++idle_count_;
+                    idle_connection_.push({std::move(conn), Clock::now()});
+                    --busy_count_;
+                } else {
+                    --busy_count_;
+                    --total_count_;
+                    metrics_.add(PoolCounter::kDestroys);
+                    if (retired[i]) {
+                        metrics_.add(PoolCounter::kRenewals);
+                    }
+                }
+            }
+            // room freed by destroyed connections
+            serveWaiters(lock);
+        }
+        // the destroyed connections close here, outside the lock
     }
 
 private:
-    void initPool() {
-        for (int i = 0; i < max_count_; ++i) {
-            auto conn = std::shared_ptr<Conn>(conn_factory_->createConnection(),
-                                              [conn_factory = conn_factory_](Conn *p) { conn_factory->destroy(p); });
-            idle_connection_.push_back({conn, time(nullptr)});
+    // stamped with Clock, in milliseconds
+    using IdleConnection = std::pair<std::shared_ptr<Conn>, int64_t>;
+    // batches one coalescing thread runs before it hands the rest to a waiting one
+    static constexpr int kCoalesceRounds = 4;
+
+    struct CoalescedOperation {
+        explicit CoalescedOperation(std::function<void(Conn &)> op) : op(std::move(op)) {
+        }
+
+        std::function<void(Conn &)> op;
+        std::exception_ptr error;
+        bool done{false};
+    };
+
+    // Runs op on conn. If it throws and conn fails checkValid, recovers conn and runs op again on
+    // the new one; if even that fails, conn goes back destroyed and is left empty.
+    template<typename Operation>
+    void runResuming(std::shared_ptr<Conn> &conn, Operation &op) {
+        try {
+            op(*conn);
+            return;
+        } catch (...) {
+            if (checkValid(conn)) {
+                throw;
+            }
+        }
+        try {
+            recoverConnection(conn);
+        } catch (...) {
+            releaseConnecion(std::move(conn), true);
+            throw;
+        }
+        op(*conn);
+    }
+
+    // Runs the queued operations on one connection until none are left, or for kCoalesceRounds
+    // batches, then wakes a waiter to take over. Called with coalesce_mutex_ held through lock, and
+    // returns with it released.
+    void runCoalesced(std::unique_lock<Mutex> &lock) {
+        std::shared_ptr<Conn> conn;
+        for (int round = 0; round < kCoalesceRounds && !coalesced_.empty(); ++round) {
+            std::vector<CoalescedOperation *> batch(coalesced_.begin(), coalesced_.end());
+            coalesced_.clear();
+            lock.unlock();
+            std::exception_ptr borrow_error;
+            for (auto operation : batch) {
+                if (conn == nullptr && !borrow_error) {
+                    try {
+                        conn = getConnection();
+                    } catch (...) {
+                        borrow_error = std::current_exception();
+                    }
+                }
+                if (conn == nullptr) {
+                    operation->error = borrow_error;
+                    continue;
+                }
+                try {
+                    runResuming(conn, operation->op);
+                } catch (...) {
+                    operation->error = std::current_exception();
+                }
+            }
+            lock.lock();
+            for (auto operation : batch) {
+                operation->done = true;
+            }
+            coalesce_cv_.notify_all();
+        }
+        coalescing_ = false;
+        // operations queued after the last batch wait for a new coalescing thread
+        coalesce_cv_.notify_all();
+        lock.unlock();
+        if (conn != nullptr) {
+            releaseConnecion(std::move(conn));
+        }
+    }
+    // max_idle_time_ is split into this many wheel ticks; the default 300s gives 5s ticks
+    static constexpr int kWheelSpan = 60;
+    static constexpr int kWheelTick = 300 * 1000 / kWheelSpan;
+
+    // Sets max_count_ and closes the idle connections above it on the maintenance thread, since
+    // shrinking may be driven by a timer job; with fill, also connects up to it.
+    void resize(int count, bool fill) {
+        reclaimThreadCaches([](const IdleConnection &) { return true; });
+        int create_count = 0;
+        int closed = 0;
+        {
+            std::lock_guard<Mutex> guard(mutex_);
+            max_count_ = count;
+            auto differ_count = max_count_ - counted();
+            if (differ_count > 0 && fill) {
+                // reserve the slots now, connect after unlocking
+                create_count = differ_count;
+                total_count_ += create_count;
+            } else if (differ_count < 0) {
+                IdleConnection idle;
+                for (; closed < -differ_count && idle_connection_.pop(idle); ++closed) {
+                    --idle_count_;
+                    --total_count_;
+                    closing_.push_back(std::move(idle));
+                }
+            }
+        }
+        if (closed > 0) {
+            metrics_.add(PoolCounter::kDestroys, closed);
+            maintain(kClose);
+        }
+
+        std::vector<std::shared_ptr<Conn>> created;
+        std::exception_ptr error;
+        try {
+            createConnections(created, create_count);
+        } catch (...) {
+            error = std::current_exception();
+            total_count_ -= create_count - static_cast<int>(created.size());
+        }
+        for (auto &conn : created) {
             ++idle_count_;
+            idle_connection_.push({std::move(conn), Clock::now()});
+        }
+        // new connections, or room for queued borrowers to connect
+        if (waiting_ > 0) {
+            notifyWaiters();
         }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
 
-        connection_checker_ = std::make_shared<std::thread>([this] {
-            while (checking_) {
-                std::this_thread::sleep_for(std::chrono::seconds(5));
-                std::lock_guard<std::mutex> guard(mutex_);
-                auto now = time(nullptr);
-                if (idle_count_ > 0 && idle_count_ + busy_count_ > 1) {
-                    for (auto iter = idle_connection_.begin(); iter != idle_connection_.end() - 1; ++iter) {
-                        if (now - iter->second >= max_idle_time_) {
-                            --idle_count_;
-                            idle_connection_.pop_front();
-                        }
+    void recordWait(std::chrono::steady_clock::time_point since) {
+        wait_total_us_ += std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - since).count();
+        ++wait_count_;
+    }
+
+    // Runs on the maintenance thread: one autoscale sample, applied through resize() without
+    // connecting, since queued borrowers start the connects they need.
+    void autoscale() {
+        auto wait_total = wait_total_us_.exchange(0);
+        auto wait_count = wait_count_.exchange(0);
+        ScaleEvent event;
+        event.average_wait = std::chrono::microseconds(wait_count > 0 ? wait_total / wait_count : 0);
+        event.waiting = waiting_;
+        auto busy = busy_count_ - cachedCount();
+        ScaleListener listener;
+        {
+            std::lock_guard<Mutex> guard(mutex_);
+            event.from = max_count_;
+            event.to = autoscale_->decide(event.from, busy, event.waiting, event.average_wait);
+            listener = scale_listener_;
+        }
+        if (event.to != event.from) {
+            event.direction = event.to > event.from ? ScaleDirection::kGrow : ScaleDirection::kShrink;
+            event.utilization = event.from > 0 ? static_cast<double>(busy) / event.from : 1.0;
+            resize(event.to, false);
+            if (listener) {
+                listener(event);
+            }
+        }
+    }
+
+    // Where replacing a stale connection is at: its successor was requested, then is open.
+    enum Renewal {
+        kNotRenewed, kRenewing, kRenewed
+    };
+
+    // Deleter of every pooled connection. It also keeps per-connection bookkeeping, reached from
+    // the handle through std::get_deleter, so no side table is needed.
+    struct ConnectionDeleter {
+        ConnectionDeleter(std::shared_ptr<ConnFactory> conn_factory, int64_t created, double jitter,
+                          uint64_t generation, std::shared_ptr<std::atomic<int>> renewed)
+                : conn_factory(std::move(conn_factory)), created(created), jitter(jitter),
+                  generation(generation), renewed(std::move(renewed)) {
+        }
+
+        ConnectionDeleter(const ConnectionDeleter &rhs)
+                : conn_factory(rhs.conn_factory), borrowed(rhs.borrowed), created(rhs.created),
+                  jitter(rhs.jitter), generation(rhs.generation), renewed(rhs.renewed),
+                  renewal(rhs.renewal.load()) {
+        }
+
+        void operator()(Conn *p) const {
+            // however it closes, its successor now counts in its place
+            if (renewal == kRenewed) {
+                --*renewed;
+            }
+            conn_factory->destroy(p);
+        }
+
+        std::shared_ptr<ConnFactory> conn_factory;
+        std::chrono::steady_clock::time_point borrowed;
+        // Clock time of the connect, and the share of lifetime_jitter_ its max lifetime is cut by
+        int64_t created;
+        double jitter;
+        // the generation_ of conn_factory, which is replaced along with the factory
+        uint64_t generation;
+        // the pool's count of kRenewed connections, which may outlive the pool
+        std::shared_ptr<std::atomic<int>> renewed;
+        // set by a creator thread while another thread may hold the connection
+        std::atomic<int> renewal{kNotRenewed};
+    };
+
+    static ConnectionDeleter *deleterOf(const std::shared_ptr<Conn> &conn) {
+        return std::get_deleter<ConnectionDeleter>(conn);
+    }
+
+    ConnectionDeleter newDeleter(std::shared_ptr<ConnFactory> conn_factory, uint64_t generation) {
+        thread_local std::minstd_rand random(std::random_device{}());
+        std::uniform_real_distribution<double> share(0, 1);
+        return ConnectionDeleter(std::move(conn_factory), Clock::now(), share(random), generation, renewed_);
+    }
+
+    static const std::shared_ptr<ConnFactory> &factoryOf(const std::shared_ptr<Conn> &conn) {
+        return deleterOf(conn)->conn_factory;
+    }
+
+    // Runs the connect create does under the creation governor, if there is one.
+    template<typename Create>
+    auto governed(int count, Create create) -> decltype(create()) {
+        auto governor = std::atomic_load(&governor_);
+        if (governor == nullptr) {
+            return create();
+        }
+        governor->begin(std::chrono::steady_clock::now() + std::chrono::seconds(timeout_), count);
+        try {
+            auto result = create();
+            governor->finish(true);
+            return result;
+        } catch (...) {
+            governor->finish(false);
+            throw;
+        }
+    }
+
+    bool backendDown() {
+        auto governor = std::atomic_load(&governor_);
+        return governor != nullptr && governor->down();
+    }
+
+    // Whether a borrower that found nothing idle needs a connect the down backend would refuse at
+    // once. One the pool cannot connect for anyway only waits for a release, and queues as usual.
+    // Called with mutex_ held.
+    bool refusedByBackend(bool admitted) {
+        return admitted && counted() < max_count_ && backendDown();
+    }
+
+    std::shared_ptr<Conn> createConnection() {
+        auto start = metrics_.now();
+        // a connection tagged with an older generation than its factory's is only replaced once more
+        auto generation = generation_.load();
+        auto factory = std::atomic_load(&conn_factory_);
+        std::shared_ptr<Conn> conn(governed(1, [&factory] { return factory->createConnection(); }),
+                                   newDeleter(factory, generation));
+        metrics_.record(PoolLatency::kCreateTime, start);
+        metrics_.add(PoolCounter::kCreates);
+        return conn;
+    }
+
+    // Fills conns up to n new connections, one createConnection call at a time, or in as few
+    // createConnections calls as it takes when the factory has that hook. Throws on the first
+    // failure, leaving the connections made so far in conns.
+    void createConnections(std::vector<std::shared_ptr<Conn>> &conns, std::size_t n) {
+        while (conns.size() < n) {
+            createMore(conns, n - conns.size(), typename Hooks::has_create_connections());
+        }
+    }
+
+    void createMore(std::vector<std::shared_ptr<Conn>> &conns, std::size_t, std::false_type) {
+        conns.push_back(createConnection());
+    }
+
+    void createMore(std::vector<std::shared_ptr<Conn>> &conns, std::size_t n, std::true_type) {
+        auto start = metrics_.now();
+        auto count = static_cast<int>(n);
+        auto generation = generation_.load();
+        auto factory = std::atomic_load(&conn_factory_);
+        auto created = governed(count, [&factory, count] { return factory->createConnections(count); });
+        if (created.empty()) {
+            throw std::runtime_error("createConnections returned no connection");
+        }
+        auto elapsed = (metrics_.now() - start) / created.size();
+        for (std::size_t i = 0; i < created.size(); ++i) {
+            if (i >= n) {
+                factory->destroy(created[i]);
+                continue;
+            }
+            conns.emplace_back(created[i], newDeleter(factory, generation));
+            metrics_.record(PoolLatency::kCreateTime, elapsed);
+            metrics_.add(PoolCounter::kCreates);
+        }
+    }
+
+    bool reset(const std::shared_ptr<Conn> &, std::false_type) {
+        return false;
+    }
+
+    bool reset(const std::shared_ptr<Conn> &conn, std::true_type) {
+        return factoryOf(conn)->reset(conn.get());
+    }
+
+    bool isCheap(const std::shared_ptr<Conn> &, std::false_type) {
+        return false;
+    }
+
+    bool isCheap(const std::shared_ptr<Conn> &conn, std::true_type) {
+        return factoryOf(conn)->isCheap(conn.get());
+    }
+
+    // Moves the live connections of batch to its front and returns where they end.
+    typename std::vector<IdleConnection>::iterator partitionValid(std::vector<IdleConnection> &batch,
+                                                                  std::false_type) {
+        return std::partition(batch.begin(), batch.end(), [this](const IdleConnection &idle) {
+            return checkValid(idle.first);
+        });
+    }
+
+    typename std::vector<IdleConnection>::iterator partitionValid(std::vector<IdleConnection> &batch,
+                                                                  std::true_type) {
+        std::vector<Conn *> conns;
+        for (auto &idle : batch) {
+            conns.push_back(idle.first.get());
+        }
+        std::unique_ptr<bool[]> valid(new bool[conns.size()]());
+        auto start = metrics_.now();
+        // one call per run of connections made by the same factory
+        for (std::size_t begin = 0, end; begin < conns.size(); begin = end) {
+            auto &factory = factoryOf(batch[begin].first);
+            for (end = begin + 1; end < conns.size() && factoryOf(batch[end].first) == factory; ++end) {
+            }
+            factory->checkValidBatch(conns.data() + begin, end - begin, valid.get() + begin);
+        }
+        auto elapsed = (metrics_.now() - start) / std::max<std::size_t>(conns.size(), 1);
+        std::size_t live = 0;
+        for (std::size_t i = 0; i < batch.size(); ++i) {
+            metrics_.record(PoolLatency::kCheckValidTime, elapsed);
+            if (valid[i]) {
+                std::swap(batch[i], batch[live++]);
+            }
+        }
+        return batch.begin() + live;
+    }
+
+    // Counts a borrow handed to a caller who started asking at since; none means it did not wait.
+    void recordBorrow(const std::shared_ptr<Conn> &conn, std::chrono::steady_clock::time_point since = {}) {
+        if (kMetrics) {
+            auto now = metrics_.now();
+            deleterOf(conn)->borrowed = now;
+            metrics_.record(PoolLatency::kAcquireWait, since == decltype(since)() ? now - now : now - since);
+            metrics_.add(PoolCounter::kAcquires);
+        }
+    }
+
+    // A connect running on a creator thread on behalf of a waiter.
+    struct PendingCreate {
+        bool done{false};
+        std::exception_ptr error;
+        // a successor for a stale connection, made on top of max count instead of in a reserved slot
+        bool renewal{false};
+        std::weak_ptr<Conn> predecessor;
+    };
+
+    // A blocked caller (woken through cv) or a queued callback.
+    struct Waiter {
+        AcquireCallback callback;
+        ConditionVariable cv;
+        bool ready{false};
+        std::shared_ptr<Conn> conn;
+        std::exception_ptr error;
+        std::shared_ptr<PendingCreate> request;
+        std::chrono::steady_clock::time_point since{std::chrono::steady_clock::now()};
+        Priority priority{Priority::kNormal};
+        // acquireMany with kAll: the connections collected so far, until there are wanted of them
+        int wanted{1};
+        std::vector<std::shared_ptr<Conn>> batch;
+        // the connects started for the rest of the batch besides request; one failing fails the waiter
+        std::vector<std::shared_ptr<PendingCreate>> batch_requests;
+    };
+
+    // Takes an idle connection if there is one; otherwise queues callback and, if the pool may
+    // grow, starts a connect for it.
+    bool acquireOrEnqueue(std::shared_ptr<Conn> &conn, AcquireCallback &callback) {
+        if (tryBorrow(conn)) {
+            return true;
+        }
+
+        ++waiting_;
+        if (thread_cache_size_ > 0) {
+            reclaimThreadCaches([](const IdleConnection &) { return true; });
+        }
+        auto start = metrics_.now();
+        std::lock_guard<Mutex> guard(mutex_);
+        auto admitted = admits(Priority::kNormal, 0);
+        if (admitted && popIdle(conn)) {
+            --waiting_;
+            recordBorrow(conn, start);
+            return true;
+        }
+        if (refusedByBackend(admitted)) {
+            --waiting_;
+            throw BackendDownError();
+        }
+        auto waiter = std::make_shared<Waiter>();
+        waiter->callback = std::move(callback);
+        waiter->request = admitted ? requestCreate() : nullptr;
+        enqueue(waiter);
+        return false;
+    }
+
+    // Called with mutex_ held: queues waiter behind every waiter of its priority or higher.
+    void enqueue(std::shared_ptr<Waiter> waiter) {
+        auto iter = waiters_.end();
+        while (iter != waiters_.begin() && (*(iter - 1))->priority < waiter->priority) {
+            --iter;
+        }
+        waiters_.insert(iter, std::move(waiter));
+    }
+
+    // total_count_ less the stale connections whose successors are open.
+    int counted() const {
+        return total_count_ - *renewed_;
+    }
+
+    // Whether a borrower of priority may take one more connection, holding held of the busy ones
+    // already: the last reserved_count_ connections are kept for reserved_priority_ and up.
+    bool admits(Priority priority, int held) const {
+        return static_cast<int>(priority) >= reserved_priority_.load(std::memory_order_relaxed) ||
+               busy_count_ - held < max_count_ - reserved_count_;
+    }
+
+    // Called with mutex_ held; the waiter must already be off the queue.
+    std::shared_ptr<Waiter> popWaiter() {
+        auto waiter = std::move(waiters_.front());
+        waiters_.pop_front();
+        --waiting_;
+        return waiter;
+    }
+
+    // Completes a waiter. A callback runs with mutex_ released.
+    void serve(std::unique_lock<Mutex> &lock, std::shared_ptr<Waiter> waiter, std::shared_ptr<Conn> conn,
+               std::exception_ptr error) {
+        recordWait(waiter->since);
+        if (conn != nullptr) {
+            recordBorrow(conn, waiter->since);
+        }
+        for (auto &collected : waiter->batch) {
+            if (!error) {
+                recordBorrow(collected, waiter->since);
+            }
+        }
+        if (waiter->callback) {
+            auto callback = std::move(waiter->callback);
+            lock.unlock();
+            callback(std::move(conn), error);
+            lock.lock();
+        } else {
+            waiter->conn = std::move(conn);
+            waiter->error = error;
+            waiter->ready = true;
+            waiter->cv.notify_one();
+        }
+    }
+
+    // Gives a released connection straight to the oldest waiter, so a thread arriving later
+    // cannot take it first. The connection stays busy. The waiters left behind it may still need
+    // connects started.
+    bool handOff(std::shared_ptr<Conn> &conn) {
+        std::unique_lock<Mutex> lock(mutex_);
+        if (waiters_.empty() || !admits(waiters_.front()->priority, 1)) {
+            return false;
+        }
+        serveFront(lock, std::move(conn));
+        if (!waiters_.empty()) {
+            serveWaiters(lock);
+        }
+        return true;
+    }
+
+    // Gives a busy connection to the oldest waiter. A batch waiter keeps it and stays first in
+    // line until it has collected all it wants. Called with mutex_ held and waiters_ not empty.
+    void serveFront(std::unique_lock<Mutex> &lock, std::shared_ptr<Conn> conn) {
+        auto &front = waiters_.front();
+        if (front->wanted > 1) {
+            front->batch.push_back(std::move(conn));
+            if (static_cast<int>(front->batch.size()) < front->wanted) {
+                if (front->request == nullptr || front->request->done) {
+                    front->request = requestCreate();
+                }
+                return;
+            }
+        }
+        serve(lock, popWaiter(), std::move(conn), nullptr);
+    }
+
+    // Puts busy connections back on the idle wheel, serving queued waiters first.
+    void returnIdle(std::unique_lock<Mutex> &lock, std::vector<std::shared_ptr<Conn>> &conns) {
+        for (auto &conn : conns) {
+            ++idle_count_;
+            idle_connection_.push({std::move(conn), Clock::now()});
+            --busy_count_;
+        }
+        conns.clear();
+        serveWaiters(lock);
+    }
+
+    void notifyWaiters() {
+        std::unique_lock<Mutex> lock(mutex_);
+        serveWaiters(lock);
+    }
+
+    // Hands idle connections to the oldest waiters and, if the pool may grow, starts connects
+    // for the waiters that have none in flight. Called with mutex_ held.
+    void serveWaiters(std::unique_lock<Mutex> &lock) {
+        std::shared_ptr<Conn> conn;
+        while (!waiters_.empty() && admits(waiters_.front()->priority, 0) && popIdle(conn)) {
+            serveFront(lock, std::move(conn));
+            conn = nullptr;
+        }
+        if (counted() < max_count_ && pending_creates_ < create_concurrency_) {
+            for (auto &waiter : waiters_) {
+                // waiters are in priority order, so none after this one may take a connection either
+                if (!admits(waiter->priority, 0)) {
+                    break;
+                }
+                if (waiter->request == nullptr || waiter->request->done) {
+                    waiter->request = requestCreate();
+                    if (waiter->request == nullptr) {
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    // Reserves a slot and queues a connect for a creator thread; nullptr if the pool is full or
+    // create_concurrency_ connects are already running. A successor for predecessor needs no slot.
+    // Called with mutex_ held.
+    std::shared_ptr<PendingCreate> requestCreate(const std::shared_ptr<Conn> &predecessor = nullptr) {
+        auto renewal = predecessor != nullptr;
+        if (stopping_ || (!renewal && counted() >= max_count_) || pending_creates_ >= create_concurrency_) {
+            return nullptr;
+        }
+        if (!renewal) {
+            ++total_count_;
+        }
+        ++pending_creates_;
+        auto request = std::make_shared<PendingCreate>();
+        request->renewal = renewal;
+        request->predecessor = predecessor;
+        create_queue_.push_back(request);
+        if (idle_creators_ == 0 && static_cast<int>(creators_.size()) < create_concurrency_) {
+            creators_.emplace_back([this] { runCreator(); });
+        }
+        create_cv_.notify_one();
+        return request;
+    }
+
+    void runCreator() {
+        std::unique_lock<Mutex> lock(mutex_);
+        while (true) {
+            ++idle_creators_;
+            create_cv_.wait(lock, [this] { return stopping_ || !create_queue_.empty(); });
+            --idle_creators_;
+            if (stopping_) {
+                return;
+            }
+            // one request, or every queued one in a single createConnections call
+            std::vector<std::shared_ptr<PendingCreate>> requests;
+            do {
+                requests.push_back(std::move(create_queue_.front()));
+                create_queue_.pop_front();
+            } while (Hooks::has_create_connections::value && !create_queue_.empty());
+            lock.unlock();
+
+            std::vector<std::shared_ptr<Conn>> conns;
+            std::exception_ptr error;
+            try {
+                createConnections(conns, requests.size());
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            lock.lock();
+            std::vector<std::shared_ptr<Conn>> unneeded;
+            for (std::size_t i = 0; i < requests.size(); ++i) {
+                auto &request = requests[i];
+                --pending_creates_;
+                request->done = true;
+                if (request->renewal && !renewed(request, i < conns.size())) {
+                    if (i < conns.size()) {
+                        unneeded.push_back(std::move(conns[i]));
+                        metrics_.add(PoolCounter::kDestroys);
+                    }
+                    continue;
+                }
+                if (i < conns.size()) {
+                    if (!waiters_.empty() && admits(waiters_.front()->priority, 0)) {
+                        ++busy_count_;
+                        serveFront(lock, std::move(conns[i]));
+                    } else {
+                        ++idle_count_;
+                        idle_connection_.push({std::move(conns[i]), Clock::now()});
                     }
+                    continue;
+                }
+                --total_count_;
+                request->error = error;
+                // fail the waiter this connect was started for
+                auto waiter = std::find_if(waiters_.begin(), waiters_.end(),
+                                           [&request](const std::shared_ptr<Waiter> &w) {
+                                               return w->request == request ||
+                                                      std::find(w->batch_requests.begin(), w->batch_requests.end(),
+                                                                request) != w->batch_requests.end();
+                                           });
+                if (waiter != waiters_.end()) {
+                    auto failed = std::move(*waiter);
+                    waiters_.erase(waiter);
+                    --waiting_;
+                    auto collected = std::move(failed->batch);
+                    failed->batch.clear();
+                    serve(lock, std::move(failed), nullptr, error);
+                    returnIdle(lock, collected);
+                }
+            }
+            if (!unneeded.empty()) {
+                lock.unlock();
+                unneeded.clear();
+                lock.lock();
+            }
+            // create_concurrency_ caps the connects running at once, not how far the pool grows:
+            // waiters queued beyond it get theirs now that these are done
+            serveWaiters(lock);
+        }
+    }
+
+    // Settles a finished successor connect and tells whether its connection joins the pool. Once
+    // open, it counts in place of its predecessor until that closes, or, if the predecessor has
+    // closed already, fills the slot it left when there still is one. Called with mutex_ held.
+    bool renewed(const std::shared_ptr<PendingCreate> &request, bool open) {
+        auto predecessor = request->predecessor.lock();
+        if (predecessor != nullptr) {
+            deleterOf(predecessor)->renewal = open ? kRenewed : kNotRenewed;
+        }
+        if (!open || (predecessor == nullptr && counted() >= max_count_)) {
+            return false;
+        }
+        if (predecessor != nullptr) {
+            ++*renewed_;
+            // it may sit idle, where only renewStale finds it
+            draining_ = true;
+        }
+        ++total_count_;
+        return true;
+    }
+
+    using Magazine = ConnectionMagazine<IdleConnection>;
+
+    // Connections in a thread cache stay counted in busy_count_; getIdleCount/getBusyCount move them
+    // over to idle, so caching and reusing them on the owning thread never touches shared counters.
+    // The lock-free borrow attempt of every acquire path: the thread cache, then the idle wheel
+    // unless someone is already queued.
+    bool tryBorrow(std::shared_ptr<Conn> &conn, Priority priority = Priority::kNormal) {
+        if (!admits(priority, 0)) {
+            return false;
+        }
+        IdleConnection idle;
+        while (popThreadCache(idle) || (waiting_ == 0 && popIdle(idle))) {
+            if (validOnBorrow(idle)) {
+                conn = std::move(idle.first);
+                recordBorrow(conn);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Pings a connection idle for at least validate_on_borrow_ ms, as far as the resolution of
+    // Clock tells, or one the factory's isCheap hook calls cheap, and drops it if dead.
+    bool validOnBorrow(IdleConnection &idle) {
+        auto validate_on_borrow = validate_on_borrow_.load(std::memory_order_relaxed);
+        if (((validate_on_borrow < 0 || Clock::now() - idle.second < validate_on_borrow) &&
+             !isCheap(idle.first, typename Hooks::has_is_cheap())) || checkValid(idle.first)) {
+            return true;
+        }
+        --busy_count_;
+        --total_count_;
+        metrics_.add(PoolCounter::kDestroys);
+        idle.first = nullptr;
+        if (waiting_ > 0) {
+            notifyWaiters();
+        }
+        return false;
+    }
+
+    bool popThreadCache(IdleConnection &idle) {
+        if (thread_cache_size_ <= 0) {
+            return false;
+        }
+        auto magazine = ThreadMagazines<IdleConnection>::local().find(pool_id_);
+        return magazine != nullptr && magazine->pop(idle);
+    }
+
+    bool pushThreadCache(std::shared_ptr<Conn> &conn) {
+        auto thread_cache_size = thread_cache_size_.load();
+        if (thread_cache_size <= 0 || waiting_ > 0) {
+            return false;
+        }
+        auto &local = ThreadMagazines<IdleConnection>::local();
+        auto magazine = local.find(pool_id_);
+        if (magazine == nullptr) {
+            auto created = std::make_shared<Magazine>(pool_id_, [this](std::vector<IdleConnection> &spilled) {
+                spillThreadCache(spilled);
+            });
+            {
+                std::lock_guard<Mutex> guard(mutex_);
+                magazines_.erase(std::remove_if(magazines_.begin(), magazines_.end(),
+                                                [](const std::shared_ptr<Magazine> &m) { return !m->attached(); }),
+                                 magazines_.end());
+                magazines_.push_back(created);
+            }
+            local.add(created);
+            magazine = created.get();
+        }
+
+        std::vector<IdleConnection> spilled;
+        magazine->push({std::move(conn), Clock::now()}, static_cast<std::size_t>(thread_cache_size), spilled);
+        // pairs with the increment of waiting_ before a waiter reclaims the caches
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting_ > 0) {
+            magazine->drain(spilled, [](const IdleConnection &) { return true; });
+        }
+        if (!spilled.empty()) {
+            spillThreadCache(spilled);
+        }
+        return true;
+    }
+
+    void spillThreadCache(std::vector<IdleConnection> &spilled) {
+        for (auto &idle : spilled) {
+            ++idle_count_;
+            idle_connection_.push(std::move(idle));
+            --busy_count_;
+        }
+        if (!spilled.empty() && waiting_ > 0) {
+            notifyWaiters();
+        }
+    }
+
+    std::vector<std::shared_ptr<Magazine>> threadMagazines() {
+        std::lock_guard<Mutex> guard(mutex_);
+        return magazines_;
+    }
+
+    // Never called with mutex_ held: a thread exiting spills its magazine under the magazine lock
+    // and then takes mutex_, so the lock order is magazine before mutex_.
+    template<typename Predicate>
+    void reclaimThreadCaches(Predicate predicate) {
+        std::vector<IdleConnection> reclaimed;
+        for (auto &magazine : threadMagazines()) {
+            magazine->drain(reclaimed, predicate);
+        }
+        spillThreadCache(reclaimed);
+    }
+
+    bool popIdle(std::shared_ptr<Conn> &conn) {
+        IdleConnection idle;
+        if (!popIdle(idle)) {
+            return false;
+        }
+        conn = std::move(idle.first);
+        return true;
+    }
+
+    bool popIdle(IdleConnection &idle) {
+        if (!idle_connection_.pop(idle)) {
+            return false;
+        }
+        ++busy_count_;
+        --idle_count_;
+        return true;
+    }
+
+    void initPool(const PoolOptions &options) {
+        auto start = std::chrono::steady_clock::now();
+        min_idle_ = std::min(options.min_idle, max_count_.load());
+        auto warmup_count = options.warmup == WarmupMode::kLazy ? min_idle_ : max_count_.load();
+        // warm-up connections count against max_count_ from the start, so early borrowers wait for
+        // them instead of starting connects of their own
+        total_count_ += warmup_count;
+        if (options.warmup == WarmupMode::kBackground) {
+            warmup_thread_ = std::thread([this, start, warmup_count, options] {
+                // nobody is left to rethrow to; borrowers connect what the warm-up did not
+                if (warmUp(warmup_count, options.warmup_concurrency)) {
+                    warmup_failed_ = true;
+                } else {
+                    recordStartup(start);
                 }
+            });
+        } else {
+            auto error = warmUp(warmup_count, options.warmup_concurrency);
+            if (error) {
+                std::rethrow_exception(error);
             }
+            recordStartup(start);
+        }
+
+        evict_timer_ = scheduleEviction();
+    }
+
+    uint64_t scheduleEviction() {
+        return TimerService::instance().add(nextEviction(), [this] {
+            maintain(kEvict);
+            return nextEviction();
         });
     }
 
+    std::chrono::steady_clock::time_point nextEviction() const {
+        return std::chrono::steady_clock::now() + std::chrono::milliseconds(idle_connection_.tick());
+    }
+
+    // Runs on the maintenance thread once per wheel tick. Takes back thread cache entries unused
+    // for 5s, then closes idle connections past max_idle_time_, oldest first, while more than
+    // min_idle_ (at least one) remain. Neither step takes mutex_, and connections are closed last.
+    void evictIdle() {
+        auto now = Clock::now();
+        reclaimThreadCaches([now](const IdleConnection &idle) { return now - idle.second >= 5000; });
+        std::vector<IdleConnection> expired;
+        idle_connection_.expire(now - max_idle_time_ * 1000LL, [this, &expired](IdleConnection &idle) {
+            if (total_count_ <= std::max(min_idle_, 1)) {
+                return false;
+            }
+            --idle_count_;
+            --total_count_;
+            expired.push_back(std::move(idle));
+            return true;
+        });
+        metrics_.add(PoolCounter::kEvictions, expired.size());
+        metrics_.add(PoolCounter::kDestroys, expired.size());
+        // kept entries went back on the wheel and evictions freed capacity
+        if (waiting_ > 0) {
+            notifyWaiters();
+        }
+        expired.clear();
+    }
+
+    // Made by a replaced factory, or past its max lifetime, cut by its own share of lifetime_jitter_
+    // so that connections made together do not all age at once.
+    bool stale(const std::shared_ptr<Conn> &conn, int64_t now) {
+        auto lifetime = max_lifetime_.load(std::memory_order_relaxed);
+        auto generation = generation_.load(std::memory_order_relaxed);
+        if (lifetime <= 0 && generation == 0) {
+            return false;
+        }
+        auto deleter = deleterOf(conn);
+        return deleter->generation != generation || (lifetime > 0 && now - deleter->created >=
+                lifetime - static_cast<int64_t>(lifetime_jitter_ * deleter->jitter));
+    }
+
+    // On release: true if conn's successor is open, so it must close. A stale one without one
+    // stays in use until its own is open.
+    bool retireStale(const std::shared_ptr<Conn> &conn) {
+        if (renewed_->load(std::memory_order_relaxed) > 0 && deleterOf(conn)->renewal == kRenewed) {
+            return true;
+        }
+        if (stale(conn, Clock::now())) {
+            renew(conn);
+        }
+        return false;
+    }
+
+    // Starts a connect for the successor of stale conn, held by the caller, unless one was started.
+    void renew(const std::shared_ptr<Conn> &conn) {
+        auto deleter = deleterOf(conn);
+        if (deleter->renewal == kNotRenewed) {
+            std::lock_guard<Mutex> guard(mutex_);
+            if (requestCreate(conn) != nullptr) {
+                deleter->renewal = kRenewing;
+            }
+        }
+        // conn goes back idle stale, so the next renewStale pass must look for it
+        if (!draining_.load(std::memory_order_relaxed)) {
+            draining_ = true;
+        }
+    }
+
+    // Runs on the maintenance thread while connections may be aged or were made by a replaced
+    // factory: closes the idle connections whose successors are open and starts successors for the
+    // other stale ones.
+    void renewStale() {
+        if (max_lifetime_ > 0 || draining_.exchange(false)) {
+            auto now = Clock::now();
+            reclaimThreadCaches([this, now](const IdleConnection &idle) { return stale(idle.first, now); });
+            std::vector<IdleConnection> retired;
+            bool found = false;
+            idle_connection_.sweep(now, validation_batch_,
+                                   [this, now, &retired, &found](std::vector<IdleConnection> &batch) {
+                for (auto iter = batch.begin(); iter != batch.end();) {
+                    if (deleterOf(iter->first)->renewal == kRenewed) {
+                        retired.push_back(std::move(*iter));
+                        iter = batch.erase(iter);
+                        continue;
+                    }
+                    if (stale(iter->first, now)) {
+                        found = true;
+                        renew(iter->first);
+                    }
+                    ++iter;
+                }
+            });
+            if (found) {
+                draining_ = true;
+            }
+            auto count = static_cast<int>(retired.size());
+            idle_count_ -= count;
+            total_count_ -= count;
+            metrics_.add(PoolCounter::kRenewals, count);
+            metrics_.add(PoolCounter::kDestroys, count);
+            if (waiting_ > 0) {
+                notifyWaiters();
+            }
+        }
+    }
+
+    // Called with mutex_ held.
+    void startRenewing() {
+        if (renew_timer_ == 0) {
+            renew_timer_ = TimerService::instance().add(std::chrono::steady_clock::now() + renewInterval(), [this] {
+                maintain(kRenew);
+                return std::chrono::steady_clock::now() + renewInterval();
+            });
+        }
+    }
+
+    std::chrono::milliseconds renewInterval() const {
+        return std::chrono::milliseconds(std::max<int64_t>(max_lifetime_ / kWheelSpan, 1000));
+    }
+
+    // Runs on the maintenance thread: pings the connections idle for validation_interval_ seconds
+    // or more, validation_batch_ at a time and off the borrow path, and starts replacements for the
+    // dead ones so borrowers find live connections waiting.
+    void validateIdle() {
+        auto interval = validation_interval_.load();
+        if (interval > 0) {
+            int dead = 0;
+            idle_connection_.sweep(Clock::now() - interval * 1000LL, validation_batch_,
+                                   [this, &dead](std::vector<IdleConnection> &batch) {
+                auto alive = partitionValid(batch, typename Hooks::has_check_valid_batch());
+                auto count = static_cast<int>(batch.end() - alive);
+                idle_count_ -= count;
+                total_count_ -= count;
+                metrics_.add(PoolCounter::kDestroys, count);
+                dead += count;
+                batch.erase(alive, batch.end());
+            });
+            if (dead > 0) {
+                std::lock_guard<Mutex> guard(mutex_);
+                for (int i = 0; i < dead; ++i) {
+                    if (requestCreate() == nullptr) {
+                        break;
+                    }
+                }
+            }
+            if (waiting_ > 0) {
+                notifyWaiters();
+            }
+        }
+    }
+
+    // Periodic work, run on the pool's maintenance thread. The timer jobs only raise these bits, so
+    // a slow ping or close never holds up the process-wide timer thread and the clock it drives.
+    enum Maintenance {
+        kEvict = 1, kValidate = 2, kRenew = 4, kAutoscale = 8, kClose = 16
+    };
+
+    // Queues task, which runs once however often it is queued meanwhile.
+    void maintain(Maintenance task) {
+        std::lock_guard<Mutex> guard(mutex_);
+        if (stopping_) {
+            return;
+        }
+        maintenance_ |= task;
+        wakeMaintainer();
+    }
+
+    // Called with mutex_ held.
+    void wakeMaintainer() {
+        if (maintenance_driver_) {
+            maintenance_driver_();
+            return;
+        }
+        if (!maintainer_.joinable()) {
+            maintainer_ = std::thread([this] { runMaintainer(); });
+        }
+        maintain_cv_.notify_one();
+    }
+
+    void runMaintainer() {
+        std::unique_lock<Mutex> lock(mutex_);
+        while (true) {
+            maintain_cv_.wait(lock, [this] { return stopping_ || maintenance_ != 0; });
+            if (stopping_) {
+                return;
+            }
+            lock.unlock();
+            runMaintenance();
+            lock.lock();
+        }
+    }
+
+    // Creates count already reserved connections on up to concurrency threads, including this
+    // one, each taking one at a time or, with createConnections, an equal share at once. Stops at
+    // the first failure and gives back the reservations it did not use.
+    std::exception_ptr warmUp(int count, int concurrency) {
+        std::atomic<int> remaining{count};
+        std::exception_ptr error;
+        std::mutex error_mutex;
+        auto chunk = Hooks::has_create_connections::value ? std::max(count / std::max(concurrency, 1), 1) : 1;
+        auto worker = [this, chunk, &remaining, &error, &error_mutex] {
+            int claimed;
+            while (!stopping_ && (claimed = std::min(chunk, remaining.fetch_sub(chunk))) > 0) {
+                std::vector<std::shared_ptr<Conn>> conns;
+                std::exception_ptr failure;
+                try {
+                    createConnections(conns, claimed);
+                } catch (...) {
+                    failure = std::current_exception();
+                }
+                for (auto &conn : conns) {
+                    ++idle_count_;
+                    idle_connection_.push({std::move(conn), Clock::now()});
+                }
+                if (failure) {
+                    {
+                        std::lock_guard<std::mutex> guard(error_mutex);
+                        if (!error) {
+                            error = failure;
+                        }
+                    }
+                    total_count_ -= claimed - static_cast<int>(conns.size()) + std::max(remaining.exchange(0), 0);
+                    notifyWaiters();
+                    return;
+                }
+                if (waiting_ > 0) {
+                    notifyWaiters();
+                }
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (int i = 1; i < std::min(concurrency, count); ++i) {
+            workers.emplace_back(worker);
+        }
+        worker();
+        for (auto &thread : workers) {
+            thread.join();
+        }
+        // stopped by the destructor before every reservation was used
+        auto unused = remaining.exchange(0);
+        if (unused > 0) {
+            total_count_ -= unused;
+        }
+        return error;
+    }
+
+    void recordStartup(std::chrono::steady_clock::time_point start) {
+        startup_time_ = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count();
+    }
+
 private:
+    // read and replaced with std::atomic_load and std::atomic_store
     std::shared_ptr<ConnFactoryType> conn_factory_;
 public:
-    const std::shared_ptr<ConnFactory> &getConnFactory() const {
-        return conn_factory_;
+    // The factory new connections come from; see replaceFactory.
+    std::shared_ptr<ConnFactory> getConnFactory() const {
+        return std::atomic_load(&conn_factory_);
+    }
+
+    static Conn *connectionOf(const HandleType &conn) {
+        return conn.get();
+    }
+
+    // checkValid through the factory that made conn, which replaceFactory may have replaced since.
+    bool checkValid(const HandleType &conn) {
+        auto start = metrics_.now();
+        auto valid = factoryOf(conn)->checkValid(conn.get());
+        metrics_.record(PoolLatency::kCheckValidTime, start);
+        return valid;
+    }
+
+    int getIdleCount() {
+        return idle_count_ + cachedCount();
+    }
+
+    PoolStats getStats() {
+        PoolStats stats;
+        auto cached = cachedCount();
+        {
+            std::lock_guard<Mutex> guard(mutex_);
+            stats.max_count = max_count_;
+            stats.idle_count = idle_count_ + cached;
+            stats.busy_count = busy_count_ - cached;
+            stats.pending_count = total_count_ - idle_count_ - busy_count_;
+            stats.waiting_count = waiting_;
+        }
+        auto startup_time = startup_time_.load();
+        stats.warmed_up = startup_time >= 0;
+        stats.startup_time = std::chrono::milliseconds(stats.warmed_up ? startup_time : 0);
+        stats.warmup_failed = warmup_failed_;
+        return stats;
+    }
+
+    // Counters and latency histograms since construction; all zero without kMetrics.
+    MetricsSnapshot snapshot() const {
+        return metrics_.snapshot();
+    }
+
+    int getBusyCount() {
+        return busy_count_ - cachedCount();
+    }
+
+    // Each thread keeps up to size released connections for itself; 0 disables the thread caches.
+    void setThreadCacheSize(int size) {
+        thread_cache_size_ = size;
+        if (size <= 0) {
+            reclaimThreadCaches([](const IdleConnection &) { return true; });
+        }
     }
 
 private:
-    std::deque<std::pair<std::shared_ptr<Conn>, time_t> > idle_connection_;
-    int max_count_{20};
-    int idle_count_{0};
-    int busy_count_{0};
+    int cachedCount() {
+        int cached = 0;
+        for (auto &magazine : threadMagazines()) {
+            cached += magazine->size();
+        }
+        return cached;
+    }
+
+private:
+    typename Policy::template IdleContainer<std::shared_ptr<Conn>> idle_connection_{kWheelTick};
+    std::atomic<int> max_count_{20};
+    std::atomic<int> idle_count_{0};
+    std::atomic<int> busy_count_{0};
+    std::atomic<int> total_count_{0};
+    std::atomic<int> waiting_{0};
+    std::deque<std::shared_ptr<Waiter>> waiters_;
+    std::deque<std::shared_ptr<PendingCreate>> create_queue_;
+    std::vector<std::thread> creators_;
+    int create_concurrency_{4};
+    int pending_creates_{0};
+    int idle_creators_{0};
+    std::atomic<bool> stopping_{false};
+    std::thread warmup_thread_;
+    int min_idle_{0};
+    // -1 until the warm-up target has been reached
+    std::atomic<long long> startup_time_{-1};
+    // a background warm-up stopped at a failed connect
+    std::atomic<bool> warmup_failed_{false};
+    ConditionVariable create_cv_;
+    // started by the first timer job that fires, unless a maintenance driver runs the work
+    std::thread maintainer_;
+    std::function<void()> maintenance_driver_;
+    int maintenance_{0};
+    // closed by the maintenance thread, or by the destructor if it stops first
+    std::vector<IdleConnection> closing_;
+    ConditionVariable maintain_cv_;
+    std::atomic<int> thread_cache_size_{0};
+    const uint64_t pool_id_{nextThreadCacheOwnerId()};
+    std::vector<std::shared_ptr<Magazine>> magazines_;
     int timeout_{3};
-    int max_idle_time_{300};
+    std::atomic<int> max_idle_time_{300};
+    uint64_t evict_timer_{0};
+    std::atomic<int> validation_interval_{0};
+    std::atomic<int> validation_batch_{8};
+    std::atomic<int> validate_on_borrow_{-1};
+    uint64_t health_timer_{0};
+    PoolMetrics<kMetrics> metrics_;
+    std::unique_ptr<AutoscaleController> autoscale_;
+    ScaleListener scale_listener_;
+    uint64_t autoscale_timer_{0};
+    std::atomic<long long> wait_total_us_{0};
+    std::atomic<long long> wait_count_{0};
+    std::atomic<int> reserved_count_{0};
+    // Priority as int; kLow means nothing is reserved
+    std::atomic<int> reserved_priority_{0};
+    std::atomic<int> fail_fast_below_{0};
+    // read and replaced with std::atomic_load and std::atomic_store
+    std::shared_ptr<CreationGovernor> governor_;
+    // in milliseconds; 0 turns max lifetime off
+    std::atomic<int64_t> max_lifetime_{0};
+    std::atomic<int64_t> lifetime_jitter_{0};
+    // stale connections whose successors are open, counted down by their deleters
+    std::shared_ptr<std::atomic<int>> renewed_{std::make_shared<std::atomic<int>>(0)};
+    uint64_t renew_timer_{0};
+    // bumped by replaceFactory; connections of older generations are stale
+    std::atomic<uint64_t> generation_{0};
+    // stale connections may sit idle, where only renewStale finds them
+    std::atomic<bool> draining_{false};
+    Mutex coalesce_mutex_;
+    ConditionVariable coalesce_cv_;
+    std::deque<CoalescedOperation *> coalesced_;
+    // a thread is running the coalesced operations
+    bool coalescing_{false};
 public:
+    // Also sets the eviction tick, so connections close within about 1/60 of the limit after expiring.
     void setMaxIdleTime(int max_idle_time) {
         max_idle_time_ = max_idle_time;
+        idle_connection_.setTick(max_idle_time * 1000 / kWheelSpan);
+        // the running timer would wait out the old tick before the first eviction at the new one
+        auto timer = scheduleEviction();
+        {
+            std::lock_guard<Mutex> guard(mutex_);
+            std::swap(timer, evict_timer_);
+        }
+        TimerService::instance().remove(timer);
+    }
+
+    // Pings connections idle for interval seconds or more in the background, batch_size at a time,
+    // once per interval, and replaces the dead ones. 0 turns it off.
+    void setValidationInterval(int interval, int batch_size = 8) {
+        validation_batch_ = batch_size > 0 ? batch_size : 1;
+        validation_interval_ = interval > 0 ? interval : 0;
+        std::lock_guard<Mutex> guard(mutex_);
+        if (health_timer_ == 0 && validation_interval_ > 0) {
+            health_timer_ = TimerService::instance().add(
+                    std::chrono::steady_clock::now() + std::chrono::seconds(validation_interval_), [this] {
+                        maintain(kValidate);
+                        auto interval = validation_interval_.load();
+                        return std::chrono::steady_clock::now() + std::chrono::seconds(interval > 0 ? interval : 1);
+                    });
+        }
+    }
+
+    // Also pings a connection on borrow when it has been idle for idle_ms or more; -1 turns it off.
+    void setValidateOnBorrow(int idle_ms) {
+        validate_on_borrow_ = idle_ms;
+    }
+
+    // Resizes the pool between options.min_count and options.max_count from then on: grows when
+    // borrowers queue or wait, shrinks when utilization stays low. listener sees every change,
+    // on the pool's maintenance thread. Calling it again replaces the options and the listener.
+    void enableAutoscale(const AutoscaleOptions &options, ScaleListener listener = nullptr) {
+        std::lock_guard<Mutex> guard(mutex_);
+        autoscale_.reset(new AutoscaleController(options));
+        scale_listener_ = std::move(listener);
+        if (autoscale_timer_ == 0) {
+            autoscale_timer_ = TimerService::instance().add(std::chrono::steady_clock::now() + options.interval, [this] {
+                maintain(kAutoscale);
+                std::lock_guard<Mutex> guard(mutex_);
+                return std::chrono::steady_clock::now() + autoscale_->options().interval;
+            });
+        }
+    }
+
+    // Keeps the last count connections of max count for borrowers of priority or higher, so lower
+    // ones cannot take the whole pool. 0 turns it off.
+    void setReservedCount(int count, Priority priority = Priority::kHigh) {
+        {
+            std::lock_guard<Mutex> guard(mutex_);
+            reserved_count_ = count > 0 ? count : 0;
+            reserved_priority_ = count > 0 ? static_cast<int>(priority) : 0;
+        }
+        // a smaller reservation may admit queued borrowers
+        if (waiting_ > 0) {
+            notifyWaiters();
+        }
+    }
+
+    // Borrowers below priority throw PoolExhaustedError rather than queue when the pool is full,
+    // or its free connections are reserved for others. Priority::kLow turns it off.
+    void setFailFast(Priority below) {
+        fail_fast_below_ = static_cast<int>(below);
+    }
+
+    // Every connect, recoverConnection included, then waits for governor's rate and in-flight
+    // limits, and borrowers fail fast with BackendDownError while it holds the backend for down.
+    // Pools connecting to the same backend may share one governor; nullptr removes it.
+    void setCreationGovernor(std::shared_ptr<CreationGovernor> governor) {
+        std::atomic_store(&governor_, std::move(governor));
+    }
+
+    // Replaces connections after max_lifetime seconds, each cut short by a random share of up to
+    // jitter of it. The successor connects first and the old connection closes once it is open:
+    // right away if idle, or on release if busy. 0 turns it off.
+    void setMaxLifetime(int max_lifetime, double jitter = 0.1) {
+        lifetime_jitter_ = static_cast<int64_t>(max_lifetime * 1000.0 * std::min(std::max(jitter, 0.0), 1.0));
+        max_lifetime_ = max_lifetime > 0 ? max_lifetime * 1000LL : 0;
+        if (max_lifetime_ > 0) {
+            std::lock_guard<Mutex> guard(mutex_);
+            startRenewing();
+        }
+    }
+
+    // Connects with conn_factory from now on, to rotate credentials or move to a new primary
+    // without rebuilding the pool. The old factory's connections are replaced like aged ones, up to
+    // create concurrency at a time: idle ones close as soon as their successors are open, busy ones
+    // on release, and borrowers keep getting them until then, so they never wait for a refill.
+    void replaceFactory(std::shared_ptr<ConnFactoryType> conn_factory) {
+        {
+            std::lock_guard<Mutex> guard(mutex_);
+            // a connect reads the generation before the factory, so it never tags an old
+            // factory's connection as new
+            std::atomic_store(&conn_factory_, std::move(conn_factory));
+            ++generation_;
+            draining_ = true;
+            startRenewing();
+        }
+        // start the first successors now rather than on the next timer pass, on the maintenance
+        // thread, as only one thread may sweep the idle connections at a time
+        maintain(kRenew);
+    }
+
+    // How many connects may run at once on the pool's creator threads.
+    void setCreateConcurrency(int create_concurrency) {
+        std::lock_guard<Mutex> guard(mutex_);
+        create_concurrency_ = create_concurrency > 0 ? create_concurrency : 1;
+    }
+
+    // Lets one thread maintain many pools: from now on wake is called, under the pool lock, when
+    // there is periodic work, and its owner calls runMaintenance() on its own thread instead of the
+    // pool starting one. wake must not call into the pool. Has no effect once the pool's own
+    // maintenance thread is running; nullptr hands the work back to the pool.
+    void setMaintenanceDriver(std::function<void()> wake) {
+        std::lock_guard<Mutex> guard(mutex_);
+        if (maintainer_.joinable() && wake) {
+            return;
+        }
+        maintenance_driver_ = std::move(wake);
+        if (!stopping_ && maintenance_ != 0) {
+            wakeMaintainer();
+        }
+    }
+
+    // Runs the periodic work queued since the last run. The pool's maintenance thread calls it, or
+    // the maintenance driver's owner, never two threads at once.
+    void runMaintenance() {
+        int tasks;
+        std::vector<IdleConnection> closing;
+        {
+            std::lock_guard<Mutex> guard(mutex_);
+            if (stopping_) {
+                return;
+            }
+            tasks = maintenance_;
+            maintenance_ = 0;
+            closing.swap(closing_);
+        }
+        closing.clear();
+        if (tasks & kEvict) {
+            evictIdle();
+        }
+        if (tasks & kValidate) {
+            validateIdle();
+        }
+        if (tasks & kRenew) {
+            renewStale();
+        }
+        if (tasks & kAutoscale) {
+            autoscale();
+        }
     }
 
 private:
-    std::mutex mutex_;
-    std::condition_variable cv_;
-    std::shared_ptr<std::thread> connection_checker_;
-    bool checking_{true};
+    Mutex mutex_;
 };
 };
 
@@ -0,0 +1,143 @@
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_CREATION_GOVERNOR_HPP
+#define CONNECTIONPOOL_CREATION_GOVERNOR_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include "pool_errors.hpp"
+
+namespace modern_utils {
+
+struct GovernorOptions {
+    // connects per second, and how many may start at once after a quiet spell; 0 means no limit
+    double rate{0};
+    int burst{10};
+    // connects running at once; 0 means no limit
+    int max_in_flight{0};
+    // consecutive failed connects after which the backend counts as down
+    int fail_after{3};
+    // how long it then stays down, doubling on every failed probe
+    std::chrono::milliseconds initial_backoff{100};
+    std::chrono::milliseconds max_backoff{30000};
+};
+
+// Paces the connects of one backend, which several pools may share. A connect takes a token from
+// a bucket refilled at rate per second and one of max_in_flight slots, waiting for both. After
+// fail_after failures in a row the backend is down for a backoff with jitter: every connect fails
+// at once with BackendDownError instead of running into the connect timeout. Once the backoff has
+// passed, a single connect probes the backend; it either brings it back or doubles the backoff.
+class CreationGovernor {
+public:
+    using Clock = std::chrono::steady_clock;
+public:
+    explicit CreationGovernor(const GovernorOptions &options) : options_(options), tokens_(options.burst) {
+        options_.burst = std::max(options_.burst, 1);
+        options_.fail_after = std::max(options_.fail_after, 1);
+        options_.max_backoff = std::max(options_.max_backoff, options_.initial_backoff);
+    }
+
+    CreationGovernor(const CreationGovernor &rhs) = delete;
+
+    CreationGovernor &operator=(const CreationGovernor &rhs) = delete;
+
+    // Waits until count connects may start; each must be ended with finish().
+    void begin(Clock::time_point deadline, int count = 1) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            auto now = Clock::now();
+            if (down_) {
+                if (now < retry_at_ || probing_) {
+                    throw BackendDownError();
+                }
+                // the backoff is over: this connect probes the backend for everyone
+                probing_ = true;
+                ++in_flight_;
+                return;
+            }
+            refill(now);
+            auto has_slot = options_.max_in_flight <= 0 || in_flight_ < options_.max_in_flight;
+            if (has_slot && tokens_ >= 1) {
+                // a bulk connect may leave the bucket in debt, which later connects pay off
+                tokens_ -= options_.rate > 0 ? count : 0;
+                ++in_flight_;
+                return;
+            }
+            auto wake = deadline;
+            if (has_slot) {
+                wake = std::min(wake, now + std::chrono::duration_cast<Clock::duration>(
+                        std::chrono::duration<double>((1 - tokens_) / options_.rate)));
+            }
+            if (now >= deadline) {
+                throw AcquireTimeoutError();
+            }
+            cv_.wait_until(lock, wake);
+        }
+    }
+
+    void finish(bool succeeded) {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            --in_flight_;
+            if (succeeded) {
+                failures_ = 0;
+                down_ = false;
+                probing_ = false;
+                backoff_ = options_.initial_backoff;
+            } else if (probing_ || ++failures_ >= options_.fail_after) {
+                if (probing_ || !down_) {
+                    backoff_ = down_ ? std::min(backoff_ * 2, options_.max_backoff) : options_.initial_backoff;
+                }
+                down_ = true;
+                probing_ = false;
+                retry_at_ = Clock::now() + jittered(backoff_);
+            }
+        }
+        cv_.notify_one();
+    }
+
+    // Whether connects currently fail at once.
+    bool down() {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return down_ && (Clock::now() < retry_at_ || probing_);
+    }
+
+private:
+    void refill(Clock::time_point now) {
+        if (options_.rate <= 0) {
+            tokens_ = options_.burst;
+            return;
+        }
+        std::chrono::duration<double> elapsed = now - refilled_;
+        tokens_ = std::min(tokens_ + elapsed.count() * options_.rate, static_cast<double>(options_.burst));
+        refilled_ = now;
+    }
+
+    // Between half and all of backoff, so pools that failed together do not retry together.
+    static Clock::duration jittered(std::chrono::milliseconds backoff) {
+        thread_local std::minstd_rand random(std::random_device{}());
+        std::uniform_real_distribution<double> share(0.5, 1.0);
+        return std::chrono::duration_cast<Clock::duration>(backoff * share(random));
+    }
+
+private:
+    GovernorOptions options_;
+    double tokens_;
+    Clock::time_point refilled_{Clock::now()};
+    int in_flight_{0};
+    int failures_{0};
+    bool down_{false};
+    bool probing_{false};
+    std::chrono::milliseconds backoff_{0};
+    Clock::time_point retry_at_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+};
+};
+
+#endif //CONNECTIONPOOL_CREATION_GOVERNOR_HPP
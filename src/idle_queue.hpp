@@ -0,0 +1,116 @@
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_IDLE_QUEUE_HPP
+#define CONNECTIONPOOL_IDLE_QUEUE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "pool_options.hpp"
+
+namespace modern_utils {
+
+// Idle values in one deque in release order, guarded by a Lock. The plain alternative to
+// IdleWheel with the same interface: exact FIFO or LIFO reuse, but expire() and sweep() walk the
+// whole queue, which suits small pools.
+template<typename V, ReuseOrder kOrder = ReuseOrder::kLifo, typename Lock = std::mutex>
+class IdleQueue {
+public:
+    using Entry = std::pair<V, int64_t>;
+
+    explicit IdleQueue(int tick = 5) : tick_(tick > 0 ? tick : 1) {}
+
+    IdleQueue(const IdleQueue &rhs) = delete;
+
+    IdleQueue &operator=(const IdleQueue &rhs) = delete;
+
+    void push(Entry entry) {
+        std::lock_guard<Lock> guard(lock_);
+        entries_.push_back(std::move(entry));
+    }
+
+    bool pop(Entry &entry) {
+        std::lock_guard<Lock> guard(lock_);
+        if (entries_.empty()) {
+            return false;
+        }
+        if (kOrder == ReuseOrder::kLifo) {
+            entry = std::move(entries_.back());
+            entries_.pop_back();
+        } else {
+            entry = std::move(entries_.front());
+            entries_.pop_front();
+        }
+        return true;
+    }
+
+    // Offers every entry released at or before cutoff to evict, oldest first; evict runs under
+    // the queue lock, so it must not touch the queue.
+    template<typename Evict>
+    void expire(int64_t cutoff, Evict evict) {
+        std::lock_guard<Lock> guard(lock_);
+        for (auto iter = entries_.begin(); iter != entries_.end();) {
+            if (iter->second <= cutoff && evict(*iter)) {
+                iter = entries_.erase(iter);
+            } else {
+                ++iter;
+            }
+        }
+    }
+
+    // Hands visit the entries released at or before cutoff, batch_size at a time and outside the
+    // lock. visit erases the entries it takes; the others go back at the old end of the queue.
+    template<typename Visit>
+    void sweep(int64_t cutoff, int batch_size, Visit visit) {
+        std::vector<Entry> batch;
+        std::size_t skipped = 0;
+        while (true) {
+            {
+                std::lock_guard<Lock> guard(lock_);
+                auto iter = entries_.begin() + std::min(skipped, entries_.size());
+                while (iter != entries_.end() && static_cast<int>(batch.size()) < batch_size) {
+                    if (iter->second <= cutoff) {
+                        batch.push_back(std::move(*iter));
+                        iter = entries_.erase(iter);
+                    } else {
+                        ++iter;
+                        ++skipped;
+                    }
+                }
+            }
+            if (batch.empty()) {
+                return;
+            }
+            visit(batch);
+            std::lock_guard<Lock> guard(lock_);
+            for (auto iter = batch.rbegin(); iter != batch.rend(); ++iter) {
+                entries_.push_front(std::move(*iter));
+            }
+            skipped += batch.size();
+            batch.clear();
+        }
+    }
+
+    int tick() const {
+        return tick_;
+    }
+
+    // Only how often the pool calls expire(); entries are not bucketed.
+    void setTick(int tick) {
+        tick_ = tick > 0 ? tick : 1;
+    }
+
+private:
+    Lock lock_;
+    std::deque<Entry> entries_;
+    std::atomic<int> tick_;
+};
+};
+
+#endif //CONNECTIONPOOL_IDLE_QUEUE_HPP
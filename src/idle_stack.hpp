@@ -0,0 +1,154 @@
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_IDLE_STACK_HPP
+#define CONNECTIONPOOL_IDLE_STACK_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+
+namespace modern_utils {
+
+// Lock-free LIFO (Treiber) list of 32-bit indices. The links live in the caller's nodes, reached
+// through next_of(index), and the head carries a 32-bit version so a recycled index cannot cause ABA.
+class TaggedIndexList {
+public:
+    static constexpr uint32_t kNil = 0xffffffffu;
+
+    template<typename NextOf>
+    void push(uint32_t index, NextOf next_of) {
+        auto old_head = head_.load();
+        do {
+            next_of(index).store(indexOf(old_head), std::memory_order_relaxed);
+        } while (!head_.compare_exchange_weak(old_head, pack(index, tagOf(old_head) + 1)));
+    }
+
+    template<typename NextOf>
+    uint32_t pop(NextOf next_of) {
+        auto old_head = head_.load();
+        while (indexOf(old_head) != kNil) {
+            auto next = next_of(indexOf(old_head)).load(std::memory_order_relaxed);
+            if (head_.compare_exchange_weak(old_head, pack(next, tagOf(old_head) + 1))) {
+                return indexOf(old_head);
+            }
+        }
+        return kNil;
+    }
+
+    bool empty() const {
+        return indexOf(head_.load()) == kNil;
+    }
+
+private:
+    static uint64_t pack(uint32_t index, uint32_t tag) {
+        return (static_cast<uint64_t>(tag) << 32) | index;
+    }
+
+    static uint32_t indexOf(uint64_t head) {
+        return static_cast<uint32_t>(head);
+    }
+
+    static uint32_t tagOf(uint64_t head) {
+        return static_cast<uint32_t>(head >> 32);
+    }
+
+private:
+    std::atomic<uint64_t> head_{pack(kNil, 0)};
+};
+
+// Lock-free LIFO stack of values. Nodes live in chunks that are never freed before the stack
+// itself, so push and pop are a couple of CAS operations. Only growing the node storage takes a lock.
+// With kLists > 1 it holds that many independent stacks sharing one node storage.
+template<typename T, uint32_t kLists = 1>
+class IdleStack {
+private:
+    static constexpr uint32_t kNil = TaggedIndexList::kNil;
+    static constexpr uint32_t kChunkShift = 6;
+    static constexpr uint32_t kChunkSize = 1u << kChunkShift;
+    static constexpr uint32_t kMaxChunks = 1024;
+
+    struct Node {
+        T value;
+        std::atomic<uint32_t> next{kNil};
+    };
+
+public:
+    IdleStack() {
+        for (auto &chunk : chunks_) {
+            chunk.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~IdleStack() {
+        for (auto &chunk : chunks_) {
+            delete[] chunk.load(std::memory_order_relaxed);
+        }
+    }
+
+    IdleStack(const IdleStack &rhs) = delete;
+
+    IdleStack &operator=(const IdleStack &rhs) = delete;
+
+    void push(T value, uint32_t list = 0) {
+        auto index = free_.pop(nextOf());
+        if (index == kNil) {
+            index = grow();
+        }
+        node(index).value = std::move(value);
+        heads_[list].push(index, nextOf());
+    }
+
+    bool pop(T &value, uint32_t list = 0) {
+        auto index = heads_[list].pop(nextOf());
+        if (index == kNil) {
+            return false;
+        }
+        value = std::move(node(index).value);
+        free_.push(index, nextOf());
+        return true;
+    }
+
+    bool empty(uint32_t list = 0) const {
+        return heads_[list].empty();
+    }
+
+private:
+    Node &node(uint32_t index) {
+        return chunks_[index >> kChunkShift].load(std::memory_order_acquire)[index & (kChunkSize - 1)];
+    }
+
+    auto nextOf() {
+        return [this](uint32_t index) -> std::atomic<uint32_t> & { return node(index).next; };
+    }
+
+    // Allocates a new chunk, keeps its first node for the caller and frees the rest.
+    uint32_t grow() {
+        std::lock_guard<std::mutex> guard(grow_mutex_);
+        auto chunk_count = chunk_count_.load(std::memory_order_relaxed);
+        if (chunk_count == kMaxChunks) {
+            throw std::runtime_error("IdleStack capacity exceeded");
+        }
+        chunks_[chunk_count].store(new Node[kChunkSize], std::memory_order_release);
+        chunk_count_.store(chunk_count + 1, std::memory_order_relaxed);
+
+        auto first = chunk_count << kChunkShift;
+        for (uint32_t i = kChunkSize - 1; i > 0; --i) {
+            free_.push(first + i, nextOf());
+        }
+        return first;
+    }
+
+private:
+    std::array<TaggedIndexList, kLists> heads_;
+    TaggedIndexList free_;
+    std::array<std::atomic<Node *>, kMaxChunks> chunks_;
+    std::atomic<uint32_t> chunk_count_{0};
+    std::mutex grow_mutex_;
+};
+};
+
+#endif //CONNECTIONPOOL_IDLE_STACK_HPP
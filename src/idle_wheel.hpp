@@ -0,0 +1,157 @@
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_IDLE_WHEEL_HPP
+#define CONNECTIONPOOL_IDLE_WHEEL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "idle_stack.hpp"
+#include "pool_options.hpp"
+
+namespace modern_utils {
+
+// Idle values bucketed by release time, a hashed timing wheel whose slots are lock-free stacks.
+// Each slot covers tick units of whatever clock stamps the entries. pop() takes from the newest
+// slot first for kLifo and from the oldest for kFifo, which is FIFO to the slot. Expiry drains
+// only the slots up to the cutoff's own, so it touches expired entries, plus the live ones sharing
+// the cutoff's slot, and leaves the rest of the pool alone.
+template<typename V, ReuseOrder kOrder = ReuseOrder::kLifo>
+class IdleWheel {
+public:
+    using Entry = std::pair<V, int64_t>;
+    static constexpr uint32_t kSlots = 64;
+
+    explicit IdleWheel(int tick = 5) : tick_(tick > 0 ? tick : 1) {}
+
+    IdleWheel(const IdleWheel &rhs) = delete;
+
+    IdleWheel &operator=(const IdleWheel &rhs) = delete;
+
+    void push(Entry entry) {
+        auto epoch = epochOf(entry.second);
+        auto newest = newest_epoch_.load(std::memory_order_relaxed);
+        while (epoch > newest && !newest_epoch_.compare_exchange_weak(newest, epoch)) {
+        }
+        stacks_.push(std::move(entry), slotOf(epoch));
+    }
+
+    bool pop(Entry &entry) {
+        // swept entries are older than most, so they go last for kLifo and first for kFifo
+        if (kOrder == ReuseOrder::kFifo && stacks_.pop(entry, kSwept)) {
+            return true;
+        }
+        auto newest = newest_epoch_.load(std::memory_order_relaxed);
+        for (uint32_t i = 0; i < kSlots; ++i) {
+            // unsigned wrap-around keeps the slot right, as 2^64 is a multiple of kSlots
+            auto epoch = kOrder == ReuseOrder::kLifo ? newest - i : newest - (kSlots - 1) + i;
+            if (stacks_.pop(entry, slotOf(epoch))) {
+                return true;
+            }
+        }
+        return kOrder == ReuseOrder::kLifo && stacks_.pop(entry, kSwept);
+    }
+
+    // Offers every entry released at or before cutoff to evict, oldest slot first. Entries it
+    // declines, and newer ones found in a drained slot after the tick changed, are put back.
+    // Only one thread may expire or sweep at a time.
+    template<typename Evict>
+    void expire(int64_t cutoff, Evict evict) {
+        if (cutoff < 0) {
+            return;
+        }
+        // the cutoff's own slot is drained too, so nothing expires a tick late; its live entries
+        // go back and the slot is looked at again on the next call
+        auto last = epochOf(cutoff);
+        auto first = std::max(epochOf(drained_until_), last >= kSlots ? last - kSlots + 1 : 0);
+        std::vector<Entry> kept;
+        for (auto epoch = first; epoch <= last; ++epoch) {
+            Entry entry;
+            while (stacks_.pop(entry, slotOf(epoch))) {
+                if (entry.second > cutoff || !evict(entry)) {
+                    kept.push_back(std::move(entry));
+                }
+            }
+        }
+        drained_until_ = std::max(drained_until_, cutoff + 1);
+        for (auto iter = kept.rbegin(); iter != kept.rend(); ++iter) {
+            push(std::move(*iter));
+        }
+    }
+
+    // Hands visit the entries released at or before cutoff, batch_size at a time, oldest slot
+    // first. visit erases the entries it takes. The others, and newer ones met on the way, go on a
+    // list of their own that pop() also takes from, so each batch can be borrowed again as soon as
+    // it has been visited without being popped twice; they return to their slots at the end.
+    // Only one thread may sweep or expire at a time.
+    template<typename Visit>
+    void sweep(int64_t cutoff, int batch_size, Visit visit) {
+        if (cutoff < 0) {
+            return;
+        }
+        auto last = epochOf(cutoff);
+        auto first = last >= kSlots ? last - kSlots + 1 : 0;
+        std::vector<Entry> batch;
+        auto flush = [this, &batch, &visit] {
+            visit(batch);
+            for (auto &visited : batch) {
+                stacks_.push(std::move(visited), kSwept);
+            }
+            batch.clear();
+        };
+        for (auto epoch = first; epoch <= last; ++epoch) {
+            Entry entry;
+            while (stacks_.pop(entry, slotOf(epoch))) {
+                if (entry.second > cutoff) {
+                    stacks_.push(std::move(entry), kSwept);
+                    continue;
+                }
+                batch.push_back(std::move(entry));
+                if (static_cast<int>(batch.size()) >= batch_size) {
+                    flush();
+                }
+            }
+            if (!batch.empty()) {
+                flush();
+            }
+        }
+        Entry entry;
+        while (stacks_.pop(entry, kSwept)) {
+            push(std::move(entry));
+        }
+    }
+
+    int tick() const {
+        return tick_;
+    }
+
+    // Entries already stored keep their slot; expire() still checks each one's own time.
+    void setTick(int tick) {
+        tick_ = tick > 0 ? tick : 1;
+    }
+
+private:
+    uint64_t epochOf(int64_t t) const {
+        return static_cast<uint64_t>(t) / static_cast<uint64_t>(tick_.load(std::memory_order_relaxed));
+    }
+
+    static uint32_t slotOf(uint64_t epoch) {
+        return static_cast<uint32_t>(epoch % kSlots);
+    }
+
+private:
+    // one list per slot, then the one sweep() parks visited entries on
+    static constexpr uint32_t kSwept = kSlots;
+    IdleStack<Entry, kSlots + 1> stacks_;
+    std::atomic<uint64_t> newest_epoch_{0};
+    std::atomic<int> tick_;
+    // everything released before this has been offered to expire()
+    int64_t drained_until_{0};
+};
+};
+
+#endif //CONNECTIONPOOL_IDLE_WHEEL_HPP
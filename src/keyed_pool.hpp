@@ -0,0 +1,252 @@
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_KEYED_POOL_HPP
+#define CONNECTIONPOOL_KEYED_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "pool_options.hpp"
+#include "pool_policy.hpp"
+#include "pool_stats.hpp"
+#include "timer_service.hpp"
+
+namespace modern_utils {
+
+// defined in connection_pool.hpp, which includes this header
+template<typename Conn, typename ConnFactory, bool kMetrics, typename Policy>
+class ConnectionPool;
+
+// One pool per key (host, shard, ...) under a single budget of global_max connections. A key gets
+// its sub-pool and factory on first use and grows its quota one connection at a time: from the
+// unallocated budget while there is some, then from the key with the most slack, i.e. quota not
+// backed by a busy or connecting connection. Taking quota from a key closes one of its idle
+// connections, so a cold key cannot sit on connections a hot key is queueing for. Keys with queued
+// borrowers are topped up as well, as other keys' connections go idle. That and every sub-pool's
+// eviction and validation run on one maintenance thread of the keyed pool, and each sub-pool
+// connects on a single creator thread, so n keys cost n + 1 threads rather than six per key.
+template<typename Key, typename Conn, typename ConnFactory, typename Hash = std::hash<Key>>
+class KeyedConnectionPool {
+public:
+    using PoolType = ConnectionPool<Conn, ConnFactory, false, DefaultPoolPolicy>;
+    using FactoryMaker = std::function<std::shared_ptr<ConnFactory>(const Key &)>;
+public:
+    KeyedConnectionPool(FactoryMaker make_factory, int global_max, int key_max = 0)
+            : make_factory_(std::move(make_factory)), global_max_(global_max),
+              key_max_(key_max > 0 ? key_max : global_max) {
+        rebalance_timer_ = TimerService::instance().add(nextRebalance(), [this] {
+            wakeMaintainer(true);
+            return nextRebalance();
+        });
+    }
+
+    ~KeyedConnectionPool() {
+        TimerService::instance().remove(rebalance_timer_);
+        {
+            std::lock_guard<std::mutex> guard(maintain_mutex_);
+            stopping_ = true;
+        }
+        maintain_cv_.notify_one();
+        if (maintainer_.joinable()) {
+            maintainer_.join();
+        }
+        // a sub-pool still held elsewhere goes back to maintaining itself
+        for (auto &entry : entries_) {
+            entry.second->pool->setMaintenanceDriver(nullptr);
+        }
+    }
+
+    KeyedConnectionPool(const KeyedConnectionPool &rhs) = delete;
+
+    KeyedConnectionPool &operator=(const KeyedConnectionPool &rhs) = delete;
+
+    std::shared_ptr<Conn> acquire(const Key &key) {
+        return acquire(key, std::chrono::seconds(timeout_));
+    }
+
+    std::shared_ptr<Conn> acquire(const Key &key, std::chrono::milliseconds timeout) {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        auto pool = poolOf(key);
+        std::shared_ptr<Conn> conn;
+        if (pool->tryGetConnection(conn)) {
+            return conn;
+        }
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            grow(*entries_.find(key)->second);
+        }
+        return pool->getConnection(deadline);
+    }
+
+    void releaseConnecion(const Key &key, std::shared_ptr<Conn> conn, bool destroy = false) {
+        poolOf(key)->releaseConnecion(std::move(conn), destroy);
+    }
+
+    // The sub-pool of key, created with its factory on first use.
+    std::shared_ptr<PoolType> poolOf(const Key &key) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        auto iter = entries_.find(key);
+        if (iter != entries_.end()) {
+            return iter->second->pool;
+        }
+        auto factory = make_factory_(key);
+        if (factory == nullptr) {
+            throw std::runtime_error("no connection factory for key");
+        }
+        PoolOptions options(0);
+        options.warmup = WarmupMode::kLazy;
+        std::shared_ptr<Entry> entry(new Entry);
+        entry->pool = std::make_shared<PoolType>(std::move(factory), options);
+        entry->pool->setCreateConcurrency(1);
+        entry->pool->setMaintenanceDriver([this] { wakeMaintainer(false); });
+        entries_.emplace(key, entry);
+        return entry->pool;
+    }
+
+    PoolStats getStats(const Key &key) {
+        return poolOf(key)->getStats();
+    }
+
+    // Connections the keys may hold between them, at most global_max.
+    int getAllocated() {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return allocated_;
+    }
+
+    void setRebalanceInterval(std::chrono::milliseconds interval) {
+        rebalance_interval_ms_ = static_cast<int>(interval.count());
+    }
+
+private:
+    struct Entry {
+        std::shared_ptr<PoolType> pool;
+        int quota{0};
+    };
+
+    static int slackOf(const PoolStats &stats) {
+        return stats.max_count - stats.busy_count - stats.pending_count;
+    }
+
+    // Called with mutex_ held. Gives entry one more connection of quota unless it already has room.
+    bool grow(Entry &entry) {
+        auto stats = entry.pool->getStats();
+        if (stats.idle_count > 0 || slackOf(stats) > 0 || entry.quota >= key_max_) {
+            return false;
+        }
+        if (allocated_ < global_max_) {
+            ++allocated_;
+        } else {
+            Entry *victim = nullptr;
+            int most_slack = 0;
+            for (auto &other : entries_) {
+                if (other.second.get() == &entry) {
+                    continue;
+                }
+                auto slack = slackOf(other.second->pool->getStats());
+                if (slack > most_slack) {
+                    most_slack = slack;
+                    victim = other.second.get();
+                }
+            }
+            if (victim == nullptr) {
+                return false;
+            }
+            // closes one of its idle connections if it has no unused quota
+            victim->pool->setMaxCount(--victim->quota);
+        }
+        entry.pool->setMaxCount(++entry.quota);
+        return true;
+    }
+
+    // Runs on the maintenance thread: moves quota to keys with queued borrowers.
+    void rebalance() {
+        std::lock_guard<std::mutex> guard(mutex_);
+        for (auto &entry : entries_) {
+            auto waiting = entry.second->pool->getStats().waiting_count;
+            for (int i = 0; i < waiting; ++i) {
+                if (!grow(*entry.second)) {
+                    break;
+                }
+            }
+        }
+    }
+
+    // Called by the rebalance timer, and by sub-pools with their lock held, so it takes no lock
+    // a sub-pool call can be made under.
+    void wakeMaintainer(bool rebalance) {
+        std::lock_guard<std::mutex> guard(maintain_mutex_);
+        if (stopping_) {
+            return;
+        }
+        (rebalance ? rebalance_due_ : maintenance_due_) = true;
+        if (!maintainer_.joinable()) {
+            maintainer_ = std::thread([this] { runMaintainer(); });
+        }
+        maintain_cv_.notify_one();
+    }
+
+    void runMaintainer() {
+        std::unique_lock<std::mutex> lock(maintain_mutex_);
+        while (true) {
+            maintain_cv_.wait(lock, [this] { return stopping_ || rebalance_due_ || maintenance_due_; });
+            if (stopping_) {
+                return;
+            }
+            auto rebalance_due = rebalance_due_;
+            auto maintenance_due = maintenance_due_;
+            rebalance_due_ = maintenance_due_ = false;
+            lock.unlock();
+            if (rebalance_due) {
+                rebalance();
+            }
+            if (maintenance_due) {
+                std::vector<std::shared_ptr<PoolType>> pools;
+                {
+                    std::lock_guard<std::mutex> guard(mutex_);
+                    for (auto &entry : entries_) {
+                        pools.push_back(entry.second->pool);
+                    }
+                }
+                for (auto &pool : pools) {
+                    pool->runMaintenance();
+                }
+            }
+            lock.lock();
+        }
+    }
+
+    std::chrono::steady_clock::time_point nextRebalance() const {
+        return std::chrono::steady_clock::now() + std::chrono::milliseconds(rebalance_interval_ms_);
+    }
+
+private:
+    FactoryMaker make_factory_;
+    const int global_max_;
+    const int key_max_;
+    int allocated_{0};
+    std::unordered_map<Key, std::shared_ptr<Entry>, Hash> entries_;
+    std::atomic<int> rebalance_interval_ms_{100};
+    uint64_t rebalance_timer_{0};
+    int timeout_{3};
+    std::mutex mutex_;
+    // guards the fields below; never held while calling into a sub-pool
+    std::mutex maintain_mutex_;
+    std::condition_variable maintain_cv_;
+    std::thread maintainer_;
+    bool rebalance_due_{false};
+    bool maintenance_due_{false};
+    bool stopping_{false};
+};
+};
+
+#endif //CONNECTIONPOOL_KEYED_POOL_HPP
@@ -0,0 +1,222 @@
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_MULTIPLEXED_POOL_HPP
+#define CONNECTIONPOOL_MULTIPLEXED_POOL_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "conn_factory_concept.hpp"
+#include "pool_errors.hpp"
+
+namespace modern_utils {
+
+// One connection shared by up to max_streams borrowers at a time.
+template<typename Conn>
+struct SharedConnection {
+    Conn *get() const {
+        return conn.get();
+    }
+
+    std::shared_ptr<Conn> conn;
+    // the two below are guarded by the pool mutex
+    int streams{0};
+    // takes no new streams, and closes when its last one is released
+    bool retired{false};
+};
+
+// A pool for protocols that pipeline or multiplex many requests over one connection (HTTP/2,
+// Redis pipelining, ...). A borrow opens a stream on the least loaded connection with a spare
+// one, and a new connection is made only when every connection is at max_streams. The handle
+// stays valid until the stream is released; UniqueConnGuard releases the stream, not the
+// connection. Conn must be safe to use from several threads at once.
+template<typename Conn, typename ConnFactory>
+class MultiplexedConnectionPool {
+private:
+    static_assert(is_acceptable<Conn, ConnFactory>::diagnose());
+public:
+    using ConnectionType = Conn;
+    using ConnFactoryType = ConnFactory;
+    using Shared = SharedConnection<Conn>;
+    using HandleType = Shared *;
+public:
+    explicit MultiplexedConnectionPool(std::shared_ptr<ConnFactoryType> conn_factory, int max_count = 4,
+                                       int max_streams = 100)
+            : conn_factory_(std::move(conn_factory)), max_count_(max_count),
+              max_streams_(max_streams > 0 ? max_streams : 1) {
+    }
+
+    MultiplexedConnectionPool(const MultiplexedConnectionPool &rhs) = delete;
+
+    MultiplexedConnectionPool &operator=(const MultiplexedConnectionPool &rhs) = delete;
+
+    Shared *getConnection() {
+        return getConnection(std::chrono::seconds(timeout_));
+    }
+
+    Shared *getConnection(std::chrono::milliseconds timeout) {
+        return getConnection(std::chrono::steady_clock::now() + timeout);
+    }
+
+    Shared *getConnection(std::chrono::steady_clock::time_point deadline) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            auto shared = leastLoaded();
+            if (shared != nullptr) {
+                ++shared->streams;
+                return shared;
+            }
+            if (live_count_ + creating_ < max_count_) {
+                return openConnection(lock);
+            }
+            ++waiting_;
+            auto status = cv_.wait_until(lock, deadline);
+            --waiting_;
+            if (status == std::cv_status::timeout && (shared = leastLoaded()) == nullptr &&
+                live_count_ + creating_ >= max_count_) {
+                throw AcquireTimeoutError();
+            }
+        }
+    }
+
+    // Closes the stream; destroy also retires its connection, which closes once every stream
+    // on it is released.
+    void releaseConnecion(Shared *shared, bool destroy = false) {
+        std::shared_ptr<Conn> closed;
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            if (destroy) {
+                retire(shared);
+            }
+            --shared->streams;
+            if (shared->retired && shared->streams == 0) {
+                closed = std::move(shared->conn);
+                connections_.erase(std::find_if(connections_.begin(), connections_.end(),
+                                                [shared](const std::unique_ptr<Shared> &c) {
+                                                    return c.get() == shared;
+                                                }));
+            }
+            if (waiting_ > 0) {
+                cv_.notify_one();
+            }
+        }
+        // a retired connection closes here, outside the lock
+    }
+
+    // Retires the stream's connection and moves the stream to another, new if need be.
+    void recoverConnection(Shared *&shared) {
+        auto next = getConnectionOnOther(shared);
+        releaseConnecion(shared, true);
+        shared = next;
+    }
+
+    const std::shared_ptr<ConnFactory> &getConnFactory() const {
+        return conn_factory_;
+    }
+
+    static Conn *connectionOf(Shared *shared) {
+        return shared->get();
+    }
+
+    bool checkValid(Shared *shared) {
+        return conn_factory_->checkValid(shared->get());
+    }
+
+    // Live connections, retired ones excluded.
+    int getConnectionCount() {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return live_count_;
+    }
+
+    int getStreamCount() {
+        std::lock_guard<std::mutex> guard(mutex_);
+        int streams = 0;
+        for (auto &shared : connections_) {
+            streams += shared->streams;
+        }
+        return streams;
+    }
+
+private:
+    // Called with mutex_ held: the live connection with the fewest streams, if it has a spare one.
+    Shared *leastLoaded() {
+        Shared *best = nullptr;
+        for (auto &shared : connections_) {
+            if (!shared->retired && shared->streams < max_streams_ &&
+                (best == nullptr || shared->streams < best->streams)) {
+                best = shared.get();
+            }
+        }
+        return best;
+    }
+
+    // Called with mutex_ held and room for one more connection; connects with it released and
+    // returns the new connection with one stream open.
+    Shared *openConnection(std::unique_lock<std::mutex> &lock) {
+        ++creating_;
+        lock.unlock();
+        std::unique_ptr<Shared> shared(new Shared);
+        try {
+            auto factory = conn_factory_;
+            shared->conn.reset(conn_factory_->createConnection(), [factory](Conn *p) { factory->destroy(p); });
+        } catch (...) {
+            lock.lock();
+            --creating_;
+            // the room is free again for a waiter to connect into
+            if (waiting_ > 0) {
+                cv_.notify_one();
+            }
+            throw;
+        }
+        lock.lock();
+        --creating_;
+        ++live_count_;
+        shared->streams = 1;
+        connections_.push_back(std::move(shared));
+        // the new connection's other streams are free for waiters
+        if (waiting_ > 0) {
+            cv_.notify_all();
+        }
+        return connections_.back().get();
+    }
+
+    Shared *getConnectionOnOther(Shared *current) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        retire(current);
+        auto shared = leastLoaded();
+        if (shared != nullptr) {
+            ++shared->streams;
+            return shared;
+        }
+        lock.unlock();
+        return getConnection();
+    }
+
+    // Called with mutex_ held.
+    void retire(Shared *shared) {
+        if (!shared->retired) {
+            shared->retired = true;
+            --live_count_;
+        }
+    }
+
+private:
+    std::shared_ptr<ConnFactoryType> conn_factory_;
+    const int max_count_;
+    const int max_streams_;
+    std::vector<std::unique_ptr<Shared>> connections_;
+    int live_count_{0};
+    int creating_{0};
+    int waiting_{0};
+    int timeout_{3};
+    std::mutex mutex_;
+    std::condition_variable cv_;
+};
+};
+
+#endif //CONNECTIONPOOL_MULTIPLEXED_POOL_HPP
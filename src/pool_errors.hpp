@@ -0,0 +1,36 @@
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_POOL_ERRORS_HPP
+#define CONNECTIONPOOL_POOL_ERRORS_HPP
+
+#include <stdexcept>
+
+namespace modern_utils {
+
+// Thrown when no connection could be borrowed before the deadline. A std::runtime_error like
+// every other pool error, distinct so callers can tell an exhausted pool from a failed connect.
+class AcquireTimeoutError : public std::runtime_error {
+public:
+    AcquireTimeoutError() : std::runtime_error("getConnection timeout") {}
+
+protected:
+    explicit AcquireTimeoutError(const char *what) : std::runtime_error(what) {}
+};
+
+// Thrown at once, without waiting for the deadline, to a borrower set to fail fast when the pool
+// has nothing it may take and no room to connect. An AcquireTimeoutError, as it means the same.
+class PoolExhaustedError : public AcquireTimeoutError {
+public:
+    PoolExhaustedError() : AcquireTimeoutError("connection pool exhausted") {}
+};
+
+// Thrown instead of connecting while a CreationGovernor holds the backend for down.
+class BackendDownError : public std::runtime_error {
+public:
+    BackendDownError() : std::runtime_error("backend down") {}
+};
+};
+
+#endif //CONNECTIONPOOL_POOL_ERRORS_HPP
@@ -0,0 +1,222 @@
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_POOL_METRICS_HPP
+#define CONNECTIONPOOL_POOL_METRICS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace modern_utils {
+
+enum class PoolCounter {
+    kAcquires, kTimeouts, kCreates, kDestroys, kEvictions, kRecoveries, kRenewals
+};
+
+enum class PoolLatency {
+    kAcquireWait, kHoldTime, kCreateTime, kCheckValidTime
+};
+
+// HDR style log-linear buckets over microseconds: 8 linear sub-buckets per power of two, so a value
+// is reported at most 12.5% above what was recorded. Values from 2^40us (about 12 days) up share
+// the last bucket.
+struct LatencyBuckets {
+    static constexpr int kSubBits = 3;
+    static constexpr int kSubCount = 1 << kSubBits;
+    static constexpr int kMaxBits = 40;
+    static constexpr int kCount = (kMaxBits - kSubBits + 1) * kSubCount;
+
+    static int indexOf(uint64_t us) {
+        if (us >> kMaxBits) {
+            return kCount - 1;
+        }
+        int shift = 0;
+        if (us >= 2 * kSubCount) {
+#if defined(__GNUC__)
+            shift = 63 - __builtin_clzll(us) - kSubBits;
+#else
+            while ((us >> shift) >= 2 * kSubCount) {
+                ++shift;
+            }
+#endif
+        }
+        return shift * kSubCount + static_cast<int>(us >> shift);
+    }
+
+    // The largest value that falls into bucket index.
+    static uint64_t upperBoundOf(int index) {
+        auto shift = index < 2 * kSubCount ? 0 : index / kSubCount - 1;
+        auto mantissa = static_cast<uint64_t>(index - shift * kSubCount);
+        return ((mantissa + 1) << shift) - 1;
+    }
+};
+
+struct LatencyHistogram {
+    // counts per LatencyBuckets index, empty while nothing was recorded
+    std::vector<uint64_t> buckets;
+    uint64_t count{0};
+    uint64_t total_us{0};
+
+    // p in [0, 100]; the bucket bound the p-th percentile value lies under.
+    std::chrono::microseconds percentile(double p) const {
+        if (count == 0) {
+            return std::chrono::microseconds(0);
+        }
+        auto rank = static_cast<uint64_t>(p / 100 * static_cast<double>(count));
+        rank = rank < 1 ? 1 : (rank > count ? count : rank);
+        uint64_t seen = 0;
+        for (int i = 0; i < static_cast<int>(buckets.size()); ++i) {
+            seen += buckets[i];
+            if (seen >= rank) {
+                return std::chrono::microseconds(LatencyBuckets::upperBoundOf(i));
+            }
+        }
+        return std::chrono::microseconds(LatencyBuckets::upperBoundOf(LatencyBuckets::kCount - 1));
+    }
+
+    std::chrono::microseconds mean() const {
+        return std::chrono::microseconds(count > 0 ? total_us / count : 0);
+    }
+
+    std::chrono::microseconds max() const {
+        return percentile(100);
+    }
+};
+
+struct MetricsSnapshot {
+    // false when the pool was built without metrics; everything else is then zero
+    bool enabled{false};
+    uint64_t acquires{0};
+    uint64_t timeouts{0};
+    uint64_t creates{0};
+    uint64_t destroys{0};
+    uint64_t evictions{0};
+    uint64_t recoveries{0};
+    // connections past their max lifetime closed once a successor was open
+    uint64_t renewals{0};
+    LatencyHistogram acquire_wait;
+    LatencyHistogram hold_time;
+    LatencyHistogram create_time;
+    LatencyHistogram check_valid_time;
+};
+
+// Per-pool counters and latency histograms. Each thread updates one of kShards shards with relaxed
+// atomic adds, so recording never takes a lock or fights over a cache line with most other
+// threads; snapshot() sums the shards.
+template<bool kEnabled>
+class PoolMetrics {
+private:
+    static constexpr int kShards = 8;
+    static constexpr int kCounters = 7;
+    static constexpr int kLatencies = 4;
+
+    struct Histogram {
+        std::array<std::atomic<uint64_t>, LatencyBuckets::kCount> buckets;
+        std::atomic<uint64_t> total_us;
+    };
+
+    struct Shard {
+        std::array<std::atomic<uint64_t>, kCounters> counters;
+        std::array<Histogram, kLatencies> histograms;
+    };
+
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // value-initialized, so every atomic starts at zero
+    PoolMetrics() : shards_(new Shard[kShards]()) {}
+
+    static Clock::time_point now() {
+        return Clock::now();
+    }
+
+    void add(PoolCounter counter, uint64_t n = 1) {
+        shard().counters[static_cast<int>(counter)].fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void record(PoolLatency latency, Clock::duration elapsed) {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+        auto value = static_cast<uint64_t>(us > 0 ? us : 0);
+        auto &histogram = shard().histograms[static_cast<int>(latency)];
+        histogram.buckets[LatencyBuckets::indexOf(value)].fetch_add(1, std::memory_order_relaxed);
+        histogram.total_us.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    void record(PoolLatency latency, Clock::time_point since) {
+        record(latency, now() - since);
+    }
+
+    // A copy summed over the shards while the pool keeps running: every count in it was recorded,
+    // and each histogram's count is the sum of its own buckets.
+    MetricsSnapshot snapshot() const {
+        MetricsSnapshot snapshot;
+        snapshot.enabled = true;
+        uint64_t *counters[kCounters] = {&snapshot.acquires, &snapshot.timeouts, &snapshot.creates,
+                                         &snapshot.destroys, &snapshot.evictions, &snapshot.recoveries,
+                                         &snapshot.renewals};
+        LatencyHistogram *histograms[kLatencies] = {&snapshot.acquire_wait, &snapshot.hold_time,
+                                                    &snapshot.create_time, &snapshot.check_valid_time};
+        for (auto histogram : histograms) {
+            histogram->buckets.assign(LatencyBuckets::kCount, 0);
+        }
+        for (int s = 0; s < kShards; ++s) {
+            auto &shard = shards_[s];
+            for (int c = 0; c < kCounters; ++c) {
+                *counters[c] += shard.counters[c].load(std::memory_order_relaxed);
+            }
+            for (int h = 0; h < kLatencies; ++h) {
+                for (int b = 0; b < LatencyBuckets::kCount; ++b) {
+                    auto count = shard.histograms[h].buckets[b].load(std::memory_order_relaxed);
+                    histograms[h]->buckets[b] += count;
+                    histograms[h]->count += count;
+                }
+                histograms[h]->total_us += shard.histograms[h].total_us.load(std::memory_order_relaxed);
+            }
+        }
+        for (auto histogram : histograms) {
+            if (histogram->count == 0) {
+                histogram->buckets.clear();
+            }
+        }
+        return snapshot;
+    }
+
+private:
+    Shard &shard() {
+        static std::atomic<int> next_shard{0};
+        thread_local int index = next_shard++ % kShards;
+        return shards_[index];
+    }
+
+private:
+    std::unique_ptr<Shard[]> shards_;
+};
+
+// Compiled out: no storage, no clock reads, every call is empty.
+template<>
+class PoolMetrics<false> {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static Clock::time_point now() {
+        return Clock::time_point();
+    }
+
+    void add(PoolCounter, uint64_t = 1) {}
+
+    void record(PoolLatency, Clock::duration) {}
+
+    void record(PoolLatency, Clock::time_point) {}
+
+    MetricsSnapshot snapshot() const {
+        return MetricsSnapshot();
+    }
+};
+};
+
+#endif //CONNECTIONPOOL_POOL_METRICS_HPP
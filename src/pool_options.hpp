@@ -0,0 +1,46 @@
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_POOL_OPTIONS_HPP
+#define CONNECTIONPOOL_POOL_OPTIONS_HPP
+
+namespace modern_utils {
+
+enum class WarmupMode {
+    // create max_count connections before the constructor returns
+    kEager,
+    // create min_idle connections before the constructor returns, the rest on demand
+    kLazy,
+    // return at once and create max_count connections in the background; borrowers only wait
+    // for the first one that is ready
+    kBackground
+};
+
+enum class ReuseOrder {
+    // the most recently released idle connection first, keeping reuse on cache-hot connections
+    kLifo,
+    // the longest idle connection first, spreading load so every connection stays warm
+    kFifo
+};
+
+// Waiters are served highest priority first, in arrival order within a priority.
+enum class Priority {
+    kLow, kNormal, kHigh
+};
+
+struct PoolOptions {
+    PoolOptions() = default;
+
+    explicit PoolOptions(int max_count) : max_count(max_count) {}
+
+    int max_count{20};
+    WarmupMode warmup{WarmupMode::kEager};
+    // also the number of connections the idle checker never evicts below
+    int min_idle{0};
+    // connects running at once during warm-up
+    int warmup_concurrency{1};
+};
+};
+
+#endif //CONNECTIONPOOL_POOL_OPTIONS_HPP
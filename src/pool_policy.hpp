@@ -0,0 +1,117 @@
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_POOL_POLICY_HPP
+#define CONNECTIONPOOL_POOL_POLICY_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include "idle_queue.hpp"
+#include "idle_wheel.hpp"
+#include "pool_options.hpp"
+#include "timer_service.hpp"
+
+namespace modern_utils {
+
+// Test-and-test-and-set lock for critical sections of a few dozen instructions; yields after a
+// short spin so it still makes progress when threads outnumber cores.
+class SpinLock {
+public:
+    void lock() {
+        for (int spins = 0; locked_.exchange(true, std::memory_order_acquire); ++spins) {
+            while (locked_.load(std::memory_order_relaxed)) {
+                if (++spins > 64) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+    }
+
+    bool try_lock() {
+        return !locked_.load(std::memory_order_relaxed) && !locked_.exchange(true, std::memory_order_acquire);
+    }
+
+    void unlock() {
+        locked_.store(false, std::memory_order_release);
+    }
+
+private:
+    std::atomic<bool> locked_{false};
+};
+
+// Milliseconds of std::chrono::steady_clock, read on every call.
+struct SteadyClock {
+    static int64_t now() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+
+// SteadyClock cached in one atomic that the shared timer thread refreshes every kResolutionMs,
+// so a read is a single relaxed load.
+struct CoarseClock {
+    static constexpr int kResolutionMs = 100;
+
+    static int64_t now() {
+        return cached().load(std::memory_order_relaxed);
+    }
+
+private:
+    static std::atomic<int64_t> &cached() {
+        // constructed before the timer service, so it outlives the refresh job
+        static std::atomic<int64_t> cached{SteadyClock::now()};
+        static const bool refreshing = [] {
+            TimerService::instance().add(nextRefresh(), [] {
+                cached.store(SteadyClock::now(), std::memory_order_relaxed);
+                return nextRefresh();
+            });
+            return true;
+        }();
+        (void) refreshing;
+        return cached;
+    }
+
+    static TimerService::Clock::time_point nextRefresh() {
+        return TimerService::Clock::now() + std::chrono::milliseconds(static_cast<int64_t>(kResolutionMs));
+    }
+};
+
+// Idle store selectors for PoolPolicy.
+struct WheelStore {
+    template<typename V, ReuseOrder kOrder, typename Lock>
+    using type = IdleWheel<V, kOrder>;
+};
+
+struct QueueStore {
+    template<typename V, ReuseOrder kOrder, typename Lock>
+    using type = IdleQueue<V, kOrder, Lock>;
+};
+
+// Compile-time choices of a ConnectionPool, so each combination gets its own inlined hot path:
+// the lock guarding the pool (std::mutex or SpinLock), the reuse order, the clock stamping idle
+// connections (CoarseClock or SteadyClock, both in milliseconds) and the idle store. kFifo
+// defaults to QueueStore, as the wheel is FIFO only from one slot to the next.
+template<typename Lock = std::mutex, ReuseOrder kOrder = ReuseOrder::kLifo, typename Clock = CoarseClock,
+        typename IdleStore = typename std::conditional<kOrder == ReuseOrder::kLifo, WheelStore, QueueStore>::type>
+struct PoolPolicy {
+    using LockType = Lock;
+    using ClockType = Clock;
+    static constexpr ReuseOrder kReuseOrder = kOrder;
+    // std::condition_variable only works with std::mutex
+    using ConditionType = typename std::conditional<std::is_same<Lock, std::mutex>::value,
+            std::condition_variable, std::condition_variable_any>::type;
+
+    template<typename V>
+    using IdleContainer = typename IdleStore::template type<V, kOrder, Lock>;
+};
+
+using DefaultPoolPolicy = PoolPolicy<>;
+};
+
+#endif //CONNECTIONPOOL_POOL_POLICY_HPP
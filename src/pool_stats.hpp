@@ -0,0 +1,27 @@
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_POOL_STATS_HPP
+#define CONNECTIONPOOL_POOL_STATS_HPP
+
+#include <chrono>
+
+namespace modern_utils {
+
+struct PoolStats {
+    int max_count{0};
+    int idle_count{0};
+    int busy_count{0};
+    // connects reserved or running, not yet idle
+    int pending_count{0};
+    int waiting_count{0};
+    bool warmed_up{false};
+    // a background warm-up stopped at a failed connect, so warmed_up stays false
+    bool warmup_failed{false};
+    // from the start of construction until the warm-up target was reached
+    std::chrono::milliseconds startup_time{0};
+};
+};
+
+#endif //CONNECTIONPOOL_POOL_STATS_HPP
@@ -0,0 +1,223 @@
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_SLOT_POOL_HPP
+#define CONNECTIONPOOL_SLOT_POOL_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include "conn_factory_concept.hpp"
+#include "idle_stack.hpp"
+#include "pool_errors.hpp"
+
+namespace modern_utils {
+
+constexpr std::size_t kCacheLineSize = 64;
+
+// One pooled connection. Slots never move, so a Slot* is the borrow handle.
+template<typename Conn>
+struct alignas(kCacheLineSize) ConnectionSlot {
+    enum State : uint32_t {
+        kEmpty, kIdle, kBusy
+    };
+
+    Conn *get() const {
+        return conn;
+    }
+
+    Conn *conn{nullptr};
+    time_t last_used{0};
+    std::atomic<uint32_t> state{kEmpty};
+    std::atomic<uint32_t> next{TaggedIndexList::kNil};
+    uint32_t index{0};
+};
+
+// A fixed-capacity pool that keeps raw connections in a preallocated, cache-line-aligned slot array.
+// Borrowing hands out a ConnectionSlot* instead of a shared_ptr: no control block per connection and
+// no reference counting, an idle borrow or a release is a single CAS on a tagged index list.
+template<typename Conn, typename ConnFactory>
+class SlotConnectionPool {
+private:
+    static_assert(is_acceptable<Conn, ConnFactory>::diagnose());
+public:
+    using ConnectionType = Conn;
+    using ConnFactoryType = ConnFactory;
+    using Slot = ConnectionSlot<Conn>;
+    using HandleType = Slot *;
+public:
+    explicit SlotConnectionPool(std::shared_ptr<ConnFactoryType> conn_factory, int max_count = 20)
+            : conn_factory_(std::move(conn_factory)), max_count_(max_count) {
+        // operator new only honours the slot alignment from C++17 on, so align the array by hand
+        storage_.reset(new char[sizeof(Slot) * max_count_ + kCacheLineSize]);
+        auto address = reinterpret_cast<std::uintptr_t>(storage_.get());
+        slots_ = reinterpret_cast<Slot *>((address + kCacheLineSize - 1) & ~(kCacheLineSize - 1));
+        for (int i = 0; i < max_count_; ++i) {
+            new(&slots_[i]) Slot();
+            slots_[i].index = static_cast<uint32_t>(i);
+        }
+
+        try {
+            for (int i = max_count_ - 1; i >= 0; --i) {
+                slots_[i].conn = conn_factory_->createConnection();
+                slots_[i].last_used = time(nullptr);
+                slots_[i].state = Slot::kIdle;
+                idle_.push(slots_[i].index, nextOf());
+            }
+        } catch (...) {
+            // the destructor does not run for a constructor that throws
+            clear();
+            throw;
+        }
+    }
+
+    ~SlotConnectionPool() {
+        clear();
+    }
+
+    SlotConnectionPool(const SlotConnectionPool &rhs) = delete;
+
+    SlotConnectionPool &operator=(const SlotConnectionPool &rhs) = delete;
+
+    Slot *getConnection() {
+        Slot *slot = nullptr;
+        bool empty = false;
+        if (!claimSlot(slot, empty)) {
+            Waiting waiting(waiting_);
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (!cv_.wait_for(lock, std::chrono::seconds(timeout_),
+                              [this, &slot, &empty] { return claimSlot(slot, empty); })) {
+                throw AcquireTimeoutError();
+            }
+        }
+        // an empty slot is connected outside mutex_, so a slow connect holds up no other borrower
+        if (empty) {
+            connect(slot);
+        }
+        return slot;
+    }
+
+    void releaseConnecion(Slot *slot, bool destroy = false) {
+        if (destroy) {
+            conn_factory_->destroy(slot->conn);
+            slot->conn = nullptr;
+            slot->state.store(Slot::kEmpty, std::memory_order_relaxed);
+            empty_.push(slot->index, nextOf());
+        } else {
+            slot->last_used = time(nullptr);
+            slot->state.store(Slot::kIdle, std::memory_order_relaxed);
+            idle_.push(slot->index, nextOf());
+        }
+
+        if (waiting_ > 0) {
+            std::lock_guard<std::mutex> guard(mutex_);
+            cv_.notify_one();
+        }
+    }
+
+    // Replaces the borrowed connection in place; the slot stays borrowed.
+    void recoverConnection(Slot *slot) {
+        auto conn = conn_factory_->createConnection();
+        if (slot->conn != nullptr) {
+            conn_factory_->destroy(slot->conn);
+        }
+        slot->conn = conn;
+    }
+
+    const std::shared_ptr<ConnFactory> &getConnFactory() const {
+        return conn_factory_;
+    }
+
+    static Conn *connectionOf(Slot *slot) {
+        return slot->conn;
+    }
+
+    bool checkValid(Slot *slot) {
+        return conn_factory_->checkValid(slot->conn);
+    }
+
+    int getCapacity() const {
+        return max_count_;
+    }
+
+private:
+    auto nextOf() {
+        return [this](uint32_t index) -> std::atomic<uint32_t> & { return slots_[index].next; };
+    }
+
+    // Counts a borrower in waiting_ for as long as it waits, however it stops waiting.
+    struct Waiting {
+        explicit Waiting(std::atomic<int> &waiting) : waiting(waiting) {
+            ++waiting;
+        }
+
+        ~Waiting() {
+            --waiting;
+        }
+
+        std::atomic<int> &waiting;
+    };
+
+    // Takes an idle slot, or else an empty one that the caller must connect; false if neither is
+    // left. Never connects, so it is safe under mutex_.
+    bool claimSlot(Slot *&slot, bool &empty) {
+        auto index = idle_.pop(nextOf());
+        empty = index == TaggedIndexList::kNil;
+        if (empty) {
+            index = empty_.pop(nextOf());
+            if (index == TaggedIndexList::kNil) {
+                return false;
+            }
+        } else {
+            slots_[index].state.store(Slot::kBusy, std::memory_order_relaxed);
+        }
+        slot = &slots_[index];
+        return true;
+    }
+
+    // Fills a claimed empty slot; if the connect fails the slot goes back empty for a waiter.
+    void connect(Slot *slot) {
+        try {
+            slot->conn = conn_factory_->createConnection();
+        } catch (...) {
+            empty_.push(slot->index, nextOf());
+            if (waiting_ > 0) {
+                std::lock_guard<std::mutex> guard(mutex_);
+                cv_.notify_one();
+            }
+            throw;
+        }
+        slot->state.store(Slot::kBusy, std::memory_order_relaxed);
+    }
+
+    void clear() {
+        for (int i = 0; i < max_count_; ++i) {
+            if (slots_[i].conn != nullptr) {
+                conn_factory_->destroy(slots_[i].conn);
+            }
+            slots_[i].~Slot();
+        }
+    }
+
+private:
+    std::shared_ptr<ConnFactoryType> conn_factory_;
+    const int max_count_;
+    std::unique_ptr<char[]> storage_;
+    Slot *slots_{nullptr};
+    TaggedIndexList idle_;
+    TaggedIndexList empty_;
+    std::atomic<int> waiting_{0};
+    int timeout_{3};
+    std::mutex mutex_;
+    std::condition_variable cv_;
+};
+};
+
+#endif //CONNECTIONPOOL_SLOT_POOL_HPP
@@ -0,0 +1,182 @@
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_THREAD_CACHE_HPP
+#define CONNECTIONPOOL_THREAD_CACHE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace modern_utils {
+
+// Identifies a pool to the thread caches; unlike its address it is never reused.
+inline uint64_t nextThreadCacheOwnerId() {
+    static std::atomic<uint64_t> next_id{1};
+    return next_id++;
+}
+
+// A small per-thread stack of idle connections owned by one pool. Only the owning thread uses it
+// on the fast path; the pool locks it from other threads just to reclaim or detach it.
+template<typename T>
+class ConnectionMagazine {
+public:
+    using SpillFunction = std::function<void(std::vector<T> &)>;
+
+    ConnectionMagazine(uint64_t pool_id, SpillFunction spill) : pool_id_(pool_id), spill_(std::move(spill)) {}
+
+    ConnectionMagazine(const ConnectionMagazine &rhs) = delete;
+
+    ConnectionMagazine &operator=(const ConnectionMagazine &rhs) = delete;
+
+    uint64_t poolId() const {
+        return pool_id_;
+    }
+
+    bool attached() const {
+        return attached_.load(std::memory_order_acquire);
+    }
+
+    int size() const {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+    bool pop(T &value) {
+        Locker locker(lock_);
+        if (entries_.empty()) {
+            return false;
+        }
+        value = std::move(entries_.back());
+        entries_.pop_back();
+        count_.store(static_cast<int>(entries_.size()), std::memory_order_relaxed);
+        return true;
+    }
+
+    // Moves the older half of a full magazine into spill before caching value.
+    void push(T &&value, std::size_t capacity, std::vector<T> &spill) {
+        Locker locker(lock_);
+        if (entries_.size() >= capacity) {
+            auto spill_count = (entries_.size() + 1) / 2;
+            std::move(entries_.begin(), entries_.begin() + spill_count, std::back_inserter(spill));
+            entries_.erase(entries_.begin(), entries_.begin() + spill_count);
+        }
+        entries_.push_back(std::move(value));
+        count_.store(static_cast<int>(entries_.size()), std::memory_order_relaxed);
+    }
+
+    // Moves every cached entry matching predicate into out, oldest first.
+    template<typename Predicate>
+    void drain(std::vector<T> &out, Predicate predicate) {
+        Locker locker(lock_);
+        auto keep = entries_.begin();
+        for (auto iter = entries_.begin(); iter != entries_.end(); ++iter) {
+            if (predicate(*iter)) {
+                out.push_back(std::move(*iter));
+            } else {
+                *keep++ = std::move(*iter);
+            }
+        }
+        entries_.erase(keep, entries_.end());
+        count_.store(static_cast<int>(entries_.size()), std::memory_order_relaxed);
+    }
+
+    // Called by the pool before it goes away; waits for a concurrent retire() to finish.
+    void detach(std::vector<T> &out) {
+        Locker locker(lock_);
+        std::move(entries_.begin(), entries_.end(), std::back_inserter(out));
+        entries_.clear();
+        count_.store(0, std::memory_order_relaxed);
+        attached_.store(false, std::memory_order_release);
+    }
+
+    // Called when the owning thread exits: hands everything back to the pool if it still exists.
+    void retire() {
+        Locker locker(lock_);
+        if (attached_.load(std::memory_order_relaxed)) {
+            std::vector<T> entries;
+            entries.swap(entries_);
+            count_.store(0, std::memory_order_relaxed);
+            spill_(entries);
+            attached_.store(false, std::memory_order_release);
+        }
+    }
+
+private:
+    class Locker {
+    public:
+        explicit Locker(std::atomic_flag &lock) : lock_(lock) {
+            while (lock_.test_and_set(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+        }
+
+        ~Locker() {
+            lock_.clear(std::memory_order_release);
+        }
+
+    private:
+        std::atomic_flag &lock_;
+    };
+
+private:
+    const uint64_t pool_id_;
+    SpillFunction spill_;
+    std::vector<T> entries_;
+    std::atomic<int> count_{0};
+    std::atomic<bool> attached_{true};
+    std::atomic_flag lock_ = ATOMIC_FLAG_INIT;
+};
+
+// The magazines of the calling thread, one per pool it has used. Retired when the thread exits.
+template<typename T>
+class ThreadMagazines {
+public:
+    using MagazinePtr = std::shared_ptr<ConnectionMagazine<T>>;
+
+    ~ThreadMagazines() {
+        for (auto &magazine : magazines_) {
+            magazine->retire();
+        }
+    }
+
+    static ThreadMagazines &local() {
+        thread_local ThreadMagazines magazines;
+        return magazines;
+    }
+
+    ConnectionMagazine<T> *find(uint64_t pool_id) {
+        if (last_ != nullptr && last_->poolId() == pool_id) {
+            return last_;
+        }
+        for (auto iter = magazines_.begin(); iter != magazines_.end();) {
+            if (!(*iter)->attached()) {
+                iter = magazines_.erase(iter);
+            } else if ((*iter)->poolId() == pool_id) {
+                last_ = iter->get();
+                return last_;
+            } else {
+                ++iter;
+            }
+        }
+        last_ = nullptr;
+        return nullptr;
+    }
+
+    void add(const MagazinePtr &magazine) {
+        magazines_.push_back(magazine);
+        last_ = magazine.get();
+    }
+
+private:
+    std::vector<MagazinePtr> magazines_;
+    ConnectionMagazine<T> *last_{nullptr};
+};
+};
+
+#endif //CONNECTIONPOOL_THREAD_CACHE_HPP
@@ -0,0 +1,119 @@
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_TIMER_SERVICE_HPP
+#define CONNECTIONPOOL_TIMER_SERVICE_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace modern_utils {
+
+// One thread running the periodic jobs of every pool in the process, earliest deadline first.
+// It sleeps until the next job is due instead of polling, and is started on first use.
+class TimerService {
+public:
+    using Clock = std::chrono::steady_clock;
+    // Returns when the job wants to run next.
+    using Job = std::function<Clock::time_point()>;
+
+    static TimerService &instance() {
+        static TimerService service;
+        return service;
+    }
+
+    ~TimerService() {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_all();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    TimerService(const TimerService &rhs) = delete;
+
+    TimerService &operator=(const TimerService &rhs) = delete;
+
+    uint64_t add(Clock::time_point first, Job job) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        auto id = next_id_++;
+        jobs_.emplace(id, std::move(job));
+        queue_.push({first, id});
+        if (!thread_.joinable()) {
+            thread_ = std::thread([this] { run(); });
+        }
+        cv_.notify_one();
+        return id;
+    }
+
+    // Returns once the job is gone and no longer running. Must not be called from a job.
+    void remove(uint64_t id) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        jobs_.erase(id);
+        done_cv_.wait(lock, [this, id] { return running_ != id; });
+    }
+
+private:
+    TimerService() = default;
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stopping_) {
+            if (queue_.empty()) {
+                cv_.wait(lock);
+                continue;
+            }
+            auto next = queue_.top();
+            auto job = jobs_.find(next.second);
+            if (job == jobs_.end()) {
+                // removed, drop its queue entry
+                queue_.pop();
+                continue;
+            }
+            if (Clock::now() < next.first) {
+                cv_.wait_until(lock, next.first);
+                continue;
+            }
+            queue_.pop();
+            // run a copy, remove() may erase the job meanwhile
+            auto function = job->second;
+            running_ = next.second;
+            lock.unlock();
+            auto when = function();
+            lock.lock();
+            running_ = 0;
+            done_cv_.notify_all();
+            if (jobs_.count(next.second) != 0) {
+                queue_.push({when, next.second});
+            }
+        }
+    }
+
+private:
+    using Entry = std::pair<Clock::time_point, uint64_t>;
+
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue_;
+    std::unordered_map<uint64_t, Job> jobs_;
+    uint64_t next_id_{1};
+    uint64_t running_{0};
+    bool stopping_{false};
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::condition_variable done_cv_;
+};
+};
+
+#endif //CONNECTIONPOOL_TIMER_SERVICE_HPP
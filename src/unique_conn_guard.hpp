@@ -0,0 +1,97 @@
+//
+// Created by dx2880 on 2026/10/17.
+//
+
+#ifndef CONNECTIONPOOL_UNIQUE_CONN_GUARD_HPP
+#define CONNECTIONPOOL_UNIQUE_CONN_GUARD_HPP
+
+#include <utility>
+
+namespace modern_utils {
+
+// Move-only counterpart of ConnGuard for hot paths. It keeps a plain pointer to the pool, which
+// must outlive the guard, and the pool's borrow handle, so borrowing does no weak_ptr locking and
+// operator-> hands out Conn* without touching a reference count. Works with any pool exposing
+// HandleType, getConnection, releaseConnecion, recoverConnection(HandleType &), checkValid and
+// connectionOf, i.e. ConnectionPool (one shared_ptr), SlotConnectionPool (one slot pointer),
+// BalancedConnectionPool (a shared_ptr and its replica) and MultiplexedConnectionPool (one stream).
+template<typename ConnectionPool>
+class UniqueConnGuard {
+public:
+    using ConnectionType = typename ConnectionPool::ConnectionType;
+    using HandleType = typename ConnectionPool::HandleType;
+public:
+    UniqueConnGuard() = default;
+
+    explicit UniqueConnGuard(ConnectionPool &pool) : pool_(&pool), conn_(pool.getConnection()) {}
+
+    UniqueConnGuard(UniqueConnGuard &&rhs) noexcept : pool_(rhs.pool_), conn_(std::move(rhs.conn_)) {
+        rhs.pool_ = nullptr;
+        rhs.conn_ = HandleType();
+    }
+
+    UniqueConnGuard &operator=(UniqueConnGuard &&rhs) noexcept {
+        if (this != &rhs) {
+            reset();
+            pool_ = rhs.pool_;
+            conn_ = std::move(rhs.conn_);
+            rhs.pool_ = nullptr;
+            rhs.conn_ = HandleType();
+        }
+        return *this;
+    }
+
+    UniqueConnGuard(const UniqueConnGuard &rhs) = delete;
+
+    UniqueConnGuard &operator=(const UniqueConnGuard &rhs) = delete;
+
+    ~UniqueConnGuard() {
+        reset();
+    }
+
+    ConnectionType *operator->() const {
+        return get();
+    }
+
+    ConnectionType &operator*() const {
+        return *get();
+    }
+
+    ConnectionType *get() const {
+        return ConnectionPool::connectionOf(conn_);
+    }
+
+    bool isReady() const {
+        return pool_ != nullptr;
+    }
+
+    explicit operator bool() const {
+        return isReady();
+    }
+
+    bool checkValid() {
+        return isReady() && pool_->checkValid(conn_);
+    }
+
+    void recover() {
+        if (isReady()) {
+            pool_->recoverConnection(conn_);
+        }
+    }
+
+    // Returns the connection to the pool now; destroy drops it instead of keeping it idle.
+    void reset(bool destroy = false) {
+        if (isReady()) {
+            pool_->releaseConnecion(std::move(conn_), destroy);
+            pool_ = nullptr;
+            conn_ = HandleType();
+        }
+    }
+
+private:
+    ConnectionPool *pool_{nullptr};
+    HandleType conn_{};
+};
+};
+
+#endif //CONNECTIONPOOL_UNIQUE_CONN_GUARD_HPP
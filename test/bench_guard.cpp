@@ -0,0 +1,63 @@
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include "../single_header/connection_pool.hpp"
+
+using namespace std;
+using namespace modern_utils;
+
+class FakeConnection {
+public:
+    void touch() {
+        ++uses_;
+    }
+
+private:
+    long uses_{0};
+};
+
+class FakeConnFactory {
+public:
+    FakeConnection *createConnection() { return new FakeConnection; }
+
+    bool checkValid(FakeConnection *conn) { return conn != nullptr; }
+
+    void destroy(FakeConnection *conn) { delete conn; }
+};
+
+template<typename Borrow>
+double nanosPerBorrow(int iterations, Borrow borrow) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        borrow();
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+int main() {
+    using Pool = ConnectionPool<FakeConnection, FakeConnFactory>;
+    using SlotPool = SlotConnectionPool<FakeConnection, FakeConnFactory>;
+    const int iterations = 2000000;
+
+    auto pool = std::make_shared<Pool>(std::make_shared<FakeConnFactory>(), 4);
+    SlotPool slot_pool(std::make_shared<FakeConnFactory>(), 4);
+
+    std::cout << "guard,size_bytes,ns_per_borrow" << std::endl;
+    std::cout << "ConnGuard<ConnectionPool>," << sizeof(ConnGuard<Pool>) << ","
+              << nanosPerBorrow(iterations, [&] {
+                  ConnGuard<Pool> conn(pool);
+                  conn->touch();
+              }) << std::endl;
+    std::cout << "UniqueConnGuard<ConnectionPool>," << sizeof(UniqueConnGuard<Pool>) << ","
+              << nanosPerBorrow(iterations, [&] {
+                  UniqueConnGuard<Pool> conn(*pool);
+                  conn->touch();
+              }) << std::endl;
+    std::cout << "UniqueConnGuard<SlotConnectionPool>," << sizeof(UniqueConnGuard<SlotPool>) << ","
+              << nanosPerBorrow(iterations, [&] {
+                  UniqueConnGuard<SlotPool> conn(slot_pool);
+                  conn->touch();
+              }) << std::endl;
+    return 0;
+}
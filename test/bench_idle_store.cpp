@@ -0,0 +1,82 @@
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../single_header/connection_pool.hpp"
+
+using namespace std;
+using namespace modern_utils;
+
+using IdleConnection = std::pair<std::shared_ptr<int>, time_t>;
+
+// the idle store ConnectionPool used before IdleStack: a deque guarded by the pool mutex
+class LockedIdleDeque {
+public:
+    void push(IdleConnection value) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        idle_.push_back(std::move(value));
+        cv_.notify_one();
+    }
+
+    bool pop(IdleConnection &value) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (idle_.empty()) {
+            return false;
+        }
+        value = std::move(idle_.back());
+        idle_.pop_back();
+        return true;
+    }
+
+private:
+    std::deque<IdleConnection> idle_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+};
+
+template<typename IdleStore>
+double run(int thread_count, int connection_count, int iterations) {
+    IdleStore store;
+    for (int i = 0; i < connection_count; ++i) {
+        store.push({std::make_shared<int>(i), time(nullptr)});
+    }
+
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&store, iterations] {
+            IdleConnection idle;
+            for (int i = 0; i < iterations;) {
+                if (store.pop(idle)) {
+                    ++*idle.first;
+                    store.push(std::move(idle));
+                    ++i;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return thread_count * iterations / elapsed.count();
+}
+
+int main() {
+    const int iterations = 200000;
+    const int connection_count = 20;
+    auto max_threads = std::max(2u, std::thread::hardware_concurrency()) * 2;
+
+    std::cout << "threads,deque_mutex_ops_per_sec,idle_stack_ops_per_sec" << std::endl;
+    for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+        auto locked = run<LockedIdleDeque>(threads, connection_count, iterations);
+        auto lock_free = run<IdleStack<IdleConnection>>(threads, connection_count, iterations);
+        std::cout << threads << "," << static_cast<long>(locked) << "," << static_cast<long>(lock_free) << std::endl;
+    }
+}
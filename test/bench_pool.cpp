@@ -0,0 +1,222 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../single_header/connection_pool.hpp"
+
+using namespace std;
+using namespace modern_utils;
+
+// pool_bench [--duration-ms=N] [--connect-us=N] [--validate-us=N] [--hold-us=N] [--threads=1,2,..]
+//            [--pools=4,16,..]
+// Prints one CSV row per thread count, pool size and hold-time distribution. A validate-us above 0
+// also turns on validate-on-borrow, so every borrow pays for one checkValid.
+
+static void spinFor(chrono::nanoseconds duration) {
+    auto until = chrono::steady_clock::now() + duration;
+    while (chrono::steady_clock::now() < until) {
+    }
+}
+
+class FakeConnection {
+public:
+    void touch() {
+        ++uses_;
+    }
+
+private:
+    long uses_{0};
+};
+
+class FakeConnFactory {
+public:
+    FakeConnFactory(int connect_us, int validate_us) : connect_us_(connect_us), validate_us_(validate_us) {}
+
+    FakeConnection *createConnection() {
+        this_thread::sleep_for(chrono::microseconds(connect_us_));
+        return new FakeConnection;
+    }
+
+    bool checkValid(FakeConnection *conn) {
+        spinFor(chrono::microseconds(validate_us_));
+        return conn != nullptr;
+    }
+
+    void destroy(FakeConnection *conn) { delete conn; }
+
+private:
+    int connect_us_;
+    int validate_us_;
+};
+
+enum class Hold {
+    kNone, kFixed, kExponential
+};
+
+struct Config {
+    int duration_ms{200};
+    int connect_us{1000};
+    int validate_us{0};
+    vector<int> threads;
+    vector<int> pools{4, 16, 64};
+    // mean of the kFixed and kExponential hold times
+    int hold_us{20};
+};
+
+struct Result {
+    double ops_per_sec{0};
+    long timeouts{0};
+    // acquire latency in ns
+    vector<uint32_t> samples;
+};
+
+static vector<int> parseList(const char *text) {
+    vector<int> values;
+    stringstream stream(text);
+    string item;
+    while (getline(stream, item, ',')) {
+        values.push_back(atoi(item.c_str()));
+    }
+    return values;
+}
+
+static Config parseArgs(int argc, char **argv) {
+    Config config;
+    for (int i = 1; i < argc; ++i) {
+        auto value = strchr(argv[i], '=');
+        if (value == nullptr) {
+            continue;
+        }
+        ++value;
+        if (strncmp(argv[i], "--duration-ms=", 14) == 0) {
+            config.duration_ms = atoi(value);
+        } else if (strncmp(argv[i], "--connect-us=", 13) == 0) {
+            config.connect_us = atoi(value);
+        } else if (strncmp(argv[i], "--validate-us=", 14) == 0) {
+            config.validate_us = atoi(value);
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            config.threads = parseList(value);
+        } else if (strncmp(argv[i], "--pools=", 8) == 0) {
+            config.pools = parseList(value);
+        } else if (strncmp(argv[i], "--hold-us=", 10) == 0) {
+            config.hold_us = atoi(value);
+        }
+    }
+    if (config.threads.empty()) {
+        // 1, 2, 4, ... up to twice the core count
+        int limit = 2 * max(1, static_cast<int>(thread::hardware_concurrency()));
+        for (int threads = 1; threads < limit; threads *= 2) {
+            config.threads.push_back(threads);
+        }
+        config.threads.push_back(limit);
+    }
+    return config;
+}
+
+static Result run(const Config &config, int threads, int pool_size, Hold hold) {
+    using Pool = ConnectionPool<FakeConnection, FakeConnFactory, false>;
+    Pool pool(make_shared<FakeConnFactory>(config.connect_us, config.validate_us), pool_size);
+    if (config.validate_us > 0) {
+        pool.setValidateOnBorrow(0);
+    }
+
+    atomic<bool> start{false};
+    atomic<bool> stop{false};
+    atomic<long> ops{0};
+    atomic<long> timeouts{0};
+    vector<vector<uint32_t>> samples(threads);
+    vector<thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            mt19937 random(static_cast<unsigned>(t + 1));
+            exponential_distribution<double> exponential(1.0 / config.hold_us);
+            auto &local = samples[t];
+            long local_ops = 0;
+            while (!start) {
+                this_thread::yield();
+            }
+            while (!stop) {
+                auto begin = chrono::steady_clock::now();
+                shared_ptr<FakeConnection> conn;
+                try {
+                    conn = pool.getConnection();
+                } catch (exception &) {
+                    ++timeouts;
+                    continue;
+                }
+                local.push_back(static_cast<uint32_t>(min<long long>(
+                        chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - begin).count(),
+                        UINT32_MAX)));
+                conn->touch();
+                if (hold == Hold::kFixed) {
+                    spinFor(chrono::microseconds(config.hold_us));
+                } else if (hold == Hold::kExponential) {
+                    spinFor(chrono::nanoseconds(static_cast<long long>(exponential(random) * 1000)));
+                }
+                pool.releaseConnecion(move(conn));
+                ++local_ops;
+            }
+            ops += local_ops;
+        });
+    }
+
+    auto begin = chrono::steady_clock::now();
+    start = true;
+    this_thread::sleep_for(chrono::milliseconds(config.duration_ms));
+    stop = true;
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - begin;
+
+    Result result;
+    result.ops_per_sec = ops / elapsed.count();
+    result.timeouts = timeouts;
+    for (auto &local : samples) {
+        result.samples.insert(result.samples.end(), local.begin(), local.end());
+    }
+    sort(result.samples.begin(), result.samples.end());
+    return result;
+}
+
+static uint32_t percentile(const vector<uint32_t> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    auto index = static_cast<size_t>(p / 100 * static_cast<double>(sorted.size() - 1));
+    return sorted[index];
+}
+
+int main(int argc, char **argv) {
+    auto config = parseArgs(argc, argv);
+    const pair<Hold, const char *> holds[] = {{Hold::kNone,        "none"},
+                                              {Hold::kFixed,       "fixed"},
+                                              {Hold::kExponential, "exponential"}};
+
+    cout << "threads,pool_size,hold,hold_us,connect_us,validate_us,ops_per_sec,timeouts,"
+            "acquire_p50_ns,acquire_p90_ns,acquire_p99_ns,acquire_p999_ns,acquire_max_ns" << endl;
+    for (auto threads : config.threads) {
+        for (auto pool_size : config.pools) {
+            for (auto &hold : holds) {
+                auto result = run(config, threads, pool_size, hold.first);
+                cout << threads << "," << pool_size << "," << hold.second << ","
+                     << (hold.first == Hold::kNone ? 0 : config.hold_us) << "," << config.connect_us << ","
+                     << config.validate_us << "," << static_cast<long long>(result.ops_per_sec) << ","
+                     << result.timeouts << "," << percentile(result.samples, 50) << ","
+                     << percentile(result.samples, 90) << "," << percentile(result.samples, 99) << ","
+                     << percentile(result.samples, 99.9) << ","
+                     << (result.samples.empty() ? 0 : result.samples.back()) << endl;
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,1155 @@
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../single_header/connection_pool.hpp"
+
+using namespace std;
+using namespace modern_utils;
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << std::endl; \
+            ++failures; \
+        } \
+    } while (0)
+
+class TestConnection {
+public:
+    explicit TestConnection(int factory) : factory(factory) {}
+
+    const int factory;
+    std::atomic<bool> alive{true};
+};
+
+class TestConnFactory {
+public:
+    explicit TestConnFactory(int tag = 0, int fail_at = -1) : tag_(tag), fail_at_(fail_at) {}
+
+    TestConnection *createConnection() {
+        if (connect_time.count() > 0) {
+            std::this_thread::sleep_for(connect_time);
+        }
+        if (failing || attempts++ == fail_at_) {
+            throw std::runtime_error("connect refused");
+        }
+        ++created;
+        return new TestConnection(tag_);
+    }
+
+    bool checkValid(TestConnection *conn) {
+        ++checks;
+        if (check_time.count() > 0) {
+            std::this_thread::sleep_for(check_time);
+        }
+        return conn->alive;
+    }
+
+    void destroy(TestConnection *conn) {
+        ++destroyed;
+        delete conn;
+    }
+
+    std::atomic<int> attempts{0};
+    std::atomic<int> created{0};
+    std::atomic<int> destroyed{0};
+    std::atomic<int> checks{0};
+    std::atomic<bool> failing{false};
+    // set before the factory is shared
+    std::chrono::milliseconds connect_time{0};
+    std::chrono::milliseconds check_time{0};
+
+private:
+    const int tag_;
+    const int fail_at_;
+};
+
+using Pool = ConnectionPool<TestConnection, TestConnFactory>;
+using MeteredPool = ConnectionPool<TestConnection, TestConnFactory, true>;
+
+template<typename Predicate>
+bool eventually(Predicate predicate, std::chrono::milliseconds timeout = std::chrono::milliseconds(5000)) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!predicate()) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return true;
+}
+
+template<typename Function>
+std::chrono::milliseconds elapsed(Function function) {
+    auto start = std::chrono::steady_clock::now();
+    function();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+}
+
+void borrowReleaseAccounting() {
+    auto factory = std::make_shared<TestConnFactory>();
+    Pool pool(factory, 4);
+    CHECK(pool.getStats().idle_count == 4);
+
+    auto first = pool.getConnection();
+    auto second = pool.getConnection();
+    auto stats = pool.getStats();
+    CHECK(stats.idle_count == 2);
+    CHECK(stats.busy_count == 2);
+
+    pool.releaseConnecion(std::move(first));
+    pool.releaseConnecion(std::move(second), true);
+    stats = pool.getStats();
+    CHECK(stats.idle_count == 3);
+    CHECK(stats.busy_count == 0);
+    CHECK(factory->destroyed == 1);
+
+    // the next borrow connects into the slot the destroyed connection left
+    std::vector<std::shared_ptr<TestConnection>> conns;
+    for (int i = 0; i < 4; ++i) {
+        conns.push_back(pool.getConnection());
+    }
+    CHECK(factory->created == 5);
+    CHECK(pool.getStats().busy_count == 4);
+    std::shared_ptr<TestConnection> conn;
+    CHECK(!pool.tryGetConnection(conn));
+
+    for (auto &borrowed : conns) {
+        pool.releaseConnecion(std::move(borrowed));
+    }
+    CHECK(pool.getStats().idle_count == 4);
+    CHECK(pool.tryGetConnection(conn));
+}
+
+void executorOnBalancedPool() {
+    using BalancedPool = BalancedConnectionPool<TestConnection, TestConnFactory>;
+    auto first = std::make_shared<TestConnFactory>(1);
+    auto second = std::make_shared<TestConnFactory>(2);
+    BalancedPool pool({first, second}, 2);
+    ConnectionExecutor<BalancedPool> executor(pool, 2);
+    std::vector<std::future<int>> results;
+    for (int i = 0; i < 20; ++i) {
+        results.push_back(executor.submit([](TestConnection &conn) { return conn.factory; }));
+    }
+    for (auto &result : results) {
+        auto factory = result.get();
+        CHECK(factory == 1 || factory == 2);
+    }
+
+    // a task failing on a dead connection gets its worker a new one
+    auto failed = executor.submit([](TestConnection &conn) {
+        conn.alive = false;
+        throw std::runtime_error("connection lost");
+    });
+    bool thrown = false;
+    try {
+        failed.get();
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    for (int i = 0; i < 4; ++i) {
+        CHECK(executor.submit([](TestConnection &conn) { return conn.alive.load(); }).get());
+    }
+}
+
+void threadMagazines() {
+    Pool pool(std::make_shared<TestConnFactory>(), 2);
+    pool.setThreadCacheSize(2);
+    auto conn = pool.getConnection();
+    auto cached = conn.get();
+    pool.releaseConnecion(std::move(conn));
+    // this thread gets its own released connection back
+    conn = pool.getConnection();
+    CHECK(conn.get() == cached);
+    pool.releaseConnecion(std::move(conn));
+    auto stats = pool.getStats();
+    CHECK(stats.idle_count == 2);
+    CHECK(stats.busy_count == 0);
+
+    // a connection cached by this thread still reaches a borrower on another thread
+    std::thread borrower([&pool] {
+        auto first = pool.getConnection(std::chrono::milliseconds(500));
+        auto second = pool.getConnection(std::chrono::milliseconds(500));
+        CHECK(first != second);
+        pool.releaseConnecion(std::move(first));
+        pool.releaseConnecion(std::move(second));
+    });
+    borrower.join();
+
+    // the exited thread's cache was spilled back to the pool
+    CHECK(pool.getStats().idle_count == 2);
+    std::vector<std::shared_ptr<TestConnection>> conns(2);
+    CHECK(pool.tryGetConnection(conns[0]));
+    CHECK(pool.tryGetConnection(conns[1]));
+}
+
+void slotPoolCleanup() {
+    using SlotPool = SlotConnectionPool<TestConnection, TestConnFactory>;
+    auto failing = std::make_shared<TestConnFactory>(0, 3);
+    bool thrown = false;
+    try {
+        SlotPool pool(failing, 6);
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    CHECK(failing->created == 3);
+    CHECK(failing->destroyed == 3);
+
+    auto factory = std::make_shared<TestConnFactory>();
+    SlotPool pool(factory, 1);
+    auto slot = pool.getConnection();
+    // an empty slot whose connect fails stays empty for the next borrower
+    pool.releaseConnecion(slot, true);
+    factory->failing = true;
+    bool refused = false;
+    try {
+        pool.getConnection();
+    } catch (const std::runtime_error &) {
+        refused = true;
+    }
+    CHECK(refused);
+    factory->failing = false;
+    auto held = pool.getConnection();
+
+    // a borrower waiting for the only slot gets it on release
+    std::thread borrower([&pool] {
+        auto slot = pool.getConnection();
+        CHECK(SlotPool::connectionOf(slot) != nullptr);
+        pool.releaseConnecion(slot);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    pool.releaseConnecion(held);
+    borrower.join();
+    UniqueConnGuard<SlotPool> conn(pool);
+    CHECK(conn.checkValid());
+}
+
+void asyncAcquisition() {
+    auto pool = std::make_shared<Pool>(std::make_shared<TestConnFactory>(), 1);
+    std::shared_ptr<TestConnection> served;
+    pool->acquireAsync([&served](std::shared_ptr<TestConnection> conn, std::exception_ptr error) {
+        CHECK(!error);
+        served = std::move(conn);
+    });
+    // an idle connection is handed over right away, on this thread
+    CHECK(served != nullptr);
+
+    bool queued_ran = false;
+    pool->acquireAsync([&queued_ran, &pool](std::shared_ptr<TestConnection> conn, std::exception_ptr error) {
+        CHECK(!error && conn != nullptr);
+        queued_ran = true;
+        pool->releaseConnecion(std::move(conn));
+    });
+    CHECK(!queued_ran);
+    // the release runs the queued callback
+    pool->releaseConnecion(std::move(served));
+    CHECK(queued_ran);
+
+    auto ready = pool->acquireFuture();
+    CHECK(ready.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+    auto held = ready.get();
+    auto pending = pool->acquireFuture();
+    CHECK(pending.wait_for(std::chrono::milliseconds(50)) == std::future_status::timeout);
+    std::thread releaser([&pool, &held] { pool->releaseConnecion(std::move(held)); });
+    CHECK(pending.wait_for(std::chrono::seconds(2)) == std::future_status::ready);
+    releaser.join();
+    auto conn = pending.get();
+
+    pool->releaseConnecion(std::move(conn));
+
+    // the pool fails the callbacks still queued when it is destroyed
+    auto other = std::unique_ptr<Pool>(new Pool(std::make_shared<TestConnFactory>(), 1));
+    held = other->getConnection();
+    std::exception_ptr failure;
+    other->acquireAsync([&failure](std::shared_ptr<TestConnection>, std::exception_ptr error) {
+        failure = error;
+    });
+    other.reset();
+    CHECK(failure != nullptr);
+}
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+// Starts running at once and frees itself when done.
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() { return {}; }
+
+        std::suspend_never initial_suspend() noexcept { return {}; }
+
+        std::suspend_never final_suspend() noexcept { return {}; }
+
+        void return_void() {}
+
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+DetachedTask borrowInCoroutine(Pool &pool, std::promise<std::thread::id> &resumed_on) {
+    auto conn = co_await pool.acquire();
+    resumed_on.set_value(std::this_thread::get_id());
+    pool.releaseConnecion(std::move(conn));
+}
+
+void coroutineAcquisition() {
+    Pool pool(std::make_shared<TestConnFactory>(), 1);
+    auto held = pool.getConnection();
+    std::promise<std::thread::id> resumed_on;
+    auto resumed = resumed_on.get_future();
+    // suspends the coroutine, not this thread, while the only connection is out
+    borrowInCoroutine(pool, resumed_on);
+    CHECK(resumed.wait_for(std::chrono::milliseconds(50)) == std::future_status::timeout);
+    std::thread releaser([&pool, &held] { pool.releaseConnecion(std::move(held)); });
+    auto releaser_id = releaser.get_id();
+    releaser.join();
+    CHECK(resumed.get() == releaser_id);
+    CHECK(pool.getStats().idle_count == 1);
+}
+#endif
+
+void connectsOffTheLock() {
+    auto factory = std::make_shared<TestConnFactory>();
+    factory->connect_time = std::chrono::milliseconds(20);
+    PoolOptions options(10);
+    options.warmup = WarmupMode::kLazy;
+    Pool pool(factory, options);
+
+    // more borrowers than creator threads: the pool keeps connecting until each has one
+    std::atomic<int> served{0};
+    std::vector<std::shared_ptr<TestConnection>> conns(8);
+    std::vector<std::thread> borrowers;
+    for (int i = 0; i < 8; ++i) {
+        borrowers.emplace_back([&pool, &served, &conns, i] {
+            try {
+                conns[i] = pool.getConnection(std::chrono::milliseconds(1000));
+                ++served;
+            } catch (const AcquireTimeoutError &) {
+            }
+        });
+    }
+    for (auto &borrower : borrowers) {
+        borrower.join();
+    }
+    CHECK(served == 8);
+    CHECK(factory->created == 8);
+
+}
+
+void warmupModes() {
+    auto eager = std::make_shared<TestConnFactory>();
+    eager->connect_time = std::chrono::milliseconds(20);
+    PoolOptions options(8);
+    options.warmup_concurrency = 4;
+    auto built = elapsed([&] { Pool pool(eager, options); CHECK(pool.getStats().warmed_up); });
+    CHECK(eager->created == 8);
+    // 8 connects of 20 ms on 4 threads
+    CHECK(built < std::chrono::milliseconds(150));
+
+    auto lazy = std::make_shared<TestConnFactory>();
+    options.warmup = WarmupMode::kLazy;
+    options.min_idle = 2;
+    Pool pool(lazy, options);
+    CHECK(lazy->created == 2);
+    CHECK(pool.getStats().idle_count == 2);
+    CHECK(pool.getStats().warmed_up);
+
+    auto background = std::make_shared<TestConnFactory>();
+    background->connect_time = std::chrono::milliseconds(20);
+    options.warmup = WarmupMode::kBackground;
+    Pool warming(background, options);
+    CHECK(eventually([&] { return warming.getStats().warmed_up; }));
+    CHECK(background->created == 8);
+    CHECK(warming.getStats().startup_time >= std::chrono::milliseconds(40));
+}
+
+void backgroundWarmupFailure() {
+    PoolOptions options(4);
+    options.warmup = WarmupMode::kBackground;
+    Pool pool(std::make_shared<TestConnFactory>(0, 2), options);
+    CHECK(eventually([&] { return pool.getStats().warmup_failed; }));
+    CHECK(!pool.getStats().warmed_up);
+    // borrowers connect what the warm-up did not
+    std::vector<std::shared_ptr<TestConnection>> conns;
+    for (int i = 0; i < 4; ++i) {
+        conns.push_back(pool.getConnection());
+    }
+}
+
+void acquireTimeout() {
+    MeteredPool pool(std::make_shared<TestConnFactory>(), 2);
+    auto first = pool.getConnection();
+    auto second = pool.getConnection();
+    bool timed_out = false;
+    auto waited = elapsed([&] {
+        try {
+            pool.getConnection(std::chrono::milliseconds(100));
+        } catch (const AcquireTimeoutError &) {
+            timed_out = true;
+        }
+    });
+    CHECK(timed_out);
+    CHECK(waited >= std::chrono::milliseconds(90));
+    CHECK(waited < std::chrono::milliseconds(1000));
+    CHECK(pool.snapshot().timeouts == 1);
+    CHECK(pool.getStats().waiting_count == 0);
+
+
+    // a deadline already passed fails without waiting
+    timed_out = false;
+    try {
+        pool.getConnection(std::chrono::steady_clock::now());
+    } catch (const AcquireTimeoutError &) {
+        timed_out = true;
+    }
+    CHECK(timed_out);
+}
+
+void fifoHandOff() {
+    Pool pool(std::make_shared<TestConnFactory>(), 1);
+    auto held = pool.getConnection();
+    std::mutex order_mutex;
+    std::vector<int> order;
+    auto borrower = [&](int id) {
+        auto conn = pool.getConnection(std::chrono::milliseconds(2000));
+        {
+            std::lock_guard<std::mutex> guard(order_mutex);
+            order.push_back(id);
+        }
+        pool.releaseConnecion(std::move(conn));
+    };
+    std::thread first(borrower, 1);
+    CHECK(eventually([&] { return pool.getStats().waiting_count == 1; }));
+    std::thread second(borrower, 2);
+    CHECK(eventually([&] { return pool.getStats().waiting_count == 2; }));
+    pool.releaseConnecion(std::move(held));
+    first.join();
+    second.join();
+    CHECK((order == std::vector<int>{1, 2}));
+}
+
+void idleEviction() {
+    auto factory = std::make_shared<TestConnFactory>();
+    PoolOptions options(4);
+    options.min_idle = 1;
+    MeteredPool pool(factory, options);
+    // the new limit's tick applies at once, not after the default 5s one
+    auto waited = elapsed([&] {
+        pool.setMaxIdleTime(1);
+        CHECK(eventually([&] { return pool.getStats().idle_count == 1; }, std::chrono::milliseconds(4000)));
+    });
+    CHECK(waited < std::chrono::milliseconds(2500));
+    CHECK(factory->destroyed == 3);
+    CHECK(pool.snapshot().evictions == 3);
+
+    // a connection in use does not expire
+    auto conn = pool.getConnection();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+    CHECK(factory->destroyed == 3);
+}
+
+void backgroundValidation() {
+    auto factory = std::make_shared<TestConnFactory>();
+    Pool pool(factory, 4);
+    std::vector<std::shared_ptr<TestConnection>> conns;
+    for (int i = 0; i < 4; ++i) {
+        conns.push_back(pool.getConnection());
+    }
+    conns[0]->alive = false;
+    conns[1]->alive = false;
+    pool.releaseMany(std::move(conns));
+
+    pool.setValidationInterval(1);
+    CHECK(eventually([&] { return factory->destroyed == 2 && pool.getStats().idle_count == 4; }));
+    CHECK(factory->created == 6);
+    for (int i = 0; i < 4; ++i) {
+        conns.push_back(pool.getConnection());
+        CHECK(conns.back()->alive);
+    }
+}
+
+void borrowDuringValidation() {
+    auto factory = std::make_shared<TestConnFactory>();
+    factory->check_time = std::chrono::milliseconds(300);
+    Pool pool(factory, 4);
+    pool.setValidationInterval(1, 1);
+    CHECK(eventually([&] { return factory->checks >= 2; }));
+
+    // one connection is being pinged and one is already back, so three are free right now
+    std::vector<std::shared_ptr<TestConnection>> conns;
+    auto waited = elapsed([&] {
+        for (int i = 0; i < 3; ++i) {
+            conns.push_back(pool.getConnection());
+        }
+    });
+    CHECK(waited < std::chrono::milliseconds(200));
+}
+
+void autoscaleEvents() {
+    Pool pool(std::make_shared<TestConnFactory>(), 2);
+    std::mutex mutex;
+    std::vector<ScaleEvent> events;
+    AutoscaleOptions options;
+    options.min_count = 2;
+    options.max_count = 8;
+    options.interval = std::chrono::milliseconds(20);
+    options.shrink_after = 3;
+    pool.enableAutoscale(options, [&](const ScaleEvent &event) {
+        std::lock_guard<std::mutex> guard(mutex);
+        events.push_back(event);
+    });
+    auto scaledTo = [&](ScaleDirection direction, int count) {
+        std::lock_guard<std::mutex> guard(mutex);
+        for (auto &event : events) {
+            if (event.direction == direction && event.to == count) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // a borrower queued on a full pool makes it grow, and gets the new connection
+    auto first = pool.getConnection();
+    auto second = pool.getConnection();
+    auto third = pool.getConnection(std::chrono::milliseconds(2000));
+    CHECK(third != nullptr);
+    // the listener runs after the resize that served it
+    CHECK(eventually([&] { return scaledTo(ScaleDirection::kGrow, 3); }));
+    CHECK(pool.getStats().max_count >= 3);
+
+    // idle again, it shrinks back, but never below min_count
+    pool.releaseConnecion(std::move(first));
+    pool.releaseConnecion(std::move(second));
+    pool.releaseConnecion(std::move(third));
+    CHECK(eventually([&] { return scaledTo(ScaleDirection::kShrink, 2); }));
+    CHECK(pool.getStats().max_count == 2);
+    std::lock_guard<std::mutex> guard(mutex);
+    for (auto &event : events) {
+        CHECK(event.to >= 2 && event.to <= 8);
+    }
+}
+
+void metricsAndHistograms() {
+    auto factory = std::make_shared<TestConnFactory>();
+    MeteredPool pool(factory, 2);
+    auto conn = pool.getConnection();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    pool.releaseConnecion(std::move(conn));
+
+    // a borrower that had to wait for a release
+    auto first = pool.getConnection();
+    auto second = pool.getConnection();
+    auto waiter = std::async(std::launch::async, [&] { return pool.getConnection(std::chrono::milliseconds(2000)); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    pool.releaseConnecion(std::move(first));
+    auto third = waiter.get();
+
+    // recovering swaps the dead connection and counts it closed
+    pool.recoverConnection(second);
+    auto metrics = pool.snapshot();
+    CHECK(metrics.enabled);
+    CHECK(metrics.acquires == 4);
+    CHECK(metrics.creates == 3);
+    CHECK(metrics.recoveries == 1);
+    CHECK(metrics.destroys == 1);
+    CHECK(metrics.create_time.count == 3);
+    CHECK(metrics.acquire_wait.count == 4);
+    CHECK(metrics.acquire_wait.max() >= std::chrono::milliseconds(40));
+    CHECK(metrics.hold_time.count == 2);
+    CHECK(metrics.hold_time.percentile(50) >= std::chrono::milliseconds(20));
+    CHECK(metrics.hold_time.mean() <= metrics.hold_time.max());
+    pool.releaseConnecion(std::move(second));
+    pool.releaseConnecion(std::move(third));
+
+    // the default pool compiles the metrics out
+    Pool plain(std::make_shared<TestConnFactory>(), 1);
+    plain.releaseConnecion(plain.getConnection());
+    auto off = plain.snapshot();
+    CHECK(!off.enabled);
+    CHECK(off.acquires == 0);
+    CHECK(off.hold_time.count == 0);
+}
+
+void keyedBudgetAndStealing() {
+    using KeyedPool = KeyedConnectionPool<int, TestConnection, TestConnFactory>;
+    KeyedPool pool([](int key) { return std::make_shared<TestConnFactory>(key); }, 4, 3);
+    std::vector<std::shared_ptr<TestConnection>> first;
+    for (int i = 0; i < 3; ++i) {
+        first.push_back(pool.acquire(1));
+        CHECK(first.back()->factory == 1);
+    }
+    CHECK(pool.getAllocated() == 3);
+    // key_max caps a single key below the global budget
+    bool timed_out = false;
+    try {
+        pool.acquire(1, std::chrono::milliseconds(100));
+    } catch (const AcquireTimeoutError &) {
+        timed_out = true;
+    }
+    CHECK(timed_out);
+    for (auto &conn : first) {
+        pool.releaseConnecion(1, std::move(conn));
+    }
+    first.clear();
+
+    // the last unallocated connection, then one taken from the idle key
+    auto a = pool.acquire(2);
+    auto b = pool.acquire(2);
+    CHECK(a->factory == 2 && b->factory == 2);
+    CHECK(pool.getAllocated() == 4);
+    CHECK(pool.getStats(1).max_count == 2);
+    CHECK(pool.getStats(2).max_count == 2);
+
+    // a borrower queued on a key with no slack is topped up once another key has some
+    first.push_back(pool.acquire(1));
+    first.push_back(pool.acquire(1));
+    auto waiter = std::async(std::launch::async, [&] { return pool.acquire(1, std::chrono::milliseconds(3000)); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    pool.releaseConnecion(2, std::move(b));
+    auto third = waiter.get();
+    CHECK(third != nullptr && third->factory == 1);
+    CHECK(pool.getStats(1).max_count == 3);
+    CHECK(pool.getStats(2).max_count == 1);
+    CHECK(pool.getAllocated() == 4);
+
+    // sub-pools are maintained by the keyed pool's thread
+    pool.poolOf(1)->setMaxIdleTime(1);
+    first.push_back(std::move(third));
+    for (auto &conn : first) {
+        pool.releaseConnecion(1, std::move(conn));
+    }
+    CHECK(eventually([&] { return pool.getStats(1).idle_count == 1; }));
+    pool.releaseConnecion(2, std::move(a));
+}
+
+void replicaEjectionAndProbing() {
+    using BalancedPool = BalancedConnectionPool<TestConnection, TestConnFactory>;
+    auto healthy = std::make_shared<TestConnFactory>(1);
+    auto broken = std::make_shared<TestConnFactory>(2);
+    broken->failing = true;
+    BalancedPool pool({healthy, broken}, 2);
+    pool.setEjectPolicy(2, std::chrono::milliseconds(50), std::chrono::milliseconds(200));
+
+    // borrows routed to the broken replica fail over to the healthy one
+    for (int i = 0; i < 10; ++i) {
+        auto handle = pool.getConnection(std::chrono::milliseconds(1000));
+        CHECK(handle.conn->factory == 1);
+        pool.releaseConnecion(std::move(handle));
+    }
+    CHECK(pool.getReplicaStats(1).ejected);
+    CHECK(!pool.getReplicaStats(0).ejected);
+    auto attempts = broken->attempts.load();
+    for (int i = 0; i < 10; ++i) {
+        pool.releaseConnecion(pool.getConnection(std::chrono::milliseconds(1000)));
+    }
+    // an ejected replica only sees probes
+    CHECK(broken->attempts - attempts <= 2);
+
+    // a probe that connects puts it back
+    broken->failing = false;
+    CHECK(eventually([&] { return !pool.getReplicaStats(1).ejected; }));
+    // and borrows are routed to it again
+    CHECK(eventually([&] {
+        auto handle = pool.getConnection(std::chrono::milliseconds(1000));
+        auto from_broken = handle.conn->factory == 2;
+        pool.releaseConnecion(std::move(handle));
+        return from_broken;
+    }));
+}
+
+void acquireManyAllOrNothing() {
+    Pool pool(std::make_shared<TestConnFactory>(), 4);
+    auto first = pool.getConnection();
+    auto second = pool.getConnection();
+
+    bool timed_out = false;
+    try {
+        pool.acquireMany(3, std::chrono::milliseconds(100));
+    } catch (const AcquireTimeoutError &) {
+        timed_out = true;
+    }
+    CHECK(timed_out);
+    // the two idle connections it collected went back
+    CHECK(pool.getStats().idle_count == 2);
+
+    {
+        auto partial = pool.acquireMany(3, std::chrono::milliseconds(100), BatchGrant::kPartial);
+        CHECK(partial.size() == 2);
+    }
+
+    bool too_many = false;
+    try {
+        pool.acquireMany(5, std::chrono::milliseconds(100));
+    } catch (const std::runtime_error &) {
+        too_many = true;
+    }
+    CHECK(too_many);
+
+    // a release while the batch waits completes it
+    std::thread releaser([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        pool.releaseConnecion(std::move(first));
+    });
+    auto batch = pool.acquireMany(3, std::chrono::milliseconds(2000));
+    releaser.join();
+    CHECK(batch.size() == 3);
+    CHECK(pool.getStats().idle_count == 0);
+}
+
+
+void acquireManyFailsFast() {
+    // one of the three connects the batch starts fails, whichever it is
+    PoolOptions options(4);
+    options.warmup = WarmupMode::kLazy;
+    auto factory = std::make_shared<TestConnFactory>(0, 1);
+    Pool pool(factory, options);
+    bool refused = false;
+    auto waited = elapsed([&] {
+        try {
+            pool.acquireMany(3, std::chrono::milliseconds(2000));
+        } catch (const std::runtime_error &) {
+            refused = true;
+        }
+    });
+    CHECK(refused);
+    CHECK(waited < std::chrono::milliseconds(1000));
+    // the connections made for it are idle, not lost
+    CHECK(eventually([&] {
+        auto stats = pool.getStats();
+        return stats.idle_count == factory->created && stats.busy_count == 0 && stats.pending_count == 0;
+    }));
+}
+
+void customPolicies() {
+    using FifoPool = ConnectionPool<TestConnection, TestConnFactory, false,
+            PoolPolicy<SpinLock, ReuseOrder::kFifo, SteadyClock>>;
+    FifoPool fifo(std::make_shared<TestConnFactory>(), 3);
+    std::vector<std::shared_ptr<TestConnection>> conns;
+    std::vector<TestConnection *> released;
+    for (int i = 0; i < 3; ++i) {
+        conns.push_back(fifo.getConnection());
+    }
+    for (auto &conn : conns) {
+        released.push_back(conn.get());
+        fifo.releaseConnecion(std::move(conn));
+    }
+    conns.clear();
+    for (int i = 0; i < 3; ++i) {
+        conns.push_back(fifo.getConnection());
+        CHECK(conns.back().get() == released[i]);
+    }
+    // a borrower blocked on the spin lock's condition variable is handed the next release
+    auto waiter = std::async(std::launch::async, [&] { return fifo.getConnection(std::chrono::milliseconds(2000)); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    auto first = conns.front().get();
+    fifo.releaseConnecion(std::move(conns.front()));
+    CHECK(waiter.get().get() == first);
+
+    using LifoQueuePool = ConnectionPool<TestConnection, TestConnFactory, false,
+            PoolPolicy<std::mutex, ReuseOrder::kLifo, CoarseClock, QueueStore>>;
+    LifoQueuePool lifo(std::make_shared<TestConnFactory>(), 3);
+    conns.clear();
+    released.clear();
+    for (int i = 0; i < 3; ++i) {
+        conns.push_back(lifo.getConnection());
+    }
+    for (auto &conn : conns) {
+        released.push_back(conn.get());
+        lifo.releaseConnecion(std::move(conn));
+    }
+    conns.clear();
+    for (int i = 2; i >= 0; --i) {
+        conns.push_back(lifo.getConnection());
+        CHECK(conns.back().get() == released[i]);
+    }
+    for (auto &conn : conns) {
+        lifo.releaseConnecion(std::move(conn));
+    }
+    CHECK(lifo.getStats().idle_count == 3);
+}
+
+class HookedConnFactory : public TestConnFactory {
+public:
+    std::vector<TestConnection *> createConnections(int n) {
+        ++batches;
+        std::vector<TestConnection *> conns;
+        for (int i = 0; i < n; ++i) {
+            conns.push_back(createConnection());
+        }
+        return conns;
+    }
+
+    bool reset(TestConnection *conn) {
+        ++resets;
+        return conn->alive;
+    }
+
+    void checkValidBatch(TestConnection *const *conns, std::size_t n, bool *valid) {
+        ++batch_checks;
+        for (std::size_t i = 0; i < n; ++i) {
+            valid[i] = conns[i]->alive;
+        }
+    }
+
+    bool isCheap(TestConnection *) { return true; }
+
+    std::atomic<int> batches{0};
+    std::atomic<int> resets{0};
+    std::atomic<int> batch_checks{0};
+};
+
+void factoryHooks() {
+    using HookedPool = ConnectionPool<TestConnection, HookedConnFactory>;
+    auto factory = std::make_shared<HookedConnFactory>();
+    HookedPool pool(factory, 4);
+    // the warm-up connects all four in one call
+    CHECK(factory->batches == 1);
+    CHECK(factory->created == 4);
+
+    // cheap connections are checked on every borrow, and a dead one is dropped there
+    auto conn = pool.getConnection();
+    CHECK(factory->checks == 1);
+    conn->alive = false;
+    pool.releaseConnecion(std::move(conn));
+    conn = pool.getConnection();
+    CHECK(conn->alive);
+    CHECK(factory->destroyed == 1);
+
+    // reset keeps a connection released with destroy
+    pool.releaseConnecion(std::move(conn), true);
+    CHECK(factory->resets == 1);
+    CHECK(factory->destroyed == 1);
+    CHECK(pool.getStats().idle_count == 3);
+
+    // background validation pings the idle connections in batches
+    conn = pool.getConnection();
+    conn->alive = false;
+    pool.releaseConnecion(std::move(conn));
+    pool.setValidationInterval(1);
+    CHECK(eventually([&] { return factory->destroyed == 2; }));
+    CHECK(factory->batch_checks > 0);
+    // and starts a replacement for the dead one
+    CHECK(eventually([&] { return factory->created == 5 && pool.getStats().idle_count == 3; }));
+}
+
+void multiplexedStreams() {
+    using MuxPool = MultiplexedConnectionPool<TestConnection, TestConnFactory>;
+    auto factory = std::make_shared<TestConnFactory>();
+    MuxPool pool(factory, 2, 3);
+    // streams share one connection until it is full
+    std::vector<MuxPool::HandleType> streams;
+    for (int i = 0; i < 3; ++i) {
+        streams.push_back(pool.getConnection());
+        CHECK(streams.back() == streams.front());
+    }
+    CHECK(factory->created == 1);
+    for (int i = 0; i < 3; ++i) {
+        streams.push_back(pool.getConnection());
+    }
+    CHECK(factory->created == 2);
+    CHECK(pool.getConnectionCount() == 2);
+    CHECK(pool.getStreamCount() == 6);
+
+    bool timed_out = false;
+    try {
+        pool.getConnection(std::chrono::milliseconds(100));
+    } catch (const AcquireTimeoutError &) {
+        timed_out = true;
+    }
+    CHECK(timed_out);
+
+    // a released stream goes to a waiting borrower
+    auto waiter = std::async(std::launch::async, [&] { return pool.getConnection(std::chrono::milliseconds(2000)); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    auto released = streams.back();
+    streams.pop_back();
+    pool.releaseConnecion(released);
+    CHECK(waiter.get() == released);
+    streams.push_back(released);
+
+    // recovering retires the connection, which makes room for a new one to move the stream to;
+    // the retired one closes with its last stream
+    auto broken = streams.front();
+    pool.recoverConnection(streams.front());
+    CHECK(streams.front() != broken && streams.front() != streams.back());
+    CHECK(factory->created == 3);
+    CHECK(pool.getConnectionCount() == 2);
+    pool.releaseConnecion(streams[1]);
+    CHECK(factory->destroyed == 0);
+    pool.releaseConnecion(streams[2]);
+    CHECK(factory->destroyed == 1);
+    CHECK(pool.getStreamCount() == 4);
+    for (std::size_t i = 3; i < streams.size(); ++i) {
+        pool.releaseConnecion(streams[i]);
+    }
+    pool.releaseConnecion(streams.front());
+    CHECK(pool.getStreamCount() == 0);
+}
+
+void priorityReservation() {
+    Pool pool(std::make_shared<TestConnFactory>(), 4);
+    pool.setReservedCount(1, Priority::kHigh);
+    std::vector<std::shared_ptr<TestConnection>> conns;
+    for (int i = 0; i < 3; ++i) {
+        conns.push_back(pool.getConnection());
+    }
+
+    bool timed_out = false;
+    try {
+        pool.getConnection(std::chrono::milliseconds(100));
+    } catch (const AcquireTimeoutError &) {
+        timed_out = true;
+    }
+    CHECK(timed_out);
+
+    pool.setFailFast(Priority::kNormal);
+    bool exhausted = false;
+    auto waited = elapsed([&] {
+        try {
+            pool.getConnection(std::chrono::milliseconds(1000), Priority::kLow);
+        } catch (const PoolExhaustedError &) {
+            exhausted = true;
+        }
+    });
+    CHECK(exhausted);
+    CHECK(waited < std::chrono::milliseconds(100));
+
+    auto high = pool.getConnection(std::chrono::milliseconds(100), Priority::kHigh);
+    CHECK(high != nullptr);
+
+    // a high priority waiter is served before a normal one queued earlier
+    auto normal = std::async(std::launch::async, [&] { return pool.getConnection(std::chrono::milliseconds(2000)); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    auto urgent = std::async(std::launch::async, [&] {
+        return pool.getConnection(std::chrono::milliseconds(2000), Priority::kHigh);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    auto released = high.get();
+    pool.releaseConnecion(std::move(high));
+    CHECK(urgent.get().get() == released);
+    CHECK(normal.wait_for(std::chrono::milliseconds(0)) == std::future_status::timeout);
+    // the last connection stays reserved, so it takes two releases to serve it
+    pool.releaseConnecion(std::move(conns[0]));
+    CHECK(normal.wait_for(std::chrono::milliseconds(50)) == std::future_status::timeout);
+    pool.releaseConnecion(std::move(conns[1]));
+    CHECK(normal.get() != nullptr);
+}
+
+void governorFailFast() {
+    auto factory = std::make_shared<TestConnFactory>();
+    PoolOptions options(2);
+    options.warmup = WarmupMode::kLazy;
+    Pool pool(factory, options);
+    GovernorOptions governor;
+    governor.fail_after = 2;
+    governor.initial_backoff = std::chrono::milliseconds(10000);
+    pool.setCreationGovernor(std::make_shared<CreationGovernor>(governor));
+    auto held = pool.getConnection();
+
+    factory->failing = true;
+    for (int i = 0; i < 2; ++i) {
+        bool refused = false;
+        try {
+            pool.getConnection(std::chrono::milliseconds(1000));
+        } catch (const BackendDownError &) {
+        } catch (const std::runtime_error &) {
+            refused = true;
+        }
+        CHECK(refused);
+    }
+    auto attempts = factory->attempts.load();
+    bool down = false;
+    auto waited = elapsed([&] {
+        try {
+            pool.getConnection(std::chrono::milliseconds(1000));
+        } catch (const BackendDownError &) {
+            down = true;
+        }
+    });
+    CHECK(down);
+    CHECK(waited < std::chrono::milliseconds(100));
+    CHECK(factory->attempts == attempts);
+
+    // a borrower of a full pool needs no connect, so it waits for a release despite the outage
+    pool.setMaxCount(1);
+    std::thread releaser([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        pool.releaseConnecion(std::move(held));
+    });
+    std::shared_ptr<TestConnection> conn;
+    try {
+        conn = pool.getConnection(std::chrono::milliseconds(1000));
+    } catch (const BackendDownError &) {
+    }
+    releaser.join();
+    CHECK(conn != nullptr);
+    CHECK(factory->attempts == attempts);
+}
+
+void maxLifetime() {
+    auto factory = std::make_shared<TestConnFactory>();
+    MeteredPool pool(factory, 2);
+    auto held = pool.getConnection();
+    pool.setMaxLifetime(1, 0);
+    // the idle connection is replaced, successor first
+    CHECK(eventually([&] { return pool.snapshot().renewals >= 1; }));
+    CHECK(factory->created >= 3);
+    CHECK(held->alive);
+
+    // an aged connection still serves its borrower and is replaced once released
+    auto destroyed = factory->destroyed.load();
+    pool.releaseConnecion(std::move(held));
+    CHECK(eventually([&] { return factory->destroyed > destroyed; }));
+    for (int i = 0; i < 10; ++i) {
+        pool.releaseConnecion(pool.getConnection(std::chrono::milliseconds(500)));
+    }
+}
+
+
+void replaceFactoryDrain() {
+    auto old_factory = std::make_shared<TestConnFactory>(1);
+    auto new_factory = std::make_shared<TestConnFactory>(2);
+    Pool pool(old_factory, 4);
+    pool.replaceFactory(new_factory);
+    bool served = true;
+    CHECK(eventually([&] {
+        try {
+            pool.releaseConnecion(pool.getConnection(std::chrono::milliseconds(500)));
+        } catch (const std::exception &) {
+            served = false;
+        }
+        return old_factory->destroyed == 4;
+    }));
+    CHECK(served);
+    CHECK(new_factory->created == 4);
+    auto conn = pool.getConnection();
+    CHECK(conn->factory == 2);
+    CHECK(pool.checkValid(conn));
+}
+
+void withConnectionBatches() {
+    auto factory = std::make_shared<TestConnFactory>();
+    Pool pool(factory, 2);
+    std::vector<TestConnection *> used;
+    bool killed = false;
+    std::vector<std::function<void(TestConnection &)>> ops;
+    for (int i = 0; i < 4; ++i) {
+        ops.push_back([&used, &killed, i](TestConnection &conn) {
+            // the third op loses its connection once, and is resumed on a new one
+            if (i == 2 && !killed) {
+                killed = true;
+                conn.alive = false;
+                throw std::runtime_error("connection lost");
+            }
+            used.push_back(&conn);
+        });
+    }
+    pool.withConnection(ops);
+    CHECK(used.size() == 4);
+    CHECK(used[0] == used[1] && used[1] != used[2] && used[2] == used[3]);
+    CHECK(factory->created == 3);
+    CHECK(pool.getStats().busy_count == 0);
+
+    // an op failing on a live connection stops the batch and is rethrown
+    used.clear();
+    ops.insert(ops.begin() + 1, [](TestConnection &) { throw std::logic_error("bad query"); });
+    bool thrown = false;
+    try {
+        pool.withConnection(ops);
+    } catch (const std::logic_error &) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    CHECK(used.size() == 1);
+    CHECK(pool.getStats().busy_count == 0);
+}
+
+void coalescedOperations() {
+    MeteredPool pool(std::make_shared<TestConnFactory>(), 1);
+    std::atomic<int> ran{0};
+    std::atomic<bool> start{false};
+    std::vector<std::future<bool>> results;
+    for (int i = 0; i < 8; ++i) {
+        results.push_back(std::async(std::launch::async, [&, i] {
+            while (!start) {
+                std::this_thread::yield();
+            }
+            try {
+                pool.coalesce([&ran, i](TestConnection &) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                    ++ran;
+                    if (i == 3) {
+                        throw std::logic_error("bad query");
+                    }
+                });
+            } catch (const std::logic_error &) {
+                return i == 3;
+            }
+            return i != 3;
+        }));
+    }
+    start = true;
+    // each thread sees only its own op's error
+    for (auto &result : results) {
+        CHECK(result.get());
+    }
+    CHECK(ran == 8);
+    // the ops queued meanwhile share borrows
+    CHECK(pool.snapshot().acquires < 8);
+    CHECK(pool.getStats().busy_count == 0);
+}
+
+int main(int argc, char *argv[]) {
+    const std::vector<std::pair<const char *, void (*)()>> checks = {
+            {"borrowReleaseAccounting",  borrowReleaseAccounting},
+            {"executorOnBalancedPool",   executorOnBalancedPool},
+            {"threadMagazines",          threadMagazines},
+            {"slotPoolCleanup",          slotPoolCleanup},
+            {"asyncAcquisition",         asyncAcquisition},
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+            {"coroutineAcquisition",     coroutineAcquisition},
+#endif
+            {"connectsOffTheLock",       connectsOffTheLock},
+            {"warmupModes",              warmupModes},
+            {"backgroundWarmupFailure",  backgroundWarmupFailure},
+            {"acquireTimeout",           acquireTimeout},
+            {"fifoHandOff",              fifoHandOff},
+            {"idleEviction",             idleEviction},
+            {"backgroundValidation",     backgroundValidation},
+            {"borrowDuringValidation",   borrowDuringValidation},
+            {"autoscaleEvents",          autoscaleEvents},
+            {"metricsAndHistograms",     metricsAndHistograms},
+            {"keyedBudgetAndStealing",   keyedBudgetAndStealing},
+            {"replicaEjectionAndProbing", replicaEjectionAndProbing},
+            {"acquireManyAllOrNothing",  acquireManyAllOrNothing},
+            {"acquireManyFailsFast",     acquireManyFailsFast},
+            {"customPolicies",           customPolicies},
+            {"factoryHooks",             factoryHooks},
+            {"multiplexedStreams",       multiplexedStreams},
+            {"priorityReservation",      priorityReservation},
+            {"governorFailFast",         governorFailFast},
+            {"maxLifetime",              maxLifetime},
+            {"replaceFactoryDrain",      replaceFactoryDrain},
+            {"withConnectionBatches",    withConnectionBatches},
+            {"coalescedOperations",      coalescedOperations},
+    };
+    for (auto &check : checks) {
+        // a name on the command line runs that check alone
+        if (argc > 1 && std::string(argv[1]) != check.first) {
+            continue;
+        }
+        auto before = failures;
+        check.second();
+        std::cout << (failures == before ? "ok   " : "FAIL ") << check.first << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}